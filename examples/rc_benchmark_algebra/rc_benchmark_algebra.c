@@ -2,81 +2,535 @@
 * rc_benchmark_algebra.c
 *
 * James Strawson 2016
-* This tests some of the more common functions in linear_algebra.c, it is not a
-* complete test of all available linear algebra functions but should get you
-* started.
+* Benchmark harness for the math libraries. Every benchmark is run across a
+* sweep of sizes. For each size the number of calls per timed batch is first
+* calibrated so the batch is long compared to the clock resolution, then a few
+* warmup batches are discarded before the timed trials. The cost of reading the
+* clock is measured at startup and subtracted from every batch.
+*
+* Results report min, median and 99th percentile time per call along with
+* MFLOPS computed from the median where a flop count is meaningful. Results can
+* be written as a human readable table, CSV, or JSON. A CSV file saved from a
+* previous run can be given with -c to flag regressions against it.
+*
+* example:
+* rc_benchmark_algebra -f csv -o baseline.csv
+* (change something and rebuild the library)
+* rc_benchmark_algebra -c baseline.csv -t 5
 *******************************************************************************/
 
 #include "../../libraries/rc_usefulincludes.h"
 #include "../../libraries/redperipherallib.h"
 
-#define DEFAULT_DIM 140
-#define MIN_DIM		1
-#define MAX_DIM		250
+#define MIN_DIM			1
+#define MAX_DIM			250
+#define DEFAULT_TRIALS	31
+#define DEFAULT_WARMUP	3
+#define DEFAULT_THRESH	10.0	// percent slowdown flagged as a regression
+#define MIN_BATCH_NS	200000	// calibrate batches to take at least 200us
+#define MAX_BENCH_NS	2000000000ULL // stop adding trials after 2s per size
+#define MIN_TRIALS		5
+#define MAX_RESULTS		256
+#define MAX_BASELINE	512
+
+#define TIMER rc_nanos_since_boot()
+
+typedef enum out_format_t{
+	FORMAT_TEXT,
+	FORMAT_CSV,
+	FORMAT_JSON
+} out_format_t;
+
+// one benchmarked operation, setup() is called once per size outside of the
+// timed region and run() is the body being timed
+typedef struct bench_t{
+	const char* group;
+	const char* name;
+	const int* sizes;
+	int nsizes;
+	int (*setup)(int n);
+	void (*run)(int n);
+	double (*flops)(int n);	// flops per call, NULL if not meaningful
+} bench_t;
+
+typedef struct result_t{
+	const char* group;
+	const char* name;
+	int size;
+	int reps;		// calls per batch
+	int trials;		// timed batches
+	double min;		// ns per call
+	double median;	// ns per call
+	double p99;		// ns per call
+	double mflops;	// from the median, 0 if not meaningful
+} result_t;
+
+typedef struct baseline_t{
+	char group[32];
+	char name[48];
+	int size;
+	double median;
+} baseline_t;
+
+// operands shared by all benchmarks, allocated by the setup functions
+static rc_vector_t va, vb, vc;
+static rc_matrix_t A, B, C, L, U, P;
+static rc_filter_t filt;
+static rc_ringbuf_t rb;
+static float q1[4], q2[4], q3[4], v3[3], tb[3];
+static rc_ahrs_t ahrs_mahony, ahrs_madgwick, ahrs_ekf;
+static float gyro[3], accel[3], mag[3];
+static volatile float sink;	// keeps results from being optimized away
+
+static double timer_overhead;
+static result_t results[MAX_RESULTS];
+static int nresults = 0;
+
+static const int vec_sizes[]	= {16, 64, 256, 1024, 4096};
+static const int mat_sizes[]	= {4, 8, 16, 32, 64, 128};
+static const int filt_sizes[]	= {1, 2, 4, 8};
+static const int rb_sizes[]		= {16, 64, 256, 1024};
+static const int fixed_size[]	= {4};
+
+#define SWEEP(x) x, (int)(sizeof(x)/sizeof(x[0]))
+
+/*******************************************************************************
+* setup functions
+*******************************************************************************/
+static int setup_vec(int n){
+	if(rc_random_vector(&va,n)) return -1;
+	if(rc_random_vector(&vb,n)) return -1;
+	if(rc_vector_zeros(&vc,n)) return -1;
+	return 0;
+}
+
+// diagonally dominant so the decompositions and solves are well conditioned
+static int setup_mat(int n){
+	int i;
+	if(rc_random_matrix(&A,n,n)) return -1;
+	if(rc_random_matrix(&B,n,n)) return -1;
+	if(rc_alloc_matrix(&C,n,n)) return -1;
+	if(rc_alloc_matrix(&L,n,n)) return -1;
+	if(rc_alloc_matrix(&U,n,n)) return -1;
+	if(rc_alloc_matrix(&P,n,n)) return -1;
+	for(i=0;i<n;i++) A.d[i][i] += n;
+	if(rc_random_vector(&va,n)) return -1;
+	if(rc_vector_zeros(&vc,n)) return -1;
+	return 0;
+}
+
+static int setup_filt(int n){
+	if(rc_butterworth_lowpass(&filt,n,0.01,10.0)) return -1;
+	rc_prefill_filter_inputs(&filt,1.0);
+	rc_prefill_filter_outputs(&filt,1.0);
+	return 0;
+}
+
+static int setup_rb(int n){
+	int i;
+	if(rc_alloc_ringbuf(&rb,n)) return -1;
+	for(i=0;i<n;i++) rc_insert_new_ringbuf_value(&rb,rc_get_random_float());
+	return 0;
+}
 
-#define TIMER rc_nanos_thread_time()
-#define TIMER_DELAY 2100 // ns consumed just by reading the thread time
+static int setup_quat(__attribute__((unused)) int n){
+	int i;
+	for(i=0;i<4;i++){
+		q1[i] = rc_get_random_float();
+		q2[i] = rc_get_random_float();
+	}
+	rc_normalize_quaternion_array(q1);
+	rc_normalize_quaternion_array(q2);
+	for(i=0;i<3;i++) v3[i] = rc_get_random_float();
+	return 0;
+}
+
+static int setup_ahrs(__attribute__((unused)) int n){
+	int i;
+	for(i=0;i<3;i++){
+		gyro[i] = 10.0f*rc_get_random_float();
+		accel[i] = 0.5f*rc_get_random_float();
+		mag[i] = 10.0f*rc_get_random_float();
+	}
+	accel[2] += 9.8f;
+	mag[0] += 20.0f;
+	mag[2] -= 40.0f;
+	if(rc_init_ahrs(&ahrs_mahony,RC_AHRS_MAHONY,0.001f)) return -1;
+	if(rc_init_ahrs(&ahrs_madgwick,RC_AHRS_MADGWICK,0.001f)) return -1;
+	if(rc_init_ahrs(&ahrs_ekf,RC_AHRS_EKF,0.001f)) return -1;
+	// first update only aligns, get that out of the way
+	rc_march_ahrs(&ahrs_mahony,gyro,accel,mag);
+	rc_march_ahrs(&ahrs_madgwick,gyro,accel,mag);
+	rc_march_ahrs(&ahrs_ekf,gyro,accel,mag);
+	return 0;
+}
+
+/*******************************************************************************
+* benchmark bodies
+*******************************************************************************/
+static void run_dot(__attribute__((unused)) int n){
+	sink = rc_vector_dot_product(va,vb);
+}
+static void run_norm(__attribute__((unused)) int n){
+	sink = rc_vector_norm(va,2);
+}
+static void run_vec_sum(__attribute__((unused)) int n){
+	rc_vector_sum(va,vb,&vc);
+}
+static void run_vec_scale(__attribute__((unused)) int n){
+	rc_vector_times_scalar(&va,1.0f);
+}
+static void run_mult(__attribute__((unused)) int n){
+	rc_multiply_matrices(A,B,&C);
+}
+static void run_mat_vec(__attribute__((unused)) int n){
+	rc_matrix_times_col_vec(A,va,&vc);
+}
+static void run_duplicate(__attribute__((unused)) int n){
+	rc_duplicate_matrix(A,&C);
+}
+static void run_transpose(__attribute__((unused)) int n){
+	rc_matrix_transpose_inplace(&B);
+}
+static void run_det(__attribute__((unused)) int n){
+	sink = rc_matrix_determinant(A);
+}
+static void run_lup(__attribute__((unused)) int n){
+	rc_lup_decomp(A,&L,&U,&P);
+}
+static void run_qr(__attribute__((unused)) int n){
+	rc_qr_decomp(A,&L,&U);
+}
+static void run_inv(__attribute__((unused)) int n){
+	rc_invert_matrix(A,&C);
+}
+static void run_solve(__attribute__((unused)) int n){
+	rc_lin_system_solve(A,va,&vc);
+}
+static void run_solve_qr(__attribute__((unused)) int n){
+	rc_lin_system_solve_qr(A,va,&vc);
+}
+static void run_filt(__attribute__((unused)) int n){
+	sink = rc_march_filter(&filt,1.0f);
+}
+static void run_rb_insert(__attribute__((unused)) int n){
+	rc_insert_new_ringbuf_value(&rb,1.0f);
+}
+static void run_rb_get(int n){
+	sink = rc_get_ringbuf_value(&rb,n-1);
+}
+static void run_rb_std(__attribute__((unused)) int n){
+	sink = rc_std_dev_ringbuf(rb);
+}
+static void run_quat_mult(__attribute__((unused)) int n){
+	rc_quaternion_multiply_array(q1,q2,q3);
+}
+static void run_quat_rotate(__attribute__((unused)) int n){
+	rc_quaternion_rotate_vector_array(v3,q1);
+}
+static void run_quat_to_tb(__attribute__((unused)) int n){
+	rc_quaternion_to_tb_array(q1,tb);
+}
+static void run_quat_norm(__attribute__((unused)) int n){
+	rc_normalize_quaternion_array(q1);
+}
+static void run_mahony(__attribute__((unused)) int n){
+	rc_march_ahrs(&ahrs_mahony,gyro,accel,mag);
+}
+static void run_madgwick(__attribute__((unused)) int n){
+	rc_march_ahrs(&ahrs_madgwick,gyro,accel,mag);
+}
+static void run_ekf(__attribute__((unused)) int n){
+	rc_march_ahrs(&ahrs_ekf,gyro,accel,mag);
+}
+static void run_ekf_6dof(__attribute__((unused)) int n){
+	rc_march_ahrs(&ahrs_ekf,gyro,accel,NULL);
+}
+
+/*******************************************************************************
+* flop counts, multiplication and addition both count as one operation
+*******************************************************************************/
+static double flops_n(int n)	{ return n; }
+static double flops_2n(int n)	{ return 2.0*n; }
+static double flops_2n2(int n)	{ return 2.0*n*n; }
+static double flops_2n3(int n)	{ return 2.0*n*n*n; }
+static double flops_lu(int n)	{ return (2.0/3.0)*n*n*n; }
+static double flops_qr(int n)	{ return (4.0/3.0)*n*n*n; }
+static double flops_solve(int n){ return (2.0/3.0)*n*n*n + 2.0*n*n; }
+static double flops_filt(int n)	{ return 4.0*n+1.0; }
+static double flops_quat(__attribute__((unused)) int n){ return 28.0; }
+
+static const bench_t benches[] = {
+	{"vector",		"dot_product",		SWEEP(vec_sizes),	setup_vec,	run_dot,		flops_2n},
+	{"vector",		"norm",				SWEEP(vec_sizes),	setup_vec,	run_norm,		flops_2n},
+	{"vector",		"sum",				SWEEP(vec_sizes),	setup_vec,	run_vec_sum,	flops_n},
+	{"vector",		"times_scalar",		SWEEP(vec_sizes),	setup_vec,	run_vec_scale,	flops_n},
+	{"matrix",		"multiply",			SWEEP(mat_sizes),	setup_mat,	run_mult,		flops_2n3},
+	{"matrix",		"times_col_vec",	SWEEP(mat_sizes),	setup_mat,	run_mat_vec,	flops_2n2},
+	{"matrix",		"duplicate",		SWEEP(mat_sizes),	setup_mat,	run_duplicate,	NULL},
+	{"matrix",		"transpose_inplace",SWEEP(mat_sizes),	setup_mat,	run_transpose,	NULL},
+	{"linalg",		"determinant",		SWEEP(mat_sizes),	setup_mat,	run_det,		flops_lu},
+	{"linalg",		"lup_decomp",		SWEEP(mat_sizes),	setup_mat,	run_lup,		flops_lu},
+	{"linalg",		"qr_decomp",		SWEEP(mat_sizes),	setup_mat,	run_qr,			flops_qr},
+	{"linalg",		"invert",			SWEEP(mat_sizes),	setup_mat,	run_inv,		flops_2n3},
+	{"linalg",		"lin_system_solve",	SWEEP(mat_sizes),	setup_mat,	run_solve,		flops_solve},
+	{"linalg",		"lin_system_solve_qr",SWEEP(mat_sizes),	setup_mat,	run_solve_qr,	NULL},
+	{"filter",		"march_butterworth",SWEEP(filt_sizes),	setup_filt,	run_filt,		flops_filt},
+	{"ringbuf",		"insert",			SWEEP(rb_sizes),	setup_rb,	run_rb_insert,	NULL},
+	{"ringbuf",		"get_value",		SWEEP(rb_sizes),	setup_rb,	run_rb_get,		NULL},
+	{"ringbuf",		"std_dev",			SWEEP(rb_sizes),	setup_rb,	run_rb_std,		NULL},
+	{"quaternion",	"multiply",			SWEEP(fixed_size),	setup_quat,	run_quat_mult,	flops_quat},
+	{"quaternion",	"rotate_vector",	SWEEP(fixed_size),	setup_quat,	run_quat_rotate,NULL},
+	{"quaternion",	"to_tb",			SWEEP(fixed_size),	setup_quat,	run_quat_to_tb,	NULL},
+	{"quaternion",	"normalize",		SWEEP(fixed_size),	setup_quat,	run_quat_norm,	NULL},
+	{"ahrs",		"mahony",			SWEEP(fixed_size),	setup_ahrs,	run_mahony,		NULL},
+	{"ahrs",		"madgwick",			SWEEP(fixed_size),	setup_ahrs,	run_madgwick,	NULL},
+	{"ahrs",		"ekf",				SWEEP(fixed_size),	setup_ahrs,	run_ekf,		NULL},
+	{"ahrs",		"ekf_no_mag",		SWEEP(fixed_size),	setup_ahrs,	run_ekf_6dof,	NULL}
+};
+#define NUM_BENCHES (int)(sizeof(benches)/sizeof(benches[0]))
 
 // printed if some invalid argument was given
 void print_usage(){
 	printf("\n");
-	printf("-d         use default matrix size (%dx%d)\n",DEFAULT_DIM,DEFAULT_DIM);
-	printf("-s {size}  use custom matrix size\n");
-	printf("-h         print this help message\n");
+	printf("-s {size}   run only this size instead of the default sweep\n");
+	printf("-n {trials} timed trials per size, default %d\n", DEFAULT_TRIALS);
+	printf("-w {warmup} warmup batches per size, default %d\n", DEFAULT_WARMUP);
+	printf("-b {filter} only run benchmarks whose group/name contains this\n");
+	printf("-f {format} output format: text, csv, or json\n");
+	printf("-o {file}   write results to a file instead of stdout\n");
+	printf("-c {file}   compare against a baseline CSV from a previous run\n");
+	printf("-t {pct}    slowdown in percent flagged as a regression, default %.0f\n",DEFAULT_THRESH);
+	printf("-l          list available benchmarks\n");
+	printf("-h          print this help message\n");
 	printf("\n");
 }
 
+static int compare_doubles(const void* a, const void* b){
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return (x>y)-(x<y);
+}
 
-int main(int argc, char *argv[]){
-	int dim = 0;
-	int c;
-	uint64_t t1, t2, diff, flops, mflops;
-	rc_vector_t b = rc_empty_vector();
-	rc_matrix_t A = rc_empty_matrix();
-	rc_matrix_t AA = rc_empty_matrix();
-	rc_matrix_t B = rc_empty_matrix();
-	rc_matrix_t L = rc_empty_matrix();
-	rc_matrix_t U = rc_empty_matrix();
-	rc_matrix_t P = rc_empty_matrix();
-	rc_matrix_t Q = rc_empty_matrix();
-	rc_matrix_t R = rc_empty_matrix();
-	rc_vector_t x = rc_empty_vector();
-	// make sure user gave an argument
-	if(argc>3){
-		printf("Too many arguments given.\n");
-		print_usage();
+// minimum cost of reading the clock, subtracted from each timed batch
+static double measure_timer_overhead(){
+	int i;
+	uint64_t t1, t2, best = UINT64_MAX;
+	for(i=0;i<1000;i++){
+		t1 = TIMER;
+		t2 = TIMER;
+		if(t2-t1<best) best = t2-t1;
+	}
+	return (double)best;
+}
+
+static double time_batch(const bench_t* b, int n, int reps){
+	int i;
+	uint64_t t1, t2;
+	double ns;
+	t1 = TIMER;
+	for(i=0;i<reps;i++) b->run(n);
+	t2 = TIMER;
+	ns = (double)(t2-t1) - timer_overhead;
+	return ns>0.0 ? ns : 0.0;
+}
+
+/*******************************************************************************
+* runs one benchmark at one size and stores the statistics in r
+*******************************************************************************/
+static int run_bench(const bench_t* b, int n, int trials, int warmup, result_t* r){
+	int i, reps, done, p99;
+	uint64_t start;
+	double* t;
+	if(b->setup(n)) return -1;
+	// double the calls per batch until a batch takes long enough to time
+	reps = 1;
+	while(time_batch(b,n,reps)<MIN_BATCH_NS && reps<(1<<24)) reps *= 2;
+	for(i=0;i<warmup;i++) time_batch(b,n,reps);
+	t = malloc(trials*sizeof(double));
+	if(t==NULL){
+		fprintf(stderr,"ERROR in run_bench, not enough memory\n");
 		return -1;
 	}
-	if(argc<2){
-		printf("Not enough arguments given.\n");
-		print_usage();
+	start = TIMER;
+	for(done=0;done<trials;done++){
+		if(done>=MIN_TRIALS && TIMER-start>MAX_BENCH_NS) break;
+		t[done] = time_batch(b,n,reps)/reps;
+	}
+	qsort(t,done,sizeof(double),compare_doubles);
+	p99 = (int)ceil(0.99*done)-1;
+	r->group	= b->group;
+	r->name		= b->name;
+	r->size		= n;
+	r->reps		= reps;
+	r->trials	= done;
+	r->min		= t[0];
+	r->median	= (done%2) ? t[done/2] : 0.5*(t[done/2-1]+t[done/2]);
+	r->p99		= t[p99];
+	if(b->flops!=NULL && r->median>0.0) r->mflops = b->flops(n)*1000.0/r->median;
+	else r->mflops = 0.0;
+	free(t);
+	return 0;
+}
+
+static void print_text_header(FILE* f){
+	fprintf(f,"%-11s %-20s %6s %8s %12s %12s %12s %9s\n","group","name",\
+			"size","reps","min(ns)","median(ns)","p99(ns)","MFLOPS");
+}
+
+static void print_text_row(FILE* f, result_t* r){
+	fprintf(f,"%-11s %-20s %6d %8d %12.1f %12.1f %12.1f ",r->group,r->name,\
+			r->size,r->reps,r->min,r->median,r->p99);
+	if(r->mflops>0.0) fprintf(f,"%9.1f\n",r->mflops);
+	else fprintf(f,"%9s\n","-");
+}
+
+static void write_csv(FILE* f){
+	int i;
+	fprintf(f,"group,name,size,reps,trials,min_ns,median_ns,p99_ns,mflops\n");
+	for(i=0;i<nresults;i++){
+		fprintf(f,"%s,%s,%d,%d,%d,%.2f,%.2f,%.2f,%.2f\n",results[i].group,\
+			results[i].name,results[i].size,results[i].reps,results[i].trials,\
+			results[i].min,results[i].median,results[i].p99,results[i].mflops);
+	}
+}
+
+static void write_json(FILE* f){
+	int i;
+	fprintf(f,"{\n  \"timer_overhead_ns\": %.1f,\n  \"results\": [\n",timer_overhead);
+	for(i=0;i<nresults;i++){
+		fprintf(f,"    {\"group\": \"%s\", \"name\": \"%s\", \"size\": %d, "\
+			"\"reps\": %d, \"trials\": %d, \"min_ns\": %.2f, \"median_ns\": %.2f, "\
+			"\"p99_ns\": %.2f, \"mflops\": %.2f}%s\n",results[i].group,\
+			results[i].name,results[i].size,results[i].reps,results[i].trials,\
+			results[i].min,results[i].median,results[i].p99,results[i].mflops,\
+			(i<nresults-1)?",":"");
+	}
+	fprintf(f,"  ]\n}\n");
+}
+
+/*******************************************************************************
+* reads a CSV written by a previous run with -f csv. Returns the number of
+* entries read or -1 on failure.
+*******************************************************************************/
+static int load_baseline(const char* path, baseline_t* base, int max){
+	int n = 0;
+	char line[256];
+	FILE* f = fopen(path,"r");
+	if(f==NULL){
+		fprintf(stderr,"ERROR: can't open baseline file %s\n",path);
 		return -1;
 	}
+	while(n<max && fgets(line,sizeof(line),f)!=NULL){
+		if(sscanf(line,"%31[^,],%47[^,],%d,%*d,%*d,%*f,%lf",base[n].group,\
+				base[n].name,&base[n].size,&base[n].median)==4) n++;
+	}
+	fclose(f);
+	return n;
+}
+
+/*******************************************************************************
+* prints the change in median time for every result also present in the
+* baseline. Returns the number of regressions beyond the threshold.
+*******************************************************************************/
+static int compare_baseline(baseline_t* base, int nbase, double thresh){
+	int i, j, regressions = 0;
+	double change;
+	const char* flag;
+	printf("\n%-11s %-20s %6s %12s %12s %8s\n","group","name","size",\
+			"base(ns)","now(ns)","change");
+	for(i=0;i<nresults;i++){
+		for(j=0;j<nbase;j++){
+			if(base[j].size==results[i].size &&\
+				!strcmp(base[j].group,results[i].group) &&\
+				!strcmp(base[j].name,results[i].name)) break;
+		}
+		if(j==nbase || base[j].median<=0.0) continue;
+		change = 100.0*(results[i].median-base[j].median)/base[j].median;
+		if(change>thresh){
+			flag = "REGRESSION";
+			regressions++;
+		}
+		else if(change<-thresh) flag = "improved";
+		else flag = "";
+		printf("%-11s %-20s %6d %12.1f %12.1f %+7.1f%% %s\n",results[i].group,\
+			results[i].name,results[i].size,base[j].median,results[i].median,\
+			change,flag);
+	}
+	printf("\n%d regression(s) beyond %.1f%%\n",regressions,thresh);
+	return regressions;
+}
+
+int main(int argc, char *argv[]){
+	int c, i, j, n;
+	int dim = 0;
+	int trials = DEFAULT_TRIALS;
+	int warmup = DEFAULT_WARMUP;
+	int nbase = 0;
+	int ret = 0;
+	int freq_set;
+	double thresh = DEFAULT_THRESH;
+	char* filter = NULL;
+	char* out_path = NULL;
+	char* base_path = NULL;
+	char fullname[96];
+	out_format_t format = FORMAT_TEXT;
+	baseline_t* base = NULL;
+	FILE* out = stdout;
+
 	// parse arguments
 	opterr = 0;
-	while ((c = getopt(argc, argv, "ds:h")) != -1){
+	while ((c = getopt(argc, argv, "s:n:w:b:f:o:c:t:lh")) != -1){
 		switch (c){
-		case 'd': // default size option
-			if(dim!=0){
-				printf("invalid combination of arguments\n");
+		case 's': // custom size option
+			dim = atoi(optarg);
+			if(dim>MAX_DIM || dim<MIN_DIM){
+				printf("requested size out of bounds\n");
 				print_usage();
 				return -1;
 			}
-			dim = DEFAULT_DIM;
 			break;
-		case 's': // custom size option
-			if(dim!=0){
-				printf("invalid combination of arguments\n");
-				print_usage();
+		case 'n':
+			trials = atoi(optarg);
+			if(trials<1){
+				printf("need at least one trial\n");
 				return -1;
 			}
-			dim = atoi(optarg);
-			if(dim>MAX_DIM || dim<MIN_DIM){
-				printf("requested size out of bounds\n");
+			break;
+		case 'w':
+			warmup = atoi(optarg);
+			if(warmup<0){
+				printf("warmup can't be negative\n");
+				return -1;
+			}
+			break;
+		case 'b':
+			filter = optarg;
+			break;
+		case 'f':
+			if(!strcmp(optarg,"text")) format = FORMAT_TEXT;
+			else if(!strcmp(optarg,"csv")) format = FORMAT_CSV;
+			else if(!strcmp(optarg,"json")) format = FORMAT_JSON;
+			else{
+				printf("unknown format %s\n",optarg);
 				print_usage();
 				return -1;
 			}
 			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		case 'c':
+			base_path = optarg;
+			break;
+		case 't':
+			thresh = atof(optarg);
+			break;
+		case 'l':
+			for(i=0;i<NUM_BENCHES;i++){
+				printf("%s/%s\n",benches[i].group,benches[i].name);
+			}
+			return 0;
 		case 'h':
 			print_usage();
 			return 0;
@@ -87,81 +541,78 @@ int main(int argc, char *argv[]){
 		}
 	}
 
+	// load the baseline before spending time on the benchmarks
+	if(base_path!=NULL){
+		base = malloc(MAX_BASELINE*sizeof(baseline_t));
+		if(base==NULL) return -1;
+		nbase = load_baseline(base_path,base,MAX_BASELINE);
+		if(nbase<=0){
+			fprintf(stderr,"ERROR: no entries found in baseline %s\n",base_path);
+			free(base);
+			return -1;
+		}
+	}
+	if(out_path!=NULL){
+		out = fopen(out_path,"w");
+		if(out==NULL){
+			fprintf(stderr,"ERROR: can't open %s for writing\n",out_path);
+			free(base);
+			return -1;
+		}
+	}
+
 	// set clock speed to 1000mhz to make sure scaling doesn't effect results
-	rc_set_cpu_freq(FREQ_1000MHZ);
-	printf("Starting\n");
-	
-	// create a random nxn matrix for later use
-	t1 = TIMER;
-	rc_random_matrix(&A,dim,dim);
-	rc_vector_zeros(&b,dim);
-	t2 = TIMER;
-	diff = (t2-t1-TIMER_DELAY);
-	printf("%10lldus Time to make random matrix & vector\n", diff/1000);
-	
-	// duplicate matrix
-	t1 = TIMER;
-	rc_duplicate_matrix(A,&AA);
-	t2 = TIMER;
-	diff = (t2-t1-TIMER_DELAY);
-	printf("%10lldus Time to duplicate matrix\n", diff/1000);
-	
-	// Multiply matrices
-	rc_alloc_matrix(&B,dim,dim);
-	t1 = TIMER;
-	rc_multiply_matrices(A, AA, &B);
-	t2 = TIMER;
-	diff = (t2-t1-TIMER_DELAY);
-	printf("%10lldus Time to multiply matrices\n", diff/1000);
-	
-	// calculate floating pointer operations per second, both multiplication
-	// and addition count as operations, hence multiply by 2
-	flops = ((uint64_t)2*dim*dim*dim*1000000000)/(diff);
-	mflops = flops/(uint64_t)1000000;
-	printf("%10lld MFLOPS multiplying matrices\n", mflops);
-	
-	// find determinant
-	t1 = TIMER;
-	rc_matrix_determinant(A);
-	t2 = TIMER;
-	diff = (t2-t1-TIMER_DELAY);
-	printf("%10lldus Time to find matrix determinant\n", diff/1000);
-	
-	// find inverse
-	t1 = TIMER;
-	rc_invert_matrix(A, &AA);
-	t2 = TIMER;
-	diff = (t2-t1-TIMER_DELAY);
-	printf("%10lldus Time to invert matrix\n", diff/1000);
-	
-	// LUP
-	rc_alloc_matrix(&L,dim,dim);
-	rc_alloc_matrix(&U,dim,dim);
-	rc_alloc_matrix(&P,dim,dim);
-	t1 = TIMER;
-	rc_lup_decomp(A,&L,&U,&P);
-	t2 = TIMER;
-	diff = (t2-t1-TIMER_DELAY);
-	printf("%10lldus Time to do LUP decomposition\n", diff/1000);
+	freq_set = (rc_set_cpu_freq(FREQ_1000MHZ)==0);
+	if(!freq_set) fprintf(stderr,"WARNING: CPU frequency not fixed, results may vary\n");
+	timer_overhead = measure_timer_overhead();
+	fprintf(stderr,"timer overhead: %.0fns, trials: %d, warmup: %d\n",\
+						timer_overhead, trials, warmup);
+	if(format==FORMAT_TEXT) print_text_header(out);
 
-	// do a QR decomposition on A
-	rc_alloc_matrix(&Q,dim,dim);
-	rc_alloc_matrix(&R,dim,dim);
-	t1 = TIMER;
-	rc_qr_decomp(A,&Q,&R);
-	t2 = TIMER;
-	diff = (t2-t1-TIMER_DELAY);
-	printf("%10lldus Time to do QR decomposition\n", diff/1000);
+	for(i=0;i<NUM_BENCHES && nresults<MAX_RESULTS;i++){
+		snprintf(fullname,sizeof(fullname),"%s/%s",benches[i].group,benches[i].name);
+		if(filter!=NULL && strstr(fullname,filter)==NULL) continue;
+		for(j=0;j<benches[i].nsizes && nresults<MAX_RESULTS;j++){
+			// a user-given size replaces the sweep, fixed-size benchmarks
+			// such as quaternions run once regardless
+			if(dim!=0 && benches[i].nsizes>1){
+				if(j>0) break;
+				n = dim;
+			}
+			else n = benches[i].sizes[j];
+			if(run_bench(&benches[i],n,trials,warmup,&results[nresults])){
+				fprintf(stderr,"ERROR: %s failed at size %d\n",fullname,n);
+				continue;
+			}
+			if(format==FORMAT_TEXT){
+				print_text_row(out,&results[nresults]);
+				fflush(out);
+			}
+			nresults++;
+		}
+	}
 
-	// do a QR decomposition on A
-	rc_alloc_vector(&x,dim);
-	t1 = TIMER;
-	rc_lin_system_solve(A,b,&x);
-	t2 = TIMER;
-	diff = (t2-t1-TIMER_DELAY);
-	printf("%10lldus Time to solve linear system\n", diff/1000);
+	if(format==FORMAT_CSV) write_csv(out);
+	else if(format==FORMAT_JSON) write_json(out);
+	if(out!=stdout) fclose(out);
 
-	printf("DONE\n");
-	rc_set_cpu_freq(FREQ_ONDEMAND);
-	return 0;
+	if(base!=NULL){
+		if(compare_baseline(base,nbase,thresh)>0) ret = 1;
+		free(base);
+	}
+
+	// cleanup
+	rc_free_vector(&va);
+	rc_free_vector(&vb);
+	rc_free_vector(&vc);
+	rc_free_matrix(&A);
+	rc_free_matrix(&B);
+	rc_free_matrix(&C);
+	rc_free_matrix(&L);
+	rc_free_matrix(&U);
+	rc_free_matrix(&P);
+	rc_free_filter(&filt);
+	rc_free_ringbuf(&rb);
+	if(freq_set) rc_set_cpu_freq(FREQ_ONDEMAND);
+	return ret;
 }
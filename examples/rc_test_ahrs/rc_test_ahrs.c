@@ -0,0 +1,298 @@
+/*******************************************************************************
+* rc_test_ahrs.c
+*
+* Compares the software AHRS algorithms for accuracy and cost. By default a
+* tumbling trajectory with known orientation is simulated and fed to each
+* algorithm as noisy, biased gyro, accel and magnetometer samples, then the
+* RMS attitude error against the truth is reported along with the average
+* time per update.
+*
+* With -f a log recorded on hardware with -r is replayed instead and each
+* algorithm is compared against the DMP. The DMP doesn't use the magnetometer
+* so only roll and pitch are compared directly, yaw is compared after
+* removing the initial heading difference and the replay skips the mag
+* unless -m is given.
+*
+* example:
+* rc_test_ahrs -r log.csv -s 30	(on the cape, move the board around)
+* rc_test_ahrs -f log.csv
+*******************************************************************************/
+
+#include "../../libraries/rc_usefulincludes.h"
+#include "../../libraries/redperipherallib.h"
+
+#define NUM_ALGS		3
+#define SIM_RATE		1000	// Hz
+#define SIM_SECONDS		60
+#define SIM_SUBSTEPS	10		// truth integration steps per sample
+#define SETTLE_SECONDS	5		// error before this is not counted
+#define REC_RATE		200		// Hz, DMP rate when recording
+#define GRAVITY			9.80665f
+
+static const char* names[NUM_ALGS] = {"mahony", "madgwick", "ekf"};
+static const rc_ahrs_algorithm_t algs[NUM_ALGS] = {RC_AHRS_MAHONY,\
+											RC_AHRS_MADGWICK, RC_AHRS_EKF};
+
+// used while recording
+static rc_imu_data_t data;
+static FILE* rec_file;
+static uint64_t rec_start;
+
+// printed if some invalid argument was given
+void print_usage(){
+	printf("\n");
+	printf("-f {file}   replay a log and compare against the DMP\n");
+	printf("-m          use the magnetometer when replaying a log\n");
+	printf("-r {file}   record a log from the DMP, needs the cape\n");
+	printf("-s {secs}   seconds to record, default 30\n");
+	printf("-h          print this help message\n");
+	printf("\n");
+}
+
+// roughly gaussian noise with unit standard deviation
+static float noise(){
+	float sum = 0.0f;
+	int i;
+	for(i=0;i<4;i++) sum += rc_get_random_float();
+	return sum*0.8660254f;	// sum of 4 uniform [-1,1] has variance 4/3
+}
+
+// angle in radians between two unit quaternions
+static float quat_angle(float a[4], float b[4]){
+	float d = fabsf(a[0]*b[0]+a[1]*b[1]+a[2]*b[2]+a[3]*b[3]);
+	if(d>1.0f) d = 1.0f;
+	return 2.0f*acosf(d);
+}
+
+// rotates world vector w into body coordinates with body-to-world quaternion q
+static void world_to_body(float q[4], const float w[3], float b[3]){
+	float v[3] = {w[0], w[1], w[2]};
+	float qc[4] = {q[0], -q[1], -q[2], -q[3]};
+	rc_quaternion_rotate_vector_array(v, qc);
+	b[0] = v[0];
+	b[1] = v[1];
+	b[2] = v[2];
+}
+
+// wraps an angle to +-PI
+static float wrap(float x){
+	while(x>M_PI) x -= 2.0f*M_PI;
+	while(x<-M_PI) x += 2.0f*M_PI;
+	return x;
+}
+
+/*******************************************************************************
+* simulation against a known trajectory
+*******************************************************************************/
+static int simulate(){
+	const float g_world[3] = {0.0f, 0.0f, GRAVITY};
+	const float m_world[3] = {20.0f, 0.0f, -40.0f};	// uT, north and down
+	const float bias[3] = {1.0f, -0.6f, 0.8f};		// deg/s
+	rc_ahrs_t a[NUM_ALGS];
+	float q[4] = {1.0f, 0.0f, 0.0f, 0.0f};
+	float w[3], gyro[3], accel[3], mag[3], t, h, q0, q1, q2, q3;
+	double err[NUM_ALGS], bias_err[NUM_ALGS], e;
+	uint64_t cost[NUM_ALGS], t1;
+	int i, j, k, n = 0;
+
+	for(j=0;j<NUM_ALGS;j++){
+		rc_init_ahrs(&a[j], algs[j], 1.0f/SIM_RATE);
+		err[j] = 0.0;
+		cost[j] = 0;
+	}
+	// the integral term is what tracks gyro bias in the mahony filter
+	a[0].ki = 0.05f;
+
+	printf("\nsimulating %ds at %dHz, gyro bias %.1f %.1f %.1f deg/s\n",\
+			SIM_SECONDS, SIM_RATE, bias[0], bias[1], bias[2]);
+	h = 1.0f/(SIM_RATE*SIM_SUBSTEPS);
+	for(i=0;i<SIM_SECONDS*SIM_RATE;i++){
+		t = (float)i/SIM_RATE;
+		// body rates in rad/s, slow enough to stay inside the accel gate
+		w[0] = 1.2f*sinf(0.7f*t);
+		w[1] = 0.9f*cosf(0.45f*t);
+		w[2] = 0.6f*sinf(0.3f*t)+0.3f;
+		// propagate the truth in finer steps than the filters get to see
+		for(k=0;k<SIM_SUBSTEPS;k++){
+			q0=q[0]; q1=q[1]; q2=q[2]; q3=q[3];
+			q[0] += 0.5f*h*(-q1*w[0] - q2*w[1] - q3*w[2]);
+			q[1] += 0.5f*h*( q0*w[0] + q2*w[2] - q3*w[1]);
+			q[2] += 0.5f*h*( q0*w[1] - q1*w[2] + q3*w[0]);
+			q[3] += 0.5f*h*( q0*w[2] + q1*w[1] - q2*w[0]);
+			rc_normalize_quaternion_array(q);
+		}
+		// synthesize sensors
+		world_to_body(q, g_world, accel);
+		world_to_body(q, m_world, mag);
+		for(k=0;k<3;k++){
+			gyro[k] = w[k]*RAD_TO_DEG + bias[k] + 0.3f*noise();
+			accel[k] += 0.05f*noise();
+			mag[k] += 0.5f*noise();
+		}
+		for(j=0;j<NUM_ALGS;j++){
+			t1 = rc_nanos_since_boot();
+			rc_march_ahrs(&a[j], gyro, accel, mag);
+			cost[j] += rc_nanos_since_boot()-t1;
+			if(i>=SETTLE_SECONDS*SIM_RATE){
+				e = quat_angle(a[j].q, q);
+				err[j] += e*e;
+			}
+		}
+		if(i>=SETTLE_SECONDS*SIM_RATE) n++;
+	}
+
+	printf("\n algorithm   rms error (deg)   bias error (deg/s)   time/update (ns)\n");
+	for(j=0;j<NUM_ALGS;j++){
+		bias_err[j] = 0.0;
+		for(k=0;k<3;k++){
+			e = a[j].bias[k]*RAD_TO_DEG - bias[k];
+			bias_err[j] += e*e;
+		}
+		printf("%10s   %15.3f   %18.3f   %16llu\n", names[j],\
+				sqrt(err[j]/n)*RAD_TO_DEG,\
+				(j==1) ? sqrt(bias[0]*bias[0]+bias[1]*bias[1]+bias[2]*bias[2])\
+						: sqrt(bias_err[j]),\
+				(unsigned long long)(cost[j]/(SIM_SECONDS*SIM_RATE)));
+	}
+	printf("(madgwick doesn't estimate bias)\n");
+	return 0;
+}
+
+/*******************************************************************************
+* replay of a recorded log against the DMP
+*******************************************************************************/
+static int replay(const char* path, int use_mag){
+	FILE* f;
+	char line[512];
+	rc_ahrs_t a[NUM_ALGS];
+	double t, last_t = -1.0;
+	float accel[3], gyro[3], mag[3], dq[4], dtb[3];
+	float yaw0[NUM_ALGS];
+	double se[NUM_ALGS][3], e;
+	int i, j, n = 0, skip = 0, first = 1;
+
+	f = fopen(path, "r");
+	if(f==NULL){
+		fprintf(stderr,"can't open %s\n", path);
+		return -1;
+	}
+	for(j=0;j<NUM_ALGS;j++){
+		rc_init_ahrs(&a[j], algs[j], 1.0f/REC_RATE);
+		se[j][0] = se[j][1] = se[j][2] = 0.0;
+	}
+	a[0].ki = 0.05f;
+
+	while(fgets(line, sizeof(line), f)!=NULL){
+		if(sscanf(line, "%lf,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f", &t,\
+				&accel[0], &accel[1], &accel[2], &gyro[0], &gyro[1], &gyro[2],\
+				&mag[0], &mag[1], &mag[2], &dq[0], &dq[1], &dq[2], &dq[3])!=14){
+			skip++;		// header or a damaged line
+			continue;
+		}
+		rc_quaternion_to_tb_array(dq, dtb);
+		for(j=0;j<NUM_ALGS;j++){
+			if(last_t>=0.0 && t>last_t) a[j].dt = t-last_t;
+			rc_march_ahrs(&a[j], gyro, accel, use_mag ? mag : NULL);
+			if(first) yaw0[j] = a[j].tb[2]-dtb[2];
+			if(t<SETTLE_SECONDS) continue;
+			for(i=0;i<3;i++){
+				e = a[j].tb[i]-dtb[i];
+				if(i==2) e -= yaw0[j];
+				e = wrap(e);
+				se[j][i] += e*e;
+			}
+		}
+		last_t = t;
+		first = 0;
+		if(t>=SETTLE_SECONDS) n++;
+	}
+	fclose(f);
+	if(n<=0){
+		fprintf(stderr,"%s has no samples after the first %ds\n", path, SETTLE_SECONDS);
+		return -1;
+	}
+	printf("\n%d samples compared, %d lines skipped\n", n, skip);
+	printf("\n algorithm   rms difference from DMP (deg)\n");
+	printf("                 X        Y     yaw\n");
+	for(j=0;j<NUM_ALGS;j++){
+		printf("%10s  %7.2f  %7.2f  %6.2f\n", names[j],\
+				sqrt(se[j][0]/n)*RAD_TO_DEG, sqrt(se[j][1]/n)*RAD_TO_DEG,\
+				sqrt(se[j][2]/n)*RAD_TO_DEG);
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* recording from the DMP
+*******************************************************************************/
+static void record_sample(){
+	double t = (rc_nanos_since_epoch()-rec_start)/1e9;
+	fprintf(rec_file, "%.6f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f\n", t,\
+		data.accel[0], data.accel[1], data.accel[2],\
+		data.gyro[0], data.gyro[1], data.gyro[2],\
+		data.mag[0], data.mag[1], data.mag[2],\
+		data.dmp_quat[QUAT_W], data.dmp_quat[QUAT_X],\
+		data.dmp_quat[QUAT_Y], data.dmp_quat[QUAT_Z]);
+}
+
+static int record(const char* path, int seconds){
+	rc_imu_config_t conf = rc_default_imu_config();
+	rec_file = fopen(path, "w");
+	if(rec_file==NULL){
+		fprintf(stderr,"can't open %s\n", path);
+		return -1;
+	}
+	fprintf(rec_file, "t,ax,ay,az,gx,gy,gz,mx,my,mz,qw,qx,qy,qz\n");
+	conf.dmp_sample_rate = REC_RATE;
+	conf.enable_magnetometer = 1;
+	rec_start = rc_nanos_since_epoch();
+	if(rc_initialize_imu_dmp(&data, conf)){
+		fprintf(stderr,"rc_initialize_imu_dmp failed\n");
+		fclose(rec_file);
+		return -1;
+	}
+	rc_set_imu_interrupt_func(&record_sample);
+	printf("\nrecording %ds to %s, move the board around\n", seconds, path);
+	rc_usleep(seconds*1000000);
+	rc_power_off_imu();
+	fclose(rec_file);
+	return 0;
+}
+
+int main(int argc, char *argv[]){
+	int c, use_mag = 0, seconds = 30;
+	char* replay_path = NULL;
+	char* record_path = NULL;
+
+	opterr = 0;
+	while ((c = getopt(argc, argv, "f:mr:s:h")) != -1){
+		switch (c){
+		case 'f':
+			replay_path = optarg;
+			break;
+		case 'm':
+			use_mag = 1;
+			break;
+		case 'r':
+			record_path = optarg;
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			if(seconds<1){
+				print_usage();
+				return -1;
+			}
+			break;
+		case 'h':
+			print_usage();
+			return 0;
+		default:
+			print_usage();
+			return -1;
+		}
+	}
+
+	if(record_path!=NULL) return record(record_path, seconds);
+	if(replay_path!=NULL) return replay(replay_path, use_mag);
+	return simulate();
+}
@@ -10,6 +10,7 @@
 #include "../../libraries/redperipherallib.h"
 
 #define DIM 3
+#define HILBERT_DIM 5
 
 int main(){
 	float det;
@@ -24,6 +25,12 @@ int main(){
 	rc_vector_t b = rc_empty_vector();
 	rc_vector_t x = rc_empty_vector();
 	rc_vector_t y = rc_empty_vector();
+	rc_matrix_d_t Ad = rc_empty_matrix_d();
+	rc_vector_d_t bd = rc_empty_vector_d();
+	rc_vector_d_t xd = rc_empty_vector_d();
+	double hilbert[HILBERT_DIM*HILBERT_DIM];
+	double err_f, err_d;
+	int i, j;
 	
 	printf("Let's test some linear algebra functions....\n\n");
 
@@ -117,6 +124,36 @@ int main(){
 	rc_lin_system_solve_qr(A,b,&y);
 	rc_print_vector(y);
 
+	// the same solve in double precision on an ill-conditioned Hilbert matrix
+	// wrapped without copying, the exact solution is all ones
+	printf("\nSolving a %dx%d Hilbert system in float and double:\n",\
+							HILBERT_DIM, HILBERT_DIM);
+	for(i=0;i<HILBERT_DIM;i++){
+		for(j=0;j<HILBERT_DIM;j++){
+			hilbert[i*HILBERT_DIM+j] = 1.0/(i+j+1);
+		}
+	}
+	rc_matrix_view_array_d(&Ad,hilbert,HILBERT_DIM,HILBERT_DIM);
+	rc_vector_zeros_d(&bd,HILBERT_DIM);
+	for(i=0;i<HILBERT_DIM;i++){
+		for(j=0;j<HILBERT_DIM;j++) bd.d[i] += Ad.d[i][j];
+	}
+	rc_lin_system_solve_d(Ad,bd,&xd);
+	rc_matrix_to_float(Ad,&A);
+	rc_vector_to_float(bd,&b);
+	rc_lin_system_solve(A,b,&x);
+	err_f = 0.0;
+	err_d = 0.0;
+	for(i=0;i<HILBERT_DIM;i++){
+		err_f += fabs(x.d[i]-1.0);
+		err_d += fabs(xd.d[i]-1.0);
+	}
+	printf("float  solution error: %g\n", err_f);
+	printf("double solution error: %g\n", err_d);
+	rc_free_matrix_d(&Ad); // only frees the row pointers, hilbert is untouched
+	rc_free_vector_d(&bd);
+	rc_free_vector_d(&xd);
+
 
 	printf("\nDONE\n");
 	return 0;
@@ -0,0 +1,90 @@
+/*******************************************************************************
+* rc_test_calibration.c
+*
+* Prints what is in the calibration store, or imports the old gyro.cal,
+* mag.cal and dsm.cal text files into it. Doesn't need rc_initialize so it
+* can be run alongside another program.
+*
+* example:
+* rc_test_calibration
+* rc_test_calibration -i
+*******************************************************************************/
+
+#include "../../libraries/rc_usefulincludes.h"
+#include "../../libraries/redperipherallib.h"
+
+// printed if some invalid argument was given
+void print_usage(){
+	printf("\n");
+	printf("-i          import the text calibration files and save them\n");
+	printf("-h          print this help message\n");
+	printf("\n");
+}
+
+static void print_calibration(rc_calibration_t* cal){
+	int i;
+	printf("\ngyro: ");
+	if(cal->valid & RC_CAL_GYRO){
+		printf("offsets %d %d %d\n", cal->gyro_offsets[0],\
+					cal->gyro_offsets[1], cal->gyro_offsets[2]);
+	}
+	else printf("not calibrated\n");
+	printf("mag:  ");
+	if(cal->valid & RC_CAL_MAG){
+		printf("offsets %.3f %.3f %.3f  scales %.4f %.4f %.4f\n",\
+			cal->mag_offsets[0], cal->mag_offsets[1], cal->mag_offsets[2],\
+			cal->mag_scales[0], cal->mag_scales[1], cal->mag_scales[2]);
+	}
+	else printf("not calibrated\n");
+	printf("dsm:  ");
+	if(cal->valid & RC_CAL_DSM){
+		printf("\n");
+		for(i=0;i<RC_CAL_DSM_CHANNELS;i++){
+			printf("  ch%d %d-%d\n", i+1, cal->dsm_mins[i], cal->dsm_maxes[i]);
+		}
+	}
+	else printf("not calibrated\n");
+	printf("adc:  ");
+	if(cal->valid & RC_CAL_ADC){
+		printf("\n");
+		for(i=0;i<RC_CAL_ADC_CHANNELS;i++){
+			printf("  ch%d gain %.5f offset %.5f\n", i, cal->adc_gains[i],\
+												cal->adc_offsets[i]);
+		}
+	}
+	else printf("not calibrated\n");
+	printf("\n");
+}
+
+int main(int argc, char *argv[]){
+	int c, n, import = 0;
+	rc_calibration_t cal;
+
+	opterr = 0;
+	while ((c = getopt(argc, argv, "ih")) != -1){
+		switch (c){
+		case 'i':
+			import = 1;
+			break;
+		case 'h':
+			print_usage();
+			return 0;
+		default:
+			print_usage();
+			return -1;
+		}
+	}
+
+	if(rc_get_calibration(&cal)) return -1;
+	if(import){
+		n = rc_import_text_calibration(&cal);
+		if(n<=0){
+			printf("no text calibration files found\n");
+			return -1;
+		}
+		if(rc_save_calibration(&cal)) return -1;
+		printf("imported %d text calibration files\n", n);
+	}
+	print_calibration(&cal);
+	return 0;
+}
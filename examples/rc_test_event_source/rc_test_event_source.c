@@ -0,0 +1,144 @@
+/*******************************************************************************
+* rc_test_event_source.c
+*
+* Measures the time from an event to the waiting thread returning from
+* rc_event_source_wait. By default events are generated in software through an
+* eventfd and a pipe so this runs without hardware. With -g the IMU interrupt
+* pin is used instead, first through the gpio character device then sysfs.
+* Note that with sysfs the timestamp is taken after wakeup so the latency
+* measured there is only the time to read the value file.
+*******************************************************************************/
+
+#include "../../libraries/rc_usefulincludes.h"
+#include "../../libraries/redperipherallib.h"
+#include <sys/eventfd.h>
+
+#define EVENTS		2000
+#define IMU_INT_PIN	117 // gpio3.21 P9.25
+#define PERIOD_US	1000
+
+int write_fd;
+rc_event_source_type_t write_type;
+volatile uint64_t eventfd_stamp;
+
+// printed if some invalid argument was given
+void print_usage(){
+	printf("\n");
+	printf("-g		wait on the IMU interrupt pin instead of software events\n");
+	printf("-n {num}	number of events to time, default %d\n", EVENTS);
+	printf("-h		print this help message\n");
+	printf("\n");
+}
+
+// generates software events at a fixed period
+void* writer(__attribute__((unused)) void* ptr){
+	int i;
+	uint64_t t, one = 1;
+	for(i=0;i<EVENTS;i++){
+		rc_usleep(PERIOD_US);
+		t = rc_nanos_since_epoch();
+		if(write_type==EVENT_SOURCE_PIPE){
+			if(write(write_fd, &t, sizeof(t))<0) break;
+		}
+		else{
+			eventfd_stamp = t;
+			if(write(write_fd, &one, sizeof(one))<0) break;
+		}
+	}
+	return NULL;
+}
+
+// waits for n events and prints latency statistics
+void time_events(rc_event_source_t* src, const char* name, int n, int software){
+	int i, ret, count = 0;
+	uint64_t ts, now, lat, min = UINT64_MAX, max = 0, total = 0;
+	for(i=0;i<n;i++){
+		ret = rc_event_source_wait(src, 1000, &ts);
+		now = rc_nanos_since_epoch();
+		if(ret<=0) break;
+		// eventfd events are stamped on wakeup, use the writer's stamp
+		if(software && src->type==EVENT_SOURCE_EVENTFD) ts = eventfd_stamp;
+		lat = now-ts;
+		if(lat<min) min = lat;
+		if(lat>max) max = lat;
+		total += lat;
+		count++;
+	}
+	if(count==0){
+		printf("%-16s no events received\n", name);
+		return;
+	}
+	printf("%-16s %6d events  min %6lluns  mean %6lluns  max %7lluns\n", name,\
+		count, (unsigned long long)min, (unsigned long long)(total/count),\
+		(unsigned long long)max);
+}
+
+int main(int argc, char *argv[]){
+	int c, n = EVENTS, use_gpio = 0;
+	int fds[2];
+	pthread_t thread;
+	rc_event_source_t src;
+
+	opterr = 0;
+	while ((c = getopt(argc, argv, "gn:h")) != -1){
+		switch (c){
+		case 'g':
+			use_gpio = 1;
+			break;
+		case 'n':
+			n = atoi(optarg);
+			if(n<1){
+				print_usage();
+				return -1;
+			}
+			break;
+		case 'h':
+			print_usage();
+			return 0;
+		default:
+			print_usage();
+			return -1;
+		}
+	}
+
+	if(use_gpio){
+		printf("\nwaiting for %d edges on the IMU interrupt pin\n", n);
+		if(rc_event_source_open_gpio(&src, IMU_INT_PIN, EDGE_FALLING,\
+										EVENT_SOURCE_GPIO_CHARDEV)==0){
+			time_events(&src, "gpio chardev", n, 0);
+			rc_event_source_close(&src);
+		}
+		if(rc_event_source_open_gpio(&src, IMU_INT_PIN, EDGE_FALLING,\
+										EVENT_SOURCE_GPIO_SYSFS)==0){
+			time_events(&src, "gpio sysfs", n, 0);
+			rc_event_source_close(&src);
+		}
+		return 0;
+	}
+	if(n>EVENTS) n = EVENTS;
+	printf("\ntiming %d software events %dus apart\n", n, PERIOD_US);
+
+	// eventfd
+	write_fd = eventfd(0, 0);
+	write_type = EVENT_SOURCE_EVENTFD;
+	rc_event_source_open_fd(&src, write_fd, EVENT_SOURCE_EVENTFD);
+	pthread_create(&thread, NULL, writer, NULL);
+	time_events(&src, "eventfd", n, 1);
+	pthread_join(thread, NULL);
+	close(write_fd);
+
+	// pipe
+	if(pipe(fds)){
+		fprintf(stderr,"failed to create pipe\n");
+		return -1;
+	}
+	write_fd = fds[1];
+	write_type = EVENT_SOURCE_PIPE;
+	rc_event_source_open_fd(&src, fds[0], EVENT_SOURCE_PIPE);
+	pthread_create(&thread, NULL, writer, NULL);
+	time_events(&src, "pipe", n, 1);
+	pthread_join(thread, NULL);
+	close(fds[0]);
+	close(fds[1]);
+	return 0;
+}
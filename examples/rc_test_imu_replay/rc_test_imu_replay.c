@@ -0,0 +1,187 @@
+/*******************************************************************************
+* rc_test_imu_replay.c
+*
+* Records the raw DMP FIFO stream on the cape, or replays a recording through
+* the DMP mode code path without any hardware. A replay prints the number of
+* samples delivered, a checksum of their contents so runs can be compared for
+* determinism, and the average time spent per sample. Recording also prints
+* how long the IMU took to start up. Replays can be run through the dynamic
+* notch filter to see which vibration it finds and what it costs.
+*
+* example:
+* rc_test_imu_replay -r imu.bin -s 30 -m	(on the cape)
+* rc_test_imu_replay -p imu.bin -x
+* rc_test_imu_replay -p imu.bin -x -n
+*******************************************************************************/
+
+#include "../../libraries/rc_usefulincludes.h"
+#include "../../libraries/redperipherallib.h"
+
+#define REC_RATE	200	// Hz, DMP rate when recording
+
+static rc_imu_data_t data;
+static uint64_t checksum = 14695981039346656037ULL;
+static uint64_t samples;
+
+// printed if some invalid argument was given
+void print_usage(){
+	printf("\n");
+	printf("-r {file}   record the DMP FIFO stream, needs the cape\n");
+	printf("-s {secs}   seconds to record, default 10\n");
+	printf("-m          enable the magnetometer when recording\n");
+	printf("-p {file}   replay a recording\n");
+	printf("-x          replay as fast as possible instead of in real time\n");
+	printf("-n          run the replay through the dynamic notch filter\n");
+	printf("-h          print this help message\n");
+	printf("\n");
+}
+
+// FNV-1a over the fields that come out of the FIFO
+static void hash(const void* p, size_t n){
+	const unsigned char* b = p;
+	size_t i;
+	for(i=0;i<n;i++) checksum = (checksum^b[i])*1099511628211ULL;
+}
+
+static void on_sample(const rc_imu_sample_t* s, __attribute__((unused)) void* ctx){
+	hash(&s->timestamp_ns, sizeof(s->timestamp_ns));
+	hash(s->data.accel, sizeof(s->data.accel));
+	hash(s->data.gyro, sizeof(s->data.gyro));
+	hash(s->data.mag, sizeof(s->data.mag));
+	hash(s->data.dmp_quat, sizeof(s->data.dmp_quat));
+	hash(s->data.fused_quat, sizeof(s->data.fused_quat));
+	samples++;
+}
+
+static int record(const char* path, int seconds, int use_mag){
+	rc_imu_config_t conf = rc_default_imu_config();
+	rc_imu_startup_stats_t st;
+	int n;
+	conf.dmp_sample_rate = REC_RATE;
+	conf.enable_magnetometer = use_mag;
+	if(rc_initialize_imu_dmp(&data, conf)){
+		fprintf(stderr,"rc_initialize_imu_dmp failed\n");
+		return -1;
+	}
+	rc_get_imu_startup_stats(&st);
+	printf("\nIMU startup took %.1fms\n", st.total_ns/1e6);
+	printf("reset:      %6.1fms\n", st.reset_ns/1e6);
+	printf("gyro cal:   %6.1fms\n", st.gyro_cal_ns/1e6);
+	printf("sensors:    %6.1fms\n", st.sensor_config_ns/1e6);
+	printf("firmware:   %6.1fms %s\n", st.firmware_ns/1e6,\
+				st.firmware_resident ? "(already loaded)" : "");
+	printf("dmp config: %6.1fms\n", st.dmp_config_ns/1e6);
+	if(rc_start_imu_recording(path)){
+		rc_power_off_imu();
+		return -1;
+	}
+	printf("\nrecording %ds to %s\n", seconds, path);
+	rc_usleep(seconds*1000000);
+	n = rc_stop_imu_recording();
+	rc_power_off_imu();
+	if(n<0) return -1;
+	printf("recorded %d FIFO reads\n", n);
+	return 0;
+}
+
+static void print_notch_stats(){
+	rc_imu_notch_stats_t ns;
+	int i, j;
+	rc_get_imu_notch_stats(&ns);
+	printf("\ndynamic notch, budget %d steps, spectrum every %.2fs\n",\
+										ns.budget, ns.spectrum_period);
+	printf("spectra: %llu  skipped windows: %llu\n",\
+		(unsigned long long)ns.spectra, (unsigned long long)ns.skipped_windows);
+	for(i=0;i<3;i++){
+		printf("%c:", 'X'+i);
+		for(j=0;j<RC_IMU_MAX_NOTCHES;j++){
+			if(ns.freq[i][j]==0.0f) continue;
+			printf("  %6.1fhz %5.2fdeg/s", ns.freq[i][j], ns.amplitude[i][j]);
+		}
+		printf("\n");
+	}
+	if(ns.samples>0){
+		printf("cost per sample: %lluns mean  %lluns max\n",\
+			(unsigned long long)(ns.cost_total_ns/ns.samples),\
+			(unsigned long long)ns.cost_max_ns);
+	}
+}
+
+static int replay(const char* path, rc_imu_replay_speed_t speed, int notch){
+	rc_imu_config_t conf = rc_default_imu_config();
+	rc_imu_fifo_stats_t stats;
+	uint64_t t1, t2;
+	int n;
+	conf.dynamic_notch = notch;
+	rc_add_imu_subscriber(on_sample, NULL, 1, 0, IMU_DISPATCH_INLINE);
+	t1 = rc_nanos_since_boot();
+	if(rc_initialize_imu_replay(&data, conf, path, speed)){
+		return -1;
+	}
+	n = rc_wait_for_imu_replay();
+	t2 = rc_nanos_since_boot();
+	rc_power_off_imu();
+	if(n<0){
+		fprintf(stderr,"replay stopped early, the recording is corrupt\n");
+		return -1;
+	}
+	rc_get_imu_fifo_stats(&stats);
+	printf("\nreplayed %d FIFO reads, %llu samples delivered\n", n,\
+										(unsigned long long)samples);
+	printf("resyncs: %llu  overflows: %llu  bad quaternions: %llu  read errors: %llu\n",\
+		(unsigned long long)stats.resyncs, (unsigned long long)stats.overflows,\
+		(unsigned long long)stats.quat_failures, (unsigned long long)stats.i2c_errors);
+	printf("checksum: %016llx\n", (unsigned long long)checksum);
+	if(speed==IMU_REPLAY_MAX_SPEED && samples>0){
+		printf("average time per sample: %lluns\n",\
+					(unsigned long long)((t2-t1)/samples));
+	}
+	if(notch) print_notch_stats();
+	return 0;
+}
+
+int main(int argc, char *argv[]){
+	int c, use_mag = 0, seconds = 10, notch = 0;
+	char* replay_path = NULL;
+	char* record_path = NULL;
+	rc_imu_replay_speed_t speed = IMU_REPLAY_REALTIME;
+
+	opterr = 0;
+	while ((c = getopt(argc, argv, "r:s:mp:xnh")) != -1){
+		switch (c){
+		case 'r':
+			record_path = optarg;
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			if(seconds<1){
+				print_usage();
+				return -1;
+			}
+			break;
+		case 'm':
+			use_mag = 1;
+			break;
+		case 'p':
+			replay_path = optarg;
+			break;
+		case 'x':
+			speed = IMU_REPLAY_MAX_SPEED;
+			break;
+		case 'n':
+			notch = 1;
+			break;
+		case 'h':
+			print_usage();
+			return 0;
+		default:
+			print_usage();
+			return -1;
+		}
+	}
+
+	if(record_path!=NULL) return record(record_path, seconds, use_mag);
+	if(replay_path!=NULL) return replay(replay_path, speed, notch);
+	print_usage();
+	return -1;
+}
@@ -0,0 +1,79 @@
+/*******************************************************************************
+* rc_test_lookup_table.c
+*
+* Builds a small 2D gain-scheduling table of 2x3 gain matrices indexed by
+* airspeed and battery voltage, interpolates a few points and times repeated
+* lookups into a preallocated output matrix.
+*******************************************************************************/
+
+#include "../../libraries/rc_usefulincludes.h"
+#include "../../libraries/redperipherallib.h"
+
+#define LOOPS 100000
+
+int main(){
+	int i,j,r,c;
+	int len[2] = {4,3};
+	int idx[2];
+	float x[2];
+	float speeds[4] = {0.0, 5.0, 10.0, 20.0};
+	float volts[3] = {10.5, 11.1, 12.6};
+	uint64_t t1, t2;
+	rc_lut_t t = rc_empty_lut();
+	rc_matrix_t K = rc_empty_matrix();
+	rc_vector_t bp = rc_empty_vector();
+
+	if(rc_alloc_lut(&t,2,len,2,3)){
+		fprintf(stderr,"failed to allocate lookup table\n");
+		return -1;
+	}
+	rc_vector_from_array(&bp,speeds,4);
+	rc_set_lut_breakpoints(&t,0,bp);
+	rc_vector_from_array(&bp,volts,3);
+	rc_set_lut_breakpoints(&t,1,bp);
+
+	// fill each grid point with a gain that is linear in both variables so
+	// interpolated values can be checked by hand: K[r][c] = speed + 10*volts
+	rc_alloc_matrix(&K,2,3);
+	for(i=0;i<4;i++){
+		for(j=0;j<3;j++){
+			for(r=0;r<2;r++){
+				for(c=0;c<3;c++) K.d[r][c] = (r*3+c) + speeds[i] + 10.0*volts[j];
+			}
+			idx[0]=i;
+			idx[1]=j;
+			rc_set_lut_entry(&t,idx,K);
+		}
+	}
+
+	printf("\nK at speed=7.5 volts=11.85, expect first entry %6.2f\n",\
+												7.5+10.0*11.85);
+	x[0] = 7.5;
+	x[1] = 11.85;
+	rc_lut_eval(&t,x,&K);
+	rc_print_matrix(K);
+
+	printf("\nK at speed=30 volts=9 clamps to the table edge, expect %6.2f\n",\
+												20.0+10.0*10.5);
+	x[0] = 30.0;
+	x[1] = 9.0;
+	rc_lut_eval(&t,x,&K);
+	rc_print_matrix(K);
+
+	// time a slow sweep through the table like a real scheduling variable
+	t1 = rc_nanos_since_boot();
+	for(i=0;i<LOOPS;i++){
+		x[0] = 20.0f*(float)i/LOOPS;
+		x[1] = 10.5f+2.0f*(float)i/LOOPS;
+		rc_lut_eval(&t,x,&K);
+	}
+	t2 = rc_nanos_since_boot();
+	printf("\naverage rc_lut_eval time: %lluns\n",\
+				(unsigned long long)((t2-t1)/LOOPS));
+
+	rc_free_lut(&t);
+	rc_free_matrix(&K);
+	rc_free_vector(&bp);
+	printf("\nDONE\n");
+	return 0;
+}
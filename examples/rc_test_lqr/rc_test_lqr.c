@@ -0,0 +1,123 @@
+/*******************************************************************************
+* rc_test_lqr.c
+*
+* Solves the discrete Riccati equation for a double integrator, checks the
+* residual of the solution, prints the LQR gain and then times repeated
+* re-solves of a 12-state, 4-input system like a small multirotor model.
+*******************************************************************************/
+
+#include "../../libraries/rc_usefulincludes.h"
+#include "../../libraries/redperipherallib.h"
+
+#define BIG_N	12
+#define BIG_M	4
+#define LOOPS	100
+
+// relative residual of P = Q + A'P(A-BK) with K=(R+B'PB)^-1 B'PA computed
+// with plain loops so the check is independent of the solver
+float riccati_residual(rc_matrix_t A, rc_matrix_t B, rc_matrix_t Q, \
+										rc_matrix_t P, rc_matrix_t K){
+	int i,j,k,l;
+	int n = A.rows;
+	float res = 0.0f;
+	float scale = 0.0f;
+	float sum;
+	rc_matrix_t ABK = rc_empty_matrix();
+	rc_matrix_t PABK = rc_empty_matrix();
+	rc_matrix_zeros(&ABK,n,n);
+	rc_matrix_zeros(&PABK,n,n);
+	for(i=0;i<n;i++){
+		for(j=0;j<n;j++){
+			sum = A.d[i][j];
+			for(k=0;k<B.cols;k++) sum -= B.d[i][k]*K.d[k][j];
+			ABK.d[i][j] = sum;
+		}
+	}
+	for(i=0;i<n;i++){
+		for(j=0;j<n;j++){
+			for(k=0;k<n;k++) PABK.d[i][j] += P.d[i][k]*ABK.d[k][j];
+		}
+	}
+	for(i=0;i<n;i++){
+		for(j=0;j<n;j++){
+			sum = Q.d[i][j];
+			for(l=0;l<n;l++) sum += A.d[l][i]*PABK.d[l][j];
+			res += fabs(sum-P.d[i][j]);
+			scale += fabs(P.d[i][j]);
+		}
+	}
+	rc_free_matrix(&ABK);
+	rc_free_matrix(&PABK);
+	return res/scale;
+}
+
+int main(){
+	int i;
+	float dt = 0.01;
+	uint64_t t1, t2;
+	rc_matrix_t A = rc_empty_matrix();
+	rc_matrix_t B = rc_empty_matrix();
+	rc_matrix_t Q = rc_empty_matrix();
+	rc_matrix_t R = rc_empty_matrix();
+	rc_matrix_t P = rc_empty_matrix();
+	rc_matrix_t K = rc_empty_matrix();
+	rc_dare_workspace_t ws = rc_empty_dare_workspace();
+
+	// double integrator
+	rc_identity_matrix(&A,2);
+	A.d[0][1] = dt;
+	rc_matrix_zeros(&B,2,1);
+	B.d[0][0] = 0.5*dt*dt;
+	B.d[1][0] = dt;
+	rc_identity_matrix(&Q,2);
+	rc_identity_matrix(&R,1);
+	R.d[0][0] = 0.1;
+
+	printf("\nDouble integrator Riccati solution P:\n");
+	if(rc_dare_solve(A,B,Q,R,&ws,&P)){
+		fprintf(stderr,"rc_dare_solve failed\n");
+		return -1;
+	}
+	rc_print_matrix(P);
+	printf("iterations: %d\n", ws.iterations);
+
+	printf("\nLQR gain K:\n");
+	rc_lqr_gain(A,B,Q,R,&ws,&K);
+	rc_print_matrix(K);
+	printf("relative residual: %g\n", riccati_residual(A,B,Q,P,K));
+
+	// 12 state system made of 4 weakly coupled triple integrators
+	rc_identity_matrix(&A,BIG_N);
+	rc_matrix_zeros(&B,BIG_N,BIG_M);
+	for(i=0;i<BIG_M;i++){
+		A.d[3*i][3*i+1] = dt;
+		A.d[3*i+1][3*i+2] = dt;
+		A.d[3*i][3*i+2] = 0.5*dt*dt;
+		B.d[3*i+2][i] = dt;
+		if(i>0) A.d[3*i+1][3*i-2] = 0.01*dt;
+	}
+	rc_identity_matrix(&Q,BIG_N);
+	rc_identity_matrix(&R,BIG_M);
+	if(rc_lqr_gain(A,B,Q,R,&ws,&K)){
+		fprintf(stderr,"rc_lqr_gain failed on 12 state system\n");
+		return -1;
+	}
+	rc_dare_solve(A,B,Q,R,&ws,&P);
+	printf("\n12 state system: %d iterations, relative residual: %g\n",\
+		ws.iterations, riccati_residual(A,B,Q,P,K));
+	t1 = rc_nanos_since_boot();
+	for(i=0;i<LOOPS;i++) rc_lqr_gain(A,B,Q,R,&ws,&K);
+	t2 = rc_nanos_since_boot();
+	printf("average 12 state rc_lqr_gain time: %lluus\n",\
+				(unsigned long long)((t2-t1)/LOOPS/1000));
+
+	rc_free_dare_workspace(&ws);
+	rc_free_matrix(&A);
+	rc_free_matrix(&B);
+	rc_free_matrix(&Q);
+	rc_free_matrix(&R);
+	rc_free_matrix(&P);
+	rc_free_matrix(&K);
+	printf("\nDONE\n");
+	return 0;
+}
@@ -0,0 +1,131 @@
+/*******************************************************************************
+* rc_test_spline.c
+*
+* Checks the tridiagonal and banded solvers against the dense solver, fits a
+* rest-to-rest spline through a few waypoints and prints the trajectory, then
+* times re-planning and batch evaluation of a long trajectory.
+*******************************************************************************/
+
+#include "../../libraries/rc_usefulincludes.h"
+#include "../../libraries/redperipherallib.h"
+
+#define DIM			8
+#define LONG_N		1000
+#define SAMPLES		10000
+#define LOOPS		100
+
+int main(){
+	int i, j;
+	float err_tri, err_band, err_ws;
+	float pos, vel, acc;
+	uint64_t t1, t2;
+	rc_vector_t a = rc_empty_vector();
+	rc_vector_t b = rc_empty_vector();
+	rc_vector_t c = rc_empty_vector();
+	rc_vector_t d = rc_empty_vector();
+	rc_vector_t x = rc_empty_vector();
+	rc_vector_t x_tri = rc_empty_vector();
+	rc_vector_t x_band = rc_empty_vector();
+	rc_matrix_t A = rc_empty_matrix();
+	rc_matrix_t Ab = rc_empty_matrix();
+	rc_vector_t t = rc_empty_vector();
+	rc_vector_t y = rc_empty_vector();
+	rc_vector_t ts = rc_empty_vector();
+	rc_vector_t ps = rc_empty_vector();
+	rc_vector_t vs = rc_empty_vector();
+	rc_spline_t s = rc_empty_spline();
+
+	// random diagonally dominant tridiagonal system solved three ways
+	rc_random_vector(&a,DIM);
+	rc_random_vector(&b,DIM);
+	rc_random_vector(&c,DIM);
+	rc_random_vector(&d,DIM);
+	for(i=0;i<DIM;i++) b.d[i] += 3.0f;
+	rc_matrix_zeros(&A,DIM,DIM);
+	rc_matrix_zeros(&Ab,DIM,3);
+	for(i=0;i<DIM;i++){
+		A.d[i][i] = b.d[i];
+		Ab.d[i][1] = b.d[i];
+		if(i>0){
+			A.d[i][i-1] = a.d[i];
+			Ab.d[i][0] = a.d[i];
+		}
+		if(i<DIM-1){
+			A.d[i][i+1] = c.d[i];
+			Ab.d[i][2] = c.d[i];
+		}
+	}
+	rc_lin_system_solve(A,d,&x);
+	rc_tridiag_solve(a,b,c,d,&x_tri);
+	rc_banded_solve(Ab,1,1,d,&x_band);
+	err_tri = 0.0f;
+	err_band = 0.0f;
+	for(i=0;i<DIM;i++){
+		err_tri += fabs(x_tri.d[i]-x.d[i]);
+		err_band += fabs(x_band.d[i]-x.d[i]);
+	}
+	printf("\nsolution from rc_lin_system_solve:\n");
+	rc_print_vector(x);
+	printf("difference with rc_tridiag_solve: %g\n", err_tri);
+	printf("difference with rc_banded_solve:  %g\n", err_band);
+
+	// factor the band in place and solve into d, nothing is allocated
+	rc_banded_solve_ws(Ab,1,1,d,&Ab,&d);
+	err_ws = 0.0f;
+	for(i=0;i<DIM;i++) err_ws += fabs(d.d[i]-x.d[i]);
+	printf("difference with rc_banded_solve_ws: %g\n", err_ws);
+
+	// rest-to-rest trajectory through 4 waypoints
+	rc_vector_zeros(&t,4);
+	rc_vector_zeros(&y,4);
+	t.d[1] = 1.0f;	y.d[1] = 1.0f;
+	t.d[2] = 2.0f;	y.d[2] = 0.0f;
+	t.d[3] = 4.0f;	y.d[3] = 2.0f;
+	if(rc_spline_fit(&s,t,y,RC_SPLINE_CLAMPED,0.0f,0.0f)){
+		fprintf(stderr,"rc_spline_fit failed\n");
+		return -1;
+	}
+	printf("\nclamped spline through (0,0) (1,1) (2,0) (4,2):\n");
+	printf("   time      pos      vel      acc\n");
+	for(i=0;i<=9;i++){
+		rc_spline_eval(&s,0.5f*i,&pos,&vel,&acc);
+		printf("%7.2f  %7.3f  %7.3f  %7.3f\n", 0.5f*i, pos, vel, acc);
+	}
+
+	// long trajectory, time re-planning and batch evaluation
+	rc_vector_zeros(&t,LONG_N);
+	rc_random_vector(&y,LONG_N);
+	for(i=1;i<LONG_N;i++) t.d[i] = t.d[i-1] + 0.5f + 0.25f*rc_get_random_float();
+	rc_alloc_vector(&ts,SAMPLES);
+	for(i=0;i<SAMPLES;i++) ts.d[i] = t.d[LONG_N-1]*i/SAMPLES;
+	rc_spline_fit(&s,t,y,RC_SPLINE_NATURAL,0.0f,0.0f);
+	t1 = rc_nanos_since_boot();
+	for(j=0;j<LOOPS;j++) rc_spline_fit(&s,t,y,RC_SPLINE_NATURAL,0.0f,0.0f);
+	t2 = rc_nanos_since_boot();
+	printf("\naverage time to re-plan %d waypoints: %lluus\n", LONG_N,\
+				(unsigned long long)((t2-t1)/LOOPS/1000));
+	rc_spline_eval_batch(&s,ts,&ps,&vs,NULL);
+	t1 = rc_nanos_since_boot();
+	for(j=0;j<LOOPS;j++) rc_spline_eval_batch(&s,ts,&ps,&vs,NULL);
+	t2 = rc_nanos_since_boot();
+	printf("average time per sample in batch evaluation: %lluns\n",\
+				(unsigned long long)((t2-t1)/LOOPS/SAMPLES));
+
+	rc_free_spline(&s);
+	rc_free_vector(&a);
+	rc_free_vector(&b);
+	rc_free_vector(&c);
+	rc_free_vector(&d);
+	rc_free_vector(&x);
+	rc_free_vector(&x_tri);
+	rc_free_vector(&x_band);
+	rc_free_matrix(&A);
+	rc_free_matrix(&Ab);
+	rc_free_vector(&t);
+	rc_free_vector(&y);
+	rc_free_vector(&ts);
+	rc_free_vector(&ps);
+	rc_free_vector(&vs);
+	printf("\nDONE\n");
+	return 0;
+}
@@ -0,0 +1,340 @@
+/*******************************************************************************
+* rc_gpio_event.c
+*
+* Event sources for interrupt-driven threads. A GPIO edge can be received
+* through the Linux GPIO character device, which timestamps the edge in the
+* kernel's interrupt handler, or through the older sysfs value file where the
+* best we can do is timestamp after poll() returns. An eventfd or pipe can
+* stand in for the GPIO so interrupt handling code can be tested and
+* benchmarked without hardware. All timestamps are nanoseconds since epoch to
+* match rc_nanos_since_epoch().
+*******************************************************************************/
+
+#include "../redperipherallib.h"
+#include "../preprocessor_macros.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+#define SYSFS_GPIO_DIR "/sys/class/gpio"
+#define MAX_BUF 64
+
+/*******************************************************************************
+* uint64_t kernel_to_epoch_nanos(uint64_t t)
+*
+* GPIO chardev events are stamped with CLOCK_REALTIME on older kernels and
+* CLOCK_MONOTONIC on newer ones. Whichever clock the stamp is closest to right
+* now is the one it came from, monotonic stamps get shifted to epoch time.
+*******************************************************************************/
+static uint64_t kernel_to_epoch_nanos(uint64_t t){
+	struct timespec ts;
+	uint64_t real, mono;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	real = ((uint64_t)ts.tv_sec*1000000000)+ts.tv_nsec;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	mono = ((uint64_t)ts.tv_sec*1000000000)+ts.tv_nsec;
+	if(t<=mono || t-mono<real-t) return t + (real-mono);
+	return t;
+}
+
+/*******************************************************************************
+* int read_sysfs_line(const char* dir, const char* file, char* buf, int len)
+*
+* Reads the first line of dir/file into buf without the newline.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+static int read_sysfs_line(const char* dir, const char* file, char* buf, int len){
+	char path[PATH_MAX];
+	FILE* f;
+	snprintf(path, sizeof(path), "%s/%s/%s", SYSFS_GPIO_DIR, dir, file);
+	f = fopen(path, "r");
+	if(f==NULL) return -1;
+	if(fgets(buf, len, f)==NULL){
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	buf[strcspn(buf, "\n")] = 0;
+	return 0;
+}
+
+/*******************************************************************************
+* int open_gpio_chip(unsigned int gpio, unsigned int* offset)
+*
+* Finds the character device for a gpio by its global number. Chip numbers and
+* bases aren't tied to each other, so the sysfs gpio class is searched for the
+* chip whose base and ngpio cover the gpio, then the /dev/gpiochip device with
+* the same label and number of lines is opened. offset is set to the gpio's
+* line on that chip. Returns the open chip fd or -1 if it can't be found.
+*******************************************************************************/
+static int open_gpio_chip(unsigned int gpio, unsigned int* offset){
+	char buf[PATH_MAX], label[sizeof(((struct gpiochip_info*)0)->label)];
+	struct gpiochip_info info;
+	struct dirent* ent;
+	unsigned int base, ngpio = 0;
+	DIR* dir;
+	int fd = -1;
+
+	dir = opendir(SYSFS_GPIO_DIR);
+	if(dir==NULL) return -1;
+	while((ent=readdir(dir))!=NULL){
+		if(strncmp(ent->d_name, "gpiochip", 8)) continue;
+		if(read_sysfs_line(ent->d_name, "base", buf, sizeof(buf))) continue;
+		base = strtoul(buf, NULL, 10);
+		if(read_sysfs_line(ent->d_name, "ngpio", buf, sizeof(buf))) continue;
+		ngpio = strtoul(buf, NULL, 10);
+		if(gpio<base || gpio>=base+ngpio) continue;
+		if(read_sysfs_line(ent->d_name, "label", label, sizeof(label))) continue;
+		*offset = gpio-base;
+		break;
+	}
+	closedir(dir);
+	if(ent==NULL) return -1;
+
+	dir = opendir("/dev");
+	if(dir==NULL) return -1;
+	while((ent=readdir(dir))!=NULL){
+		if(strncmp(ent->d_name, "gpiochip", 8)) continue;
+		snprintf(buf, sizeof(buf), "/dev/%s", ent->d_name);
+		fd = open(buf, O_RDONLY);
+		if(fd<0) continue;
+		if(ioctl(fd, GPIO_GET_CHIPINFO_IOCTL, &info)==0 && info.lines==ngpio &&\
+							!strncmp(info.label, label, sizeof(info.label))){
+			break;
+		}
+		close(fd);
+		fd = -1;
+	}
+	closedir(dir);
+	return fd;
+}
+
+/*******************************************************************************
+* int open_chardev_line(unsigned int gpio, rc_pin_edge_t edge)
+*
+* Requests edge events for a gpio through the character device. If the line is
+* busy because it's exported through sysfs, unexport it and try once more.
+* Returns the line event fd or -1 on failure.
+*******************************************************************************/
+static int open_chardev_line(unsigned int gpio, rc_pin_edge_t edge){
+	int chip_fd, ret;
+	unsigned int offset;
+	struct gpioevent_request req;
+
+	chip_fd = open_gpio_chip(gpio, &offset);
+	if(chip_fd<0) return -1;
+
+	memset(&req, 0, sizeof(req));
+	req.lineoffset = offset;
+	req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+	switch(edge){
+	case EDGE_RISING:
+		req.eventflags = GPIOEVENT_REQUEST_RISING_EDGE;
+		break;
+	case EDGE_FALLING:
+		req.eventflags = GPIOEVENT_REQUEST_FALLING_EDGE;
+		break;
+	case EDGE_BOTH:
+		req.eventflags = GPIOEVENT_REQUEST_BOTH_EDGES;
+		break;
+	default:
+		close(chip_fd);
+		return -1;
+	}
+	strncpy(req.consumer_label, "redperipherallib", sizeof(req.consumer_label)-1);
+
+	ret = ioctl(chip_fd, GPIO_GET_LINEEVENT_IOCTL, &req);
+	if(ret<0 && errno==EBUSY){
+		rc_gpio_unexport(gpio);
+		ret = ioctl(chip_fd, GPIO_GET_LINEEVENT_IOCTL, &req);
+	}
+	close(chip_fd);
+	if(ret<0) return -1;
+	return req.fd;
+}
+
+/*******************************************************************************
+* int rc_event_source_open_gpio(rc_event_source_t* src, unsigned int gpio,
+*									rc_pin_edge_t edge, rc_event_source_type_t type)
+*
+* Opens a gpio as an event source. type may be EVENT_SOURCE_GPIO_CHARDEV,
+* EVENT_SOURCE_GPIO_SYSFS, or EVENT_SOURCE_AUTO to try the character device
+* first and fall back to sysfs. Check src->type afterwards to see which one
+* was used. Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_event_source_open_gpio(rc_event_source_t* src, unsigned int gpio,\
+							rc_pin_edge_t edge, rc_event_source_type_t type){
+	int fd;
+	if(unlikely(src==NULL)){
+		fprintf(stderr,"ERROR in rc_event_source_open_gpio, received NULL pointer\n");
+		return -1;
+	}
+	if(unlikely(type!=EVENT_SOURCE_AUTO && type!=EVENT_SOURCE_GPIO_CHARDEV &&\
+								type!=EVENT_SOURCE_GPIO_SYSFS)){
+		fprintf(stderr,"ERROR in rc_event_source_open_gpio, invalid type\n");
+		return -1;
+	}
+	src->initialized = 0;
+	src->gpio = gpio;
+	// character device first
+	if(type!=EVENT_SOURCE_GPIO_SYSFS){
+		fd = open_chardev_line(gpio, edge);
+		if(fd>=0){
+			src->fd = fd;
+			src->type = EVENT_SOURCE_GPIO_CHARDEV;
+			src->initialized = 1;
+			return 0;
+		}
+		if(type==EVENT_SOURCE_GPIO_CHARDEV){
+			fprintf(stderr,"ERROR in rc_event_source_open_gpio, can't request line events for gpio %d\n", gpio);
+			return -1;
+		}
+	}
+	// sysfs fallback
+	if(rc_gpio_export(gpio)<0 || rc_gpio_set_dir(gpio, INPUT_PIN)<0 ||\
+								rc_gpio_set_edge(gpio, edge)<0){
+		fprintf(stderr,"ERROR in rc_event_source_open_gpio, failed to configure gpio %d\n", gpio);
+		return -1;
+	}
+	fd = rc_gpio_fd_open(gpio);
+	if(fd<0){
+		fprintf(stderr,"ERROR in rc_event_source_open_gpio, failed to open gpio %d\n", gpio);
+		return -1;
+	}
+	src->fd = fd;
+	src->type = EVENT_SOURCE_GPIO_SYSFS;
+	src->initialized = 1;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_event_source_open_fd(rc_event_source_t* src, int fd,
+*												rc_event_source_type_t type)
+*
+* Wraps an existing file descriptor as an event source. With EVENT_SOURCE_EVENTFD
+* fd is an eventfd, each write signals an event and it is timestamped when the
+* waiting thread wakes up. With EVENT_SOURCE_PIPE fd is the read end of a pipe
+* and each event is one uint64_t written to the pipe holding the event time in
+* nanoseconds since epoch, or 0 to timestamp on wakeup. The fd is not closed by
+* rc_event_source_close. Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_event_source_open_fd(rc_event_source_t* src, int fd,\
+											rc_event_source_type_t type){
+	if(unlikely(src==NULL)){
+		fprintf(stderr,"ERROR in rc_event_source_open_fd, received NULL pointer\n");
+		return -1;
+	}
+	if(unlikely(fd<0)){
+		fprintf(stderr,"ERROR in rc_event_source_open_fd, invalid file descriptor\n");
+		return -1;
+	}
+	if(unlikely(type!=EVENT_SOURCE_EVENTFD && type!=EVENT_SOURCE_PIPE)){
+		fprintf(stderr,"ERROR in rc_event_source_open_fd, type must be EVENT_SOURCE_EVENTFD or EVENT_SOURCE_PIPE\n");
+		return -1;
+	}
+	src->fd = fd;
+	src->gpio = -1;
+	src->type = type;
+	src->initialized = 1;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_event_source_wait(rc_event_source_t* src, int timeout_ms,
+*														uint64_t* timestamp)
+*
+* Blocks until an event arrives or timeout_ms passes, -1 waits forever. If
+* several events queued up while the caller was busy they are all consumed and
+* the timestamp of the newest one is written to timestamp. Returns the number
+* of events consumed, 0 on timeout, or -1 on error.
+*******************************************************************************/
+int rc_event_source_wait(rc_event_source_t* src, int timeout_ms, uint64_t* timestamp){
+	struct pollfd fdset[1];
+	struct gpioevent_data ev[16];
+	uint64_t val;
+	char buf[MAX_BUF];
+	int ret, i, n;
+
+	if(unlikely(src==NULL || timestamp==NULL)){
+		fprintf(stderr,"ERROR in rc_event_source_wait, received NULL pointer\n");
+		return -1;
+	}
+	if(unlikely(!src->initialized)){
+		fprintf(stderr,"ERROR in rc_event_source_wait, source not initialized\n");
+		return -1;
+	}
+	fdset[0].fd = src->fd;
+	if(src->type==EVENT_SOURCE_GPIO_SYSFS) fdset[0].events = POLLPRI;
+	else fdset[0].events = POLLIN;
+	ret = poll(fdset, 1, timeout_ms);
+	if(ret<0){
+		if(errno==EINTR) return 0;
+		return -1;
+	}
+	if(ret==0) return 0;
+
+	switch(src->type){
+	case EVENT_SOURCE_GPIO_CHARDEV:
+		// the kernel queues every edge, take them all
+		ret = read(src->fd, ev, sizeof(ev));
+		n = ret/(int)sizeof(ev[0]);
+		if(n<=0) return -1;
+		*timestamp = kernel_to_epoch_nanos(ev[n-1].timestamp);
+		return n;
+	case EVENT_SOURCE_GPIO_SYSFS:
+		if(!(fdset[0].revents & POLLPRI)) return 0;
+		*timestamp = rc_nanos_since_epoch();
+		lseek(src->fd, 0, SEEK_SET);
+		if(read(src->fd, buf, MAX_BUF)<0) return -1;
+		return 1;
+	case EVENT_SOURCE_EVENTFD:
+		*timestamp = rc_nanos_since_epoch();
+		if(read(src->fd, &val, sizeof(val))!=sizeof(val)) return -1;
+		return (int)val;
+	case EVENT_SOURCE_PIPE:
+		// drain whatever is there without blocking again
+		n = 0;
+		do{
+			if(read(src->fd, &val, sizeof(val))!=sizeof(val)) break;
+			n++;
+			*timestamp = val ? val : rc_nanos_since_epoch();
+			fdset[0].revents = 0;
+			i = poll(fdset, 1, 0);
+		}while(i>0 && (fdset[0].revents & POLLIN));
+		if(n==0) return -1;
+		return n;
+	default:
+		fprintf(stderr,"ERROR in rc_event_source_wait, invalid source type\n");
+		return -1;
+	}
+}
+
+/*******************************************************************************
+* int rc_event_source_close(rc_event_source_t* src)
+*
+* Closes file descriptors opened by rc_event_source_open_gpio. Descriptors
+* handed to rc_event_source_open_fd are left for the caller to close.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_event_source_close(rc_event_source_t* src){
+	if(unlikely(src==NULL)){
+		fprintf(stderr,"ERROR in rc_event_source_close, received NULL pointer\n");
+		return -1;
+	}
+	if(!src->initialized) return 0;
+	if(src->type==EVENT_SOURCE_GPIO_CHARDEV || src->type==EVENT_SOURCE_GPIO_SYSFS){
+		close(src->fd);
+	}
+	src->fd = -1;
+	src->initialized = 0;
+	return 0;
+}
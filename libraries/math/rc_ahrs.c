@@ -0,0 +1,462 @@
+/*******************************************************************************
+* rc_ahrs.c
+*
+* Attitude and heading reference system running on raw gyro, accel and
+* optionally magnetometer samples at any rate. Three algorithms are available:
+* Mahony's nonlinear complementary filter, Madgwick's gradient descent filter,
+* and a 7-state extended Kalman filter estimating the quaternion and gyro
+* bias. All state lives in the fixed-size rc_ahrs_t struct so updates never
+* touch the heap. The EKF applies its measurements one scalar at a time so
+* no matrix inversion is needed.
+*
+* The quaternion rotates body to world coordinates where the world frame has
+* Z up, so a level IMU reads +g on the accel Z axis, and X is magnetic north
+* when the magnetometer is used. Inputs use the same units as rc_imu_data_t.
+*******************************************************************************/
+
+#include "../redperipherallib.h"
+#include "../preprocessor_macros.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define DEG_TO_RAD		0.0174532925199
+#define GRAVITY			9.80665f
+#define AHRS_STATES		7
+#define EKF_MIN_VAR		1e-12f	// floor on the EKF covariance diagonal
+
+/*******************************************************************************
+* rc_ahrs_t rc_empty_ahrs()
+*
+* Returns an rc_ahrs_t struct which is completely zero'd out. It should be
+* initialized with rc_init_ahrs before use.
+*******************************************************************************/
+rc_ahrs_t rc_empty_ahrs(){
+	rc_ahrs_t out;
+	memset(&out, 0, sizeof(out));
+	out.q[0] = 1.0f;
+	return out;
+}
+
+/*******************************************************************************
+* int rc_init_ahrs(rc_ahrs_t* a, rc_ahrs_algorithm_t algorithm, float dt)
+*
+* Sets up an AHRS with the chosen algorithm to be updated every dt seconds.
+* Tuning parameters are set to reasonable defaults and may be changed in the
+* struct afterwards. Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_init_ahrs(rc_ahrs_t* a, rc_ahrs_algorithm_t algorithm, float dt){
+	if(unlikely(a==NULL)){
+		fprintf(stderr,"ERROR in rc_init_ahrs, received NULL pointer\n");
+		return -1;
+	}
+	if(unlikely(algorithm!=RC_AHRS_MAHONY && algorithm!=RC_AHRS_MADGWICK &&\
+												algorithm!=RC_AHRS_EKF)){
+		fprintf(stderr,"ERROR in rc_init_ahrs, invalid algorithm\n");
+		return -1;
+	}
+	if(unlikely(dt<=0.0f)){
+		fprintf(stderr,"ERROR in rc_init_ahrs, dt must be positive\n");
+		return -1;
+	}
+	*a = rc_empty_ahrs();
+	a->algorithm = algorithm;
+	a->dt = dt;
+	a->kp = 0.5f;
+	a->ki = 0.0f;
+	a->beta = 0.1f;
+	a->gyro_noise = 0.01f;
+	a->gyro_bias_noise = 0.0005f;
+	a->accel_noise = 0.05f;
+	a->mag_noise = 0.1f;
+	a->accel_gate = 0.2f;
+	a->initialized = 1;
+	rc_reset_ahrs(a);
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_reset_ahrs(rc_ahrs_t* a)
+*
+* Forgets the current estimate, keeping the algorithm and tuning. The next
+* update with a valid accel sample will set the initial attitude.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_reset_ahrs(rc_ahrs_t* a){
+	int i;
+	if(unlikely(a==NULL || !a->initialized)){
+		fprintf(stderr,"ERROR in rc_reset_ahrs, ahrs not initialized\n");
+		return -1;
+	}
+	a->q[0] = 1.0f;
+	a->q[1] = a->q[2] = a->q[3] = 0.0f;
+	a->bias[0] = a->bias[1] = a->bias[2] = 0.0f;
+	a->tb[0] = a->tb[1] = a->tb[2] = 0.0f;
+	memset(a->P, 0, sizeof(a->P));
+	for(i=0;i<4;i++) a->P[i][i] = 0.01f;
+	for(i=4;i<AHRS_STATES;i++) a->P[i][i] = 0.01f;
+	a->updates = 0;
+	a->aligned = 0;
+	return 0;
+}
+
+/*******************************************************************************
+* static void align(rc_ahrs_t* a, float* acc, float* mag)
+*
+* Sets the attitude directly from one accel sample, and the heading from a
+* tilt compensated magnetometer sample if there is one.
+*******************************************************************************/
+static void align(rc_ahrs_t* a, float* acc, float* mag){
+	float tb[3], mxh, myh;
+	tb[0] = atan2f(acc[1], acc[2]);
+	tb[1] = atan2f(-acc[0], sqrtf(acc[1]*acc[1]+acc[2]*acc[2]));
+	tb[2] = 0.0f;
+	if(mag!=NULL){
+		mxh = mag[0]*cosf(tb[1]) + (mag[1]*sinf(tb[0]) + mag[2]*cosf(tb[0]))*sinf(tb[1]);
+		myh = mag[1]*cosf(tb[0]) - mag[2]*sinf(tb[0]);
+		tb[2] = atan2f(-myh, mxh);
+	}
+	rc_tb_to_quaternion_array(tb, a->q);
+	a->aligned = 1;
+	return;
+}
+
+/*******************************************************************************
+* static void integrate(float q[4], float g[3], float dt)
+*
+* First order quaternion integration of body rates g in rad/s.
+*******************************************************************************/
+static inline void integrate(float q[4], float g[3], float dt){
+	float h = 0.5f*dt;
+	float q0=q[0], q1=q[1], q2=q[2], q3=q[3];
+	q[0] += h*(-q1*g[0] - q2*g[1] - q3*g[2]);
+	q[1] += h*( q0*g[0] + q2*g[2] - q3*g[1]);
+	q[2] += h*( q0*g[1] - q1*g[2] + q3*g[0]);
+	q[3] += h*( q0*g[2] + q1*g[1] - q2*g[0]);
+	return;
+}
+
+/*******************************************************************************
+* static void mag_reference(float q[4], float m[3], float* bx, float* bz)
+*
+* Rotates the normalized magnetometer vector into the world frame with the
+* current estimate and keeps only its horizontal magnitude and vertical part
+* so the reference field always points north.
+*******************************************************************************/
+static inline void mag_reference(float q[4], float m[3], float* bx, float* bz){
+	float q0=q[0], q1=q[1], q2=q[2], q3=q[3];
+	float hx, hy;
+	hx = 2.0f*(m[0]*(0.5f-q2*q2-q3*q3) + m[1]*(q1*q2-q0*q3) + m[2]*(q1*q3+q0*q2));
+	hy = 2.0f*(m[0]*(q1*q2+q0*q3) + m[1]*(0.5f-q1*q1-q3*q3) + m[2]*(q2*q3-q0*q1));
+	*bz = 2.0f*(m[0]*(q1*q3-q0*q2) + m[1]*(q2*q3+q0*q1) + m[2]*(0.5f-q1*q1-q2*q2));
+	*bx = sqrtf(hx*hx+hy*hy);
+	return;
+}
+
+/*******************************************************************************
+* static void mahony_update(rc_ahrs_t* a, float g[3], float* acc, float* mag)
+*
+* Corrects the gyro rates with the cross product between measured and
+* estimated gravity and magnetic field directions, PI feedback with gains
+* kp and ki. The integral term is kept as the gyro bias estimate.
+*******************************************************************************/
+static void mahony_update(rc_ahrs_t* a, float g[3], float* acc, float* mag){
+	float q0=a->q[0], q1=a->q[1], q2=a->q[2], q3=a->q[3];
+	float vx, vy, vz, wx, wy, wz, bx, bz;
+	float e[3] = {0.0f, 0.0f, 0.0f};
+	int i;
+	if(acc!=NULL){
+		// estimated direction of gravity, halved
+		vx = q1*q3 - q0*q2;
+		vy = q0*q1 + q2*q3;
+		vz = q0*q0 - 0.5f + q3*q3;
+		e[0] = acc[1]*vz - acc[2]*vy;
+		e[1] = acc[2]*vx - acc[0]*vz;
+		e[2] = acc[0]*vy - acc[1]*vx;
+		if(mag!=NULL){
+			mag_reference(a->q, mag, &bx, &bz);
+			// estimated direction of the magnetic field, halved
+			wx = bx*(0.5f-q2*q2-q3*q3) + bz*(q1*q3-q0*q2);
+			wy = bx*(q1*q2-q0*q3) + bz*(q0*q1+q2*q3);
+			wz = bx*(q0*q2+q1*q3) + bz*(0.5f-q1*q1-q2*q2);
+			e[0] += mag[1]*wz - mag[2]*wy;
+			e[1] += mag[2]*wx - mag[0]*wz;
+			e[2] += mag[0]*wy - mag[1]*wx;
+		}
+		for(i=0;i<3;i++){
+			if(a->ki>0.0f) a->bias[i] -= 2.0f*a->ki*e[i]*a->dt;
+			g[i] += 2.0f*a->kp*e[i];
+		}
+	}
+	for(i=0;i<3;i++) g[i] -= a->bias[i];
+	integrate(a->q, g, a->dt);
+	return;
+}
+
+/*******************************************************************************
+* static void madgwick_update(rc_ahrs_t* a, float g[3], float* acc, float* mag)
+*
+* Integrates the gyro rates minus a step of size beta along the normalized
+* gradient of the gravity and magnetic field direction errors.
+*******************************************************************************/
+static void madgwick_update(rc_ahrs_t* a, float g[3], float* acc, float* mag){
+	float q0=a->q[0], q1=a->q[1], q2=a->q[2], q3=a->q[3];
+	float s0, s1, s2, s3, f0, f1, f2, norm, bx, bz;
+	float qdot[4];
+	// rate of change from the gyro
+	qdot[0] = 0.5f*(-q1*g[0] - q2*g[1] - q3*g[2]);
+	qdot[1] = 0.5f*( q0*g[0] + q2*g[2] - q3*g[1]);
+	qdot[2] = 0.5f*( q0*g[1] - q1*g[2] + q3*g[0]);
+	qdot[3] = 0.5f*( q0*g[2] + q1*g[1] - q2*g[0]);
+	if(acc!=NULL){
+		// gravity objective function and its gradient J'f
+		f0 = 2.0f*(q1*q3 - q0*q2) - acc[0];
+		f1 = 2.0f*(q0*q1 + q2*q3) - acc[1];
+		f2 = 2.0f*(0.5f - q1*q1 - q2*q2) - acc[2];
+		s0 = -2.0f*q2*f0 + 2.0f*q1*f1;
+		s1 =  2.0f*q3*f0 + 2.0f*q0*f1 - 4.0f*q1*f2;
+		s2 = -2.0f*q0*f0 + 2.0f*q3*f1 - 4.0f*q2*f2;
+		s3 =  2.0f*q1*f0 + 2.0f*q2*f1;
+		if(mag!=NULL){
+			mag_reference(a->q, mag, &bx, &bz);
+			f0 = 2.0f*bx*(0.5f-q2*q2-q3*q3) + 2.0f*bz*(q1*q3-q0*q2) - mag[0];
+			f1 = 2.0f*bx*(q1*q2-q0*q3) + 2.0f*bz*(q0*q1+q2*q3) - mag[1];
+			f2 = 2.0f*bx*(q0*q2+q1*q3) + 2.0f*bz*(0.5f-q1*q1-q2*q2) - mag[2];
+			s0 += -2.0f*bz*q2*f0 + (-2.0f*bx*q3+2.0f*bz*q1)*f1 + 2.0f*bx*q2*f2;
+			s1 +=  2.0f*bz*q3*f0 + (2.0f*bx*q2+2.0f*bz*q0)*f1 +\
+											(2.0f*bx*q3-4.0f*bz*q1)*f2;
+			s2 += (-4.0f*bx*q2-2.0f*bz*q0)*f0 + (2.0f*bx*q1+2.0f*bz*q3)*f1 +\
+											(2.0f*bx*q0-4.0f*bz*q2)*f2;
+			s3 += (-4.0f*bx*q3+2.0f*bz*q1)*f0 + (-2.0f*bx*q0+2.0f*bz*q2)*f1 +\
+											2.0f*bx*q1*f2;
+		}
+		norm = sqrtf(s0*s0 + s1*s1 + s2*s2 + s3*s3);
+		if(norm>0.0f){
+			norm = a->beta/norm;
+			qdot[0] -= norm*s0;
+			qdot[1] -= norm*s1;
+			qdot[2] -= norm*s2;
+			qdot[3] -= norm*s3;
+		}
+	}
+	a->q[0] += qdot[0]*a->dt;
+	a->q[1] += qdot[1]*a->dt;
+	a->q[2] += qdot[2]*a->dt;
+	a->q[3] += qdot[3]*a->dt;
+	return;
+}
+
+/*******************************************************************************
+* static void ekf_measure(rc_ahrs_t* a, float H[4], float z, float h, float r)
+*
+* Scalar Kalman update with measurement z, prediction h, noise variance r and
+* a measurement Jacobian which only depends on the quaternion states.
+*******************************************************************************/
+static inline void ekf_measure(rc_ahrs_t* a, float H[4], float z, float h, float r){
+	float PHt[AHRS_STATES], K[AHRS_STATES], S, innov;
+	int i, j;
+	for(i=0;i<AHRS_STATES;i++){
+		PHt[i] = a->P[i][0]*H[0] + a->P[i][1]*H[1] + a->P[i][2]*H[2] + a->P[i][3]*H[3];
+	}
+	S = H[0]*PHt[0] + H[1]*PHt[1] + H[2]*PHt[2] + H[3]*PHt[3] + r;
+	if(S<=0.0f) return;
+	innov = z-h;
+	for(i=0;i<AHRS_STATES;i++) K[i] = PHt[i]/S;
+	for(i=0;i<4;i++) a->q[i] += K[i]*innov;
+	for(i=0;i<3;i++) a->bias[i] += K[i+4]*innov;
+	for(i=0;i<AHRS_STATES;i++){
+		for(j=0;j<AHRS_STATES;j++) a->P[i][j] -= K[i]*PHt[j];
+	}
+	return;
+}
+
+/*******************************************************************************
+* static void ekf_condition(rc_ahrs_t* a)
+*
+* Single precision covariance updates slowly lose symmetry and positive
+* definiteness, most of all with yaw unobservable when there's no mag. Keep P
+* symmetric with a small positive floor on the diagonal and correlations no
+* larger than 1. Quaternion components can't exceed 1 so neither can their
+* variance, which stops unobservable yaw from growing without bound.
+*******************************************************************************/
+static inline void ekf_condition(rc_ahrs_t* a){
+	int i, j;
+	float m;
+	for(i=0;i<AHRS_STATES;i++){
+		if(a->P[i][i]<EKF_MIN_VAR) a->P[i][i] = EKF_MIN_VAR;
+		if(i<4 && a->P[i][i]>1.0f) a->P[i][i] = 1.0f;
+	}
+	for(i=0;i<AHRS_STATES;i++){
+		for(j=i+1;j<AHRS_STATES;j++){
+			m = 0.5f*(a->P[i][j]+a->P[j][i]);
+			if(fabsf(m)>sqrtf(a->P[i][i]*a->P[j][j])){
+				m = copysignf(sqrtf(a->P[i][i]*a->P[j][j]), m);
+			}
+			a->P[i][j] = m;
+			a->P[j][i] = m;
+		}
+	}
+	return;
+}
+
+/*******************************************************************************
+* static void ekf_update(rc_ahrs_t* a, float g[3], float* acc, float* mag)
+*
+* Predicts the quaternion and covariance forward with the bias corrected gyro
+* rates then corrects with the gravity and magnetic field directions.
+*******************************************************************************/
+static void ekf_update(rc_ahrs_t* a, float g[3], float* acc, float* mag){
+	float F[AHRS_STATES][AHRS_STATES], FP[AHRS_STATES][AHRS_STATES];
+	float G[4][3], H[4], w[3], h, bx, bz, qn, qb, rg;
+	float q0, q1, q2, q3;
+	int i, j, k;
+
+	// predict
+	q0=a->q[0]; q1=a->q[1]; q2=a->q[2]; q3=a->q[3];
+	for(i=0;i<3;i++) w[i] = g[i]-a->bias[i];
+	h = 0.5f*a->dt;
+	memset(F, 0, sizeof(F));
+	for(i=0;i<AHRS_STATES;i++) F[i][i] = 1.0f;
+	F[0][1]=-h*w[0]; F[0][2]=-h*w[1]; F[0][3]=-h*w[2];
+	F[1][0]= h*w[0]; F[1][2]= h*w[2]; F[1][3]=-h*w[1];
+	F[2][0]= h*w[1]; F[2][1]=-h*w[2]; F[2][3]= h*w[0];
+	F[3][0]= h*w[2]; F[3][1]= h*w[1]; F[3][2]=-h*w[0];
+	// dq/dw, the bias enters with a minus sign
+	G[0][0]=-q1*h; G[0][1]=-q2*h; G[0][2]=-q3*h;
+	G[1][0]= q0*h; G[1][1]=-q3*h; G[1][2]= q2*h;
+	G[2][0]= q3*h; G[2][1]= q0*h; G[2][2]=-q1*h;
+	G[3][0]=-q2*h; G[3][1]= q1*h; G[3][2]= q0*h;
+	for(i=0;i<4;i++) for(j=0;j<3;j++) F[i][j+4] = -G[i][j];
+	integrate(a->q, w, a->dt);
+
+	// P = F P F' + Q
+	for(i=0;i<AHRS_STATES;i++){
+		for(j=0;j<AHRS_STATES;j++){
+			FP[i][j] = 0.0f;
+			for(k=0;k<AHRS_STATES;k++) FP[i][j] += F[i][k]*a->P[k][j];
+		}
+	}
+	for(i=0;i<AHRS_STATES;i++){
+		for(j=i;j<AHRS_STATES;j++){
+			h = 0.0f;
+			for(k=0;k<AHRS_STATES;k++) h += FP[i][k]*F[j][k];
+			a->P[i][j] = h;
+			a->P[j][i] = h;
+		}
+	}
+	qn = a->gyro_noise*a->gyro_noise;
+	for(i=0;i<4;i++){
+		for(j=0;j<4;j++){
+			a->P[i][j] += qn*(G[i][0]*G[j][0] + G[i][1]*G[j][1] + G[i][2]*G[j][2]);
+		}
+	}
+	qb = a->gyro_bias_noise*a->gyro_bias_noise*a->dt;
+	for(i=4;i<AHRS_STATES;i++) a->P[i][i] += qb;
+
+	if(acc==NULL){
+		ekf_condition(a);
+		return;
+	}
+	// gravity direction, one axis at a time
+	q0=a->q[0]; q1=a->q[1]; q2=a->q[2]; q3=a->q[3];
+	rg = a->accel_noise*a->accel_noise;
+	H[0]=-2.0f*q2; H[1]= 2.0f*q3; H[2]=-2.0f*q0; H[3]= 2.0f*q1;
+	ekf_measure(a, H, acc[0], 2.0f*(q1*q3-q0*q2), rg);
+	H[0]= 2.0f*q1; H[1]= 2.0f*q0; H[2]= 2.0f*q3; H[3]= 2.0f*q2;
+	ekf_measure(a, H, acc[1], 2.0f*(q0*q1+q2*q3), rg);
+	H[0]= 2.0f*q0; H[1]=-2.0f*q1; H[2]=-2.0f*q2; H[3]= 2.0f*q3;
+	ekf_measure(a, H, acc[2], q0*q0-q1*q1-q2*q2+q3*q3, rg);
+
+	if(mag==NULL){
+		ekf_condition(a);
+		return;
+	}
+	// magnetic field direction against a reference from the corrected estimate
+	mag_reference(a->q, mag, &bx, &bz);
+	q0=a->q[0]; q1=a->q[1]; q2=a->q[2]; q3=a->q[3];
+	rg = a->mag_noise*a->mag_noise;
+	H[0]=-2.0f*bz*q2;
+	H[1]= 2.0f*bz*q3;
+	H[2]=-4.0f*bx*q2 - 2.0f*bz*q0;
+	H[3]=-4.0f*bx*q3 + 2.0f*bz*q1;
+	ekf_measure(a, H, mag[0], 2.0f*bx*(0.5f-q2*q2-q3*q3) + 2.0f*bz*(q1*q3-q0*q2), rg);
+	H[0]=-2.0f*bx*q3 + 2.0f*bz*q1;
+	H[1]= 2.0f*bx*q2 + 2.0f*bz*q0;
+	H[2]= 2.0f*bx*q1 + 2.0f*bz*q3;
+	H[3]=-2.0f*bx*q0 + 2.0f*bz*q2;
+	ekf_measure(a, H, mag[1], 2.0f*bx*(q1*q2-q0*q3) + 2.0f*bz*(q0*q1+q2*q3), rg);
+	H[0]= 2.0f*bx*q2;
+	H[1]= 2.0f*bx*q3 - 4.0f*bz*q1;
+	H[2]= 2.0f*bx*q0 - 4.0f*bz*q2;
+	H[3]= 2.0f*bx*q1;
+	ekf_measure(a, H, mag[2], 2.0f*bx*(q0*q2+q1*q3) + 2.0f*bz*(0.5f-q1*q1-q2*q2), rg);
+	ekf_condition(a);
+	return;
+}
+
+/*******************************************************************************
+* int rc_march_ahrs(rc_ahrs_t* a, float gyro[3], float accel[3], float mag[3])
+*
+* Advances the estimate by one time step of a->dt seconds. gyro is in deg/s,
+* accel in m/s^2 and mag in any consistent unit such as uT. mag may be NULL to
+* only estimate roll and pitch, in which case yaw drifts with the gyro. accel
+* may also be NULL, or is ignored when its magnitude differs from gravity by
+* more than the accel_gate fraction, and then the gyro is just integrated.
+* Updates a->q and a->tb. Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_march_ahrs(rc_ahrs_t* a, float gyro[3], float accel[3], float mag[3]){
+	float g[3], acc[3], m[3], norm;
+	float* accp = NULL;
+	float* magp = NULL;
+	int i;
+	if(unlikely(a==NULL || !a->initialized)){
+		fprintf(stderr,"ERROR in rc_march_ahrs, ahrs not initialized\n");
+		return -1;
+	}
+	if(unlikely(gyro==NULL)){
+		fprintf(stderr,"ERROR in rc_march_ahrs, received NULL gyro pointer\n");
+		return -1;
+	}
+	for(i=0;i<3;i++) g[i] = gyro[i]*DEG_TO_RAD;
+	// normalize the reference vectors, ignoring any that can't be used
+	if(accel!=NULL){
+		norm = sqrtf(accel[0]*accel[0]+accel[1]*accel[1]+accel[2]*accel[2]);
+		if(norm>0.0f && (a->accel_gate<=0.0f ||\
+						fabsf(norm/GRAVITY-1.0f)<=a->accel_gate)){
+			for(i=0;i<3;i++) acc[i] = accel[i]/norm;
+			accp = acc;
+		}
+	}
+	if(mag!=NULL && accp!=NULL){
+		norm = sqrtf(mag[0]*mag[0]+mag[1]*mag[1]+mag[2]*mag[2]);
+		if(norm>0.0f){
+			for(i=0;i<3;i++) m[i] = mag[i]/norm;
+			magp = m;
+		}
+	}
+	// start from the measured attitude instead of converging from level
+	if(!a->aligned){
+		if(accp==NULL) return 0;
+		align(a, accp, magp);
+	}
+	else{
+		switch(a->algorithm){
+		case RC_AHRS_MAHONY:
+			mahony_update(a, g, accp, magp);
+			break;
+		case RC_AHRS_MADGWICK:
+			madgwick_update(a, g, accp, magp);
+			break;
+		case RC_AHRS_EKF:
+			ekf_update(a, g, accp, magp);
+			break;
+		default:
+			fprintf(stderr,"ERROR in rc_march_ahrs, invalid algorithm\n");
+			return -1;
+		}
+		rc_normalize_quaternion_array(a->q);
+	}
+	rc_quaternion_to_tb_array(a->q, a->tb);
+	a->updates++;
+	return 0;
+}
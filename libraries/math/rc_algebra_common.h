@@ -2,8 +2,16 @@
 * rc_algebra_common.h
 *
 * all things shared between rc_vector.c, rc_matrix.c, and rc_linear_algebra.c
+*
+* These modules, along with rc_polynomial.c, are written in terms of RC_REAL so
+* the same source also builds the double precision library. rc_algebra_double.c
+* defines RC_ALGEBRA_DOUBLE and includes them again, at which point every type
+* and function name is mapped to its _d twin by rc_algebra_double.h.
 *******************************************************************************/
 
+#ifndef RC_ALGEBRA_COMMON_H
+#define RC_ALGEBRA_COMMON_H
+
 #include "../redperipherallib.h"
 #include "../preprocessor_macros.h"
 #include <stdio.h>	// for fprintf
@@ -13,9 +21,22 @@
 #include <string.h>	// for memcpy
 
 #define ZERO_TOLERANCE 1e-6 // consider v to be zero if fabs(v)<ZERO_TOLERANCE
+#define BORROWED_MEMORY 2	// initialized flag for views of user memory
+
+#ifdef RC_ALGEBRA_DOUBLE
+#include "rc_algebra_double.h"
+#define RC_REAL		double
+#define RC_REAL_MAX	DBL_MAX
+#define RC_RANDOM	rc_get_random_double
+#else
+#define RC_REAL		float
+#define RC_REAL_MAX	FLT_MAX
+#define RC_RANDOM	rc_get_random_float
+#endif
 
 /*******************************************************************************
-* float rc_mult_accumulate(float * __restrict__ a, float * __restrict__ b, int n)
+* RC_REAL rc_mult_accumulate(RC_REAL * __restrict__ a,
+*							RC_REAL * __restrict__ b, int n)
 * 
 * Performs a vector dot product on the contents of a and b over n values.
 * This is a dangerous function that could segfault if not used properly. Hence
@@ -23,5 +44,34 @@
 * the C compiler that the pointers are not aliased which helps the vectorization
 * process for optimization with the NEON FPU.
 *******************************************************************************/
-float rc_mult_accumulate(float * __restrict__ a, float * __restrict__ b, int n);
+RC_REAL rc_mult_accumulate(RC_REAL * __restrict__ a, RC_REAL * __restrict__ b, int n);
+
+
+/*******************************************************************************
+* int rc_lu_factor_inplace(RC_REAL** A, int n, int* piv)
+* void rc_lu_solve_inplace(RC_REAL** LU, int n, int* piv, RC_REAL** B, int cols)
+*
+* Allocation-free LU decomposition with partial pivoting for use inside
+* iterative algorithms with preallocated workspaces. rc_lu_factor_inplace
+* overwrites the n x n matrix A with its L and U factors and records the row
+* swaps in piv which must hold n ints. Returns 0 on success or -1 if A is
+* singular. rc_lu_solve_inplace then overwrites the n x cols matrix B with the
+* solution X to AX=B. Rows are swapped by content so contiguous rc_matrix_t
+* memory stays contiguous. Internal use only, no sanity checks are done.
+*******************************************************************************/
+int  rc_lu_factor_inplace(RC_REAL** A, int n, int* piv);
+void rc_lu_solve_inplace(RC_REAL** LU, int n, int* piv, RC_REAL** B, int cols);
+
+/*******************************************************************************
+* int rc_vector_replace(rc_vector_t* v, rc_vector_t* tmp)
+* int rc_matrix_replace(rc_matrix_t* A, rc_matrix_t* tmp)
+*
+* Used by in place operations to put a result built in tmp back into v or A.
+* Views get the result copied into the user's array rather than being pointed
+* at new memory, which fails if the size changed. tmp is consumed either way.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_vector_replace(rc_vector_t* v, rc_vector_t* tmp);
+int rc_matrix_replace(rc_matrix_t* A, rc_matrix_t* tmp);
 
+#endif // RC_ALGEBRA_COMMON_H
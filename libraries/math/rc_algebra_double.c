@@ -0,0 +1,15 @@
+/*******************************************************************************
+* rc_algebra_double.c
+*
+* Builds the double precision (_d) versions of the vector, matrix, linear
+* algebra and polynomial functions from the same source as the float versions.
+* See rc_algebra_common.h and rc_algebra_double.h for how the names are mapped.
+*******************************************************************************/
+
+#define RC_ALGEBRA_DOUBLE
+
+#include "rc_neon_functions.c"
+#include "rc_vector.c"
+#include "rc_matrix.c"
+#include "rc_linear_algebra.c"
+#include "rc_polynomial.c"
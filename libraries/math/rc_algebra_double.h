@@ -0,0 +1,106 @@
+/*******************************************************************************
+* rc_algebra_double.h
+*
+* Maps the names used in the single-precision algebra sources to their double
+* precision twins declared in redperipherallib.h. Only included through
+* rc_algebra_common.h when RC_ALGEBRA_DOUBLE is defined. Any new function added
+* to rc_vector.c, rc_matrix.c, rc_linear_algebra.c or rc_polynomial.c must also
+* be listed here, otherwise the double build will define it a second time.
+*******************************************************************************/
+
+#ifndef RC_ALGEBRA_DOUBLE_H
+#define RC_ALGEBRA_DOUBLE_H
+
+// types
+#define rc_vector_t	rc_vector_d_t
+#define rc_matrix_t	rc_matrix_d_t
+
+// rc_vector.c
+#define rc_alloc_vector                  rc_alloc_vector_d
+#define rc_free_vector                   rc_free_vector_d
+#define rc_empty_vector                  rc_empty_vector_d
+#define rc_vector_zeros                  rc_vector_zeros_d
+#define rc_vector_ones                   rc_vector_ones_d
+#define rc_random_vector                 rc_random_vector_d
+#define rc_vector_fibonnaci              rc_vector_fibonnaci_d
+#define rc_vector_from_array             rc_vector_from_array_d
+#define rc_vector_view_array             rc_vector_view_array_d
+#define rc_duplicate_vector              rc_duplicate_vector_d
+#define rc_set_vector_entry              rc_set_vector_entry_d
+#define rc_get_vector_entry              rc_get_vector_entry_d
+#define rc_print_vector                  rc_print_vector_d
+#define rc_print_vector_sci              rc_print_vector_sci_d
+#define rc_vector_times_scalar           rc_vector_times_scalar_d
+#define rc_vector_norm                   rc_vector_norm_d
+#define rc_vector_max                    rc_vector_max_d
+#define rc_vector_min                    rc_vector_min_d
+#define rc_std_dev                       rc_std_dev_d
+#define rc_vector_mean                   rc_vector_mean_d
+#define rc_vector_projection             rc_vector_projection_d
+#define rc_vector_dot_product            rc_vector_dot_product_d
+#define rc_vector_outer_product          rc_vector_outer_product_d
+#define rc_vector_cross_product          rc_vector_cross_product_d
+#define rc_vector_sum                    rc_vector_sum_d
+#define rc_vector_sum_inplace            rc_vector_sum_inplace_d
+
+// rc_matrix.c
+#define rc_alloc_matrix                  rc_alloc_matrix_d
+#define rc_free_matrix                   rc_free_matrix_d
+#define rc_empty_matrix                  rc_empty_matrix_d
+#define rc_matrix_zeros                  rc_matrix_zeros_d
+#define rc_identity_matrix               rc_identity_matrix_d
+#define rc_random_matrix                 rc_random_matrix_d
+#define rc_diag_matrix                   rc_diag_matrix_d
+#define rc_duplicate_matrix              rc_duplicate_matrix_d
+#define rc_matrix_view_array             rc_matrix_view_array_d
+#define rc_set_matrix_entry              rc_set_matrix_entry_d
+#define rc_get_matrix_entry              rc_get_matrix_entry_d
+#define rc_print_matrix                  rc_print_matrix_d
+#define rc_print_matrix_sci              rc_print_matrix_sci_d
+#define rc_matrix_times_scalar           rc_matrix_times_scalar_d
+#define rc_multiply_matrices             rc_multiply_matrices_d
+#define rc_left_multiply_matrix_inplace  rc_left_multiply_matrix_inplace_d
+#define rc_right_multiply_matrix_inplace rc_right_multiply_matrix_inplace_d
+#define rc_add_matrices                  rc_add_matrices_d
+#define rc_add_matrices_inplace          rc_add_matrices_inplace_d
+#define rc_matrix_transpose              rc_matrix_transpose_d
+#define rc_matrix_transpose_inplace      rc_matrix_transpose_inplace_d
+
+// rc_linear_algebra.c
+#define rc_matrix_times_col_vec          rc_matrix_times_col_vec_d
+#define rc_row_vec_times_matrix          rc_row_vec_times_matrix_d
+#define rc_matrix_determinant            rc_matrix_determinant_d
+#define rc_lup_decomp                    rc_lup_decomp_d
+#define rc_qr_decomp                     rc_qr_decomp_d
+#define rc_invert_matrix                 rc_invert_matrix_d
+#define rc_invert_matrix_inplace         rc_invert_matrix_inplace_d
+#define rc_lin_system_solve              rc_lin_system_solve_d
+#define rc_lin_system_solve_qr           rc_lin_system_solve_qr_d
+#define rc_fit_ellipsoid                 rc_fit_ellipsoid_d
+#define rc_tridiag_solve                 rc_tridiag_solve_d
+#define rc_banded_solve                  rc_banded_solve_d
+#define rc_banded_solve_ws               rc_banded_solve_ws_d
+
+// rc_polynomial.c
+#define rc_print_poly                    rc_print_poly_d
+#define rc_poly_conv                     rc_poly_conv_d
+#define rc_poly_power                    rc_poly_power_d
+#define rc_poly_add                      rc_poly_add_d
+#define rc_poly_add_inplace              rc_poly_add_inplace_d
+#define rc_poly_subtract                 rc_poly_subtract_d
+#define rc_poly_subtract_inplace         rc_poly_subtract_inplace_d
+#define rc_poly_differentiate            rc_poly_differentiate_d
+#define rc_poly_divide                   rc_poly_divide_d
+#define rc_poly_butter                   rc_poly_butter_d
+
+// internal helpers
+#define rc_mult_accumulate               rc_mult_accumulate_d
+#define rc_lu_factor_inplace             rc_lu_factor_inplace_d
+#define rc_lu_solve_inplace              rc_lu_solve_inplace_d
+#define rc_vector_replace                rc_vector_replace_d
+#define rc_matrix_replace                rc_matrix_replace_d
+#define qr_multiply_q_right              qr_multiply_q_right_d
+#define qr_multiply_r_left               qr_multiply_r_left_d
+#define qr_householder_matrix            qr_householder_matrix_d
+
+#endif // RC_ALGEBRA_DOUBLE_H
@@ -47,7 +47,7 @@ int rc_matrix_times_col_vec(rc_matrix_t A, rc_vector_t v, rc_vector_t* c){
 *******************************************************************************/
 int rc_row_vec_times_matrix(rc_vector_t v, rc_matrix_t A, rc_vector_t* c){
 	int i,j;
-	float* tmp;
+	RC_REAL* tmp;
 	// sanity checks
 	if(unlikely(!A.initialized || !v.initialized)){
 		fprintf(stderr,"ERROR in rc_row_vec_times_matrix, matrix or vector uninitialized\n");
@@ -60,7 +60,7 @@ int rc_row_vec_times_matrix(rc_vector_t v, rc_matrix_t A, rc_vector_t* c){
 	// allocate memory for a column of A from the stack, this is faster than 
 	// malloc and the memory is freed automatically when this function returns
 	// it is faster to put a column of A in contiguous memory then multiply
-	tmp = alloca(A.rows*sizeof(float));
+	tmp = alloca(A.rows*sizeof(RC_REAL));
 	if(unlikely(tmp==NULL)){
 		fprintf(stderr,"ERROR in rc_row_vec_times_matrix, alloca failed, stack overflow\n");
 		return -1;
@@ -81,13 +81,13 @@ int rc_row_vec_times_matrix(rc_vector_t v, rc_matrix_t A, rc_vector_t* c){
 }
 
 /*******************************************************************************
-* float rc_matrix_determinant(rc_matrix_t A)
+* RC_REAL rc_matrix_determinant(rc_matrix_t A)
 *
 * Returns the determinant of square matrix A or -1.0f on failure.
 *******************************************************************************/
-float rc_matrix_determinant(rc_matrix_t A){
+RC_REAL rc_matrix_determinant(rc_matrix_t A){
 	int i,j,k;
-	float ratio, det;
+	RC_REAL ratio, det;
 	rc_matrix_t tmp = rc_empty_matrix();
 	// sanity checks
 	if(unlikely(!A.initialized)){
@@ -131,7 +131,7 @@ float rc_matrix_determinant(rc_matrix_t A){
 *******************************************************************************/
 int rc_lup_decomp(rc_matrix_t A, rc_matrix_t* L, rc_matrix_t* U, rc_matrix_t* P){
 	int i,j,k,m,index,tmpint;
-	float s1, s2;
+	RC_REAL s1, s2;
 	int* ptmp;
 	void* rowtmp;
 	rc_matrix_t Adup = rc_empty_matrix();
@@ -171,7 +171,7 @@ int rc_lup_decomp(rc_matrix_t A, rc_matrix_t* L, rc_matrix_t* U, rc_matrix_t* P)
 	// represent P as an array of positions 0 through (m-1) for fast pivoting
 	// also alloc memory for a row of A as tmp holder while pivoting
 	ptmp = alloca(m*sizeof(int));
-	rowtmp = alloca(m*sizeof(float));
+	rowtmp = alloca(m*sizeof(RC_REAL));
 	if(unlikely(ptmp==NULL || rowtmp==NULL)){
 		fprintf(stderr,"ERROR in rc_lup_decomp, alloca failed, stack overflow\n");
 		rc_free_matrix(&Adup);
@@ -195,9 +195,9 @@ int rc_lup_decomp(rc_matrix_t A, rc_matrix_t* L, rc_matrix_t* U, rc_matrix_t* P)
 			ptmp[index]=ptmp[i];
 			ptmp[i]=tmpint;
 			// swap rows of A
-			memcpy(rowtmp,Adup.d[index],m*sizeof(float));
-			memcpy(Adup.d[index],Adup.d[i],m*sizeof(float));
-			memcpy(Adup.d[i],rowtmp,m*sizeof(float));
+			memcpy(rowtmp,Adup.d[index],m*sizeof(RC_REAL));
+			memcpy(Adup.d[index],Adup.d[i],m*sizeof(RC_REAL));
+			memcpy(Adup.d[i],rowtmp,m*sizeof(RC_REAL));
 		}
 	}
 	// construct P from ptmp
@@ -217,6 +217,94 @@ int rc_lup_decomp(rc_matrix_t A, rc_matrix_t* L, rc_matrix_t* U, rc_matrix_t* P)
 	return 0;
 }
 
+/*******************************************************************************
+* void lu_swap_rows(RC_REAL* __restrict__ a, RC_REAL* __restrict__ b, int n)
+*
+* swaps the contents of two matrix rows. Only used here in the backend.
+*******************************************************************************/
+static inline void lu_swap_rows(RC_REAL* __restrict__ a, RC_REAL* __restrict__ b, int n){
+	int i;
+	RC_REAL tmp;
+	for(i=0;i<n;i++){
+		tmp = a[i];
+		a[i] = b[i];
+		b[i] = tmp;
+	}
+}
+
+/*******************************************************************************
+* void lu_row_axpy(RC_REAL* __restrict__ y, RC_REAL s,
+*								RC_REAL* __restrict__ x, int n)
+*
+* y -= s*x over n values, the inner loop of both elimination and substitution.
+* Only used here in the backend.
+*******************************************************************************/
+static inline void lu_row_axpy(RC_REAL* __restrict__ y, RC_REAL s, RC_REAL* __restrict__ x, int n){
+	int i;
+	for(i=0;i<n;i++) y[i] -= s*x[i];
+}
+
+/*******************************************************************************
+* int rc_lu_factor_inplace(RC_REAL** A, int n, int* piv)
+*
+* Allocation-free LU decomposition with partial pivoting. A is overwritten
+* with the unit lower triangular L below the diagonal and U on and above it.
+* piv[k] records the row swapped with row k at step k. Returns 0 on success or
+* -1 if a zero pivot shows A is singular. Internal use only.
+*******************************************************************************/
+int rc_lu_factor_inplace(RC_REAL** A, int n, int* piv){
+	int i,k,m;
+	RC_REAL max, ratio;
+	for(k=0;k<n;k++){
+		// find pivot in column k
+		m = k;
+		max = fabs(A[k][k]);
+		for(i=k+1;i<n;i++){
+			if(fabs(A[i][k])>max){
+				max = fabs(A[i][k]);
+				m = i;
+			}
+		}
+		piv[k] = m;
+		if(unlikely(max<ZERO_TOLERANCE)) return -1;
+		if(m!=k) lu_swap_rows(A[k],A[m],n);
+		// eliminate below the pivot, storing multipliers in place
+		for(i=k+1;i<n;i++){
+			ratio = A[i][k]/A[k][k];
+			A[i][k] = ratio;
+			lu_row_axpy(&A[i][k+1],ratio,&A[k][k+1],n-k-1);
+		}
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* void rc_lu_solve_inplace(RC_REAL** LU, int n, int* piv, RC_REAL** B, int cols)
+*
+* Overwrites the n x cols matrix B with the solution X to AX=B where LU and piv
+* came from rc_lu_factor_inplace. Works on whole rows of B at a time so the
+* inner loops are contiguous and vectorize well. Internal use only.
+*******************************************************************************/
+void rc_lu_solve_inplace(RC_REAL** LU, int n, int* piv, RC_REAL** B, int cols){
+	int i,k;
+	RC_REAL inv;
+	// apply row swaps in the order they were made
+	for(k=0;k<n;k++){
+		if(piv[k]!=k) lu_swap_rows(B[k],B[piv[k]],cols);
+	}
+	// forward substitution with unit lower triangle
+	for(k=0;k<n;k++){
+		for(i=k+1;i<n;i++) lu_row_axpy(B[i],LU[i][k],B[k],cols);
+	}
+	// back substitution with upper triangle
+	for(i=n-1;i>=0;i--){
+		for(k=i+1;k<n;k++) lu_row_axpy(B[i],LU[i][k],B[k],cols);
+		inv = 1.0f/LU[i][i];
+		for(k=0;k<cols;k++) B[i][k] *= inv;
+	}
+	return;
+}
+
 /*******************************************************************************
 * int qr_multiply_q_right(rc_matrix_t* A, rc_matrix_t x)
 *
@@ -227,7 +315,7 @@ int rc_lup_decomp(rc_matrix_t A, rc_matrix_t* L, rc_matrix_t* U, rc_matrix_t* P)
 int qr_multiply_q_right(rc_matrix_t* A, rc_matrix_t x){
 	int i,j,k,q;
 	rc_matrix_t tmp = rc_empty_matrix();
-	float* col;
+	RC_REAL* col;
 	if(unlikely(!A->initialized || !x.initialized)){
 		fprintf(stderr,"ERROR in qr_multiply_q_right, uninitialized matrix\n");
 		return -1;
@@ -251,7 +339,7 @@ int qr_multiply_q_right(rc_matrix_t* A, rc_matrix_t x){
 	// allocate memory for a column of tmp from the stack, this is faster than 
 	// malloc and the memory is freed automatically when this function returns
 	// it is faster to put a column in contiguous memory before multiplying
-	col = alloca(x.rows*sizeof(float));
+	col = alloca(x.rows*sizeof(RC_REAL));
 	if(unlikely(col==NULL)){
 		fprintf(stderr,"ERROR in qr_multiply_q_right, alloca failed, stack overflow\n");
 		rc_free_matrix(&tmp);
@@ -273,13 +361,13 @@ int qr_multiply_q_right(rc_matrix_t* A, rc_matrix_t x){
 }
 
 /*******************************************************************************
-* int qr_multiply_r_left(rc_matrix_t x, rc_matrix_t* Am, float norm)
+* int qr_multiply_r_left(rc_matrix_t x, rc_matrix_t* Am, RC_REAL norm)
 *
 * performs a left matrix multiplication of x on the bottom right minor of A 
 * where x is smaller than or equal to the size of A. Only used here in the
 * backend, not for user access.
 *******************************************************************************/
-int qr_multiply_r_left(rc_matrix_t H, rc_matrix_t* R, float norm){
+int qr_multiply_r_left(rc_matrix_t H, rc_matrix_t* R, RC_REAL norm){
 	int i,j,p;
 	rc_matrix_t tmp = rc_empty_matrix();
 	// sanity checks
@@ -326,15 +414,15 @@ int qr_multiply_r_left(rc_matrix_t H, rc_matrix_t* R, float norm){
 }
 
 /*******************************************************************************
-* rc_matrix_t qr_householder_matrix(rc_vector_t x, float* new_norm)
+* rc_matrix_t qr_householder_matrix(rc_vector_t x, RC_REAL* new_norm)
 *
 * returns the householder reflection matrix for a given vector
 * where u=x-ae1, v=u/norm(u), H=I-(2/norm(x))vv'
 * warning! modifies x!, only for use by qr decomposition below
 *******************************************************************************/
-rc_matrix_t qr_householder_matrix(rc_vector_t x, float* new_norm){
+rc_matrix_t qr_householder_matrix(rc_vector_t x, RC_REAL* new_norm){
 	int i, j;
-	float norm, tau, taui, dot;
+	RC_REAL norm, tau, taui, dot;
 	rc_matrix_t out = rc_empty_matrix();
 	rc_vector_t v = rc_empty_vector();
 
@@ -394,7 +482,7 @@ rc_matrix_t qr_householder_matrix(rc_vector_t x, float* new_norm){
 *******************************************************************************/
 int rc_qr_decomp(rc_matrix_t A, rc_matrix_t* Q, rc_matrix_t* R){
 	int i,j,steps;
-	float norm;
+	RC_REAL norm;
 	rc_vector_t x = rc_empty_vector();
 	rc_matrix_t H = rc_empty_matrix();
 	// Sanity Checks
@@ -512,8 +600,9 @@ int rc_invert_matrix(rc_matrix_t A, rc_matrix_t* Ainv){
 /*******************************************************************************
 * int rc_invert_matrix_inplace(rc_matrix_t* A)
 *
-* Inverts Matrix A in place. The original contents of A are lost.
-* Returns 0 on success or -1 on failure such as if A is not invertible.
+* Inverts Matrix A in place. The original contents of A are lost, a view gets
+* the inverse written into its array. Returns 0 on success or -1 on failure
+* such as if A is not invertible.
 *******************************************************************************/
 int rc_invert_matrix_inplace(rc_matrix_t* A){
 	rc_matrix_t Atmp = rc_empty_matrix();
@@ -522,9 +611,7 @@ int rc_invert_matrix_inplace(rc_matrix_t* A){
 		return -1;
 	}
 	// free original memory and copy new matrix into place
-	rc_free_matrix(A);
-	*A = Atmp;
-	return 0;
+	return rc_matrix_replace(A, &Atmp);
 }
 
 /*******************************************************************************
@@ -537,7 +624,7 @@ int rc_invert_matrix_inplace(rc_matrix_t* A){
 * Returns 0 on success or -1 on failure.
 *******************************************************************************/
 int rc_lin_system_solve(rc_matrix_t A, rc_vector_t b, rc_vector_t* x){
-	float fMaxElem, fAcc;
+	RC_REAL fMaxElem, fAcc;
 	int nDim,i,j,k,m;
 	rc_matrix_t Atemp = rc_empty_matrix();
 	rc_vector_t btemp = rc_empty_vector();
@@ -795,3 +882,152 @@ int rc_fit_ellipsoid(rc_matrix_t pts, rc_vector_t* ctr, rc_vector_t* lens){
 	rc_free_vector(&f);
 	return 0;
 }
+
+/*******************************************************************************
+* int rc_tridiag_solve(rc_vector_t a, rc_vector_t b, rc_vector_t c, rc_vector_t d, rc_vector_t* x)
+*
+* Solves the tridiagonal system Ax=d in O(n) with the Thomas algorithm. b is
+* the main diagonal, a the sub-diagonal and c the super-diagonal, all of length
+* n so row i reads a[i]x[i-1] + b[i]x[i] + c[i]x[i+1] = d[i]. a[0] and c[n-1]
+* are ignored. No pivoting is done so A should be diagonally dominant or
+* symmetric positive definite as is the case for splines. x may be the same
+* vector as d. The only scratch memory is taken from the stack.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_tridiag_solve(rc_vector_t a, rc_vector_t b, rc_vector_t c, rc_vector_t d, rc_vector_t* x){
+	int i, n;
+	RC_REAL m;
+	RC_REAL* cp;
+	// sanity checks
+	if(unlikely(!a.initialized || !b.initialized || !c.initialized || !d.initialized)){
+		fprintf(stderr,"ERROR in rc_tridiag_solve, vector uninitialized\n");
+		return -1;
+	}
+	n = b.len;
+	if(unlikely(a.len!=n || c.len!=n || d.len!=n)){
+		fprintf(stderr,"ERROR in rc_tridiag_solve, dimension mismatch\n");
+		return -1;
+	}
+	if(unlikely(rc_alloc_vector(x,n))){
+		fprintf(stderr,"ERROR in rc_tridiag_solve, failed to alloc vector\n");
+		return -1;
+	}
+	// modified super-diagonal lives on the stack, the modified right hand
+	// side is built directly in x
+	cp = alloca(n*sizeof(RC_REAL));
+	if(unlikely(cp==NULL)){
+		fprintf(stderr,"ERROR in rc_tridiag_solve, alloca failed, stack overflow\n");
+		return -1;
+	}
+	if(unlikely(fabs(b.d[0])<ZERO_TOLERANCE)){
+		fprintf(stderr,"ERROR in rc_tridiag_solve, zero pivot\n");
+		return -1;
+	}
+	cp[0] = c.d[0]/b.d[0];
+	x->d[0] = d.d[0]/b.d[0];
+	// forward sweep
+	for(i=1;i<n;i++){
+		m = b.d[i]-a.d[i]*cp[i-1];
+		if(unlikely(fabs(m)<ZERO_TOLERANCE)){
+			fprintf(stderr,"ERROR in rc_tridiag_solve, zero pivot\n");
+			return -1;
+		}
+		cp[i] = c.d[i]/m;
+		x->d[i] = (d.d[i]-a.d[i]*x->d[i-1])/m;
+	}
+	// back substitution
+	for(i=n-2;i>=0;i--) x->d[i] -= cp[i]*x->d[i+1];
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_banded_solve(rc_matrix_t Ab, int kl, int ku, rc_vector_t b, rc_vector_t* x)
+*
+* Solves Ax=b where A is an n x n band matrix with kl sub-diagonals and ku
+* super-diagonals given in compact row storage: Ab is n x (kl+ku+1) and
+* A[i][j] is stored at Ab.d[i][j-i+kl] so the main diagonal is column kl of Ab.
+* Entries of Ab that fall outside of A are ignored. This takes O(n*kl*ku)
+* operations instead of O(n^3) for rc_lin_system_solve. No pivoting is done so
+* A should be diagonally dominant or symmetric positive definite. The band is
+* copied to a temporary matrix each call, use rc_banded_solve_ws to keep that
+* memory between calls. Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_banded_solve(rc_matrix_t Ab, int kl, int ku, rc_vector_t b, rc_vector_t* x){
+	int ret;
+	rc_matrix_t U = rc_empty_matrix();
+	ret = rc_banded_solve_ws(Ab,kl,ku,b,&U,x);
+	rc_free_matrix(&U);
+	return ret;
+}
+
+/*******************************************************************************
+* int rc_banded_solve_ws(rc_matrix_t Ab, int kl, int ku, rc_vector_t b,
+*						rc_matrix_t* U, rc_vector_t* x)
+*
+* Same as rc_banded_solve but eliminates in the caller's workspace U, which is
+* only allocated when it doesn't already match the size of Ab. Keeping U and x
+* between calls makes repeated solves of the same size allocation free. Pass
+* &Ab as U to factor the band in place when Ab is no longer needed, and x may
+* be the same vector as b. Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_banded_solve_ws(rc_matrix_t Ab, int kl, int ku, rc_vector_t b, rc_matrix_t* U, rc_vector_t* x){
+	int i, j, k, n, last;
+	RC_REAL f, piv;
+	RC_REAL* __restrict__ rowi;
+	RC_REAL* __restrict__ rowk;
+	// sanity checks
+	if(unlikely(!Ab.initialized || !b.initialized)){
+		fprintf(stderr,"ERROR in rc_banded_solve, matrix or vector uninitialized\n");
+		return -1;
+	}
+	if(unlikely(kl<0 || ku<0 || Ab.cols!=(kl+ku+1))){
+		fprintf(stderr,"ERROR in rc_banded_solve, Ab must have kl+ku+1 columns\n");
+		return -1;
+	}
+	n = Ab.rows;
+	if(unlikely(b.len!=n)){
+		fprintf(stderr,"ERROR in rc_banded_solve, dimension mismatch\n");
+		return -1;
+	}
+	if(unlikely(U==NULL)){
+		fprintf(stderr,"ERROR in rc_banded_solve, received NULL pointer\n");
+		return -1;
+	}
+	// eliminate in the workspace so the user's matrix is left untouched,
+	// unless the user handed Ab itself in as the workspace
+	if(unlikely(rc_alloc_matrix(U,n,Ab.cols))){
+		fprintf(stderr,"ERROR in rc_banded_solve, failed to alloc workspace\n");
+		return -1;
+	}
+	if(U->d[0]!=Ab.d[0]) memcpy(U->d[0],Ab.d[0],n*Ab.cols*sizeof(RC_REAL));
+	if(unlikely(rc_alloc_vector(x,n))){
+		fprintf(stderr,"ERROR in rc_banded_solve, failed to alloc vector\n");
+		return -1;
+	}
+	if(x->d!=b.d) memcpy(x->d,b.d,n*sizeof(RC_REAL));
+	// gaussian elimination confined to the band, without pivoting no fill-in
+	// occurs outside of the original super-diagonals
+	for(k=0;k<n;k++){
+		piv = U->d[k][kl];
+		if(unlikely(fabs(piv)<ZERO_TOLERANCE)){
+			fprintf(stderr,"ERROR in rc_banded_solve, zero pivot\n");
+			return -1;
+		}
+		last = (k+ku<n-1) ? k+ku : n-1;
+		rowk = &U->d[k][kl];	// rowk[j-k] is A[k][j]
+		for(i=k+1;i<n && i<=k+kl;i++){
+			rowi = &U->d[i][k-i+kl];	// rowi[j-k] is A[i][j]
+			f = rowi[0]/piv;
+			for(j=0;j<=last-k;j++) rowi[j] -= f*rowk[j];
+			x->d[i] -= f*x->d[k];
+		}
+	}
+	// back substitution on the upper band
+	for(i=n-1;i>=0;i--){
+		last = (i+ku<n-1) ? i+ku : n-1;
+		f = x->d[i];
+		for(j=i+1;j<=last;j++) f -= U->d[i][j-i+kl]*x->d[j];
+		x->d[i] = f/U->d[i][kl];
+	}
+	return 0;
+}
@@ -0,0 +1,352 @@
+/*******************************************************************************
+* rc_lookup_table.c
+*
+* N-dimensional gridded lookup tables of vectors or matrices with multilinear
+* interpolation. Intended for gain scheduling where a controller gain matrix is
+* picked by airspeed, battery voltage, etc. every control cycle. All memory is
+* allocated up front so rc_lut_eval does not touch the heap as long as the
+* output matrix is already the right size.
+*******************************************************************************/
+
+#include "rc_algebra_common.h"
+
+/*******************************************************************************
+* rc_lut_t rc_empty_lut()
+*
+* Returns an rc_lut_t struct which is completely zero'd out with no memory
+* allocated for it. New tables should be initialized with this before calling
+* rc_alloc_lut.
+*******************************************************************************/
+rc_lut_t rc_empty_lut(){
+	int i;
+	rc_lut_t out;
+	// zero-out piecemeal instead of with memset to avoid issues with padding
+	out.dims = 0;
+	out.rows = 0;
+	out.cols = 0;
+	out.entries = 0;
+	for(i=0;i<RC_LUT_MAX_DIMS;i++){
+		out.len[i] = 0;
+		out.stride[i] = 0;
+		out.bp[i] = NULL;
+		out.last[i] = 0;
+	}
+	out.d = NULL;
+	out.initialized = 0;
+	return out;
+}
+
+/*******************************************************************************
+* int rc_alloc_lut(rc_lut_t* t, int dims, int* len, int rows, int cols)
+*
+* Allocates memory for a table with 'dims' scheduling variables where dimension
+* i has len[i] breakpoints. Each grid point holds a rows x cols matrix, use
+* cols=1 for tables of vectors. Breakpoints default to 0,1,2... and all table
+* entries are zero'd. Any existing memory in t is freed first.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_alloc_lut(rc_lut_t* t, int dims, int* len, int rows, int cols){
+	int i,j,points;
+	// sanity checks
+	if(unlikely(t==NULL || len==NULL)){
+		fprintf(stderr,"ERROR in rc_alloc_lut, received NULL pointer\n");
+		return -1;
+	}
+	if(unlikely(dims<1 || dims>RC_LUT_MAX_DIMS)){
+		fprintf(stderr,"ERROR in rc_alloc_lut, dims must be between 1 and %d\n",\
+															RC_LUT_MAX_DIMS);
+		return -1;
+	}
+	if(unlikely(rows<1 || cols<1)){
+		fprintf(stderr,"ERROR in rc_alloc_lut, rows and cols must be >=1\n");
+		return -1;
+	}
+	for(i=0;i<dims;i++){
+		if(unlikely(len[i]<2)){
+			fprintf(stderr,"ERROR in rc_alloc_lut, need at least 2 breakpoints per dimension\n");
+			return -1;
+		}
+	}
+	rc_free_lut(t);
+	// strides are in units of table entries, last dimension is contiguous
+	t->entries = rows*cols;
+	points = 1;
+	for(i=dims-1;i>=0;i--){
+		t->stride[i] = points*t->entries;
+		points *= len[i];
+	}
+	t->d = (float*)calloc(points*t->entries,sizeof(float));
+	if(unlikely(t->d==NULL)){
+		fprintf(stderr,"ERROR in rc_alloc_lut, not enough memory\n");
+		return -1;
+	}
+	for(i=0;i<dims;i++){
+		t->bp[i] = (float*)malloc(len[i]*sizeof(float));
+		if(unlikely(t->bp[i]==NULL)){
+			fprintf(stderr,"ERROR in rc_alloc_lut, not enough memory\n");
+			t->initialized = 1;
+			rc_free_lut(t);
+			return -1;
+		}
+		for(j=0;j<len[i];j++) t->bp[i][j]=(float)j;
+		t->len[i] = len[i];
+	}
+	t->dims = dims;
+	t->rows = rows;
+	t->cols = cols;
+	t->initialized = 1;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_free_lut(rc_lut_t* t)
+*
+* Frees the memory allocated for table t and zeros out the struct.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_free_lut(rc_lut_t* t){
+	int i;
+	if(unlikely(t==NULL)){
+		fprintf(stderr,"ERROR in rc_free_lut, received NULL pointer\n");
+		return -1;
+	}
+	if(t->initialized){
+		for(i=0;i<RC_LUT_MAX_DIMS;i++) free(t->bp[i]);
+		free(t->d);
+	}
+	*t = rc_empty_lut();
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_set_lut_breakpoints(rc_lut_t* t, int dim, rc_vector_t bp)
+*
+* Sets the breakpoints of dimension 'dim'. Vector bp must have the same length
+* as given to rc_alloc_lut for that dimension and be strictly ascending.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_set_lut_breakpoints(rc_lut_t* t, int dim, rc_vector_t bp){
+	int i;
+	if(unlikely(t==NULL || !t->initialized || !bp.initialized)){
+		fprintf(stderr,"ERROR in rc_set_lut_breakpoints, table or vector uninitialized\n");
+		return -1;
+	}
+	if(unlikely(dim<0 || dim>=t->dims)){
+		fprintf(stderr,"ERROR in rc_set_lut_breakpoints, invalid dimension\n");
+		return -1;
+	}
+	if(unlikely(bp.len!=t->len[dim])){
+		fprintf(stderr,"ERROR in rc_set_lut_breakpoints, dimension mismatch\n");
+		return -1;
+	}
+	for(i=1;i<bp.len;i++){
+		if(unlikely(bp.d[i]<=bp.d[i-1])){
+			fprintf(stderr,"ERROR in rc_set_lut_breakpoints, breakpoints must be strictly ascending\n");
+			return -1;
+		}
+	}
+	memcpy(t->bp[dim],bp.d,bp.len*sizeof(float));
+	t->last[dim] = 0;
+	return 0;
+}
+
+/*******************************************************************************
+* float* lut_entry_ptr(rc_lut_t* t, int* index)
+*
+* returns a pointer to the start of the table entry at grid index 'index' or
+* NULL if any index is out of bounds. Only used internally.
+*******************************************************************************/
+static float* lut_entry_ptr(rc_lut_t* t, int* index){
+	int i, offset = 0;
+	for(i=0;i<t->dims;i++){
+		if(unlikely(index[i]<0 || index[i]>=t->len[i])) return NULL;
+		offset += index[i]*t->stride[i];
+	}
+	return t->d + offset;
+}
+
+/*******************************************************************************
+* int rc_set_lut_entry(rc_lut_t* t, int* index, rc_matrix_t M)
+*
+* Copies matrix M into the table at grid point 'index' which must be an array
+* with one index per dimension. M must match the rows and cols of the table.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_set_lut_entry(rc_lut_t* t, int* index, rc_matrix_t M){
+	float* ptr;
+	if(unlikely(t==NULL || !t->initialized || !M.initialized || index==NULL)){
+		fprintf(stderr,"ERROR in rc_set_lut_entry, table or matrix uninitialized\n");
+		return -1;
+	}
+	if(unlikely(M.rows!=t->rows || M.cols!=t->cols)){
+		fprintf(stderr,"ERROR in rc_set_lut_entry, dimension mismatch\n");
+		return -1;
+	}
+	ptr = lut_entry_ptr(t,index);
+	if(unlikely(ptr==NULL)){
+		fprintf(stderr,"ERROR in rc_set_lut_entry, index out of bounds\n");
+		return -1;
+	}
+	// matrix data is allocated contiguously so copy it in one go
+	memcpy(ptr,M.d[0],t->entries*sizeof(float));
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_set_lut_entry_vector(rc_lut_t* t, int* index, rc_vector_t v)
+*
+* Like rc_set_lut_entry but for tables of vectors (cols=1).
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_set_lut_entry_vector(rc_lut_t* t, int* index, rc_vector_t v){
+	float* ptr;
+	if(unlikely(t==NULL || !t->initialized || !v.initialized || index==NULL)){
+		fprintf(stderr,"ERROR in rc_set_lut_entry_vector, table or vector uninitialized\n");
+		return -1;
+	}
+	if(unlikely(v.len!=t->entries)){
+		fprintf(stderr,"ERROR in rc_set_lut_entry_vector, dimension mismatch\n");
+		return -1;
+	}
+	ptr = lut_entry_ptr(t,index);
+	if(unlikely(ptr==NULL)){
+		fprintf(stderr,"ERROR in rc_set_lut_entry_vector, index out of bounds\n");
+		return -1;
+	}
+	memcpy(ptr,v.d,t->entries*sizeof(float));
+	return 0;
+}
+
+/*******************************************************************************
+* int lut_bracket(rc_lut_t* t, int dim, float x, float* frac)
+*
+* Finds the cell i such that bp[i]<=x<bp[i+1] for one dimension and writes the
+* fractional position inside that cell to frac. The cell found last time is
+* checked first, then its neighbours, before falling back to a binary search.
+* Scheduling variables change slowly between control cycles so the first check
+* almost always hits. Inputs outside the grid are clamped to the edge.
+*******************************************************************************/
+static inline int lut_bracket(rc_lut_t* t, int dim, float x, float* frac){
+	int lo, hi, mid;
+	int i = t->last[dim];
+	int n = t->len[dim];
+	float* bp = t->bp[dim];
+	// clamp to the grid
+	if(x<=bp[0]){
+		*frac = 0.0f;
+		t->last[dim] = 0;
+		return 0;
+	}
+	if(x>=bp[n-1]){
+		*frac = 1.0f;
+		t->last[dim] = n-2;
+		return n-2;
+	}
+	// cached cell and its neighbours
+	if(likely(x>=bp[i] && x<bp[i+1])) goto FOUND;
+	if(i+2<n && x>=bp[i+1] && x<bp[i+2]){
+		i++;
+		goto FOUND;
+	}
+	if(i>0 && x>=bp[i-1] && x<bp[i]){
+		i--;
+		goto FOUND;
+	}
+	// binary search
+	lo = 0;
+	hi = n-1;
+	while(hi-lo>1){
+		mid = (lo+hi)>>1;
+		if(x>=bp[mid]) lo=mid;
+		else hi=mid;
+	}
+	i = lo;
+FOUND:
+	t->last[dim] = i;
+	*frac = (x-bp[i])/(bp[i+1]-bp[i]);
+	return i;
+}
+
+/*******************************************************************************
+* void lut_axpy(float * __restrict__ y, float a, float * __restrict__ x, int n)
+*
+* y += a*x over n values. Written as a plain loop with restrict pointers so
+* the compiler vectorizes it for NEON.
+*******************************************************************************/
+static inline void lut_axpy(float * __restrict__ y, float a, \
+										float * __restrict__ x, int n){
+	int i;
+	for(i=0;i<n;i++) y[i]+=a*x[i];
+}
+
+/*******************************************************************************
+* int lut_interpolate(rc_lut_t* t, float* x, float* out)
+*
+* Multilinear interpolation into raw output memory of length t->entries.
+* Loops through the 2^dims corners of the bracketing cell, skipping corners
+* with zero weight such as when an input sits on a breakpoint or is clamped.
+*******************************************************************************/
+static int lut_interpolate(rc_lut_t* t, float* x, float* out){
+	int i, c, corners, offset, base;
+	float w;
+	float frac[RC_LUT_MAX_DIMS];
+	base = 0;
+	for(i=0;i<t->dims;i++){
+		base += lut_bracket(t,i,x[i],&frac[i])*t->stride[i];
+	}
+	memset(out,0,t->entries*sizeof(float));
+	corners = 1<<t->dims;
+	for(c=0;c<corners;c++){
+		w = 1.0f;
+		offset = base;
+		for(i=0;i<t->dims;i++){
+			if(c&(1<<i)){
+				w *= frac[i];
+				offset += t->stride[i];
+			}
+			else w *= 1.0f-frac[i];
+		}
+		if(w==0.0f) continue;
+		lut_axpy(out,w,t->d+offset,t->entries);
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_lut_eval(rc_lut_t* t, float* x, rc_matrix_t* out)
+*
+* Evaluates the table at the point given by array x which must contain one
+* value per dimension. The interpolated matrix is written to out. If out is
+* already the right size no memory is allocated, so preallocate it once with
+* rc_alloc_matrix to keep this call cheap inside a control loop.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_lut_eval(rc_lut_t* t, float* x, rc_matrix_t* out){
+	if(unlikely(t==NULL || !t->initialized || x==NULL)){
+		fprintf(stderr,"ERROR in rc_lut_eval, table uninitialized\n");
+		return -1;
+	}
+	if(unlikely(rc_alloc_matrix(out,t->rows,t->cols))){
+		fprintf(stderr,"ERROR in rc_lut_eval, failed to allocate matrix\n");
+		return -1;
+	}
+	return lut_interpolate(t,x,out->d[0]);
+}
+
+/*******************************************************************************
+* int rc_lut_eval_vector(rc_lut_t* t, float* x, rc_vector_t* out)
+*
+* Like rc_lut_eval but places the rows*cols interpolated values in vector out.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_lut_eval_vector(rc_lut_t* t, float* x, rc_vector_t* out){
+	if(unlikely(t==NULL || !t->initialized || x==NULL)){
+		fprintf(stderr,"ERROR in rc_lut_eval_vector, table uninitialized\n");
+		return -1;
+	}
+	if(unlikely(rc_alloc_vector(out,t->entries))){
+		fprintf(stderr,"ERROR in rc_lut_eval_vector, failed to allocate vector\n");
+		return -1;
+	}
+	return lut_interpolate(t,x,out->d);
+}
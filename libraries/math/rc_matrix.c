@@ -31,23 +31,28 @@ int rc_alloc_matrix(rc_matrix_t* A, int rows, int cols){
 	}
 	// if A is already allocated and of the right size, nothing to do!
 	if(A->initialized && rows==A->rows && cols==A->cols) return 0;
+	// a view can't grow into new memory without leaving the user's array
+	if(unlikely(A->initialized==BORROWED_MEMORY)){
+		fprintf(stderr,"ERROR in rc_alloc_matrix, can't resize a view\n");
+		return -1;
+	}
 	// free any old memory 
 	rc_free_matrix(A);
 	// allocate contiguous memory for the major(row) pointers
-	A->d = (float**)malloc(rows*sizeof(float*));
+	A->d = (RC_REAL**)malloc(rows*sizeof(RC_REAL*));
 	if(unlikely(A->d==NULL)){
 		fprintf(stderr,"ERROR in rc_alloc_matrix, not enough memory\n");
 		return -1;
 	}
 	// allocate contiguous memory for the actual data
-	void* ptr = malloc(rows*cols*sizeof(float));
+	void* ptr = malloc(rows*cols*sizeof(RC_REAL));
 	if(unlikely(ptr==NULL)){
 		fprintf(stderr,"ERROR in rc_alloc_matrix, not enough memory\n");
 		free(A->d);
 		return -1;
 	}
 	// manually fill in the pointer to each row
-	for(i=0;i<rows;i++) A->d[i]=(float*)(ptr+i*cols*sizeof(float));
+	for(i=0;i<rows;i++) A->d[i]=(RC_REAL*)(ptr+i*cols*sizeof(RC_REAL));
 	A->rows = rows;
 	A->cols = cols;
 	A->initialized = 1;
@@ -69,8 +74,11 @@ int rc_free_matrix(rc_matrix_t* A){
 		fprintf(stderr,"ERROR in rc_free_matrix, received NULL pointer\n");
 		return -1;
 	}
-	// free memory allocated for the data then the major array
-	if(A->d!=NULL && A->initialized) free(A->d[0]);
+	// free memory allocated for the data then the major array, views only
+	// borrow the data from the user so just free their row pointers
+	if(A->d!=NULL && A->initialized && A->initialized!=BORROWED_MEMORY){
+		free(A->d[0]);
+	}
 	free(A->d);
 	// zero out the struct
 	*A = rc_empty_matrix();
@@ -121,20 +129,20 @@ int rc_matrix_zeros(rc_matrix_t* A, int rows, int cols){
 	// make sure A is freed before allocating new memory
 	rc_free_matrix(A);
 	// allocate contiguous memory for the major(row) pointers
-	A->d = (float**)malloc(rows*sizeof(float*));
+	A->d = (RC_REAL**)malloc(rows*sizeof(RC_REAL*));
 	if(unlikely(A->d==NULL)){
 		fprintf(stderr,"ERROR in rc_create_matrix_zeros, not enough memory\n");
 		return -1;
 	}
 	// allocate contiguous memory for the actual data
-	void* ptr = calloc(rows*cols,sizeof(float));
+	void* ptr = calloc(rows*cols,sizeof(RC_REAL));
 	if(unlikely(ptr==NULL)){
 		fprintf(stderr,"ERROR in rc_create_matrix_zeros, not enough memory\n");
 		free(A->d);
 		return -1;
 	}
 	// manually fill in the pointer to each row
-	for(i=0;i<rows;i++) A->d[i]=(float*)(ptr+i*cols*sizeof(float));
+	for(i=0;i<rows;i++) A->d[i]=(RC_REAL*)(ptr+i*cols*sizeof(RC_REAL));
 	A->rows = rows;
 	A->cols = cols;
 	A->initialized = 1;
@@ -173,7 +181,7 @@ int rc_random_matrix(rc_matrix_t* A, int rows, int cols){
 		fprintf(stderr,"ERROR in rc_random_matrix, failed to allocate matrix\n");
 		return -1;
 	}
-	for(i=0;i<(A->rows*A->cols);i++) A->d[0][i]=rc_get_random_float();
+	for(i=0;i<(A->rows*A->cols);i++) A->d[0][i]=RC_RANDOM();
 	return 0;
 }
 
@@ -223,12 +231,45 @@ int rc_duplicate_matrix(rc_matrix_t A, rc_matrix_t* B){
 		return -1;
 	}
 	// all matrix data is stored contiguously so one memcpy is sufficient
-	memcpy(B->d[0],A.d[0],A.rows*A.cols*sizeof(float));
+	memcpy(B->d[0],A.d[0],A.rows*A.cols*sizeof(RC_REAL));
 	return 0;
 }
 
 /*******************************************************************************
-* int rc_set_matrix_entry(rc_matrix_t* A, int row, int col, float val)
+* int rc_matrix_view_array(rc_matrix_t* A, RC_REAL* ptr, int rows, int cols)
+*
+* Wraps a user's existing row-major array of rows*cols values as a matrix
+* without copying the data. Only the row pointers are allocated. The array
+* still belongs to the caller and must outlive A. rc_free_matrix on a view
+* frees the row pointers but never the array. Nothing resizes a view, so
+* results land in the array or the operation fails. Returns 0 on success or
+* -1 on failure.
+*******************************************************************************/
+int rc_matrix_view_array(rc_matrix_t* A, RC_REAL* ptr, int rows, int cols){
+	int i;
+	if(unlikely(A==NULL || ptr==NULL)){
+		fprintf(stderr,"ERROR in rc_matrix_view_array, received NULL pointer\n");
+		return -1;
+	}
+	if(unlikely(rows<1 || cols<1)){
+		fprintf(stderr,"ERROR in rc_matrix_view_array, rows and cols must be >=1\n");
+		return -1;
+	}
+	rc_free_matrix(A);
+	A->d = (RC_REAL**)malloc(rows*sizeof(RC_REAL*));
+	if(unlikely(A->d==NULL)){
+		fprintf(stderr,"ERROR in rc_matrix_view_array, not enough memory\n");
+		return -1;
+	}
+	for(i=0;i<rows;i++) A->d[i] = ptr+i*cols;
+	A->rows = rows;
+	A->cols = cols;
+	A->initialized = BORROWED_MEMORY;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_set_matrix_entry(rc_matrix_t* A, int row, int col, RC_REAL val)
 *
 * Sets the specified single entry of matrix A to 'val' where the position is
 * zero-indexed at the top-left corner. In practice this is never used as it is
@@ -244,7 +285,7 @@ int rc_duplicate_matrix(rc_matrix_t A, rc_matrix_t* B){
 * modified by the function, and as a normal argument when it is only to be read 
 * by the function. Returns 0 on success or -1 on error.
 *******************************************************************************/
-int rc_set_matrix_entry(rc_matrix_t* A, int row, int col, float val){
+int rc_set_matrix_entry(rc_matrix_t* A, int row, int col, RC_REAL val){
 	if(unlikely(A==NULL)){
 		fprintf(stderr,"ERROR in rc_set_matrix_entry, received null pointer\n");
 		return -1;
@@ -266,7 +307,7 @@ int rc_set_matrix_entry(rc_matrix_t* A, int row, int col, float val){
 }
 
 /*******************************************************************************
-* float rc_get_matrix_entry(rc_matrix_t A, int row, int col)
+* RC_REAL rc_get_matrix_entry(rc_matrix_t A, int row, int col)
 *
 * Returns the specified single entry of matrix 'A' in position 'pos' where the
 * position is zero-indexed. Returns -1.0f on failure and prints an error message
@@ -278,7 +319,7 @@ int rc_set_matrix_entry(rc_matrix_t* A, int row, int col, float val){
 * However, we provide this function for completeness. It also provides sanity
 * checks to avoid possible segfaults.
 *******************************************************************************/
-float rc_get_matrix_entry(rc_matrix_t A, int row, int col){
+RC_REAL rc_get_matrix_entry(rc_matrix_t A, int row, int col){
 	if(unlikely(!A.initialized)){
 		fprintf(stderr,"ERROR in rc_get_matrix_entry, ,matrix not initialized yet\n");
 		return -1.0f;
@@ -339,7 +380,7 @@ void rc_print_matrix_sci(rc_matrix_t A){
 }
 
 /*******************************************************************************
-* int rc_matrix_times_scalar(rc_matrix_t* A, float s)
+* int rc_matrix_times_scalar(rc_matrix_t* A, RC_REAL s)
 *
 * Multiplies every entry in A by scalar value s. It is not strictly
 * necessary for A to be provided as a pointer since a copy of the struct A
@@ -349,7 +390,7 @@ void rc_print_matrix_sci(rc_matrix_t A){
 * modified by the function, and as a normal argument when it is only to be read 
 * by the function. Returns 0 on success or -1 on failure.
 *******************************************************************************/
-int rc_matrix_times_scalar(rc_matrix_t* A, float s){
+int rc_matrix_times_scalar(rc_matrix_t* A, RC_REAL s){
 	int i;
 	if(unlikely(!A->initialized)){
 		fprintf(stderr,"ERROR in rc_matrix_times_scalar. matrix uninitialized\n");
@@ -368,7 +409,7 @@ int rc_matrix_times_scalar(rc_matrix_t* A, float s){
 *******************************************************************************/
 int rc_multiply_matrices(rc_matrix_t A, rc_matrix_t B, rc_matrix_t* C){
 	int i,j;
-	float* tmp;
+	RC_REAL* tmp;
 	if(unlikely(!A.initialized||!B.initialized)){
 		fprintf(stderr,"ERROR in rc_multiply_matrices, matrix not initialized\n");
 		return -1;
@@ -385,7 +426,7 @@ int rc_multiply_matrices(rc_matrix_t A, rc_matrix_t B, rc_matrix_t* C){
 	// allocate memory for a column of B from the stack, this is faster than 
 	// malloc and the memory is freed automatically when this function returns
 	// it is faster to put a column in contiguous memory before multiplying
-	tmp = alloca(B.rows*sizeof(float));
+	tmp = alloca(B.rows*sizeof(RC_REAL));
 	if(unlikely(tmp==NULL)){
 		fprintf(stderr,"ERROR in rc_multiply_matrices, alloca failed, stack overflow\n");
 		return -1;
@@ -402,12 +443,37 @@ int rc_multiply_matrices(rc_matrix_t A, rc_matrix_t B, rc_matrix_t* C){
 	return 0;
 }
 
+/*******************************************************************************
+* int rc_matrix_replace(rc_matrix_t* A, rc_matrix_t* tmp)
+*
+* Finishes an in place operation that built its result in tmp. Normally A is
+* freed and takes over tmp's memory, but a view has to keep pointing at the
+* user's array so the result is copied into it instead, which needs the same
+* shape. tmp is freed or taken over either way. Returns 0 on success or -1 if
+* A is a view of a different shape.
+*******************************************************************************/
+int rc_matrix_replace(rc_matrix_t* A, rc_matrix_t* tmp){
+	if(A->initialized==BORROWED_MEMORY){
+		if(unlikely(A->rows!=tmp->rows || A->cols!=tmp->cols)){
+			rc_free_matrix(tmp);
+			return -1;
+		}
+		memcpy(A->d[0], tmp->d[0], A->rows*A->cols*sizeof(RC_REAL));
+		rc_free_matrix(tmp);
+		return 0;
+	}
+	rc_free_matrix(A);
+	*A = *tmp;
+	return 0;
+}
+
 /*******************************************************************************
 * int rc_left_multiply_matrix_inplace(rc_matrix_t A, rc_matrix_t* B)
 *
 * Multiplies A*B and puts the result back in the place of B. B is resized and
-* its original contents are freed if necessary to avoid memory leaks.
-* Returns 0 on success or -1 on failure.
+* its original contents are freed if necessary to avoid memory leaks. A view
+* can't be resized so A must be square then. Returns 0 on success or -1 on
+* failure.
 *******************************************************************************/
 int rc_left_multiply_matrix_inplace(rc_matrix_t A, rc_matrix_t* B){
 	rc_matrix_t tmp = rc_empty_matrix();
@@ -417,8 +483,10 @@ int rc_left_multiply_matrix_inplace(rc_matrix_t A, rc_matrix_t* B){
 		rc_free_matrix(&tmp);
 		return -1;
 	}
-	rc_free_matrix(B);
-	*B=tmp;
+	if(unlikely(rc_matrix_replace(B, &tmp))){
+		fprintf(stderr,"ERROR in rc_left_multiply_matrix_inplace, can't resize a view\n");
+		return -1;
+	}
 	return 0;
 }
 
@@ -426,8 +494,9 @@ int rc_left_multiply_matrix_inplace(rc_matrix_t A, rc_matrix_t* B){
 * int rc_right_multiply_matrix_inplace(rc_matrix_t* A, rc_matrix_t B)
 *
 * Multiplies A*B and puts the result back in the place of A. A is resized and
-* its original contents are freed if necessary to avoid memory leaks.
-* Returns 0 on success or -1 on failure.
+* its original contents are freed if necessary to avoid memory leaks. A view
+* can't be resized so B must be square then. Returns 0 on success or -1 on
+* failure.
 *******************************************************************************/
 int rc_right_multiply_matrix_inplace(rc_matrix_t* A, rc_matrix_t B){
 	rc_matrix_t tmp = rc_empty_matrix();
@@ -436,8 +505,10 @@ int rc_right_multiply_matrix_inplace(rc_matrix_t* A, rc_matrix_t B){
 		rc_free_matrix(&tmp);
 		return -1;
 	}
-	rc_free_matrix(A);
-	*A=tmp;
+	if(unlikely(rc_matrix_replace(A, &tmp))){
+		fprintf(stderr,"ERROR in rc_right_multiply_matrix_inplace, can't resize a view\n");
+		return -1;
+	}
 	return 0;
 }
 
@@ -503,14 +574,14 @@ int rc_matrix_transpose(rc_matrix_t A, rc_matrix_t* T){
 		return -1;
 	}
 	// make sure T is allocated
-	if(unlikely(rc_alloc_matrix(T,A.rows,A.cols))){
+	if(unlikely(rc_alloc_matrix(T,A.cols,A.rows))){
 		fprintf(stderr,"ERROR in rc_matrix_transpose, can't allocate memory for T\n");
 		return -1;
 	}
 	// fill in new memory
 	for(i=0;i<(A.rows);i++){
 		for(j=0;j<(A.cols);j++){
-			T->d[i][j] = A.d[j][i];
+			T->d[j][i] = A.d[i][j];
 		}
 	}
 	return 0;
@@ -520,10 +591,14 @@ int rc_matrix_transpose(rc_matrix_t A, rc_matrix_t* T){
 * int rc_matrix_transpose_inplace(rc_matrix_t* A)
 *
 * Transposes matrix A in place. Use as an alternative to rc_matrix_transpose
-* if you no longer have need for the original contents of matrix A.
+* if you no longer have need for the original contents of matrix A. A square
+* matrix is transposed by swapping entries without allocating, a non-square
+* one changes shape so it can't be a view.
 * Returns 0 on success or -1 on failure.
 *******************************************************************************/
 int rc_matrix_transpose_inplace(rc_matrix_t* A){
+	int i, j;
+	RC_REAL t;
 	if(unlikely(A==NULL)){
 		fprintf(stderr,"ERROR in rc_transpose_matrix_inplace, received NULL pointer\n");
 		return -1;
@@ -532,8 +607,21 @@ int rc_matrix_transpose_inplace(rc_matrix_t* A){
 		fprintf(stderr,"ERROR in rc_transpose_matrix_inplace, matrix uninitialized\n");
 		return -1;
 	}
-	// shortcut for 1x1 matrix
-	if(A->rows==1 && A->cols==1) return 0;
+	// square matrices keep their shape, swap across the diagonal
+	if(A->rows==A->cols){
+		for(i=0;i<A->rows;i++){
+			for(j=i+1;j<A->cols;j++){
+				t = A->d[i][j];
+				A->d[i][j] = A->d[j][i];
+				A->d[j][i] = t;
+			}
+		}
+		return 0;
+	}
+	if(unlikely(A->initialized==BORROWED_MEMORY)){
+		fprintf(stderr,"ERROR in rc_transpose_matrix_inplace, can't resize a view\n");
+		return -1;
+	}
 	// allocate memory for new A, easier than doing it in place since A will 
 	// change size if non-square
 	rc_matrix_t tmp = rc_empty_matrix();
@@ -547,3 +635,45 @@ int rc_matrix_transpose_inplace(rc_matrix_t* A){
 	*A=tmp;
 	return 0;
 }
+
+#ifndef RC_ALGEBRA_DOUBLE
+/*******************************************************************************
+* int rc_matrix_to_double(rc_matrix_t A, rc_matrix_d_t* out)
+*
+* Copies a float matrix into a double precision matrix, allocating out if
+* necessary. Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_matrix_to_double(rc_matrix_t A, rc_matrix_d_t* out){
+	int i;
+	if(unlikely(!A.initialized)){
+		fprintf(stderr,"ERROR in rc_matrix_to_double, matrix uninitialized\n");
+		return -1;
+	}
+	if(unlikely(rc_alloc_matrix_d(out,A.rows,A.cols))){
+		fprintf(stderr,"ERROR in rc_matrix_to_double, failed to allocate out\n");
+		return -1;
+	}
+	for(i=0;i<(A.rows*A.cols);i++) out->d[0][i] = A.d[0][i];
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_matrix_to_float(rc_matrix_d_t A, rc_matrix_t* out)
+*
+* Copies a double precision matrix into a float matrix, allocating out if
+* necessary. Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_matrix_to_float(rc_matrix_d_t A, rc_matrix_t* out){
+	int i;
+	if(unlikely(!A.initialized)){
+		fprintf(stderr,"ERROR in rc_matrix_to_float, matrix uninitialized\n");
+		return -1;
+	}
+	if(unlikely(rc_alloc_matrix(out,A.rows,A.cols))){
+		fprintf(stderr,"ERROR in rc_matrix_to_float, failed to allocate out\n");
+		return -1;
+	}
+	for(i=0;i<(A.rows*A.cols);i++) out->d[0][i] = (float)A.d[0][i];
+	return 0;
+}
+#endif // RC_ALGEBRA_DOUBLE
@@ -153,7 +153,8 @@ int rc_poly_add(rc_vector_t a, rc_vector_t b, rc_vector_t* c){
 *
 * Adds polynomials b&a with right justification. The result is placed in vector
 * a and a's original contents are lost. More memory is allocated for a if
-* necessary. Returns 0 on success or -1 on failure.
+* necessary, which a view can't have so b must be no longer then. Returns 0 on
+* success or -1 on failure.
 *******************************************************************************/
 int rc_poly_add_inplace(rc_vector_t* a, rc_vector_t b){
 	rc_vector_t tmp = rc_empty_vector();
@@ -166,8 +167,10 @@ int rc_poly_add_inplace(rc_vector_t* a, rc_vector_t b){
 		fprintf(stderr,"ERROR in rc_poly_add_in_place, add failed\n");
 		return -1;
 	}
-	rc_free_vector(a);
-	*a=tmp;
+	if(unlikely(rc_vector_replace(a, &tmp))){
+		fprintf(stderr,"ERROR in rc_poly_add_in_place, can't resize a view\n");
+		return -1;
+	}
 	return 0;
 }
 
@@ -208,7 +211,7 @@ int rc_poly_subtract(rc_vector_t a, rc_vector_t b, rc_vector_t* c){
 * int rc_poly_subtract_inplace(rc_vector_t* a, rc_vector_t b)
 *
 * Subtracts b from a with right justification. a stays in place and new memory 
-* is allocated only if b is longer than a.
+* is allocated only if b is longer than a, which fails if a is a view.
 *******************************************************************************/
 int rc_poly_subtract_inplace(rc_vector_t* a, rc_vector_t b){
 	rc_vector_t tmp = rc_empty_vector();
@@ -221,8 +224,10 @@ int rc_poly_subtract_inplace(rc_vector_t* a, rc_vector_t b){
 		fprintf(stderr,"ERROR in rc_poly_subtract_in_place, subtract failed\n");
 		return -1;
 	}
-	rc_free_vector(a);
-	*a=tmp;
+	if(unlikely(rc_vector_replace(a, &tmp))){
+		fprintf(stderr,"ERROR in rc_poly_subtract_in_place, can't resize a view\n");
+		return -1;
+	}
 	return 0;
 }
 
@@ -328,13 +333,13 @@ int rc_poly_divide(rc_vector_t n, rc_vector_t d, rc_vector_t* div, rc_vector_t*
 }
 
 /*******************************************************************************
-* int rc_poly_butter(int N, float wc, rc_vector_t* b)
+* int rc_poly_butter(int N, RC_REAL wc, rc_vector_t* b)
 *
 * Calculates vector of coefficients for continuous-time Butterworth polynomial
 * of order N and cutoff wc (rad/s) and places them in vector b.
 * Returns 0 on success or -1 on failure.
 *******************************************************************************/
-int rc_poly_butter(int N, float wc, rc_vector_t* b){
+int rc_poly_butter(int N, RC_REAL wc, rc_vector_t* b){
 	int i;
 	int ret=0;
 	rc_vector_t P2	= rc_empty_vector();
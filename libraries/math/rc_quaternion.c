@@ -59,7 +59,7 @@ int rc_normalize_quaternion(rc_vector_t* q){
 		fprintf(stderr, "ERROR in rc_normalize_quaternion, unable to calculate norm\n");
 		return -1;
 	}
-	for(i=0;i<3;i++) q->d[i]/=len;
+	for(i=0;i<4;i++) q->d[i]/=len;
 	return 0;
 }
 
@@ -73,7 +73,7 @@ int rc_normalize_quaternion_array(float q[4]){
 	int i;
 	float len;
 	float sum=0.0f;
-	for(i=0;i<3;i++) sum+=q[i]*q[i];
+	for(i=0;i<4;i++) sum+=q[i]*q[i];
 	len = sqrtf(sum);
 
 	// can't check if length is below a constant value as q may be filled
@@ -82,7 +82,7 @@ int rc_normalize_quaternion_array(float q[4]){
 		fprintf(stderr, "ERROR in quaternion has 0 length\n");
 		return -1;
 	}
-	for(i=0;i<3;i++) q[i]=q[i]/len;
+	for(i=0;i<4;i++) q[i]=q[i]/len;
 	return 0;
 }
 
@@ -365,9 +365,9 @@ void rc_quaternion_multiply_array(float a[4], float b[4], float c[4]){
 	tmp[3][2] =  a[1];
 	tmp[3][3] =  a[0];
 	// multiply
-	for(i=0;i<3;i++){
+	for(i=0;i<4;i++){
 		c[i]=0.0f;
-		for(j=0;j<3;j++) c[i]+=tmp[i][j]*b[j];
+		for(j=0;j<4;j++) c[i]+=tmp[i][j]*b[j];
 	}
 	return;
 }
@@ -0,0 +1,322 @@
+/*******************************************************************************
+* rc_riccati.c
+*
+* Discrete algebraic Riccati equation solver and LQR gain computation using the
+* structure-preserving doubling algorithm (SDA). Each doubling step squares the
+* effective horizon so convergence is quadratic and usually takes well under
+* 20 iterations. All matrices used during the iteration live in a preallocated
+* rc_dare_workspace_t so gains can be recomputed on-board without heap traffic.
+*
+* Reference: Chu, Fan, Lin & Wang, "Structure-Preserving Algorithms for
+* Periodic Discrete-Time Algebraic Riccati Equations", 2004.
+*******************************************************************************/
+
+#include "rc_algebra_common.h"
+
+#define DARE_MAX_ITER	60		// doubling steps before giving up
+#define DARE_TOL		1e-6f	// relative change in P considered converged
+
+/*******************************************************************************
+* void dare_mult(float** A, float** B, float** C, int n, int k, int m)
+*
+* C = A*B where A is n x k and B is k x m. Uses i-k-j loop ordering so the
+* inner loop runs along contiguous rows of B and C. Only used internally.
+*******************************************************************************/
+static void dare_mult(float** A, float** B, float** C, int n, int k, int m){
+	int i,j,p;
+	float a;
+	float* __restrict__ c;
+	float* __restrict__ b;
+	for(i=0;i<n;i++){
+		c = C[i];
+		for(j=0;j<m;j++) c[j]=0.0f;
+		for(p=0;p<k;p++){
+			a = A[i][p];
+			b = B[p];
+			for(j=0;j<m;j++) c[j] += a*b[j];
+		}
+	}
+	return;
+}
+
+/*******************************************************************************
+* rc_dare_workspace_t rc_empty_dare_workspace()
+*
+* Returns an rc_dare_workspace_t with no allocated memory and the initialized
+* flag set to 0.
+*******************************************************************************/
+rc_dare_workspace_t rc_empty_dare_workspace(){
+	rc_dare_workspace_t out;
+	out.n = 0;
+	out.m = 0;
+	out.iterations = 0;
+	out.Ak = rc_empty_matrix();
+	out.Gk = rc_empty_matrix();
+	out.Hk = rc_empty_matrix();
+	out.W  = rc_empty_matrix();
+	out.XA = rc_empty_matrix();
+	out.XG = rc_empty_matrix();
+	out.T  = rc_empty_matrix();
+	out.S  = rc_empty_matrix();
+	out.Y  = rc_empty_matrix();
+	out.NB = rc_empty_matrix();
+	out.piv = NULL;
+	out.initialized = 0;
+	return out;
+}
+
+/*******************************************************************************
+* int rc_free_dare_workspace(rc_dare_workspace_t* ws)
+*
+* Frees all memory in the workspace. Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_free_dare_workspace(rc_dare_workspace_t* ws){
+	if(unlikely(ws==NULL)){
+		fprintf(stderr,"ERROR in rc_free_dare_workspace, received NULL pointer\n");
+		return -1;
+	}
+	rc_free_matrix(&ws->Ak);
+	rc_free_matrix(&ws->Gk);
+	rc_free_matrix(&ws->Hk);
+	rc_free_matrix(&ws->W);
+	rc_free_matrix(&ws->XA);
+	rc_free_matrix(&ws->XG);
+	rc_free_matrix(&ws->T);
+	rc_free_matrix(&ws->S);
+	rc_free_matrix(&ws->Y);
+	rc_free_matrix(&ws->NB);
+	free(ws->piv);
+	*ws = rc_empty_dare_workspace();
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_alloc_dare_workspace(rc_dare_workspace_t* ws, int n, int m)
+*
+* Allocates a workspace for systems with n states and m inputs. If ws is
+* already the right size nothing is done. Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_alloc_dare_workspace(rc_dare_workspace_t* ws, int n, int m){
+	if(unlikely(ws==NULL)){
+		fprintf(stderr,"ERROR in rc_alloc_dare_workspace, received NULL pointer\n");
+		return -1;
+	}
+	if(unlikely(n<1 || m<1)){
+		fprintf(stderr,"ERROR in rc_alloc_dare_workspace, n and m must be >=1\n");
+		return -1;
+	}
+	if(ws->initialized && ws->n==n && ws->m==m) return 0;
+	rc_free_dare_workspace(ws);
+	if(unlikely(rc_alloc_matrix(&ws->Ak,n,n) || rc_alloc_matrix(&ws->Gk,n,n) ||
+				rc_alloc_matrix(&ws->Hk,n,n) || rc_alloc_matrix(&ws->W,n,n)  ||
+				rc_alloc_matrix(&ws->XA,n,n) || rc_alloc_matrix(&ws->XG,n,n) ||
+				rc_alloc_matrix(&ws->T,n,n)  || rc_alloc_matrix(&ws->S,m,m)  ||
+				rc_alloc_matrix(&ws->Y,m,n)  || rc_alloc_matrix(&ws->NB,n,m))){
+		fprintf(stderr,"ERROR in rc_alloc_dare_workspace, failed to allocate matrix\n");
+		rc_free_dare_workspace(ws);
+		return -1;
+	}
+	ws->piv = (int*)malloc((n>m?n:m)*sizeof(int));
+	if(unlikely(ws->piv==NULL)){
+		fprintf(stderr,"ERROR in rc_alloc_dare_workspace, not enough memory\n");
+		rc_free_dare_workspace(ws);
+		return -1;
+	}
+	ws->n = n;
+	ws->m = m;
+	ws->initialized = 1;
+	return 0;
+}
+
+/*******************************************************************************
+* int dare_check_args(...)
+*
+* dimension checks shared by rc_dare_solve and rc_lqr_gain
+*******************************************************************************/
+static int dare_check_args(const char* fn, rc_matrix_t A, rc_matrix_t B, \
+									rc_matrix_t Q, rc_matrix_t R){
+	if(unlikely(!A.initialized||!B.initialized||!Q.initialized||!R.initialized)){
+		fprintf(stderr,"ERROR in %s, matrix uninitialized\n",fn);
+		return -1;
+	}
+	if(unlikely(A.rows!=A.cols || B.rows!=A.rows || Q.rows!=A.rows || \
+				Q.cols!=A.rows || R.rows!=B.cols || R.cols!=B.cols)){
+		fprintf(stderr,"ERROR in %s, dimension mismatch\n",fn);
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int dare_iterate(rc_matrix_t A, rc_matrix_t B, rc_matrix_t Q, rc_matrix_t R,
+*												rc_dare_workspace_t* ws)
+*
+* Runs the doubling iteration leaving the solution in ws->Hk.
+*
+* A_0 = A, G_0 = B R^-1 B', H_0 = Q
+* W_k = I + G_k H_k
+* A_k+1 = A_k W_k^-1 A_k
+* G_k+1 = G_k + A_k W_k^-1 G_k A_k'
+* H_k+1 = H_k + A_k' H_k W_k^-1 A_k
+*******************************************************************************/
+static int dare_iterate(rc_matrix_t A, rc_matrix_t B, rc_matrix_t Q, \
+								rc_matrix_t R, rc_dare_workspace_t* ws){
+	int i,j,p,k;
+	int n = ws->n;
+	int m = ws->m;
+	float a, inc, nrm, tmp;
+	rc_matrix_t swap;
+
+	// G_0 = B R^-1 B', solve R Y = B' for Y=R^-1 B'
+	for(i=0;i<m;i++){
+		for(j=0;j<m;j++) ws->S.d[i][j]=R.d[i][j];
+		for(j=0;j<n;j++) ws->Y.d[i][j]=B.d[j][i];
+	}
+	if(unlikely(rc_lu_factor_inplace(ws->S.d,m,ws->piv))){
+		fprintf(stderr,"ERROR in rc_dare_solve, R is singular\n");
+		return -1;
+	}
+	rc_lu_solve_inplace(ws->S.d,m,ws->piv,ws->Y.d,n);
+	dare_mult(B.d,ws->Y.d,ws->Gk.d,n,m,n);
+	// A_0 and H_0
+	memcpy(ws->Ak.d[0],A.d[0],n*n*sizeof(float));
+	memcpy(ws->Hk.d[0],Q.d[0],n*n*sizeof(float));
+
+	for(k=1;k<=DARE_MAX_ITER;k++){
+		// W = I + G*H, factor it once and solve for both right hand sides
+		dare_mult(ws->Gk.d,ws->Hk.d,ws->W.d,n,n,n);
+		for(i=0;i<n;i++) ws->W.d[i][i] += 1.0f;
+		if(unlikely(rc_lu_factor_inplace(ws->W.d,n,ws->piv))){
+			fprintf(stderr,"ERROR in rc_dare_solve, I+GH became singular\n");
+			return -1;
+		}
+		memcpy(ws->XA.d[0],ws->Ak.d[0],n*n*sizeof(float));
+		memcpy(ws->XG.d[0],ws->Gk.d[0],n*n*sizeof(float));
+		rc_lu_solve_inplace(ws->W.d,n,ws->piv,ws->XA.d,n);
+		rc_lu_solve_inplace(ws->W.d,n,ws->piv,ws->XG.d,n);
+		// G += (A W^-1 G) A'
+		dare_mult(ws->Ak.d,ws->XG.d,ws->T.d,n,n,n);
+		for(i=0;i<n;i++){
+			for(j=0;j<n;j++){
+				ws->Gk.d[i][j] += rc_mult_accumulate(ws->T.d[i],ws->Ak.d[j],n);
+			}
+		}
+		// H += A' (H W^-1 A). XG is free now so build the increment there
+		// first and use its size to judge convergence
+		dare_mult(ws->Hk.d,ws->XA.d,ws->T.d,n,n,n);
+		for(i=0;i<n;i++){
+			for(j=0;j<n;j++) ws->XG.d[i][j] = 0.0f;
+		}
+		for(p=0;p<n;p++){
+			for(i=0;i<n;i++){
+				a = ws->Ak.d[p][i];
+				for(j=0;j<n;j++) ws->XG.d[i][j] += a*ws->T.d[p][j];
+			}
+		}
+		inc = 0.0f;
+		nrm = 0.0f;
+		for(i=0;i<n;i++){
+			for(j=0;j<n;j++){
+				ws->Hk.d[i][j] += ws->XG.d[i][j];
+				inc += fabs(ws->XG.d[i][j]);
+				nrm += fabs(ws->Hk.d[i][j]);
+			}
+		}
+		// A = A W^-1 A, written to T then swapped in to avoid a copy
+		dare_mult(ws->Ak.d,ws->XA.d,ws->T.d,n,n,n);
+		swap = ws->Ak;
+		ws->Ak = ws->T;
+		ws->T = swap;
+		if(unlikely(nrm!=nrm)){
+			fprintf(stderr,"ERROR in rc_dare_solve, iteration diverged\n");
+			return -1;
+		}
+		if(inc<=DARE_TOL*nrm){
+			ws->iterations = k;
+			// remove any asymmetry from round-off
+			for(i=0;i<n;i++){
+				for(j=i+1;j<n;j++){
+					tmp = 0.5f*(ws->Hk.d[i][j]+ws->Hk.d[j][i]);
+					ws->Hk.d[i][j] = tmp;
+					ws->Hk.d[j][i] = tmp;
+				}
+			}
+			return 0;
+		}
+	}
+	ws->iterations = DARE_MAX_ITER;
+	fprintf(stderr,"ERROR in rc_dare_solve, failed to converge, is (A,B) stabilizable?\n");
+	return -1;
+}
+
+/*******************************************************************************
+* int rc_dare_solve(rc_matrix_t A, rc_matrix_t B, rc_matrix_t Q, rc_matrix_t R,
+*								rc_dare_workspace_t* ws, rc_matrix_t* P)
+*
+* Solves the discrete algebraic Riccati equation
+* P = A'PA - A'PB(R+B'PB)^-1 B'PA + Q
+* for the stabilizing solution P. ws is allocated on first use and reused on
+* later calls of the same size. Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_dare_solve(rc_matrix_t A, rc_matrix_t B, rc_matrix_t Q, rc_matrix_t R,\
+								rc_dare_workspace_t* ws, rc_matrix_t* P){
+	if(dare_check_args("rc_dare_solve",A,B,Q,R)) return -1;
+	if(unlikely(rc_alloc_dare_workspace(ws,A.rows,B.cols))){
+		fprintf(stderr,"ERROR in rc_dare_solve, failed to allocate workspace\n");
+		return -1;
+	}
+	if(dare_iterate(A,B,Q,R,ws)) return -1;
+	if(unlikely(rc_alloc_matrix(P,ws->n,ws->n))){
+		fprintf(stderr,"ERROR in rc_dare_solve, failed to allocate P\n");
+		return -1;
+	}
+	memcpy(P->d[0],ws->Hk.d[0],ws->n*ws->n*sizeof(float));
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_lqr_gain(rc_matrix_t A, rc_matrix_t B, rc_matrix_t Q, rc_matrix_t R,
+*								rc_dare_workspace_t* ws, rc_matrix_t* K)
+*
+* Computes the infinite-horizon discrete LQR gain K=(R+B'PB)^-1 B'PA such that
+* u=-Kx minimizes the sum of x'Qx + u'Ru. The Riccati solution is left in
+* ws->Hk. Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_lqr_gain(rc_matrix_t A, rc_matrix_t B, rc_matrix_t Q, rc_matrix_t R,\
+								rc_dare_workspace_t* ws, rc_matrix_t* K){
+	int i,j,p,n,m;
+	float a;
+	if(dare_check_args("rc_lqr_gain",A,B,Q,R)) return -1;
+	if(unlikely(rc_alloc_dare_workspace(ws,A.rows,B.cols))){
+		fprintf(stderr,"ERROR in rc_lqr_gain, failed to allocate workspace\n");
+		return -1;
+	}
+	if(dare_iterate(A,B,Q,R,ws)) return -1;
+	n = ws->n;
+	m = ws->m;
+	if(unlikely(rc_alloc_matrix(K,m,n))){
+		fprintf(stderr,"ERROR in rc_lqr_gain, failed to allocate K\n");
+		return -1;
+	}
+	// NB = P*B, S = R + B'PB and Y = B'P so that K = (R+B'PB)^-1 Y A
+	dare_mult(ws->Hk.d,B.d,ws->NB.d,n,n,m);
+	for(i=0;i<m;i++){
+		for(j=0;j<m;j++) ws->S.d[i][j] = R.d[i][j];
+	}
+	for(p=0;p<n;p++){
+		for(i=0;i<m;i++){
+			a = B.d[p][i];
+			for(j=0;j<m;j++) ws->S.d[i][j] += a*ws->NB.d[p][j];
+		}
+	}
+	for(i=0;i<n;i++){
+		for(j=0;j<m;j++) ws->Y.d[j][i] = ws->NB.d[i][j];
+	}
+	dare_mult(ws->Y.d,A.d,K->d,m,n,n);
+	if(unlikely(rc_lu_factor_inplace(ws->S.d,m,ws->piv))){
+		fprintf(stderr,"ERROR in rc_lqr_gain, R+B'PB is singular\n");
+		return -1;
+	}
+	rc_lu_solve_inplace(ws->S.d,m,ws->piv,K->d,n);
+	return 0;
+}
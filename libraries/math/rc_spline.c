@@ -0,0 +1,275 @@
+/*******************************************************************************
+* rc_spline.c
+*
+* Cubic spline trajectories through waypoints. Fitting solves the tridiagonal
+* system for the knot second derivatives with rc_tridiag_solve in O(n) and
+* keeps all intermediate vectors in the rc_spline_t struct so trajectories can
+* be re-planned on the fly without touching the heap as long as the number of
+* waypoints stays the same. Evaluation remembers the last segment so sampling
+* a trajectory forward in time is O(1) per sample, O(log n) otherwise.
+*******************************************************************************/
+
+#include "rc_algebra_common.h"
+
+/*******************************************************************************
+* rc_spline_t rc_empty_spline()
+*
+* Returns an rc_spline_t struct which is completely zero'd out with no memory
+* allocated for it. Splines should be initialized with this when declared.
+*******************************************************************************/
+rc_spline_t rc_empty_spline(){
+	rc_spline_t out;
+	// zero-out piecemeal instead of with memset to avoid issues with padding
+	out.n = 0;
+	out.last = 0;
+	out.t = rc_empty_vector();
+	out.c = rc_empty_matrix();
+	out.sub = rc_empty_vector();
+	out.diag = rc_empty_vector();
+	out.sup = rc_empty_vector();
+	out.rhs = rc_empty_vector();
+	out.m = rc_empty_vector();
+	out.initialized = 0;
+	return out;
+}
+
+/*******************************************************************************
+* int rc_free_spline(rc_spline_t* s)
+*
+* Frees all memory used by the spline and returns it to the empty state.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_free_spline(rc_spline_t* s){
+	if(unlikely(s==NULL)){
+		fprintf(stderr,"ERROR in rc_free_spline, received NULL pointer\n");
+		return -1;
+	}
+	rc_free_vector(&s->t);
+	rc_free_matrix(&s->c);
+	rc_free_vector(&s->sub);
+	rc_free_vector(&s->diag);
+	rc_free_vector(&s->sup);
+	rc_free_vector(&s->rhs);
+	rc_free_vector(&s->m);
+	*s = rc_empty_spline();
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_spline_fit(rc_spline_t* s, rc_vector_t t, rc_vector_t y,
+*								rc_spline_bc_t bc, float v0, float vn)
+*
+* Fits a cubic spline through the points (t[i],y[i]). t must be strictly
+* increasing and contain at least 2 points. With RC_SPLINE_NATURAL the second
+* derivative is zero at both ends and v0, vn are ignored. With
+* RC_SPLINE_CLAMPED the first derivative at the ends is set to v0 and vn, use
+* 0 for both to start and stop at rest. Invalid arguments leave s as it was,
+* any later failure frees s so a half built spline can't be evaluated.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_spline_fit(rc_spline_t* s, rc_vector_t t, rc_vector_t y,\
+								rc_spline_bc_t bc, float v0, float vn){
+	int i, n;
+	float h, hp, dy, dyp;
+	// sanity checks
+	if(unlikely(s==NULL)){
+		fprintf(stderr,"ERROR in rc_spline_fit, received NULL pointer\n");
+		return -1;
+	}
+	if(unlikely(!t.initialized || !y.initialized)){
+		fprintf(stderr,"ERROR in rc_spline_fit, vector uninitialized\n");
+		return -1;
+	}
+	n = t.len;
+	if(unlikely(y.len!=n)){
+		fprintf(stderr,"ERROR in rc_spline_fit, t and y must be the same length\n");
+		return -1;
+	}
+	if(unlikely(n<2)){
+		fprintf(stderr,"ERROR in rc_spline_fit, need at least 2 points\n");
+		return -1;
+	}
+	for(i=1;i<n;i++){
+		if(unlikely(t.d[i]<=t.d[i-1])){
+			fprintf(stderr,"ERROR in rc_spline_fit, t must be strictly increasing\n");
+			return -1;
+		}
+	}
+	if(unlikely(bc!=RC_SPLINE_NATURAL && bc!=RC_SPLINE_CLAMPED)){
+		fprintf(stderr,"ERROR in rc_spline_fit, invalid boundary condition\n");
+		return -1;
+	}
+	// these do nothing when re-planning with the same number of points
+	if(unlikely(rc_duplicate_vector(t,&s->t)			||\
+				rc_alloc_matrix(&s->c,n-1,4)			||\
+				rc_alloc_vector(&s->sub,n)				||\
+				rc_alloc_vector(&s->diag,n)				||\
+				rc_alloc_vector(&s->sup,n)				||\
+				rc_alloc_vector(&s->rhs,n))){
+		fprintf(stderr,"ERROR in rc_spline_fit, failed to allocate memory\n");
+		rc_free_spline(s);
+		return -1;
+	}
+	// interior rows of the tridiagonal system for the second derivatives m:
+	// h[i-1]m[i-1] + 2(h[i-1]+h[i])m[i] + h[i]m[i+1] = 6(dy[i]/h[i]-dy[i-1]/h[i-1])
+	for(i=1;i<n-1;i++){
+		hp  = t.d[i]-t.d[i-1];
+		h   = t.d[i+1]-t.d[i];
+		dyp = (y.d[i]-y.d[i-1])/hp;
+		dy  = (y.d[i+1]-y.d[i])/h;
+		s->sub.d[i]  = hp;
+		s->diag.d[i] = 2.0f*(hp+h);
+		s->sup.d[i]  = h;
+		s->rhs.d[i]  = 6.0f*(dy-dyp);
+	}
+	// boundary rows
+	if(bc==RC_SPLINE_NATURAL){
+		s->diag.d[0] = 1.0f;
+		s->sup.d[0]  = 0.0f;
+		s->rhs.d[0]  = 0.0f;
+		s->sub.d[n-1]  = 0.0f;
+		s->diag.d[n-1] = 1.0f;
+		s->rhs.d[n-1]  = 0.0f;
+	}
+	else{
+		h = t.d[1]-t.d[0];
+		s->diag.d[0] = 2.0f*h;
+		s->sup.d[0]  = h;
+		s->rhs.d[0]  = 6.0f*((y.d[1]-y.d[0])/h - v0);
+		h = t.d[n-1]-t.d[n-2];
+		s->sub.d[n-1]  = h;
+		s->diag.d[n-1] = 2.0f*h;
+		s->rhs.d[n-1]  = 6.0f*(vn - (y.d[n-1]-y.d[n-2])/h);
+	}
+	s->sub.d[0] = 0.0f;
+	s->sup.d[n-1] = 0.0f;
+	if(unlikely(rc_tridiag_solve(s->sub,s->diag,s->sup,s->rhs,&s->m))){
+		fprintf(stderr,"ERROR in rc_spline_fit, failed to solve for knot curvature\n");
+		rc_free_spline(s);
+		return -1;
+	}
+	// polynomial coefficients per segment in local time u=t-t[i]:
+	// y = c0 + c1*u + c2*u^2 + c3*u^3
+	for(i=0;i<n-1;i++){
+		h = t.d[i+1]-t.d[i];
+		s->c.d[i][0] = y.d[i];
+		s->c.d[i][1] = (y.d[i+1]-y.d[i])/h - h*(2.0f*s->m.d[i]+s->m.d[i+1])/6.0f;
+		s->c.d[i][2] = 0.5f*s->m.d[i];
+		s->c.d[i][3] = (s->m.d[i+1]-s->m.d[i])/(6.0f*h);
+	}
+	s->n = n;
+	if(s->last>n-2) s->last = 0;
+	s->initialized = 1;
+	return 0;
+}
+
+/*******************************************************************************
+* int spline_segment(rc_spline_t* s, float t)
+*
+* Finds the segment i such that t[i]<=t<t[i+1]. The segment found last time is
+* checked first, then the next one, before falling back to a binary search.
+* Only called with t inside the knot range.
+*******************************************************************************/
+static inline int spline_segment(rc_spline_t* s, float t){
+	int lo, hi, mid;
+	int i = s->last;
+	float* k = s->t.d;
+	if(likely(t>=k[i] && t<k[i+1])) return i;
+	if(i+2<s->n && t>=k[i+1] && t<k[i+2]){
+		s->last = i+1;
+		return i+1;
+	}
+	lo = 0;
+	hi = s->n-1;
+	while(hi-lo>1){
+		mid = (lo+hi)>>1;
+		if(t>=k[mid]) lo=mid;
+		else hi=mid;
+	}
+	s->last = lo;
+	return lo;
+}
+
+/*******************************************************************************
+* void spline_eval(rc_spline_t* s, float t, float* pos, float* vel, float* acc)
+*
+* Evaluates the spline with no sanity checks, any output pointer may be NULL.
+* Outside the knot range the position is held at the end point and the
+* velocity and acceleration are zero.
+*******************************************************************************/
+static inline void spline_eval(rc_spline_t* s, float t, float* pos, float* vel, float* acc){
+	int i;
+	float u;
+	float* c;
+	if(unlikely(t<s->t.d[0] || t>=s->t.d[s->n-1])){
+		if(t<s->t.d[0]){
+			if(pos!=NULL) *pos = s->c.d[0][0];
+		}
+		else{
+			// end point from the last segment
+			i = s->n-2;
+			u = s->t.d[s->n-1]-s->t.d[i];
+			c = s->c.d[i];
+			if(pos!=NULL) *pos = c[0]+u*(c[1]+u*(c[2]+u*c[3]));
+		}
+		if(vel!=NULL) *vel = 0.0f;
+		if(acc!=NULL) *acc = 0.0f;
+		return;
+	}
+	i = spline_segment(s,t);
+	u = t-s->t.d[i];
+	c = s->c.d[i];
+	if(pos!=NULL) *pos = c[0]+u*(c[1]+u*(c[2]+u*c[3]));
+	if(vel!=NULL) *vel = c[1]+u*(2.0f*c[2]+3.0f*u*c[3]);
+	if(acc!=NULL) *acc = 2.0f*c[2]+6.0f*u*c[3];
+	return;
+}
+
+/*******************************************************************************
+* int rc_spline_eval(rc_spline_t* s, float t, float* pos, float* vel, float* acc)
+*
+* Evaluates position, velocity and acceleration of the spline at time t. Any
+* of the output pointers may be NULL if that quantity is not needed. Outside of
+* the knot range the position is held at the nearest end point and velocity and
+* acceleration are zero. Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_spline_eval(rc_spline_t* s, float t, float* pos, float* vel, float* acc){
+	if(unlikely(s==NULL || !s->initialized)){
+		fprintf(stderr,"ERROR in rc_spline_eval, spline not initialized\n");
+		return -1;
+	}
+	spline_eval(s,t,pos,vel,acc);
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_spline_eval_batch(rc_spline_t* s, rc_vector_t t, rc_vector_t* pos,
+*								rc_vector_t* vel, rc_vector_t* acc)
+*
+* Evaluates the spline at every time in t, resizing the output vectors to match
+* if necessary. vel and acc may be NULL. Times in ascending order are fastest
+* since each lookup then starts from the previous segment.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_spline_eval_batch(rc_spline_t* s, rc_vector_t t, rc_vector_t* pos,\
+								rc_vector_t* vel, rc_vector_t* acc){
+	int i;
+	if(unlikely(s==NULL || !s->initialized)){
+		fprintf(stderr,"ERROR in rc_spline_eval_batch, spline not initialized\n");
+		return -1;
+	}
+	if(unlikely(!t.initialized || pos==NULL)){
+		fprintf(stderr,"ERROR in rc_spline_eval_batch, invalid arguments\n");
+		return -1;
+	}
+	if(unlikely(rc_alloc_vector(pos,t.len) ||\
+			(vel!=NULL && rc_alloc_vector(vel,t.len)) ||\
+			(acc!=NULL && rc_alloc_vector(acc,t.len)))){
+		fprintf(stderr,"ERROR in rc_spline_eval_batch, failed to allocate output\n");
+		return -1;
+	}
+	for(i=0;i<t.len;i++){
+		spline_eval(s,t.d[i],&pos->d[i],vel?&vel->d[i]:NULL,acc?&acc->d[i]:NULL);
+	}
+	return 0;
+}
@@ -29,10 +29,15 @@ int rc_alloc_vector(rc_vector_t* v, int length){
 	}
 	// if v is already allocated and of the right size, nothing to do!
 	if(v->initialized && v->len==length) return 0;
+	// a view can't grow into new memory without leaving the user's array
+	if(unlikely(v->initialized==BORROWED_MEMORY)){
+		fprintf(stderr,"ERROR in rc_alloc_vector, can't resize a view\n");
+		return -1;
+	}
 	// free any old memory 
 	rc_free_vector(v);
 	// allocate contiguous memory for the vector
-	v->d = (float*)malloc(length*sizeof(float));
+	v->d = (RC_REAL*)malloc(length*sizeof(RC_REAL));
 	if(unlikely(v->d==NULL)){
 		fprintf(stderr,"ERROR in rc_alloc_vector, not enough memory\n");
 		return -1;
@@ -57,8 +62,8 @@ int rc_free_vector(rc_vector_t* v){
 		fprintf(stderr,"ERROR rc_free_vector, received NULL pointer\n");
 		return -1;
 	}
-	// free memory
-	if(v->initialized)free(v->d);
+	// free memory, views only borrow their memory from the user
+	if(v->initialized && v->initialized!=BORROWED_MEMORY) free(v->d);
 	// zero out the struct
 	*v = rc_empty_vector();
 	return 0;
@@ -102,7 +107,7 @@ int rc_vector_zeros(rc_vector_t* v, int length){
 	// free any old memory 
 	rc_free_vector(v);
 	// allocate contiguous zeroed-out memory for the vector
-	v->d = (float*)calloc(length,sizeof(float));
+	v->d = (RC_REAL*)calloc(length,sizeof(RC_REAL));
 	if(unlikely(v->d==NULL)){
 		fprintf(stderr,"ERROR in rc_vector_zeros, not enough memory\n");
 		return -1;
@@ -145,7 +150,7 @@ int rc_random_vector(rc_vector_t* v, int length){
 		fprintf(stderr,"ERROR rc_random_vector, failed to allocate vector\n");
 		return -1;
 	}
-	for(i=0;i<length;i++) v->d[i]=rc_get_random_float();
+	for(i=0;i<length;i++) v->d[i]=RC_RANDOM();
 	return 0;
 }
 
@@ -169,7 +174,7 @@ int rc_vector_fibonnaci(rc_vector_t* v, int length){
 
 
 /*******************************************************************************
-* int rc_vector_from_array(rc_vector_t* v, float* ptr, int length)
+* int rc_vector_from_array(rc_vector_t* v, RC_REAL* ptr, int length)
 *
 * Sometimes you will have a normal C-array of floats and wish to convert to 
 * rc_vector_t format for use with the other linear algebra functions.
@@ -177,7 +182,7 @@ int rc_vector_fibonnaci(rc_vector_t* v, int length){
 * ensures v is sized correctly. Existing data in v (if any) is freed and lost.
 * Returns 0 on success or -1 on failure.
 *******************************************************************************/
-int rc_vector_from_array(rc_vector_t* v, float* ptr, int length){
+int rc_vector_from_array(rc_vector_t* v, RC_REAL* ptr, int length){
 	// sanity check pointer
 	if(unlikely(ptr==NULL)){
 		fprintf(stderr,"ERROR in rc_vector_from_array, received NULL pointer\n");
@@ -189,7 +194,56 @@ int rc_vector_from_array(rc_vector_t* v, float* ptr, int length){
 		return -1;
 	}
 	// duplicate memory over
-	memcpy(v->d, ptr, length*sizeof(float));
+	memcpy(v->d, ptr, length*sizeof(RC_REAL));
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_vector_view_array(rc_vector_t* v, RC_REAL* ptr, int length)
+*
+* Like rc_vector_from_array but without the copy. v is pointed at the user's
+* existing array so writes through v land directly in the array. The array
+* still belongs to the caller and must outlive v. rc_free_vector only resets a
+* view and never frees the array. Nothing resizes a view, so results land in
+* the array or the operation fails. Any existing memory in v is freed first.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_vector_view_array(rc_vector_t* v, RC_REAL* ptr, int length){
+	if(unlikely(v==NULL || ptr==NULL)){
+		fprintf(stderr,"ERROR in rc_vector_view_array, received NULL pointer\n");
+		return -1;
+	}
+	if(unlikely(length<1)){
+		fprintf(stderr,"ERROR in rc_vector_view_array, length must be >=1\n");
+		return -1;
+	}
+	rc_free_vector(v);
+	v->d = ptr;
+	v->len = length;
+	v->initialized = BORROWED_MEMORY;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_vector_replace(rc_vector_t* v, rc_vector_t* tmp)
+*
+* Vector version of rc_matrix_replace, finishes an in place operation that
+* built its result in tmp. A view gets the result copied into the user's array,
+* which needs the same length. tmp is freed or taken over either way. Returns 0
+* on success or -1 if v is a view of a different length.
+*******************************************************************************/
+int rc_vector_replace(rc_vector_t* v, rc_vector_t* tmp){
+	if(v->initialized==BORROWED_MEMORY){
+		if(unlikely(v->len!=tmp->len)){
+			rc_free_vector(tmp);
+			return -1;
+		}
+		memcpy(v->d, tmp->d, v->len*sizeof(RC_REAL));
+		rc_free_vector(tmp);
+		return 0;
+	}
+	rc_free_vector(v);
+	*v = *tmp;
 	return 0;
 }
 
@@ -215,13 +269,13 @@ int rc_duplicate_vector(rc_vector_t a, rc_vector_t* b){
 		return -1;
 	}
 	// copy memory over
-	memcpy(b->d, a.d, a.len*sizeof(float));
+	memcpy(b->d, a.d, a.len*sizeof(RC_REAL));
 	return 0;
 }
 
 
 /*******************************************************************************
-* int rc_set_vector_entry(rc_vector_t* v, int pos, float val)
+* int rc_set_vector_entry(rc_vector_t* v, int pos, RC_REAL val)
 *
 * Sets the entry of vector 'v' in position 'pos' to 'val' where the position is
 * zero-indexed. In practice this is never used as it is much easier for the user
@@ -238,7 +292,7 @@ int rc_duplicate_vector(rc_vector_t a, rc_vector_t* b){
 * by the function. 
 * Returns 0 on success or -1 on error.
 *******************************************************************************/
-int rc_set_vector_entry(rc_vector_t* v, int pos, float val){
+int rc_set_vector_entry(rc_vector_t* v, int pos, RC_REAL val){
 	if(unlikely(v==NULL)){
 		fprintf(stderr,"ERROR in rc_set_vector_entry, received NULL pointer\n");
 		return -1;
@@ -256,7 +310,7 @@ int rc_set_vector_entry(rc_vector_t* v, int pos, float val){
 }
 
 /*******************************************************************************
-* float rc_get_vector_entry(rc_vector_t v, int pos)
+* RC_REAL rc_get_vector_entry(rc_vector_t v, int pos)
 *
 * Returns the entry of vector 'v' in position 'pos' where the position is
 * zero-indexed. Returns -1.0f on failure and prints an error message to stderr.
@@ -268,7 +322,7 @@ int rc_set_vector_entry(rc_vector_t* v, int pos, float val){
 * However, we provide this function for completeness. It also provides sanity
 * checks to avoid possible segfaults.
 *******************************************************************************/
-float rc_get_vector_entry(rc_vector_t v, int pos){
+RC_REAL rc_get_vector_entry(rc_vector_t v, int pos){
 	if(unlikely(!v.initialized)){
 		fprintf(stderr,"ERROR in rc_get_vector_entry, v not initialized yet\n");
 		return -1.0f;
@@ -319,7 +373,7 @@ int rc_print_vector_sci(rc_vector_t v){
 
 
 /*******************************************************************************
-* int rc_vector_times_scalar(rc_vector_t* v, float s)
+* int rc_vector_times_scalar(rc_vector_t* v, RC_REAL s)
 *
 * Multiplies every entry in vector v by scalar s. It is not strictly
 * necessary for v to be provided as a pointer since a copy of the struct v
@@ -330,7 +384,7 @@ int rc_print_vector_sci(rc_vector_t v){
 * by the function.
 * Returns 0 on success or -1 on failure.
 *******************************************************************************/
-int rc_vector_times_scalar(rc_vector_t* v, float s){
+int rc_vector_times_scalar(rc_vector_t* v, RC_REAL s){
 	int i;
 	if(unlikely(!v->initialized)){
 		fprintf(stderr,"ERROR in rc_vector_times_scalar, vector uninitialized\n");
@@ -342,7 +396,7 @@ int rc_vector_times_scalar(rc_vector_t* v, float s){
 
 
 /*******************************************************************************
-* float rc_vector_norm(rc_vector_t v, float p)
+* RC_REAL rc_vector_norm(rc_vector_t v, RC_REAL p)
 *
 * Just like the matlab norm(v,p) function, returns the vector norm defined by
 * sum(abs(v)^p)^(1/p), where p is any positive real value. Most common norms
@@ -350,8 +404,8 @@ int rc_vector_times_scalar(rc_vector_t* v, float s){
 * 2-norm which is the square root of sum of squares.
 * for infinity and -infinity norms see vector_max and vector_min
 *******************************************************************************/
-float rc_vector_norm(rc_vector_t v, float p){
-	float norm = 0.0f;
+RC_REAL rc_vector_norm(rc_vector_t v, RC_REAL p){
+	RC_REAL norm = 0.0f;
 	int i;
 	if(unlikely(!v.initialized)){
 		fprintf(stderr,"ERROR in rc_vector_norm, vector not initialized yet\n");
@@ -387,7 +441,7 @@ float rc_vector_norm(rc_vector_t v, float p){
 int rc_vector_max(rc_vector_t v){
 	int i;
 	int index = 0;
-	float tmp = -FLT_MAX;
+	RC_REAL tmp = -RC_REAL_MAX;
 	if(unlikely(!v.initialized)){
 		fprintf(stderr,"ERROR in rc_vector_max, vector not initialized yet\n");
 		return -1;
@@ -412,7 +466,7 @@ int rc_vector_max(rc_vector_t v){
 int rc_vector_min(rc_vector_t v){
 	int i;
 	int index = 0;
-	float tmp = FLT_MAX;
+	RC_REAL tmp = RC_REAL_MAX;
 	if(unlikely(!v.initialized)){
 		fprintf(stderr,"ERROR in rc_vector_min, vector not initialized yet\n");
 		return -1;
@@ -427,13 +481,13 @@ int rc_vector_min(rc_vector_t v){
 }
 
 /*******************************************************************************
-* float rc_std_dev(rc_vector_t v)
+* RC_REAL rc_std_dev(rc_vector_t v)
 *
 * Returns the standard deviation of the values in a vector or -1.0f on failure.
 *******************************************************************************/
-float rc_std_dev(rc_vector_t v){
+RC_REAL rc_std_dev(rc_vector_t v){
 	int i;
-	float mean, mean_sqr, diff;
+	RC_REAL mean, mean_sqr, diff;
 	if(unlikely(!v.initialized)){
 		fprintf(stderr,"ERROR in rc_std_dev, vector not initialized yet\n");
 		return -1.0f;
@@ -443,31 +497,31 @@ float rc_std_dev(rc_vector_t v){
 	// calculate mean
 	mean = 0.0f;
 	for(i=0;i<v.len;i++) mean+=v.d[i];
-	mean = mean/(float)v.len;
+	mean = mean/(RC_REAL)v.len;
 	// calculate mean square
 	mean_sqr = 0.0f;
 	for(i=0;i<v.len;i++){
 		diff = v.d[i]-mean;
 		mean_sqr += diff*diff;
 	}
-	return sqrt(mean_sqr/(float)v.len);
+	return sqrt(mean_sqr/(RC_REAL)v.len);
 }
 
 /*******************************************************************************
-* float rc_vector_mean(rc_vector_t v)
+* RC_REAL rc_vector_mean(rc_vector_t v)
 *
 * Returns the mean (average) of all values in vector v or -1.0f on error.
 *******************************************************************************/
-float rc_vector_mean(rc_vector_t v){
+RC_REAL rc_vector_mean(rc_vector_t v){
 	int i;
-	float sum = 0.0f;
+	RC_REAL sum = 0.0f;
 	if(unlikely(!v.initialized)){
 		fprintf(stderr,"ERROR in rc_vector_mean, vector not initialized yet\n");
 		return -1.0f;
 	}
 	// calculate mean
 	for(i=0;i<v.len;i++) sum+=v.d[i];
-	return sum/(float)v.len;
+	return sum/(RC_REAL)v.len;
 }
 
 /*******************************************************************************
@@ -478,7 +532,7 @@ float rc_vector_mean(rc_vector_t v){
 *******************************************************************************/
 int rc_vector_projection(rc_vector_t v, rc_vector_t e, rc_vector_t* p){
 	int i;
-	float factor;
+	RC_REAL factor;
 	// sanity checks
 	if(unlikely(!v.initialized || !e.initialized)){
 		fprintf(stderr,"ERROR in rc_vector_projection, received uninitialized vector\n");
@@ -498,12 +552,12 @@ int rc_vector_projection(rc_vector_t v, rc_vector_t e, rc_vector_t* p){
 }
 
 /*******************************************************************************
-* float rc_vector_dot_product(rc_vector_t v1, rc_vector_t v2)
+* RC_REAL rc_vector_dot_product(rc_vector_t v1, rc_vector_t v2)
 *
 * Returns the dot product of two equal-length vectors or floating-point -1.0f
 * on error.
 *******************************************************************************/
-float rc_vector_dot_product(rc_vector_t v1, rc_vector_t v2){
+RC_REAL rc_vector_dot_product(rc_vector_t v1, rc_vector_t v2){
 	if(unlikely(!v1.initialized || !v2.initialized)){
 		fprintf(stderr,"ERROR in rc_vector_dot_product, vector uninitialized\n");
 		return -1.0f;
@@ -619,3 +673,45 @@ int rc_vector_sum_inplace(rc_vector_t* v1, rc_vector_t v2){
 	for(i=0;i<v1->len;i++) v1->d[i]+=v2.d[i];
 	return 0;
 }
+
+#ifndef RC_ALGEBRA_DOUBLE
+/*******************************************************************************
+* int rc_vector_to_double(rc_vector_t v, rc_vector_d_t* out)
+*
+* Copies a float vector into a double precision vector, allocating out if
+* necessary. Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_vector_to_double(rc_vector_t v, rc_vector_d_t* out){
+	int i;
+	if(unlikely(!v.initialized)){
+		fprintf(stderr,"ERROR in rc_vector_to_double, vector uninitialized\n");
+		return -1;
+	}
+	if(unlikely(rc_alloc_vector_d(out,v.len))){
+		fprintf(stderr,"ERROR in rc_vector_to_double, failed to allocate out\n");
+		return -1;
+	}
+	for(i=0;i<v.len;i++) out->d[i] = v.d[i];
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_vector_to_float(rc_vector_d_t v, rc_vector_t* out)
+*
+* Copies a double precision vector into a float vector, allocating out if
+* necessary. Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_vector_to_float(rc_vector_d_t v, rc_vector_t* out){
+	int i;
+	if(unlikely(!v.initialized)){
+		fprintf(stderr,"ERROR in rc_vector_to_float, vector uninitialized\n");
+		return -1;
+	}
+	if(unlikely(rc_alloc_vector(out,v.len))){
+		fprintf(stderr,"ERROR in rc_vector_to_float, failed to allocate out\n");
+		return -1;
+	}
+	for(i=0;i<v.len;i++) out->d[i] = (float)v.d[i];
+	return 0;
+}
+#endif // RC_ALGEBRA_DOUBLE
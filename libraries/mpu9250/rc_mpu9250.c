@@ -4,12 +4,13 @@
 * This is a collection of high-level functions to control the
 * MPU9250 from a BeagleBone Black as configured on the Robotics Cape.
 * Credit to Kris Winer most of the framework and register definitions.
+*
+* The sample queue and subscribers, recording and replay, background bias
+* estimation and the dynamic notch are in the rc_mpu9250_*.c files next to
+* this one, sharing rc_mpu9250_common.h.
 *******************************************************************************/
 #define _GNU_SOURCE
-#include "../rc_defs.h"
-#include "../redperipherallib.h"
-#include "../preprocessor_macros.h"
-#include "rc_mpu9250_defs.h"
+#include "rc_mpu9250_common.h"
 #include "dmp_firmware.h"
 #include "dmpKey.h"
 #include <stdio.h>
@@ -22,84 +23,106 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <errno.h>
-
-// macros
-#define ARRAY_SIZE(array) sizeof(array)/sizeof(array[0])
-#define min(a, b)	((a < b) ? a : b)
-#define DEG_TO_RAD		0.0174532925199
-#define RAD_TO_DEG		57.295779513
-#define PI				M_PI
-#define TWO_PI			(2.0 * M_PI)
-
-// there should be 28 or 35 bytes in the FIFO if the magnetometer is disabled
-// or enabled.
-#define FIFO_LEN_NO_MAG 28
-#define FIFO_LEN_MAG	35
-
-// error threshold checks
-#define QUAT_ERROR_THRESH		(1L<<16) // very precise threshold
-#define QUAT_MAG_SQ_NORMALIZED	(1L<<28)
-#define QUAT_MAG_SQ_MIN			(QUAT_MAG_SQ_NORMALIZED - QUAT_ERROR_THRESH)
-#define QUAT_MAG_SQ_MAX			(QUAT_MAG_SQ_NORMALIZED + QUAT_ERROR_THRESH)
-#define GYRO_CAL_THRESH			50
-#define GYRO_OFFSET_THRESH		500
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <time.h>
 
 /*******************************************************************************
 *	Local variables
 *******************************************************************************/
 rc_imu_config_t config;
-int bypass_en;  
+static int bypass_en;  
 int dmp_en;
 int packet_len;
 pthread_t imu_interrupt_thread;
 int thread_running_flag;
-struct sched_param params;
-void (*imu_interrupt_func)(); // pointer to user's interrupt function
+static struct sched_param params;
+static void (*imu_interrupt_func)(); // pointer to user's interrupt function
 int interrupt_func_set;
-float mag_factory_adjust[3];
-float mag_offsets[3];
-float mag_scales[3];
 int last_read_successful;
 uint64_t last_interrupt_timestamp_nanos;
 rc_imu_data_t* data_ptr;
 int shutdown_interrupt_thread = 0;
+// FIFO bytes not yet consumed, room for a full FIFO plus a partial packet
+unsigned char fifo_buf[FIFO_BUF_LEN];
+int fifo_fill;
+static int fifo_parsed;
+// offsets into fifo_buf of parsed packets, negative for magnetometer blocks
+static int fifo_tokens[FIFO_BUF_LEN/(FIFO_LEN_MAG-FIFO_LEN_NO_MAG)+1];
+static int fifo_num_tokens;
+static int fifo_num_packets;
+static uint8_t fifo_en_mask;	// FIFO_EN register value, what goes in the FIFO
+int fifo_spec_len;		// bytes expected per FIFO read, 0 to not speculate
+static int combined_read_ok = 1;	// cleared if the i2c driver lacks I2C_RDWR
+// raw FIFO mode
+static int fifo_record_len;	// bytes per sample, 6 for accel and/or 6 for gyro
+static rc_imu_fifo_sample_t* batch_ptr;
+static int batch_len;
+static void (*imu_batch_func)(int n);
+rc_imu_fifo_stats_t fifo_stats;
+static rc_event_source_t imu_event_src;
+// fast startup, see dmp_fast_load_firmware
+#define DMP_FAST_CHUNK		128		// divides MPU6500_BANK_SIZE, fits one i2c write
+#define DMP_SIG_ADDR		DMP_CODE_SIZE	// unused bytes after the firmware
+#define DMP_SIG_LEN			8
+#define RESET_POLL_US		1000
+#define RESET_TIMEOUT_US	100000
+static int fast_startup;
+static rc_imu_startup_stats_t startup_stats;
 // for magnetometer Yaw filtering
-rc_filter_t low_pass, high_pass;
-
-/*******************************************************************************
-*	config functions for internal use only
-*******************************************************************************/
-int reset_mpu9250();
-int set_gyro_fsr(rc_gyro_fsr_t fsr, rc_imu_data_t* data);
-int set_accel_fsr(rc_accel_fsr_t, rc_imu_data_t* data);
-int set_gyro_dlpf(rc_gyro_dlpf_t);
-int set_accel_dlpf(rc_accel_dlpf_t);
-int initialize_magnetometer();
-int power_down_magnetometer();
-int mpu_set_bypass(unsigned char bypass_on);
-int mpu_write_mem(unsigned short mem_addr, unsigned short length,\
-												unsigned char *data);
-int mpu_read_mem(unsigned short mem_addr, unsigned short length,\
-												unsigned char *data);
-int dmp_load_motion_driver_firmware();
-int dmp_set_orientation(unsigned short orient);
-int dmp_enable_gyro_cal(unsigned char enable);
-int dmp_enable_lp_quat(unsigned char enable);
-int dmp_enable_6x_lp_quat(unsigned char enable);
-int mpu_reset_fifo(void);
-int mpu_set_sample_rate(int rate);
-int dmp_set_fifo_rate(unsigned short rate);
-int dmp_enable_feature(unsigned short mask);
-int mpu_set_dmp_state(unsigned char enable);
-int set_int_enable(unsigned char enable);
-int dmp_set_interrupt_mode(unsigned char mode);
-int read_dmp_fifo();
-int data_fusion();
-int load_gyro_offets();
-int load_mag_calibration();
-int write_mag_cal_to_disk(float offsets[3], float scale[3]);
-void* imu_interrupt_handler(void* ptr);
-int check_quaternion_validity(unsigned char* raw, int i);
+static rc_filter_t low_pass, high_pass;
+// mag axes in the DMP's frame, mag_vec[i] = orient_sign[i]*mag[orient_perm[i]]
+int orient_perm[3];
+float orient_sign[3];
+int fusion_reset = 1;	// data_fusion rebuilds its filters when set
+// runtime reconfiguration, see rc_reconfigure_imu. The IMU thread holds
+// imu_config_mutex while it touches the chip or the FIFO buffer.
+pthread_mutex_t imu_config_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int reconfig_pending;
+static rc_imu_config_t reconfig_conf;
+// periodic stats dump, see rc_start_imu_stats_dump
+#define STATS_DUMP_POLL_MS	100		// how quickly the dump thread notices a stop
+static pthread_t stats_dump_thread;
+static int stats_dump_running;
+static int shutdown_stats_dump;
+static FILE* stats_dump_file;
+static int stats_dump_period_ms;
+// register access, see imu_bus_init
+#define IMU_SPI_MODE		SPI_MODE_CPOL1_CPHA1
+#define IMU_SPI_CONFIG_HZ	1000000		// datasheet limit for all registers
+#define IMU_SPI_READ_HZ		20000000	// sensor, status and FIFO reads only
+#define IMU_SPI_READ		0x80		// register address bit for a read
+#define MAG_SLV4_POLL_US	100
+#define MAG_SLV4_TIMEOUT_US	10000
+// an i2c register read is a write and a read system call, over SPI it's one
+#define READ_SYSCALLS		(imu0->transport==IMU_TRANSPORT_SPI ? 1 : 2)
+#define I2C_BUSES			3
+imu_dev_t imu_devs[RC_MAX_IMUS] = {{
+	.transport = IMU_TRANSPORT_I2C,
+	.bus = IMU_BUS,
+	.address = IMU_ADDR,
+	.spi_slave = 1,
+	.mag_scales = {1.0f, 1.0f, 1.0f}
+}};
+imu_dev_t* const imu0 = &imu_devs[0];
+static int spi_open[3];		// slaves already set up with rc_spi_init
+static int spi_manual_ss[3];	// slaves we select by hand around transfers
+// IMUs on the same i2c bus take turns, the device address is bus state
+static pthread_mutex_t i2c_bus_mutex[I2C_BUSES] = {PTHREAD_MUTEX_INITIALIZER,\
+					PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER};
+// so do IMUs on SPI, the driver has one set of transfer settings for all slaves
+static pthread_mutex_t spi_bus_mutex = PTHREAD_MUTEX_INITIALIZER;
+// newest sample of every running IMU for rc_read_imu_instance and the vote,
+// each slot a seqlock written only by its IMU's thread
+typedef struct imu_vote_slot_t{
+	uint32_t ver;	// odd while the writer is updating the slot
+	int has_mag;
+	rc_imu_sample_t s;
+} imu_vote_slot_t;
+static imu_vote_slot_t vote_slots[RC_MAX_IMUS];
+static uint32_t vote_running;	// bit i set while IMU i publishes samples
 
 
 /*******************************************************************************
@@ -123,6 +146,36 @@ rc_imu_config_t rc_default_imu_config(){
 	conf.compass_time_constant = 5.0;
 	conf.dmp_interrupt_priority = sched_get_priority_max(SCHED_FIFO)-1;
 	conf.show_warnings = 0;
+	conf.interrupt_source = EVENT_SOURCE_AUTO;
+	conf.interrupt_fd = -1;
+	conf.fifo_combined_read = 1;
+	conf.fast_startup = 1;
+	conf.transport = IMU_TRANSPORT_I2C;
+	conf.spi_slave = 1;
+	conf.i2c_bus = IMU_BUS;
+	conf.i2c_address = IMU_ADDR;
+	conf.interrupt_pin = IMU_INTERRUPT_PIN;
+	conf.gyro_bias_estimation = 0;
+	conf.gyro_bias_to_hardware = 0;
+	conf.still_gyro_thresh = 0.5;
+	conf.still_accel_thresh = 0.1;
+	conf.still_time = 2.0;
+	conf.gyro_bias_time_constant = 10.0;
+	conf.temp_compensation = 0;
+	conf.temp_model_online = 0;
+	conf.mag_cal_online = 0;
+	conf.mag_cal_coverage = 0.75;
+	conf.dynamic_notch = 0;
+	conf.notch_count = 2;
+	conf.notch_min_hz = 20.0;
+	conf.notch_max_hz = 400.0;
+	conf.notch_q = 4.0;
+	conf.notch_budget = NOTCH_STEPS/NOTCH_WINDOW;
+
+	// raw FIFO stuff
+	conf.fifo_sample_rate = 1000;
+	conf.fifo_enable_accel = 1;
+	conf.fifo_enable_gyro = 1;
 	return conf;
 }
 
@@ -136,6 +189,288 @@ int rc_set_imu_config_to_defaults(rc_imu_config_t *conf){
 	return 0;
 }
 
+/*******************************************************************************
+* int imu_bus_init(imu_dev_t* dev, rc_imu_transport_t transport, int bus,
+*											int address, int spi_slave)
+*
+* Opens the bus an MPU9250 is on and points dev's register access functions
+* below at it. The SPI device is only set up the first time since, unlike the
+* i2c bus, nothing else is expected to share a slave. Returns 0 on success or
+* -1 on failure.
+*******************************************************************************/
+int imu_bus_init(imu_dev_t* dev, rc_imu_transport_t transport, int bus,\
+											int address, int spi_slave){
+	int ret;
+	switch(transport){
+	case IMU_TRANSPORT_I2C:
+		if(bus<0 || bus>=I2C_BUSES || address<0 || address>0x7F){
+			fprintf(stderr,"ERROR: in imu_bus_init, invalid i2c bus or address\n");
+			return -1;
+		}
+		pthread_mutex_lock(&i2c_bus_mutex[bus]);
+		ret = rc_i2c_init(bus, address);
+		pthread_mutex_unlock(&i2c_bus_mutex[bus]);
+		if(ret) return -1;
+		break;
+	case IMU_TRANSPORT_SPI:
+		if(spi_slave<1 || spi_slave>2){
+			fprintf(stderr,"ERROR: in imu_bus_init, invalid SPI slave\n");
+			return -1;
+		}
+		pthread_mutex_lock(&spi_bus_mutex);
+		if(!spi_open[spi_slave]){
+			// the driver only selects slave 1 on the cape, slave 2 is a gpio
+			spi_manual_ss[spi_slave] = (spi_slave==2);
+			if(rc_spi_init(spi_manual_ss[spi_slave] ? SS_MODE_MANUAL : SS_MODE_AUTO,\
+						IMU_SPI_MODE, IMU_SPI_READ_HZ, spi_slave)){
+				pthread_mutex_unlock(&spi_bus_mutex);
+				fprintf(stderr,"ERROR: in imu_bus_init, failed to set up SPI slave %d\n", spi_slave);
+				return -1;
+			}
+			spi_open[spi_slave] = 1;
+		}
+		pthread_mutex_unlock(&spi_bus_mutex);
+		break;
+	default:
+		fprintf(stderr,"ERROR: in imu_bus_init, invalid transport\n");
+		return -1;
+	}
+	dev->transport = transport;
+	dev->bus = bus;
+	dev->address = address;
+	dev->spi_slave = spi_slave;
+	return 0;
+}
+
+/*******************************************************************************
+* int imu_bus_in_use(imu_dev_t* dev)
+* void imu_claim_bus(imu_dev_t* dev)
+* void imu_release_bus(imu_dev_t* dev)
+*
+* The i2c bus is shared with the barometer so the IMU claims it while working
+* to let other code check. Nothing else is on the IMU's SPI slave.
+*******************************************************************************/
+int imu_bus_in_use(imu_dev_t* dev){
+	if(dev->transport!=IMU_TRANSPORT_I2C) return 0;
+	return rc_i2c_get_in_use_state(dev->bus);
+}
+
+void imu_claim_bus(imu_dev_t* dev){
+	if(dev->transport==IMU_TRANSPORT_I2C) rc_i2c_claim_bus(dev->bus);
+}
+
+void imu_release_bus(imu_dev_t* dev){
+	if(dev->transport==IMU_TRANSPORT_I2C) rc_i2c_release_bus(dev->bus);
+}
+
+/*******************************************************************************
+* int imu_spi_transfer(imu_dev_t* dev, uint8_t reg, uint8_t length,
+*												uint8_t* tx, uint8_t* rx)
+*
+* One SPI transaction with length bytes starting at register reg. Writes send
+* tx, reads set the read bit in the address and copy what comes back into rx.
+* The MPU9250 only allows 1MHz in general but sensor, interrupt status and
+* FIFO registers may be read at 20MHz, so the clock is picked per transfer.
+* The clock is a setting of the whole SPI driver rather than of a slave, so it
+* is set on every transfer under spi_bus_mutex along with the transfer itself.
+* A slave set up with manual slave select is selected for just the transfer.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int imu_spi_transfer(imu_dev_t* dev, uint8_t reg, uint8_t length, uint8_t* tx,\
+																uint8_t* rx){
+	char tx_buf[UINT8_MAX+1];
+	char rx_buf[UINT8_MAX+1];
+	int hz = IMU_SPI_CONFIG_HZ;
+	int ret;
+
+	if(rx!=NULL){
+		tx_buf[0] = reg | IMU_SPI_READ;
+		memset(&tx_buf[1], 0, length);
+		if((reg>=INT_STATUS && reg<=EXT_SENS_DATA_23) ||\
+						(reg>=FIFO_COUNTH && reg<=FIFO_R_W)){
+			hz = IMU_SPI_READ_HZ;
+		}
+	}
+	else{
+		tx_buf[0] = reg & ~IMU_SPI_READ;
+		memcpy(&tx_buf[1], tx, length);
+	}
+	pthread_mutex_lock(&spi_bus_mutex);
+	if(rc_spi_set_speed(hz, dev->spi_slave)){
+		pthread_mutex_unlock(&spi_bus_mutex);
+		return -1;
+	}
+	if(spi_manual_ss[dev->spi_slave]) rc_manual_select_spi_slave(dev->spi_slave);
+	ret = rc_spi_transfer(tx_buf, length+1, rx_buf, dev->spi_slave);
+	if(spi_manual_ss[dev->spi_slave]) rc_manual_deselect_spi_slave(dev->spi_slave);
+	pthread_mutex_unlock(&spi_bus_mutex);
+	if(ret<0) return -1;
+	if(rx!=NULL) memcpy(rx, &rx_buf[1], length);
+	return 0;
+}
+
+/*******************************************************************************
+* int mpu_read_bytes(imu_dev_t* dev, uint8_t reg, uint8_t length, uint8_t* data)
+* int mpu_read_byte(imu_dev_t* dev, uint8_t reg, uint8_t* data)
+* int mpu_read_word(imu_dev_t* dev, uint8_t reg, uint16_t* data)
+* int mpu_write_bytes(imu_dev_t* dev, uint8_t reg, uint8_t length,
+*																uint8_t* data)
+* int mpu_write_byte(imu_dev_t* dev, uint8_t reg, uint8_t data)
+*
+* MPU9250 register access over whichever transport imu_bus_init set up for
+* dev. They return what the rc_i2c functions of the same name do: the number
+* of bytes read for mpu_read_bytes and mpu_read_byte, otherwise 0, or -1 on
+* error. Over SPI, I2C_IF_DIS is added to every USER_CTRL write so the chip's
+* i2c interface stays off however the other bits change. Over i2c the bus is
+* held for the address change and transfer so IMUs sharing it can't mix up
+* each other's.
+*******************************************************************************/
+int mpu_read_bytes(imu_dev_t* dev, uint8_t reg, uint8_t length, uint8_t* data){
+	int ret;
+	if(dev->transport==IMU_TRANSPORT_SPI){
+		if(imu_spi_transfer(dev, reg, length, NULL, data)) return -1;
+		return length;
+	}
+	pthread_mutex_lock(&i2c_bus_mutex[dev->bus]);
+	rc_i2c_set_device_address(dev->bus, dev->address);
+	ret = rc_i2c_read_bytes(dev->bus, reg, length, data);
+	pthread_mutex_unlock(&i2c_bus_mutex[dev->bus]);
+	return ret;
+}
+
+int mpu_read_byte(imu_dev_t* dev, uint8_t reg, uint8_t* data){
+	return mpu_read_bytes(dev, reg, 1, data);
+}
+
+int mpu_read_word(imu_dev_t* dev, uint8_t reg, uint16_t* data){
+	uint8_t raw[2];
+	int ret;
+	if(dev->transport==IMU_TRANSPORT_SPI){
+		if(imu_spi_transfer(dev, reg, 2, NULL, raw)) return -1;
+		*data = ((uint16_t)raw[0]<<8) | raw[1];
+		return 0;
+	}
+	pthread_mutex_lock(&i2c_bus_mutex[dev->bus]);
+	rc_i2c_set_device_address(dev->bus, dev->address);
+	ret = rc_i2c_read_word(dev->bus, reg, data);
+	pthread_mutex_unlock(&i2c_bus_mutex[dev->bus]);
+	return ret;
+}
+
+int mpu_write_bytes(imu_dev_t* dev, uint8_t reg, uint8_t length, uint8_t* data){
+	int ret;
+	if(dev->transport==IMU_TRANSPORT_SPI){
+		return imu_spi_transfer(dev, reg, length, data, NULL);
+	}
+	pthread_mutex_lock(&i2c_bus_mutex[dev->bus]);
+	rc_i2c_set_device_address(dev->bus, dev->address);
+	ret = rc_i2c_write_bytes(dev->bus, reg, length, data);
+	pthread_mutex_unlock(&i2c_bus_mutex[dev->bus]);
+	return ret;
+}
+
+int mpu_write_byte(imu_dev_t* dev, uint8_t reg, uint8_t data){
+	if(dev->transport==IMU_TRANSPORT_SPI && reg==USER_CTRL){
+		data |= I2C_IF_DIS;
+	}
+	return mpu_write_bytes(dev, reg, 1, &data);
+}
+
+/*******************************************************************************
+* int imu_read_bytes(uint8_t reg, uint8_t length, uint8_t* data)
+* int imu_read_byte(uint8_t reg, uint8_t* data)
+* int imu_read_word(uint8_t reg, uint16_t* data)
+* int imu_write_bytes(uint8_t reg, uint8_t length, uint8_t* data)
+* int imu_write_byte(uint8_t reg, uint8_t data)
+*
+* The same for IMU 0, which is all the DMP and FIFO code talks to.
+*******************************************************************************/
+int imu_read_bytes(uint8_t reg, uint8_t length, uint8_t* data){
+	return mpu_read_bytes(imu0, reg, length, data);
+}
+
+int imu_read_byte(uint8_t reg, uint8_t* data){
+	return mpu_read_bytes(imu0, reg, 1, data);
+}
+
+int imu_read_word(uint8_t reg, uint16_t* data){
+	return mpu_read_word(imu0, reg, data);
+}
+
+int imu_write_bytes(uint8_t reg, uint8_t length, uint8_t* data){
+	return mpu_write_bytes(imu0, reg, length, data);
+}
+
+int imu_write_byte(uint8_t reg, uint8_t data){
+	return mpu_write_byte(imu0, reg, data);
+}
+
+/*******************************************************************************
+* int mag_slv4_transfer(imu_dev_t* dev, uint8_t addr, uint8_t reg,
+*																uint8_t data)
+*
+* Runs one single byte transfer on the MPU's auxiliary bus through I2C slave
+* 4 and waits for it to finish. This is how the magnetometer is reached over
+* SPI, where bypass mode isn't available. addr has I2C_SLV_READ set for a read
+* which leaves the byte in I2C_SLV4_DI. Returns 0 on success or -1 on timeout.
+*******************************************************************************/
+static int mag_slv4_transfer(imu_dev_t* dev, uint8_t addr, uint8_t reg,\
+																uint8_t data){
+	uint8_t cmd[4], c;
+	int i;
+	// I2C_SLV4_ADDR, _REG, _DO and _CTRL are next to each other
+	cmd[0] = addr;
+	cmd[1] = reg;
+	cmd[2] = data;
+	cmd[3] = I2C_SLV_EN;
+	// reading the status clears it, throw away anything left over
+	if(mpu_read_byte(dev, I2C_MST_STATUS, &c)<0) return -1;
+	if(mpu_write_bytes(dev, I2C_SLV4_ADDR, 4, cmd)) return -1;
+	for(i=0;i<MAG_SLV4_TIMEOUT_US;i+=MAG_SLV4_POLL_US){
+		rc_usleep(MAG_SLV4_POLL_US);
+		if(mpu_read_byte(dev, I2C_MST_STATUS, &c)<0) continue;
+		if(c & I2C_SLV4_DONE) return 0;
+	}
+	return -1;
+}
+
+/*******************************************************************************
+* int mag_read_bytes(imu_dev_t* dev, uint8_t reg, uint8_t length, uint8_t* data)
+* int mag_write_byte(imu_dev_t* dev, uint8_t reg, uint8_t data)
+*
+* AK8963 register access for configuring the magnetometer. Over i2c this needs
+* bypass mode, over SPI it needs the MPU's I2C master and goes one byte at a
+* time through slave 4, see mpu_set_bypass. Return values follow the rc_i2c
+* functions like the mpu_* ones above.
+*******************************************************************************/
+int mag_read_bytes(imu_dev_t* dev, uint8_t reg, uint8_t length, uint8_t* data){
+	int i, ret;
+	if(dev->transport==IMU_TRANSPORT_SPI){
+		for(i=0;i<length;i++){
+			if(mag_slv4_transfer(dev, AK8963_ADDR|I2C_SLV_READ, reg+i, 0)) return -1;
+			if(mpu_read_byte(dev, I2C_SLV4_DI, &data[i])<0) return -1;
+		}
+		return length;
+	}
+	pthread_mutex_lock(&i2c_bus_mutex[dev->bus]);
+	rc_i2c_set_device_address(dev->bus, AK8963_ADDR);
+	ret = rc_i2c_read_bytes(dev->bus, reg, length, data);
+	pthread_mutex_unlock(&i2c_bus_mutex[dev->bus]);
+	return ret;
+}
+
+int mag_write_byte(imu_dev_t* dev, uint8_t reg, uint8_t data){
+	int ret;
+	if(dev->transport==IMU_TRANSPORT_SPI){
+		return mag_slv4_transfer(dev, AK8963_ADDR, reg, data);
+	}
+	pthread_mutex_lock(&i2c_bus_mutex[dev->bus]);
+	rc_i2c_set_device_address(dev->bus, AK8963_ADDR);
+	ret = rc_i2c_write_byte(dev->bus, reg, data);
+	pthread_mutex_unlock(&i2c_bus_mutex[dev->bus]);
+	return ret;
+}
+
 /*******************************************************************************
 * int rc_initialize_imu(rc_imu_config_t conf)
 *
@@ -146,93 +481,99 @@ int rc_initialize_imu(rc_imu_data_t *data, rc_imu_config_t conf){
 	
 	// make sure the bus is not currently in use by another thread
 	// do not proceed to prevent interfering with that process
-	if(rc_i2c_get_in_use_state(IMU_BUS)){
+	if(conf.transport==IMU_TRANSPORT_I2C && rc_i2c_get_in_use_state(conf.i2c_bus)){
 		printf("i2c bus claimed by another process\n");
 		printf("Continuing with rc_initialize_imu() anyway.\n");
 	}
 	
 	// if it is not claimed, start the i2c bus
-	if(rc_i2c_init(IMU_BUS, IMU_ADDR)<0){
+	if(imu_bus_init(imu0, conf.transport, conf.i2c_bus, conf.i2c_address,\
+													conf.spi_slave)<0){
 		fprintf(stderr,"failed to initialize i2c bus\n");
 		return -1;
 	}
 	// claiming the bus does no guarantee other code will not interfere 
 	// with this process, but best to claim it so other code can check
 	// like we did above
-	rc_i2c_claim_bus(IMU_BUS);
+	imu_claim_bus(imu0);
 	
 	// update local copy of config struct with new values
 	config=conf;
+	data_ptr = data;
+	dmp_en = 0;
+	fast_startup = conf.fast_startup;
 	
 	// restart the device so we start with clean registers
-	if(reset_mpu9250()<0){
+	if(reset_mpu9250(imu0, fast_startup)<0){
 		fprintf(stderr,"ERROR: failed to reset_mpu9250\n");
-		rc_i2c_release_bus(IMU_BUS);
+		imu_release_bus(imu0);
 		return -1;
 	}
 	
 	//check the who am i register to make sure the chip is alive
-	if(rc_i2c_read_byte(IMU_BUS, WHO_AM_I_MPU9250, &c)<0){
+	if(imu_read_byte(WHO_AM_I_MPU9250, &c)<0){
 		fprintf(stderr,"Reading WHO_AM_I_MPU9250 register failed\n");
-		rc_i2c_release_bus(IMU_BUS);
+		imu_release_bus(imu0);
 		return -1;
 	}
 	if(c!=0x71){
 		fprintf(stderr,"mpu9250 WHO AM I register should return 0x71\n");
 		fprintf(stderr,"WHO AM I returned: 0x%x\n", c);
-		rc_i2c_release_bus(IMU_BUS);
+		imu_release_bus(imu0);
 		return -1;
 	}
  
 	// load in gyro calibration offsets from disk
-	if(load_gyro_offets()<0){
+	if(load_gyro_offets(imu0)<0){
 		fprintf(stderr,"ERROR: failed to load gyro calibration offsets\n");
-		rc_i2c_release_bus(IMU_BUS);
+		imu_release_bus(imu0);
 		return -1;
 	}
 	
 	// Set sample rate = 1000/(1 + SMPLRT_DIV)
 	// here we use a divider of 0 for 1khz sample
-	if(rc_i2c_write_byte(IMU_BUS, SMPLRT_DIV, 0x00)){
+	if(imu_write_byte(SMPLRT_DIV, 0x00)){
 		fprintf(stderr,"I2C bus write error\n");
-		rc_i2c_release_bus(IMU_BUS);
+		imu_release_bus(imu0);
 		return -1;
 	}
 	
 	// set full scale ranges and filter constants
-	if(set_gyro_fsr(conf.gyro_fsr, data)){
+	if(set_gyro_fsr(imu0, conf.gyro_fsr, data)){
 		fprintf(stderr,"failed to set gyro fsr\n");
-		rc_i2c_release_bus(IMU_BUS);
+		imu_release_bus(imu0);
 		return -1;
 	}
-	if(set_accel_fsr(conf.accel_fsr, data)){
+	if(set_accel_fsr(imu0, conf.accel_fsr, data)){
 		fprintf(stderr,"failed to set accel fsr\n");
-		rc_i2c_release_bus(IMU_BUS);
+		imu_release_bus(imu0);
 		return -1;
 	}
-	if(set_gyro_dlpf(conf.gyro_dlpf)){
+	if(set_gyro_dlpf(imu0, conf.gyro_dlpf)){
 		fprintf(stderr,"failed to set gyro dlpf\n");
-		rc_i2c_release_bus(IMU_BUS);
+		imu_release_bus(imu0);
 		return -1;
 	}
-	if(set_accel_dlpf(conf.accel_dlpf)){
+	if(set_accel_dlpf(imu0, conf.accel_dlpf)){
 		fprintf(stderr,"failed to set accel_dlpf\n");
-		rc_i2c_release_bus(IMU_BUS);
+		imu_release_bus(imu0);
 		return -1;
 	}
 	
-	// initialize the magnetometer too if requested in config
+	// initialize the magnetometer too if requested in config, then hand it to
+	// the MPU's I2C master so reads don't need bypass mode
 	if(conf.enable_magnetometer){
-		if(initialize_magnetometer()){
+		if(initialize_magnetometer(imu0) || set_mag_slave_read(imu0) ||\
+												mpu_set_bypass(imu0, 0)){
 			fprintf(stderr,"failed to initialize magnetometer\n");
-			rc_i2c_release_bus(IMU_BUS);
+			imu_release_bus(imu0);
 			return -1;
 		}
 	}
-	else power_down_magnetometer();
+	else power_down_magnetometer(imu0);
 	
 	// all done!!
-	rc_i2c_release_bus(IMU_BUS);
+	imu_release_bus(imu0);
 	return 0;
 }
 
@@ -245,10 +586,8 @@ int rc_initialize_imu(rc_imu_data_t *data, rc_imu_config_t conf){
 int rc_read_accel_data(rc_imu_data_t *data){
 	// new register data stored here
 	uint8_t raw[6];  
-	// set the device address
-	rc_i2c_set_device_address(IMU_BUS, IMU_ADDR);
 	 // Read the six raw data registers into data array
-	if(rc_i2c_read_bytes(IMU_BUS, ACCEL_XOUT_H, 6, &raw[0])<0){
+	if(imu_read_bytes(ACCEL_XOUT_H, 6, &raw[0])<0){
 		return -1;
 	}
 	// Turn the MSB and LSB into a signed 16-bit value
@@ -259,6 +598,8 @@ int rc_read_accel_data(rc_imu_data_t *data){
 	data->accel[0] = data->raw_accel[0] * data->accel_to_ms2;
 	data->accel[1] = data->raw_accel[1] * data->accel_to_ms2;
 	data->accel[2] = data->raw_accel[2] * data->accel_to_ms2;
+	// at the last temperature read
+	if(config.temp_compensation && temp_valid) apply_temp_comp(data, 1, 0);
 	return 0;
 }
 
@@ -271,10 +612,8 @@ int rc_read_accel_data(rc_imu_data_t *data){
 int rc_read_gyro_data(rc_imu_data_t *data){
 	// new register data stored here
 	uint8_t raw[6];
-	// set the device address
-	rc_i2c_set_device_address(IMU_BUS, IMU_ADDR);
 	// Read the six raw data registers into data array
-	if(rc_i2c_read_bytes(IMU_BUS, GYRO_XOUT_H, 6, &raw[0])<0){
+	if(imu_read_bytes(GYRO_XOUT_H, 6, &raw[0])<0){
 		return -1;
 	}
 	// Turn the MSB and LSB into a signed 16-bit value
@@ -285,46 +624,28 @@ int rc_read_gyro_data(rc_imu_data_t *data){
 	data->gyro[0] = data->raw_gyro[0] * data->gyro_to_degs;
 	data->gyro[1] = data->raw_gyro[1] * data->gyro_to_degs;
 	data->gyro[2] = data->raw_gyro[2] * data->gyro_to_degs;
+	// at the last temperature read
+	if(config.temp_compensation && temp_valid) apply_temp_comp(data, 0, 1);
 	return 0;
 }
 
 /*******************************************************************************
 * int rc_read_mag_data(rc_imu_data_t* data)
 *
-* Checks if there is new magnetometer data and reads it in if true.
-* Magnetometer only updates at 100hz, if there is no new data then
-* the values in rc_imu_data_t struct are left alone.
+* Reads the latest magnetometer values. The MPU's I2C master fetches them from
+* the AK8963 into the EXT_SENS_DATA registers every sample, so this is a
+* single read from the MPU rather than a trip through bypass mode. The
+* magnetometer only updates at 100hz so consecutive reads may return the same
+* values.
 *******************************************************************************/
 int rc_read_mag_data(rc_imu_data_t* data){
-	uint8_t st1;
 	uint8_t raw[7];
-	int16_t adc[3];
-	float factory_cal_data[3];
 	if(config.enable_magnetometer==0){
 		fprintf(stderr,"ERROR: can't read magnetometer unless it is enabled in \n");
 		fprintf(stderr,"rc_imu_config_t struct before calling rc_initialize_imu\n");
 		return -1;
 	}
-	// magnetometer is actually a separate device with its
-	// own address inside the mpu9250
-	// MPU9250 was put into passthrough mode 
-	rc_i2c_set_device_address(IMU_BUS, AK8963_ADDR);
-	// read the data ready bit to see if there is new data
-	if(rc_i2c_read_byte(IMU_BUS, AK8963_ST1, &st1)<0){
-		fprintf(stderr,"ERROR reading Magnetometer, i2c_bypass is probably not set\n");
-		return -1;
-	}
-	#ifdef DEBUG
-	printf("st1: %d", st1);
-	#endif
-	if(!(st1&MAG_DATA_READY)){ 
-		#ifdef DEBUG
-		printf("no new data\n");
-		#endif
-		return 0;
-	}
-	// Read the six raw data regs into data array	
-	if(rc_i2c_read_bytes(IMU_BUS,AK8963_XOUT_L,7,&raw[0])<0){
+	if(imu_read_bytes(EXT_SENS_DATA_00, 7, &raw[0])<0){
 		printf("rc_read_mag_data failed\n");
 		return -1;
 	}
@@ -334,32 +655,65 @@ int rc_read_mag_data(rc_imu_data_t* data){
 		fprintf(stderr,"ERROR: magnetometer saturated\n");
 		return -1;
 	}
-	// Turn the MSB and LSB into a signed 16-bit value
-	// Data stored as little Endian
-	adc[0] = (int16_t)(((int16_t)raw[1]<<8) | raw[0]);  
-	adc[1] = (int16_t)(((int16_t)raw[3]<<8) | raw[2]);  
-	adc[2] = (int16_t)(((int16_t)raw[5]<<8) | raw[4]); 
-	#ifdef DEBUG
-	printf("raw mag:%d %d %d\n", adc[0], adc[1], adc[2]);
-	#endif
+	parse_mag_block(imu0, raw, data);
+	return 0;
+}
 
-	// multiply by the sensitivity adjustment and convert to units of uT micro
-	// Teslas. Also correct the coordinate system as someone in invensense 
-	// thought it would be bright idea to have the magnetometer coordiate
-	// system aligned differently than the accelerometer and gyro.... -__-
-	factory_cal_data[0] = adc[1] * mag_factory_adjust[1] * MAG_RAW_TO_uT;
-	factory_cal_data[1] = adc[0] * mag_factory_adjust[0] * MAG_RAW_TO_uT;
-	factory_cal_data[2] = -adc[2] * mag_factory_adjust[2] * MAG_RAW_TO_uT;
-
-	// now apply out own calibration, but first make sure we don't accidentally
-	// multiply by zero in case of uninitialized scale factors
-	if(mag_scales[0]==0.0) mag_scales[0]=1.0;
-	if(mag_scales[1]==0.0) mag_scales[1]=1.0;
-	if(mag_scales[2]==0.0) mag_scales[2]=1.0;
-	data->mag[0] = (factory_cal_data[0]-mag_offsets[0])*mag_scales[0];
-	data->mag[1] = (factory_cal_data[1]-mag_offsets[1])*mag_scales[1];
-	data->mag[2] = (factory_cal_data[2]-mag_offsets[2])*mag_scales[2];
+/*******************************************************************************
+* int rc_read_imu_all(rc_imu_data_t* data)
+*
+* Reads accel, temperature and gyro, and the magnetometer if it is enabled, in
+* one burst. These registers are contiguous in the MPU9250, with the
+* EXT_SENS_DATA registers the I2C master fills from the AK8963 right after the
+* gyro, so everything comes back in a single i2c transaction. A saturated
+* magnetometer reading is skipped and the previous one kept.
+*******************************************************************************/
+int rc_read_imu_all(rc_imu_data_t* data){
+	return read_imu_burst(imu0, &config, data);
+}
 
+/*******************************************************************************
+* int read_imu_burst(imu_dev_t* dev, rc_imu_config_t* conf, rc_imu_data_t* data)
+*
+* rc_read_imu_all for any IMU, conf being the config it was set up with.
+*******************************************************************************/
+int read_imu_burst(imu_dev_t* dev, rc_imu_config_t* conf, rc_imu_data_t* data){
+	uint8_t raw[IMU_BURST_LEN+7];
+	int len = IMU_BURST_LEN;
+	if(conf->enable_magnetometer) len += 7;
+	if(mpu_read_bytes(dev, ACCEL_XOUT_H, len, &raw[0])<0){
+		return -1;
+	}
+	// Turn the MSB and LSB into a signed 16-bit value
+	data->raw_accel[0] = (int16_t)(((uint16_t)raw[0]<<8)|raw[1]);
+	data->raw_accel[1] = (int16_t)(((uint16_t)raw[2]<<8)|raw[3]);
+	data->raw_accel[2] = (int16_t)(((uint16_t)raw[4]<<8)|raw[5]);
+	data->temp = 21.0 + (int16_t)(((uint16_t)raw[6]<<8)|raw[7])/TEMP_SENSITIVITY;
+	data->raw_gyro[0] = (int16_t)(((uint16_t)raw[8]<<8)|raw[9]);
+	data->raw_gyro[1] = (int16_t)(((uint16_t)raw[10]<<8)|raw[11]);
+	data->raw_gyro[2] = (int16_t)(((uint16_t)raw[12]<<8)|raw[13]);
+	// Fill in real unit values
+	data->accel[0] = data->raw_accel[0] * data->accel_to_ms2;
+	data->accel[1] = data->raw_accel[1] * data->accel_to_ms2;
+	data->accel[2] = data->raw_accel[2] * data->accel_to_ms2;
+	data->gyro[0] = data->raw_gyro[0] * data->gyro_to_degs;
+	data->gyro[1] = data->raw_gyro[1] * data->gyro_to_degs;
+	data->gyro[2] = data->raw_gyro[2] * data->gyro_to_degs;
+	if(conf->enable_magnetometer){
+		if(raw[IMU_BURST_LEN+6]&MAGNETOMETER_SATURATION){
+			if(conf->show_warnings) printf("warning: magnetometer saturated\n");
+		}
+		else parse_mag_block(dev, &raw[IMU_BURST_LEN], data);
+	}
+	// the temperature came with this read, in DMP and FIFO modes the IMU
+	// thread keeps the model evaluated instead
+	if(dev==imu0 && conf->temp_compensation){
+		if(!thread_running_flag){
+			if(temp_dirty) fill_temp_model();
+			eval_temp_model(data->temp);
+		}
+		if(temp_valid) apply_temp_comp(data, 1, 1);
+	}
 	return 0;
 }
 
@@ -370,58 +724,85 @@ int rc_read_mag_data(rc_imu_data_t* data){
 *******************************************************************************/
 int rc_read_imu_temp(rc_imu_data_t* data){
 	uint16_t adc;
-	// set device address
-	rc_i2c_set_device_address(IMU_BUS, IMU_ADDR);
 	// Read the two raw data registers
-	if(rc_i2c_read_word(IMU_BUS, TEMP_OUT_H, &adc)<0){
+	if(imu_read_word(TEMP_OUT_H, &adc)<0){
 		fprintf(stderr,"failed to read IMU temperature registers\n");
 		return -1;
 	}
-	// convert to real units
-	data->temp = 21.0 + adc/TEMP_SENSITIVITY;
+	// convert to real units, the reading is signed
+	data->temp = 21.0 + (int16_t)adc/TEMP_SENSITIVITY;
+	if(config.temp_compensation && !thread_running_flag){
+		if(temp_dirty) fill_temp_model();
+		eval_temp_model(data->temp);
+	}
 	return 0;
 }
  
 /*******************************************************************************
-* int reset_mpu9250()
+* int reset_mpu9250(imu_dev_t* dev, int fast)
 *
 * sets the reset bit in the power management register which restores
 * the device to defualt settings. a 0.1 second wait is also included
-* to let the device compelete the reset process.
+* to let the device compelete the reset process, or with fast set the chip
+* is polled until it's back instead.
 *******************************************************************************/
-int reset_mpu9250(){
+int reset_mpu9250(imu_dev_t* dev, int fast){
+	uint8_t c;
+	int i;
 	// disable the interrupt to prevent it from doing things while we reset
-	shutdown_interrupt_thread = 1;
-	// set the device address
-	rc_i2c_set_device_address(IMU_BUS, IMU_ADDR);
+	if(dev==imu0) shutdown_interrupt_thread = 1;
 	// write the reset bit
-	if(rc_i2c_write_byte(IMU_BUS, PWR_MGMT_1, H_RESET)){
+	if(mpu_write_byte(dev, PWR_MGMT_1, H_RESET)){
 		// wait and try again
 		rc_usleep(10000);
-			if(rc_i2c_write_byte(IMU_BUS, PWR_MGMT_1, H_RESET)){
+			if(mpu_write_byte(dev, PWR_MGMT_1, H_RESET)){
 				fprintf(stderr,"I2C write to MPU9250 Failed\n");
 			return -1;
 		}
 	}
+	// instead of a fixed sleep, poll until the reset bit clears and the
+	// chip answers, giving up after as long as the sleep would have been
+	if(fast){
+		for(i=0;i<RESET_TIMEOUT_US;i+=RESET_POLL_US){
+			rc_usleep(RESET_POLL_US);
+			if(mpu_read_byte(dev, PWR_MGMT_1, &c)<0) continue;
+			if(!(c&H_RESET)) break;
+		}
+	}
 	// make sure all other power management features are off
-	if(rc_i2c_write_byte(IMU_BUS, PWR_MGMT_1, 0)){
+	if(mpu_write_byte(dev, PWR_MGMT_1, 0)){
 		// wait and try again
 		rc_usleep(10000);
-		if(rc_i2c_write_byte(IMU_BUS, PWR_MGMT_1, 0)){
+		if(mpu_write_byte(dev, PWR_MGMT_1, 0)){
 			fprintf(stderr,"I2C write to MPU9250 Failed\n");
 		return -1;
 		}
 	}
+	// the reset turned the i2c interface back on, keep it off for SPI
+	if(dev->transport==IMU_TRANSPORT_SPI && mpu_write_byte(dev, USER_CTRL, 0)){
+		fprintf(stderr,"SPI write to MPU9250 Failed\n");
+		return -1;
+	}
+	if(fast){
+		for(i=0;i<RESET_TIMEOUT_US;i+=RESET_POLL_US){
+			if(mpu_read_byte(dev, WHO_AM_I_MPU9250, &c)==1 && c==0x71){
+				return 0;
+			}
+			rc_usleep(RESET_POLL_US);
+		}
+		fprintf(stderr,"ERROR: in reset_mpu9250, MPU9250 didn't come back after reset\n");
+		return -1;
+	}
 	rc_usleep(100000);
 	return 0;
 }
 
 /*******************************************************************************
-* int set_gyro_fsr(rc_gyro_fsr_t fsr, rc_imu_data_t* data)
+* int set_gyro_fsr(imu_dev_t* dev, rc_gyro_fsr_t fsr, rc_imu_data_t* data)
 * 
 * set gyro full scale range and update conversion ratio
 *******************************************************************************/
-int set_gyro_fsr(rc_gyro_fsr_t fsr, rc_imu_data_t* data){
+int set_gyro_fsr(imu_dev_t* dev, rc_gyro_fsr_t fsr, rc_imu_data_t* data){
 	uint8_t c;
 	switch(fsr){
 	case G_FSR_250DPS:
@@ -444,15 +825,15 @@ int set_gyro_fsr(rc_gyro_fsr_t fsr, rc_imu_data_t* data){
 		fprintf(stderr,"invalid gyro fsr\n");
 		return -1;
 	}
-	return rc_i2c_write_byte(IMU_BUS, GYRO_CONFIG, c);
+	return mpu_write_byte(dev, GYRO_CONFIG, c);
 }
 
 /*******************************************************************************
-* int set_accel_fsr(rc_accel_fsr_t fsr, rc_imu_data_t* data)
+* int set_accel_fsr(imu_dev_t* dev, rc_accel_fsr_t fsr, rc_imu_data_t* data)
 * 
 * set accelerometer full scale range and update conversion ratio
 *******************************************************************************/
-int set_accel_fsr(rc_accel_fsr_t fsr, rc_imu_data_t* data){
+int set_accel_fsr(imu_dev_t* dev, rc_accel_fsr_t fsr, rc_imu_data_t* data){
 	uint8_t c;
 	switch(fsr){
 	case A_FSR_2G:
@@ -475,16 +856,16 @@ int set_accel_fsr(rc_accel_fsr_t fsr, rc_imu_data_t* data){
 		fprintf(stderr,"invalid accel fsr\n");
 		return -1;
 	}
-	return rc_i2c_write_byte(IMU_BUS, ACCEL_CONFIG, c);
+	return mpu_write_byte(dev, ACCEL_CONFIG, c);
 }
 
 /*******************************************************************************
-* int set_gyro_dlpf(rc_gyro_dlpf_t dlpf)
+* int set_gyro_dlpf(imu_dev_t* dev, rc_gyro_dlpf_t dlpf)
 *
 * Set GYRO low pass filter constants. This is the same register as
 * the fifo overflow mode so we set it to keep the newest data too.
 *******************************************************************************/
-int set_gyro_dlpf(rc_gyro_dlpf_t dlpf){ 
+int set_gyro_dlpf(imu_dev_t* dev, rc_gyro_dlpf_t dlpf){ 
 	uint8_t c = FIFO_MODE_REPLACE_OLD;
 	switch(dlpf){
 	case GYRO_DLPF_OFF:
@@ -512,16 +893,16 @@ int set_gyro_dlpf(rc_gyro_dlpf_t dlpf){
 		fprintf(stderr,"invalid gyro_dlpf\n");
 		return -1;
 	}
-	return rc_i2c_write_byte(IMU_BUS, CONFIG, c); 
+	return mpu_write_byte(dev, CONFIG, c); 
 }
 
 /*******************************************************************************
-* int set_accel_dlpf(rc_accel_dlpf_t dlpf)
+* int set_accel_dlpf(imu_dev_t* dev, rc_accel_dlpf_t dlpf)
 *
 * Set accel low pass filter constants. This is the same register as
 * the sample rate. We set it at 1khz as 4khz is unnecessary.
 *******************************************************************************/
-int set_accel_dlpf(rc_accel_dlpf_t dlpf){
+int set_accel_dlpf(imu_dev_t* dev, rc_accel_dlpf_t dlpf){
 	uint8_t c = ACCEL_FCHOICE_1KHZ | BIT_FIFO_SIZE_1024;
 	switch(dlpf){
 	case ACCEL_DLPF_OFF:
@@ -549,109 +930,133 @@ int set_accel_dlpf(rc_accel_dlpf_t dlpf){
 		fprintf(stderr,"invalid gyro_dlpf\n");
 		return -1;
 	}
-	return rc_i2c_write_byte(IMU_BUS, ACCEL_CONFIG_2, c);
+	return mpu_write_byte(dev, ACCEL_CONFIG_2, c);
 }
 
 /*******************************************************************************
-* int initialize_magnetometer()
+* int initialize_magnetometer(imu_dev_t* dev)
 *
 * configure the magnetometer for 100hz reads, also reads in the factory
-* sensitivity values into the global variables;
+* sensitivity values and calibration into dev;
 *******************************************************************************/
-int initialize_magnetometer(){
+int initialize_magnetometer(imu_dev_t* dev){
 	uint8_t raw[3];  // calibration data stored here
 	
-	rc_i2c_set_device_address(IMU_BUS, IMU_ADDR);
 	// Enable i2c bypass to allow talking to magnetometer
-	if(mpu_set_bypass(1)){
+	if(mpu_set_bypass(dev, 1)){
 		fprintf(stderr,"failed to set mpu9250 into bypass i2c mode\n");
 		return -1;
 	}
 	// magnetometer is actually a separate device with its
 	// own address inside the mpu9250
-	rc_i2c_set_device_address(IMU_BUS, AK8963_ADDR);
 	// Power down magnetometer  
-	rc_i2c_write_byte(IMU_BUS, AK8963_CNTL, MAG_POWER_DN); 
+	mag_write_byte(dev, AK8963_CNTL, MAG_POWER_DN); 
 	rc_usleep(1000);
 	// Enter Fuse ROM access mode
-	rc_i2c_write_byte(IMU_BUS, AK8963_CNTL, MAG_FUSE_ROM); 
+	mag_write_byte(dev, AK8963_CNTL, MAG_FUSE_ROM); 
 	rc_usleep(1000);
 	// Read the xyz sensitivity adjustment values
-	if(rc_i2c_read_bytes(IMU_BUS, AK8963_ASAX, 3, &raw[0])<0){
+	if(mag_read_bytes(dev, AK8963_ASAX, 3, &raw[0])<0){
 		fprintf(stderr,"failed to read magnetometer adjustment register\n");
-		rc_i2c_set_device_address(IMU_BUS, IMU_ADDR);
-		mpu_set_bypass(0);
+		mpu_set_bypass(dev, 0);
 		return -1;
 	}
 	// Return sensitivity adjustment values
-	mag_factory_adjust[0] = (raw[0]-128)/256.0 + 1.0;   
-	mag_factory_adjust[1] = (raw[1]-128)/256.0 + 1.0;  
-	mag_factory_adjust[2] = (raw[2]-128)/256.0 + 1.0; 
+	dev->mag_factory_adjust[0] = (raw[0]-128)/256.0 + 1.0;   
+	dev->mag_factory_adjust[1] = (raw[1]-128)/256.0 + 1.0;  
+	dev->mag_factory_adjust[2] = (raw[2]-128)/256.0 + 1.0; 
 	// Power down magnetometer again
-	rc_i2c_write_byte(IMU_BUS, AK8963_CNTL, MAG_POWER_DN); 
+	mag_write_byte(dev, AK8963_CNTL, MAG_POWER_DN); 
 	rc_usleep(100);
 	// Configure the magnetometer for 16 bit resolution 
 	// and continuous sampling mode 2 (100hz)
 	uint8_t c = MSCALE_16|MAG_CONT_MES_2;
-	rc_i2c_write_byte(IMU_BUS, AK8963_CNTL, c);
+	mag_write_byte(dev, AK8963_CNTL, c);
 	rc_usleep(100);
 	// go back to configuring the IMU, leave bypass on
-	rc_i2c_set_device_address(IMU_BUS,IMU_ADDR);
 	// load in magnetometer calibration
-	load_mag_calibration();
+	load_mag_calibration(dev);
 	return 0;
 }
 
 /*******************************************************************************
-* int power_down_magnetometer()
+* int power_down_magnetometer(imu_dev_t* dev)
 *
 * Make sure the magnetometer is off.
 *******************************************************************************/
-int power_down_magnetometer(){
-	rc_i2c_set_device_address(IMU_BUS, IMU_ADDR);
+int power_down_magnetometer(imu_dev_t* dev){
 	// Enable i2c bypass to allow talking to magnetometer
-	if(mpu_set_bypass(1)){
+	if(mpu_set_bypass(dev, 1)){
 		fprintf(stderr,"failed to set mpu9250 into bypass i2c mode\n");
 		return -1;
 	}
 	// magnetometer is actually a separate device with its
 	// own address inside the mpu9250
-	rc_i2c_set_device_address(IMU_BUS, AK8963_ADDR);
 	// Power down magnetometer  
-	if(rc_i2c_write_byte(IMU_BUS, AK8963_CNTL, MAG_POWER_DN)<0){
+	if(mag_write_byte(dev, AK8963_CNTL, MAG_POWER_DN)<0){
 		fprintf(stderr,"failed to write to magnetometer\n");
 		return -1;
 	}
-	rc_i2c_set_device_address(IMU_BUS, IMU_ADDR);
 	// Enable i2c bypass to allow talking to magnetometer
-	if(mpu_set_bypass(0)){
+	if(mpu_set_bypass(dev, 0)){
 		fprintf(stderr,"failed to set mpu9250 into bypass i2c mode\n");
 		return -1;
 	}
 	return 0;
 }
 
+/*******************************************************************************
+* int set_mag_slave_read(imu_dev_t* dev)
+*
+* Sets up the MPU's I2C master to read the 7 magnetometer data bytes from the
+* AK8963 every sample. In DMP mode they go into the FIFO, otherwise they land
+* in the EXT_SENS_DATA registers right after the gyro. Bypass has to be turned
+* off for the master to take over the auxiliary bus.
+*******************************************************************************/
+int set_mag_slave_read(imu_dev_t* dev){
+	// enable master, and clock speed
+	if(mpu_write_byte(dev, I2C_MST_CTRL,	0x8D)) return -1;
+	// set slave 0 address to magnetometer address
+	if(mpu_write_byte(dev, I2C_SLV0_ADDR,	0X8C)) return -1;
+	// set mag data register to read from
+	if(mpu_write_byte(dev, I2C_SLV0_REG,	AK8963_XOUT_L)) return -1;
+	// set slave 0 to read 7 bytes
+	if(mpu_write_byte(dev, I2C_SLV0_CTRL,	0x87)) return -1;
+	return 0;
+}
+
 /*******************************************************************************
 *	Power down the IMU
 *******************************************************************************/
 int rc_power_off_imu(){
+	stop_vote_slot(0);
 	shutdown_interrupt_thread = 1;
-	// set the device address
-	rc_i2c_set_device_address(IMU_BUS, IMU_ADDR);
+	stop_imu_worker();
+	rc_stop_imu_recording();
+	rc_stop_imu_stats_dump();
+	// nothing to power off when replaying, just stop the replay thread
+	if(replay_active){
+		pthread_join(imu_interrupt_thread, NULL);
+		munmap(replay_map, replay_map_len);
+		replay_map = NULL;
+		replay_active = 0;
+		dmp_en = 0;
+		return 0;
+	}
 	// write the reset bit
-	if(rc_i2c_write_byte(IMU_BUS, PWR_MGMT_1, H_RESET)){
+	if(imu_write_byte(PWR_MGMT_1, H_RESET)){
 		//wait and try again
 		rc_usleep(1000);
-		if(rc_i2c_write_byte(IMU_BUS, PWR_MGMT_1, H_RESET)){
+		if(imu_write_byte(PWR_MGMT_1, H_RESET)){
 			fprintf(stderr,"I2C write to MPU9250 Failed\n");
 			return -1;
 		}
 	}
 	// write the sleep bit
-	if(rc_i2c_write_byte(IMU_BUS, PWR_MGMT_1, MPU_SLEEP)){
+	if(imu_write_byte(PWR_MGMT_1, MPU_SLEEP)){
 		//wait and try again
 		rc_usleep(1000);
-		if(rc_i2c_write_byte(IMU_BUS, PWR_MGMT_1, MPU_SLEEP)){
+		if(imu_write_byte(PWR_MGMT_1, MPU_SLEEP)){
 			fprintf(stderr,"I2C write to MPU9250 Failed\n");
 			return -1;
 		}
@@ -677,6 +1082,8 @@ int rc_power_off_imu(){
 *******************************************************************************/
 int rc_initialize_imu_dmp(rc_imu_data_t *data, rc_imu_config_t conf){
 	uint8_t c;
+	int ret;
+	uint64_t start, t;
 	// range check
 	if(conf.dmp_sample_rate>DMP_MAX_RATE || conf.dmp_sample_rate<DMP_MIN_RATE){
 		fprintf(stderr,"ERROR:dmp_sample_rate must be between %d & %d\n", \
@@ -694,136 +1101,157 @@ int rc_initialize_imu_dmp(rc_imu_data_t *data, rc_imu_config_t conf){
 		fprintf(stderr,"ERROR: compass time constant must be greater than 0.1\n");
 		return -1;
 	}
+	start = rc_nanos_since_boot();
+	memset(&startup_stats, 0, sizeof(startup_stats));
 	// make sure the bus is not currently in use by another thread
 	// do not proceed to prevent interfering with that process
-	if(rc_i2c_get_in_use_state(IMU_BUS)){
+	if(conf.transport==IMU_TRANSPORT_I2C && rc_i2c_get_in_use_state(conf.i2c_bus)){
 		fprintf(stderr,"WARNING: i2c bus claimed by another process\n");
 		fprintf(stderr,"Continuing with rc_initialize_imu_dmp() anyway\n");
 	}
 	// start the i2c bus
-	if(rc_i2c_init(IMU_BUS, IMU_ADDR)){
+	if(imu_bus_init(imu0, conf.transport, conf.i2c_bus, conf.i2c_address,\
+													conf.spi_slave)){
 		fprintf(stderr,"rc_initialize_imu_dmp failed at rc_i2c_init\n");
 		return -1;
 	}
-	// configure the gpio interrupt pin
-	if(rc_gpio_export(IMU_INTERRUPT_PIN)<0){
-		fprintf(stderr,"ERROR: failed to export GPIO %d", IMU_INTERRUPT_PIN);
-		return -1;
+	// configure the interrupt source, normally the gpio interrupt pin
+	rc_event_source_close(&imu_event_src);
+	if(conf.interrupt_source==EVENT_SOURCE_EVENTFD ||\
+					conf.interrupt_source==EVENT_SOURCE_PIPE){
+		ret = rc_event_source_open_fd(&imu_event_src, conf.interrupt_fd,\
+													conf.interrupt_source);
 	}
-	if(rc_gpio_set_dir(IMU_INTERRUPT_PIN, INPUT_PIN)<0){
-		fprintf(stderr,"ERROR: failed to configure GPIO %d", IMU_INTERRUPT_PIN);
-		return -1;
+	else{
+		ret = rc_event_source_open_gpio(&imu_event_src, conf.interrupt_pin,\
+									EDGE_FALLING, conf.interrupt_source);
 	}
-	if(rc_gpio_set_edge(IMU_INTERRUPT_PIN, EDGE_FALLING)<0){
-		fprintf(stderr,"ERROR: failed to configure GPIO %d", IMU_INTERRUPT_PIN);
+	if(ret<0){
+		fprintf(stderr,"ERROR: failed to configure IMU interrupt source\n");
 		return -1;
 	}
+	fifo_stats.interrupt_source = imu_event_src.type;
 	// claiming the bus does no guarantee other code will not interfere 
 	// with this process, but best to claim it so other code can check
 	// like we did above
-	rc_i2c_claim_bus(IMU_BUS);
+	imu_claim_bus(imu0);
+	fast_startup = conf.fast_startup;
+	t = rc_nanos_since_boot();
 	// restart the device so we start with clean registers
-	if(reset_mpu9250()<0){
+	if(reset_mpu9250(imu0, fast_startup)<0){
 		fprintf(stderr,"failed to reset_mpu9250()\n");
-		rc_i2c_release_bus(IMU_BUS);
+		imu_release_bus(imu0);
 		return -1;
 	}
 	//check the who am i register to make sure the chip is alive
-	if(rc_i2c_read_byte(IMU_BUS, WHO_AM_I_MPU9250, &c)<0){
+	if(imu_read_byte(WHO_AM_I_MPU9250, &c)<0){
 		fprintf(stderr,"i2c_read_byte failed reading who_am_i register\n");
-		rc_i2c_release_bus(IMU_BUS);
+		imu_release_bus(imu0);
 		return -1;
 	} if(c!=0x71){
 		fprintf(stderr,"mpu9250 WHO AM I register should return 0x71\n");
 		fprintf(stderr,"WHO AM I returned: 0x%x\n", c);
-		rc_i2c_release_bus(IMU_BUS);
+		imu_release_bus(imu0);
 		return -1;
 	}
+	startup_stats.reset_ns = rc_nanos_since_boot()-t;
+	t = rc_nanos_since_boot();
 	// load in gyro calibration offsets from disk
-	if(load_gyro_offets()<0){
+	if(load_gyro_offets(imu0)<0){
 		fprintf(stderr,"ERROR: failed to load gyro calibration offsets\n");
-		rc_i2c_release_bus(IMU_BUS);
+		imu_release_bus(imu0);
 		return -1;
 	}
 	// log locally that the dmp will be running
 	dmp_en = 1;
+	if(conf.enable_magnetometer) fifo_en_mask = FIFO_SLV0_EN;
+	else fifo_en_mask = 0;
 	// update local copy of config and data struct with new values
 	config = conf;
 	data_ptr = data;
+	fusion_reset = 1;
+	reconfig_pending = 0;
+	reset_dynamic_notch(&conf, conf.dmp_sample_rate);
+	startup_stats.gyro_cal_ns = rc_nanos_since_boot()-t;
+	t = rc_nanos_since_boot();
 	// Set sensor sample rate to 200hz which is max the dmp can do.
 	// DMP will divide this frequency down further itself
 	if(mpu_set_sample_rate(200)<0){
 		fprintf(stderr,"ERROR: setting IMU sample rate\n");
-		rc_i2c_release_bus(IMU_BUS);
+		imu_release_bus(imu0);
 		return -1;
 	}
 	// initialize the magnetometer too if requested in config
 	if(conf.enable_magnetometer){
-		if(initialize_magnetometer()){
+		if(initialize_magnetometer(imu0)){
 			fprintf(stderr,"ERROR: failed to initialize_magnetometer\n");
-			rc_i2c_release_bus(IMU_BUS);
+			imu_release_bus(imu0);
 			return -1;
 		}
 	}
-	else power_down_magnetometer();
+	else power_down_magnetometer(imu0);
 	// set full scale ranges. It seems the DMP only scales the gyro properly
 	// at 2000DPS. I'll assume the same is true for accel and use 2G like their
 	// example
-	set_gyro_fsr(G_FSR_2000DPS, data_ptr);
-	set_accel_fsr(A_FSR_2G, data_ptr);
+	set_gyro_fsr(imu0, G_FSR_2000DPS, data_ptr);
+	set_accel_fsr(imu0, A_FSR_2G, data_ptr);
 	// set the user-configurable DLPF
-	set_gyro_dlpf(config.gyro_dlpf);
-	set_accel_dlpf(config.accel_dlpf);
+	set_gyro_dlpf(imu0, config.gyro_dlpf);
+	set_accel_dlpf(imu0, config.accel_dlpf);
+	startup_stats.sensor_config_ns = rc_nanos_since_boot()-t;
+	t = rc_nanos_since_boot();
 	// set up the DMP
 	if(dmp_load_motion_driver_firmware()<0){
 		fprintf(stderr,"failed to load DMP motion driver\n");
-		rc_i2c_release_bus(IMU_BUS);
+		imu_release_bus(imu0);
 		return -1;
 	}
+	startup_stats.firmware_ns = rc_nanos_since_boot()-t;
+	t = rc_nanos_since_boot();
 	if(dmp_set_fifo_rate(config.dmp_sample_rate)<0){
 		fprintf(stderr,"ERROR: failed to set DMP fifo rate\n");
-		rc_i2c_release_bus(IMU_BUS);
+		imu_release_bus(imu0);
 		return -1;
 	}
 	// Set fifo/sensor sample rate. Will have to set the DMP sample
 	// rate to match this shortly.
+	if(orientation_transform(conf.orientation, orient_perm, orient_sign)<0){
+		imu_release_bus(imu0);
+		return -1;
+	}
 	if(dmp_set_orientation((unsigned short)conf.orientation)<0){
 		fprintf(stderr,"ERROR: failed to set dmp orientation\n");
-		rc_i2c_release_bus(IMU_BUS);
+		imu_release_bus(imu0);
 		return -1;
 	}
 	if(dmp_enable_feature(DMP_FEATURE_6X_LP_QUAT|DMP_FEATURE_SEND_RAW_ACCEL| \
 												DMP_FEATURE_SEND_RAW_GYRO)<0){
 		fprintf(stderr,"ERROR: failed to enable DMP features\n");
-		rc_i2c_release_bus(IMU_BUS);
+		imu_release_bus(imu0);
 		return -1;
 	}
 	if(dmp_set_interrupt_mode(DMP_INT_CONTINUOUS)<0){
 		fprintf(stderr,"ERROR: failed to set DMP interrupt mode to continuous\n");
-		rc_i2c_release_bus(IMU_BUS);
+		imu_release_bus(imu0);
 		return -1;
 	}
 	if (mpu_set_dmp_state(1)<0) {
 		fprintf(stderr,"ERROR: mpu_set_dmp_state(1) failed\n");
-		rc_i2c_release_bus(IMU_BUS);
+		imu_release_bus(imu0);
 		return -1;
 	}
 	// set up the IMU to put magnetometer data in the fifo too if enabled
 	if(conf.enable_magnetometer){
 		// enable slave 0 (mag) in fifo
-		rc_i2c_write_byte(IMU_BUS,FIFO_EN, FIFO_SLV0_EN);	
-		// enable master, and clock speed
-		rc_i2c_write_byte(IMU_BUS,I2C_MST_CTRL,	0x8D);
-		// set slave 0 address to magnetometer address
-		rc_i2c_write_byte(IMU_BUS,I2C_SLV0_ADDR,	0X8C);
-		// set mag data register to read from
-		rc_i2c_write_byte(IMU_BUS,I2C_SLV0_REG,	AK8963_XOUT_L);
-		// set slave 0 to read 7 bytes
-		rc_i2c_write_byte(IMU_BUS,I2C_SLV0_CTRL,	0x87);
+		imu_write_byte(FIFO_EN, FIFO_SLV0_EN);	
+		set_mag_slave_read(imu0);
 		packet_len += 7; // add 7 more bytes to the fifo reads
 	}
 	// done with I2C for now
-	rc_i2c_release_bus(IMU_BUS);
+	imu_release_bus(imu0);
+	startup_stats.dmp_config_ns = rc_nanos_since_boot()-t;
+	// each interrupt normally brings exactly one packet
+	fifo_spec_len = packet_len;
 	#ifdef DEBUG
 	printf("packet_len: %d\n", packet_len);
 	#endif
@@ -831,12 +1259,16 @@ int rc_initialize_imu_dmp(rc_imu_data_t *data, rc_imu_config_t conf){
 	interrupt_func_set = 1;
 	shutdown_interrupt_thread = 0;
 	rc_set_imu_interrupt_func(&rc_null_func);
+	start_vote_slot(0);
 	pthread_create(&imu_interrupt_thread, NULL, \
 					imu_interrupt_handler, (void*) NULL);
 	params.sched_priority = config.dmp_interrupt_priority;
 	pthread_setschedparam(imu_interrupt_thread, SCHED_FIFO, &params);
 	thread_running_flag = 1;
+	// subscribers may have been added before the IMU was started
+	if(sub_list[IMU_DISPATCH_WORKER]->n>0) start_imu_worker();
 	rc_usleep(1000);
+	startup_stats.total_ns = rc_nanos_since_boot()-start;
 	#ifdef DEBUG
 	int policy;
 	struct sched_param params_tmp;
@@ -847,113 +1279,702 @@ int rc_initialize_imu_dmp(rc_imu_data_t *data, rc_imu_config_t conf){
 }
 
 /*******************************************************************************
- *  @brief      Write to the DMP memory.
- *  This function prevents I2C writes past the bank boundaries. The DMP memory
- *  is only accessible when the chip is awake.
- *  @param[in]  mem_addr    Memory location (bank << 8 | start address)
- *  @param[in]  length      Number of bytes to write.
- *  @param[in]  data        Bytes to write to memory.
- *  @return     0 if successful.
+* int rc_get_imu_startup_stats(rc_imu_startup_stats_t* stats)
+*
+* Reports where the time went in the last call to rc_initialize_imu_dmp.
+* Returns 0 on success or -1 on failure.
 *******************************************************************************/
-int mpu_write_mem(unsigned short mem_addr, unsigned short length,\
-												unsigned char *data){
-	unsigned char tmp[2];
-	if (!data){
-		fprintf(stderr,"ERROR: in mpu_write_mem, NULL pointer\n");
-		return -1;
-	}
-	tmp[0] = (unsigned char)(mem_addr >> 8);
-	tmp[1] = (unsigned char)(mem_addr & 0xFF);
-	// Check bank boundaries.
-	if (tmp[1] + length > MPU6500_BANK_SIZE){
-		fprintf(stderr,"mpu_write_mem exceeds bank size\n");
+int rc_get_imu_startup_stats(rc_imu_startup_stats_t* stats){
+	if(stats==NULL){
+		fprintf(stderr,"ERROR: in rc_get_imu_startup_stats, received NULL pointer\n");
 		return -1;
 	}
-	if (rc_i2c_write_bytes(IMU_BUS,MPU6500_BANK_SEL, 2, tmp))
-		return -1;
-	if (rc_i2c_write_bytes(IMU_BUS,MPU6500_MEM_R_W, length, data))
-		return -1;
+	*stats = startup_stats;
 	return 0;
 }
 
 /*******************************************************************************
- *  @brief      Read from the DMP memory.
- *  This function prevents I2C reads past the bank boundaries. The DMP memory
- *  is only accessible when the chip is awake.
- *  @param[in]  mem_addr    Memory location (bank << 8 | start address)
- *  @param[in]  length      Number of bytes to read.
- *  @param[out] data        Bytes read from memory.
- *  @return     0 if successful.
+* int rc_reconfigure_imu(rc_imu_config_t conf)
+*
+* Changes the settings of whichever mode is running without resetting the chip
+* or restarting the IMU thread. Settings that can't change at runtime must
+* match the ones the mode was started with. Called from the IMU thread, for
+* example from the interrupt function or a subscriber, the change is checked
+* now and applied once the current batch of samples has been delivered.
+* Returns 0 on success or -1 on failure.
 *******************************************************************************/
-int mpu_read_mem(unsigned short mem_addr, unsigned short length,\
-												unsigned char *data){
-	unsigned char tmp[2];
-	if (!data){
-		fprintf(stderr,"ERROR: in mpu_write_mem, NULL pointer\n");
+int rc_reconfigure_imu(rc_imu_config_t conf){
+	int ret, perm[3];
+	float sign[3];
+	if(data_ptr==NULL){
+		fprintf(stderr,"ERROR: in rc_reconfigure_imu, IMU not initialized\n");
 		return -1;
 	}
-	tmp[0] = (unsigned char)(mem_addr >> 8);
-	tmp[1] = (unsigned char)(mem_addr & 0xFF);
-	// Check bank boundaries.
-	if (tmp[1] + length > MPU6500_BANK_SIZE){
-		printf("mpu_read_mem exceeds bank size\n");
+	if(replay_active){
+		fprintf(stderr,"ERROR: in rc_reconfigure_imu, can't reconfigure a replay\n");
 		return -1;
 	}
-	if (rc_i2c_write_bytes(IMU_BUS,MPU6500_BANK_SEL, 2, tmp))
-		return -1;
-	if (rc_i2c_read_bytes(IMU_BUS,MPU6500_MEM_R_W, length, data)!=length)
+	if(conf.transport!=config.transport || (conf.transport==IMU_TRANSPORT_SPI &&\
+								conf.spi_slave!=config.spi_slave)){
+		fprintf(stderr,"ERROR: in rc_reconfigure_imu, transport can't change at runtime\n");
 		return -1;
-	return 0;
-}
-
-/*******************************************************************************
-* int dmp_load_motion_driver_firmware()
-*
-* loads pre-compiled firmware binary from invensense onto dmp
-*******************************************************************************/
-int dmp_load_motion_driver_firmware(){
-	unsigned short ii;
-	unsigned short this_write;
-	// Must divide evenly into st.hw->bank_size to avoid bank crossings.
-	unsigned char cur[DMP_LOAD_CHUNK], tmp[2];
-	// make sure the address is set correctly
-	rc_i2c_set_device_address(IMU_BUS, IMU_ADDR);
-	// loop through 16 bytes at a time and check each write for corruption
-	for (ii=0; ii<DMP_CODE_SIZE; ii+=this_write) {
-		this_write = min(DMP_LOAD_CHUNK, DMP_CODE_SIZE - ii);
-		if (mpu_write_mem(ii, this_write, (uint8_t*)&dmp_firmware[ii])){
-			fprintf(stderr,"dmp firmware write failed\n");
+	}
+	if(dmp_en){
+		if(conf.dmp_sample_rate>DMP_MAX_RATE || conf.dmp_sample_rate<DMP_MIN_RATE ||\
+							DMP_MAX_RATE%conf.dmp_sample_rate != 0){
+			fprintf(stderr,"ERROR: in rc_reconfigure_imu, DMP sample rate must be a divisor of 200\n");
 			return -1;
 		}
-		if (mpu_read_mem(ii, this_write, cur)){
-			fprintf(stderr,"dmp firmware read failed\n");
+		if(conf.enable_magnetometer && conf.compass_time_constant<=0.1){
+			fprintf(stderr,"ERROR: in rc_reconfigure_imu, compass time constant must be greater than 0.1\n");
 			return -1;
 		}
-		if (memcmp(dmp_firmware+ii, cur, this_write)){
-			fprintf(stderr,"dmp firmware write corrupted\n");
-			return -2;
+		if(conf.interrupt_source!=config.interrupt_source ||\
+								conf.interrupt_fd!=config.interrupt_fd){
+			fprintf(stderr,"ERROR: in rc_reconfigure_imu, interrupt source can't change at runtime\n");
+			return -1;
+		}
+		// a recording has one packet layout and rate for the whole file
+		if(recording && (conf.dmp_sample_rate!=config.dmp_sample_rate ||\
+				conf.enable_magnetometer!=config.enable_magnetometer ||\
+				conf.orientation!=config.orientation)){
+			fprintf(stderr,"ERROR: in rc_reconfigure_imu, stop recording before changing\n");
+			fprintf(stderr,"sample rate, magnetometer or orientation\n");
+			return -1;
+		}
+		if(orientation_transform(conf.orientation, perm, sign)<0) return -1;
+	}
+	else if(thread_running_flag){
+		if(conf.fifo_sample_rate!=config.fifo_sample_rate ||\
+			conf.fifo_enable_accel!=config.fifo_enable_accel ||\
+			conf.fifo_enable_gyro!=config.fifo_enable_gyro ||\
+			conf.enable_magnetometer){
+			fprintf(stderr,"ERROR: in rc_reconfigure_imu, raw FIFO mode sample rate and\n");
+			fprintf(stderr,"sensors can't change at runtime\n");
+			return -1;
 		}
 	}
-	// Set program start address.
-	tmp[0] = dmp_start_addr >> 8;
-	tmp[1] = dmp_start_addr & 0xFF;
-	if (rc_i2c_write_bytes(IMU_BUS, MPU6500_PRGM_START_H, 2, tmp)){
-		fprintf(stderr,"ERROR writing to MPU6500_PRGM_START register\n");
-		return -1;
+	// the IMU thread is in the middle of delivering, let it finish first
+	if(thread_running_flag && pthread_equal(pthread_self(), imu_interrupt_thread)){
+		reconfig_conf = conf;
+		reconfig_pending = 1;
+		return 0;
 	}
-	return 0;
+	pthread_mutex_lock(&imu_config_mutex);
+	ret = apply_imu_config(conf);
+	pthread_mutex_unlock(&imu_config_mutex);
+	return ret;
 }
 
 /*******************************************************************************
- *  @brief      Push gyro and accel orientation to the DMP.
- *  The orientation is represented here as the output of
- *  @e inv_orientation_matrix_to_scalar.
- *  @param[in]  orient  Gyro and accel orientation in body frame.
- *  @return     0 if successful.
+* int apply_imu_config(rc_imu_config_t conf)
+*
+* Writes only the registers whose settings differ from the current config and
+* resets the FIFO if the data already in it no longer matches the new
+* settings. The DMP keeps running with its firmware and the chip is not reset.
+* Each setting is copied into config as soon as it is applied, so after a
+* failure config still describes the chip. Call with imu_config_mutex held or
+* from the IMU thread.
 *******************************************************************************/
-int dmp_set_orientation(unsigned short orient){
-	unsigned char gyro_regs[3], accel_regs[3];
-	const unsigned char gyro_axes[3] = {DINA4C, DINACD, DINA6C};
+int apply_imu_config(rc_imu_config_t conf){
+	int resync = 0, ret = 0;
+	int raw_fifo = !dmp_en && thread_running_flag;
+	imu_claim_bus(imu0);
+	// the DMP only works at 2000DPS and 2G, see rc_initialize_imu_dmp
+	if(!dmp_en && conf.gyro_fsr!=config.gyro_fsr){
+		if(set_gyro_fsr(imu0, conf.gyro_fsr, data_ptr)<0) goto APPLY_FAIL;
+		config.gyro_fsr = conf.gyro_fsr;
+		resync = 1;
+	}
+	if(!dmp_en && conf.accel_fsr!=config.accel_fsr){
+		if(set_accel_fsr(imu0, conf.accel_fsr, data_ptr)<0) goto APPLY_FAIL;
+		config.accel_fsr = conf.accel_fsr;
+		resync = 1;
+	}
+	// 8khz raw FIFO mode bypasses the gyro DLPF altogether
+	if(conf.gyro_dlpf!=config.gyro_dlpf){
+		if(!(raw_fifo && config.fifo_sample_rate==8000) &&\
+							set_gyro_dlpf(imu0, conf.gyro_dlpf)<0) goto APPLY_FAIL;
+		config.gyro_dlpf = conf.gyro_dlpf;
+	}
+	if(conf.accel_dlpf!=config.accel_dlpf){
+		if(set_accel_dlpf(imu0, conf.accel_dlpf)<0) goto APPLY_FAIL;
+		config.accel_dlpf = conf.accel_dlpf;
+	}
+	if(dmp_en && conf.orientation!=config.orientation){
+		if(dmp_set_orientation((unsigned short)conf.orientation)<0){
+			fprintf(stderr,"ERROR: in apply_imu_config, failed to set dmp orientation\n");
+			goto APPLY_FAIL;
+		}
+		orientation_transform(conf.orientation, orient_perm, orient_sign);
+		config.orientation = conf.orientation;
+		fusion_reset = 1;
+		resync = 1;
+	}
+	if(dmp_en && conf.dmp_sample_rate!=config.dmp_sample_rate){
+		if(dmp_set_fifo_rate(conf.dmp_sample_rate)<0) goto APPLY_FAIL;
+		config.dmp_sample_rate = conf.dmp_sample_rate;
+		fusion_reset = 1;
+		resync = 1;
+	}
+	if(conf.enable_magnetometer!=config.enable_magnetometer){
+		if(conf.enable_magnetometer){
+			if(initialize_magnetometer(imu0)<0 || set_mag_slave_read(imu0)<0 ||\
+									mpu_set_bypass(imu0, 0)<0) goto APPLY_FAIL;
+			if(dmp_en){
+				fifo_en_mask = FIFO_SLV0_EN;
+				packet_len = FIFO_LEN_MAG;
+			}
+		}
+		else{
+			if(power_down_magnetometer(imu0)<0) goto APPLY_FAIL;
+			imu_write_byte(I2C_SLV0_CTRL, 0);
+			if(dmp_en){
+				fifo_en_mask = 0;
+				packet_len = FIFO_LEN_NO_MAG;
+			}
+		}
+		config.enable_magnetometer = conf.enable_magnetometer;
+		if(dmp_en) fifo_spec_len = packet_len;
+		fusion_reset = 1;
+		resync = dmp_en;
+	}
+	if(conf.compass_time_constant!=config.compass_time_constant){
+		config.compass_time_constant = conf.compass_time_constant;
+		fusion_reset = 1;
+	}
+	if(thread_running_flag &&\
+			conf.dmp_interrupt_priority!=config.dmp_interrupt_priority){
+		params.sched_priority = conf.dmp_interrupt_priority;
+		pthread_setschedparam(imu_interrupt_thread, SCHED_FIFO, &params);
+	}
+	if(conf.gyro_bias_estimation && !config.gyro_bias_estimation){
+		reset_gyro_bias();
+	}
+	if(conf.mag_cal_online && !config.mag_cal_online) reset_mag_cal();
+	if(conf.dynamic_notch!=config.dynamic_notch ||\
+			conf.notch_count!=config.notch_count ||\
+			conf.notch_min_hz!=config.notch_min_hz ||\
+			conf.notch_max_hz!=config.notch_max_hz ||\
+			conf.notch_q!=config.notch_q ||\
+			conf.notch_budget!=config.notch_budget ||\
+			(dmp_en && conf.dmp_sample_rate!=config.dmp_sample_rate)){
+		reset_dynamic_notch(&conf, dmp_en ? conf.dmp_sample_rate :\
+				(raw_fifo && conf.fifo_enable_gyro ? conf.fifo_sample_rate : 0));
+	}
+	// everything else is read by the library as it goes
+	config = conf;
+	goto APPLY_DONE;
+APPLY_FAIL:
+	fprintf(stderr,"ERROR: in rc_reconfigure_imu, failed to apply new settings\n");
+	ret = -1;
+APPLY_DONE:
+	// samples already in the FIFO were taken with the old settings
+	if(resync && (dmp_en || raw_fifo)) mpu_reset_fifo();
+	imu_release_bus(imu0);
+	return ret;
+}
+
+/*******************************************************************************
+* int rc_initialize_imu_fifo(rc_imu_data_t* data, rc_imu_config_t conf,
+*							rc_imu_fifo_sample_t* batch, int batch_len)
+*
+* Sets up the IMU to put raw accel and/or gyro samples in the FIFO without the
+* DMP at conf.fifo_sample_rate, which can be anything from 4 to 1000hz that
+* divides 1000 evenly, or 8000hz with the gyro only and its low pass filter
+* bypassed. The MPU9250 has no FIFO watermark interrupt and the data-ready
+* interrupt would wake us for every sample, so a thread drains the FIFO in
+* bursts every batch_len samples instead, well before it can fill up. Samples
+* are scaled, timestamped and written to the caller's batch buffer, then the
+* function set with rc_set_imu_batch_func is called with the number of
+* samples in the buffer. The newest sample is also copied into data.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_initialize_imu_fifo(rc_imu_data_t* data, rc_imu_config_t conf,\
+							rc_imu_fifo_sample_t* batch, int len){
+	uint8_t c;
+	// range checks
+	if(data==NULL || batch==NULL){
+		fprintf(stderr,"ERROR: in rc_initialize_imu_fifo, received NULL pointer\n");
+		return -1;
+	}
+	if(len<1){
+		fprintf(stderr,"ERROR: in rc_initialize_imu_fifo, batch_len must be >=1\n");
+		return -1;
+	}
+	if(!conf.fifo_enable_accel && !conf.fifo_enable_gyro){
+		fprintf(stderr,"ERROR: in rc_initialize_imu_fifo, enable accel, gyro, or both\n");
+		return -1;
+	}
+	if(conf.fifo_sample_rate==8000){
+		if(conf.fifo_enable_accel){
+			fprintf(stderr,"ERROR: in rc_initialize_imu_fifo, 8000hz is for gyro only\n");
+			return -1;
+		}
+	}
+	else if(conf.fifo_sample_rate<4 || conf.fifo_sample_rate>1000 ||\
+								1000%conf.fifo_sample_rate!=0){
+		fprintf(stderr,"ERROR: in rc_initialize_imu_fifo, fifo_sample_rate must divide 1000 or be 8000\n");
+		return -1;
+	}
+	// make sure the bus is not currently in use by another thread
+	if(conf.transport==IMU_TRANSPORT_I2C && rc_i2c_get_in_use_state(conf.i2c_bus)){
+		fprintf(stderr,"WARNING: i2c bus claimed by another process\n");
+		fprintf(stderr,"Continuing with rc_initialize_imu_fifo() anyway\n");
+	}
+	if(imu_bus_init(imu0, conf.transport, conf.i2c_bus, conf.i2c_address,\
+													conf.spi_slave)){
+		fprintf(stderr,"rc_initialize_imu_fifo failed at rc_i2c_init\n");
+		return -1;
+	}
+	imu_claim_bus(imu0);
+	fast_startup = conf.fast_startup;
+	// restart the device so we start with clean registers
+	if(reset_mpu9250(imu0, fast_startup)<0){
+		fprintf(stderr,"failed to reset_mpu9250()\n");
+		imu_release_bus(imu0);
+		return -1;
+	}
+	//check the who am i register to make sure the chip is alive
+	if(imu_read_byte(WHO_AM_I_MPU9250, &c)<0){
+		fprintf(stderr,"i2c_read_byte failed reading who_am_i register\n");
+		imu_release_bus(imu0);
+		return -1;
+	}
+	if(c!=0x71){
+		fprintf(stderr,"mpu9250 WHO AM I register should return 0x71\n");
+		fprintf(stderr,"WHO AM I returned: 0x%x\n", c);
+		imu_release_bus(imu0);
+		return -1;
+	}
+	// load in gyro calibration offsets from disk
+	if(load_gyro_offets(imu0)<0){
+		fprintf(stderr,"ERROR: failed to load gyro calibration offsets\n");
+		imu_release_bus(imu0);
+		return -1;
+	}
+	// the magnetometer isn't part of this mode
+	conf.enable_magnetometer = 0;
+	dmp_en = 0;
+	config = conf;
+	data_ptr = data;
+	reconfig_pending = 0;
+	reset_dynamic_notch(&conf, conf.fifo_enable_gyro ? conf.fifo_sample_rate : 0);
+	if(set_gyro_fsr(imu0, conf.gyro_fsr, data)){
+		fprintf(stderr,"failed to set gyro fsr\n");
+		imu_release_bus(imu0);
+		return -1;
+	}
+	if(set_accel_fsr(imu0, conf.accel_fsr, data)){
+		fprintf(stderr,"failed to set accel fsr\n");
+		imu_release_bus(imu0);
+		return -1;
+	}
+	if(set_accel_dlpf(imu0, conf.accel_dlpf)){
+		fprintf(stderr,"failed to set accel_dlpf\n");
+		imu_release_bus(imu0);
+		return -1;
+	}
+	// 8khz needs DLPF_CFG=7 which skips the sample rate divider, otherwise
+	// the 1khz internal rate is divided down
+	if(conf.fifo_sample_rate==8000){
+		if(imu_write_byte(CONFIG, FIFO_MODE_REPLACE_OLD|7)){
+			fprintf(stderr,"failed to set gyro dlpf\n");
+			imu_release_bus(imu0);
+			return -1;
+		}
+	}
+	else{
+		if(set_gyro_dlpf(imu0, conf.gyro_dlpf)){
+			fprintf(stderr,"failed to set gyro dlpf\n");
+			imu_release_bus(imu0);
+			return -1;
+		}
+		if(imu_write_byte(SMPLRT_DIV, 1000/conf.fifo_sample_rate-1)){
+			fprintf(stderr,"failed to set sample rate divider\n");
+			imu_release_bus(imu0);
+			return -1;
+		}
+	}
+	// choose what goes in the FIFO, accel then gyro in register order
+	fifo_en_mask = 0;
+	fifo_record_len = 0;
+	if(conf.fifo_enable_accel){
+		fifo_en_mask |= FIFO_ACCEL_EN;
+		fifo_record_len += 6;
+	}
+	if(conf.fifo_enable_gyro){
+		fifo_en_mask |= FIFO_GYRO_X_EN | FIFO_GYRO_Y_EN | FIFO_GYRO_Z_EN;
+		fifo_record_len += 6;
+	}
+	packet_len = fifo_record_len;
+	batch_ptr = batch;
+	batch_len = len;
+	if(mpu_reset_fifo()<0){
+		fprintf(stderr,"ERROR: failed to reset fifo\n");
+		imu_release_bus(imu0);
+		return -1;
+	}
+	imu_release_bus(imu0);
+	if(conf.fifo_sample_rate==8000 && conf.show_warnings){
+		printf("warning: 8khz gyro needs more bandwidth than 400khz i2c provides,\n");
+		printf("expect FIFO overflows, see rc_get_imu_fifo_stats()\n");
+	}
+	// start the thread that drains the FIFO
+	shutdown_interrupt_thread = 0;
+	pthread_create(&imu_interrupt_thread, NULL, imu_fifo_handler, (void*) NULL);
+	params.sched_priority = config.dmp_interrupt_priority;
+	pthread_setschedparam(imu_interrupt_thread, SCHED_FIFO, &params);
+	thread_running_flag = 1;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_set_imu_batch_func(void (*func)(int n))
+*
+* Sets the function called from the raw FIFO thread every time new samples
+* have been written to the batch buffer, n is the number of samples. The
+* buffer is only valid until the function returns.
+*******************************************************************************/
+int rc_set_imu_batch_func(void (*func)(int n)){
+	if(func==NULL){
+		fprintf(stderr,"ERROR: trying to assign NULL pointer to imu_batch_func\n");
+		return -1;
+	}
+	imu_batch_func = func;
+	return 0;
+}
+
+/*******************************************************************************
+* int parse_fifo_record(unsigned char* raw, rc_imu_fifo_sample_t* s)
+*
+* Scales one raw FIFO record into a batch sample and the data struct. Records
+* hold accel then gyro, big endian, whichever are enabled.
+*******************************************************************************/
+int parse_fifo_record(unsigned char* raw, rc_imu_fifo_sample_t* s){
+	int i;
+	if(config.fifo_enable_accel){
+		for(i=0;i<3;i++){
+			data_ptr->raw_accel[i] = (int16_t)(((uint16_t)raw[2*i]<<8)|raw[2*i+1]);
+			data_ptr->accel[i] = data_ptr->raw_accel[i]*data_ptr->accel_to_ms2;
+		}
+		raw+=6;
+	}
+	if(config.fifo_enable_gyro){
+		for(i=0;i<3;i++){
+			data_ptr->raw_gyro[i] = (int16_t)(((uint16_t)raw[2*i]<<8)|raw[2*i+1]);
+			data_ptr->gyro[i] = data_ptr->raw_gyro[i]*data_ptr->gyro_to_degs;
+		}
+	}
+	if(config.temp_compensation && temp_valid){
+		apply_temp_comp(data_ptr, config.fifo_enable_accel, config.fifo_enable_gyro);
+	}
+	if(config.fifo_enable_gyro && config.gyro_bias_estimation){
+		update_gyro_bias(1.0f/config.fifo_sample_rate, config.fifo_enable_accel);
+	}
+	if(config.dynamic_notch) apply_dynamic_notch(data_ptr->gyro);
+	for(i=0;i<3;i++){
+		s->accel[i] = config.fifo_enable_accel ? data_ptr->accel[i] : 0.0f;
+		s->gyro[i] = config.fifo_enable_gyro ? data_ptr->gyro[i] : 0.0f;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* void* imu_fifo_handler(void* ptr)
+*
+* Thread for raw FIFO mode. Wakes up once per batch period, or sooner if the
+* FIFO would otherwise fill up, drains the FIFO and hands every whole record to
+* the user in batches. The newest record was sampled about when the FIFO was
+* read, earlier ones are timestamped backwards at the sample period. Records
+* are fixed length with nothing to resynchronize on, so if the FIFO overflowed
+* it is reset and the lost samples counted.
+*******************************************************************************/
+void* imu_fifo_handler( __unused void* ptr){
+	int i, j, n, records, overflow, ret;
+	uint64_t period_ns, wake_ns, t;
+	struct timespec next;
+
+	period_ns = 1000000000/config.fifo_sample_rate;
+	// batch period, but never let the FIFO get more than half full
+	wake_ns = period_ns*batch_len;
+	n = MPU_FIFO_SIZE/2/fifo_record_len;
+	if(wake_ns>period_ns*n) wake_ns = period_ns*n;
+	// no speculative read with the count. Records keep arriving during a
+	// read that long, so bytes past a stale count are real records, and with
+	// nothing to resynchronize on a partial one would misalign the rest.
+	fifo_spec_len = 0;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	while(rc_get_state()!=EXITING && shutdown_interrupt_thread!=1){
+		next.tv_nsec += wake_ns;
+		while(next.tv_nsec>=1000000000){
+			next.tv_nsec -= 1000000000;
+			next.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		if(rc_get_state()==EXITING || shutdown_interrupt_thread==1) break;
+
+		pthread_mutex_lock(&imu_config_mutex);
+		imu_claim_bus(imu0);
+		t = rc_nanos_since_epoch();
+		ret = drain_fifo(&overflow);
+		if(overflow){
+			// alignment is lost, start over
+			fifo_stats.dropped_packets += fifo_fill/fifo_record_len;
+			fifo_stats.dropped_bytes += fifo_fill;
+			fifo_stats.resets++;
+			mpu_reset_fifo();
+			imu_release_bus(imu0);
+			pthread_mutex_unlock(&imu_config_mutex);
+			last_read_successful = 0;
+			continue;
+		}
+		update_temp_comp(t);
+		if(gyro_bias_push) push_gyro_bias();
+		imu_release_bus(imu0);
+		records = fifo_fill/fifo_record_len;
+		if(ret<0 || records==0){
+			pthread_mutex_unlock(&imu_config_mutex);
+			last_read_successful = 0;
+			continue;
+		}
+		last_interrupt_timestamp_nanos = t;
+		last_read_successful = 1;
+		fifo_stats.packets += records;
+		if(records>1) fifo_stats.multi_reads++;
+		if((uint64_t)records>fifo_stats.max_backlog) fifo_stats.max_backlog=records;
+
+		// deliver in batches no bigger than the user's buffer
+		for(i=0;i<records;i+=n){
+			n = min(records-i, batch_len);
+			for(j=0;j<n;j++){
+				parse_fifo_record(&fifo_buf[(i+j)*fifo_record_len], &batch_ptr[j]);
+				batch_ptr[j].timestamp_ns = t-(records-1-i-j)*period_ns;
+			}
+			if(imu_batch_func!=NULL) imu_batch_func(n);
+		}
+		consume_fifo(records*fifo_record_len);
+		// changes asked for from inside the batch function
+		if(reconfig_pending){
+			reconfig_pending = 0;
+			apply_imu_config(reconfig_conf);
+		}
+		pthread_mutex_unlock(&imu_config_mutex);
+	}
+	thread_running_flag = 0;
+	return 0;
+}
+
+/*******************************************************************************
+ *  @brief      Write to the DMP memory.
+ *  This function prevents I2C writes past the bank boundaries. The DMP memory
+ *  is only accessible when the chip is awake.
+ *  @param[in]  mem_addr    Memory location (bank << 8 | start address)
+ *  @param[in]  length      Number of bytes to write.
+ *  @param[in]  data        Bytes to write to memory.
+ *  @return     0 if successful.
+*******************************************************************************/
+int mpu_write_mem(unsigned short mem_addr, unsigned short length,\
+												unsigned char *data){
+	unsigned char tmp[2];
+	if (!data){
+		fprintf(stderr,"ERROR: in mpu_write_mem, NULL pointer\n");
+		return -1;
+	}
+	tmp[0] = (unsigned char)(mem_addr >> 8);
+	tmp[1] = (unsigned char)(mem_addr & 0xFF);
+	// Check bank boundaries.
+	if (tmp[1] + length > MPU6500_BANK_SIZE){
+		fprintf(stderr,"mpu_write_mem exceeds bank size\n");
+		return -1;
+	}
+	if (imu_write_bytes(MPU6500_BANK_SEL, 2, tmp))
+		return -1;
+	if (imu_write_bytes(MPU6500_MEM_R_W, length, data))
+		return -1;
+	return 0;
+}
+
+/*******************************************************************************
+ *  @brief      Read from the DMP memory.
+ *  This function prevents I2C reads past the bank boundaries. The DMP memory
+ *  is only accessible when the chip is awake.
+ *  @param[in]  mem_addr    Memory location (bank << 8 | start address)
+ *  @param[in]  length      Number of bytes to read.
+ *  @param[out] data        Bytes read from memory.
+ *  @return     0 if successful.
+*******************************************************************************/
+int mpu_read_mem(unsigned short mem_addr, unsigned short length,\
+												unsigned char *data){
+	unsigned char tmp[2];
+	if (!data){
+		fprintf(stderr,"ERROR: in mpu_write_mem, NULL pointer\n");
+		return -1;
+	}
+	tmp[0] = (unsigned char)(mem_addr >> 8);
+	tmp[1] = (unsigned char)(mem_addr & 0xFF);
+	// Check bank boundaries.
+	if (tmp[1] + length > MPU6500_BANK_SIZE){
+		printf("mpu_read_mem exceeds bank size\n");
+		return -1;
+	}
+	if (imu_write_bytes(MPU6500_BANK_SEL, 2, tmp))
+		return -1;
+	if (imu_read_bytes(MPU6500_MEM_R_W, length, data)!=length)
+		return -1;
+	return 0;
+}
+
+/*******************************************************************************
+* int dmp_load_motion_driver_firmware()
+*
+* loads pre-compiled firmware binary from invensense onto dmp
+*******************************************************************************/
+int dmp_load_motion_driver_firmware(){
+	unsigned short ii;
+	unsigned short this_write;
+	// Must divide evenly into st.hw->bank_size to avoid bank crossings.
+	unsigned char cur[DMP_LOAD_CHUNK], tmp[2];
+	if(fast_startup) return dmp_fast_load_firmware();
+	// loop through 16 bytes at a time and check each write for corruption
+	for (ii=0; ii<DMP_CODE_SIZE; ii+=this_write) {
+		this_write = min(DMP_LOAD_CHUNK, DMP_CODE_SIZE - ii);
+		if (mpu_write_mem(ii, this_write, (uint8_t*)&dmp_firmware[ii])){
+			fprintf(stderr,"dmp firmware write failed\n");
+			return -1;
+		}
+		if (mpu_read_mem(ii, this_write, cur)){
+			fprintf(stderr,"dmp firmware read failed\n");
+			return -1;
+		}
+		if (memcmp(dmp_firmware+ii, cur, this_write)){
+			fprintf(stderr,"dmp firmware write corrupted\n");
+			return -2;
+		}
+	}
+	startup_stats.firmware_resident = 0;
+	startup_stats.firmware_bytes = DMP_CODE_SIZE;
+	// Set program start address.
+	tmp[0] = dmp_start_addr >> 8;
+	tmp[1] = dmp_start_addr & 0xFF;
+	if (imu_write_bytes(MPU6500_PRGM_START_H, 2, tmp)){
+		fprintf(stderr,"ERROR writing to MPU6500_PRGM_START register\n");
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* uint32_t dmp_firmware_crc()
+*
+* CRC-32 of the DMP firmware image, computed once.
+*******************************************************************************/
+static uint32_t dmp_firmware_crc(){
+	static uint32_t crc = 0;
+	uint32_t c;
+	int i, j;
+	if(crc) return crc;
+	c = 0xFFFFFFFF;
+	for(i=0;i<DMP_CODE_SIZE;i++){
+		c ^= dmp_firmware[i];
+		for(j=0;j<8;j++) c = (c>>1) ^ (0xEDB88320 & -(c&1));
+	}
+	crc = ~c;
+	return crc;
+}
+
+/*******************************************************************************
+* static int dmp_fast_write(int start, int len)
+*
+* Writes len bytes of the firmware image starting at start into DMP memory in
+* DMP_FAST_CHUNK bursts that never cross a bank, then reads them all back once.
+* Returns 0 on success, -1 on an i2c error or -2 if the read back differs.
+*******************************************************************************/
+static int dmp_fast_write(int start, int len){
+	unsigned char buf[DMP_FAST_CHUNK];
+	int i, n;
+	for(i=start;i<start+len;i+=n){
+		n = min(DMP_FAST_CHUNK, start+len-i);
+		if(mpu_write_mem(i, n, (uint8_t*)&dmp_firmware[i])){
+			fprintf(stderr,"dmp firmware write failed\n");
+			return -1;
+		}
+	}
+	for(i=start;i<start+len;i+=n){
+		n = min(DMP_FAST_CHUNK, start+len-i);
+		if(mpu_read_mem(i, n, buf)){
+			fprintf(stderr,"dmp firmware read failed\n");
+			return -1;
+		}
+		if(memcmp(dmp_firmware+i, buf, n)){
+			fprintf(stderr,"dmp firmware write corrupted\n");
+			return -2;
+		}
+	}
+	startup_stats.firmware_bytes += len;
+	return 0;
+}
+
+/*******************************************************************************
+* int dmp_fast_load_firmware()
+*
+* Faster version of dmp_load_motion_driver_firmware used when fast_startup is
+* set. The image goes out in DMP_FAST_CHUNK bursts that never cross a bank and
+* is read back once at the end instead of after every chunk. Once verified, a
+* signature holding the image CRC is written to the otherwise unused bytes
+* right after the image. If the signature is already there when we start,
+* this exact image was loaded before a warm restart and still is, so only the
+* banks below dmp_start_addr are written. Those are the DMP's data RAM, which
+* it changed while running, the code above them it never writes. Configuration
+* written into DMP memory later is always rewritten by rc_initialize_imu_dmp.
+*******************************************************************************/
+int dmp_fast_load_firmware(){
+	unsigned char sig[DMP_SIG_LEN], cur[DMP_SIG_LEN], tmp[2];
+	uint32_t crc = dmp_firmware_crc();
+	int i, ret;
+
+	memcpy(sig, "RCDM", 4);
+	for(i=0;i<4;i++) sig[4+i] = (crc>>(8*i)) & 0xFF;
+	startup_stats.firmware_resident = 0;
+	startup_stats.firmware_bytes = 0;
+	if(mpu_read_mem(DMP_SIG_ADDR, DMP_SIG_LEN, cur)==0 && !memcmp(sig,cur,DMP_SIG_LEN)){
+		startup_stats.firmware_resident = 1;
+		// restore the data banks to the state the image starts from
+		ret = dmp_fast_write(0, dmp_start_addr);
+		if(ret) return ret;
+	}
+	else{
+		// clear any stale signature first so a failed load is never trusted
+		memset(cur, 0, DMP_SIG_LEN);
+		mpu_write_mem(DMP_SIG_ADDR, DMP_SIG_LEN, cur);
+		ret = dmp_fast_write(0, DMP_CODE_SIZE);
+		if(ret) return ret;
+		if(mpu_write_mem(DMP_SIG_ADDR, DMP_SIG_LEN, sig)){
+			fprintf(stderr,"dmp firmware signature write failed\n");
+			return -1;
+		}
+	}
+	// Set program start address.
+	tmp[0] = dmp_start_addr >> 8;
+	tmp[1] = dmp_start_addr & 0xFF;
+	if (imu_write_bytes(MPU6500_PRGM_START_H, 2, tmp)){
+		fprintf(stderr,"ERROR writing to MPU6500_PRGM_START register\n");
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+ *  @brief      Push gyro and accel orientation to the DMP.
+ *  The orientation is represented here as the output of
+ *  @e inv_orientation_matrix_to_scalar.
+ *  @param[in]  orient  Gyro and accel orientation in body frame.
+ *  @return     0 if successful.
+*******************************************************************************/
+int dmp_set_orientation(unsigned short orient){
+	unsigned char gyro_regs[3], accel_regs[3];
+	const unsigned char gyro_axes[3] = {DINA4C, DINACD, DINA6C};
 	const unsigned char accel_axes[3] = {DINA0C, DINAC9, DINA2C};
 	const unsigned char gyro_sign[3] = {DINA36, DINA56, DINA76};
 	const unsigned char accel_sign[3] = {DINA26, DINA46, DINA66};
@@ -1029,25 +2050,27 @@ int dmp_set_fifo_rate(unsigned short rate){
 }
 
 /*******************************************************************************
-* int mpu_set_bypass(unsigned char bypass_on)
+* int mpu_set_bypass(imu_dev_t* dev, unsigned char bypass_on)
 * 
 * configures the USER_CTRL and INT_PIN_CFG registers to turn on and off the
 * i2c bypass mode for talking to the magnetometer. In random read mode this
 * is used to turn on the bypass and left as is. In DMP mode bypass is turned
 * off after configuration and the MPU fetches magnetometer data automatically.
+* Over SPI there are no i2c pins to bypass to, so the I2C master stays on and
+* the magnetometer is configured through it instead, see mag_write_byte.
 * USER_CTRL - based on global variable dsp_en
 * INT_PIN_CFG based on requested bypass state
 *******************************************************************************/
-int mpu_set_bypass(uint8_t bypass_on){
+int mpu_set_bypass(imu_dev_t* dev, uint8_t bypass_on){
 	uint8_t tmp = 0;
 	// set up USER_CTRL first
-	if(dmp_en){
+	if(dmp_en && dev==imu0){
 		tmp |= FIFO_EN_BIT; // enable fifo for dsp mode
 	}
-	if(!bypass_on){
+	if(!bypass_on || dev->transport==IMU_TRANSPORT_SPI){
 		tmp |= I2C_MST_EN; // i2c master mode when not in bypass
 	}
-	if (rc_i2c_write_byte(IMU_BUS, USER_CTRL, tmp)){
+	if (mpu_write_byte(dev, USER_CTRL, tmp)){
 		fprintf(stderr,"ERROR in mpu_set_bypass, failed to write USER_CTRL register\n");
 		return -1;
 	}
@@ -1055,12 +2078,13 @@ int mpu_set_bypass(uint8_t bypass_on){
 	// INT_PIN_CFG settings
 	tmp = LATCH_INT_EN | INT_ANYRD_CLEAR | ACTL_ACTIVE_LOW;
 	tmp =  ACTL_ACTIVE_LOW;
-	if(bypass_on)
+	if(bypass_on && dev->transport==IMU_TRANSPORT_I2C)
 		tmp |= BYPASS_EN;
-	if (rc_i2c_write_byte(IMU_BUS, INT_PIN_CFG, tmp)){
+	if (mpu_write_byte(dev, INT_PIN_CFG, tmp)){
 		fprintf(stderr,"ERROR in mpu_set_bypass, failed to write INT_PIN_CFG register\n");
 		return -1;
 	}
+	if(dev!=imu0) return 0;
 	if(bypass_on){
 		bypass_en = 1;
 	}
@@ -1248,37 +2272,39 @@ int dmp_enable_lp_quat(unsigned char enable){
 * allow magnetometer data to come in through the FIFO. This just turns off the
 * interrupt, resets fifo and DMP, then starts them again. Used once while 
 * initializing (probably no necessary) then again if the fifo gets too full.
+* In raw FIFO mode the DMP is left off and fifo_en_mask picks the sensors.
 *******************************************************************************/
 int mpu_reset_fifo(void){
 	uint8_t data;
-	// make sure the i2c address is set correctly. 
-	// this shouldn't take any time at all if already set
-	rc_i2c_set_device_address(IMU_BUS, IMU_ADDR);
+	// anything buffered from before the reset is stale now
+	fifo_fill = 0;
+	fifo_parsed = 0;
+	fifo_num_tokens = 0;
+	fifo_num_packets = 0;
+	// a replayed stream already contains whatever followed the reset
+	if(replay_active) return 0;
 	data = 0;
-	if (rc_i2c_write_byte(IMU_BUS, INT_ENABLE, data)) return -1;
-	if (rc_i2c_write_byte(IMU_BUS, FIFO_EN, data)) return -1;
-	//if (rc_i2c_write_byte(IMU_BUS, USER_CTRL, data)) return -1;
-	data = BIT_FIFO_RST | BIT_DMP_RST;
-	if (rc_i2c_write_byte(IMU_BUS, USER_CTRL, data)) return -1;
+	if (imu_write_byte(INT_ENABLE, data)) return -1;
+	if (imu_write_byte(FIFO_EN, data)) return -1;
+	//if (imu_write_byte(USER_CTRL, data)) return -1;
+	data = BIT_FIFO_RST;
+	if(dmp_en) data |= BIT_DMP_RST;
+	if (imu_write_byte(USER_CTRL, data)) return -1;
 	rc_usleep(1000);
-	data = BIT_DMP_EN | BIT_FIFO_EN;
+	data = BIT_FIFO_EN;
+	if(dmp_en) data |= BIT_DMP_EN;
 	if(config.enable_magnetometer){
 		data |= I2C_MST_EN;
 	}
-	if(rc_i2c_write_byte(IMU_BUS, USER_CTRL, data)){
+	if(imu_write_byte(USER_CTRL, data)){
 		return -1;
 	}
-	if(config.enable_magnetometer){
-		rc_i2c_write_byte(IMU_BUS, FIFO_EN, FIFO_SLV0_EN);
-	}
-	else{
-		rc_i2c_write_byte(IMU_BUS, FIFO_EN, 0);
-	}
+	imu_write_byte(FIFO_EN, fifo_en_mask);
 	if(dmp_en){
-		rc_i2c_write_byte(IMU_BUS, INT_ENABLE, BIT_DMP_INT_EN);
+		imu_write_byte(INT_ENABLE, BIT_DMP_INT_EN);
 	}
 	else{
-		rc_i2c_write_byte(IMU_BUS, INT_ENABLE, 0);
+		imu_write_byte(INT_ENABLE, 0);
 	}
 	return 0;
 }
@@ -1319,12 +2345,12 @@ int set_int_enable(unsigned char enable){
 	else{
 		tmp = 0x00;
 	}
-	if(rc_i2c_write_byte(IMU_BUS, INT_ENABLE, tmp)){
+	if(imu_write_byte(INT_ENABLE, tmp)){
 		fprintf(stderr, "ERROR: in set_int_enable, failed to write INT_ENABLE register\n");
 		return -1;
 	}
 	// disable all other FIFO features leaving just DMP
-	if (rc_i2c_write_byte(IMU_BUS, FIFO_EN, 0)){
+	if (imu_write_byte(FIFO_EN, 0)){
 		fprintf(stderr, "ERROR: in set_int_enable, failed to write FIFO_EN register\n");
 		return -1;
 	}
@@ -1346,7 +2372,7 @@ int mpu_set_sample_rate(int rate){
 	#ifdef DEBUG
 	printf("setting divider to %d\n", div);
 	#endif
-	if(rc_i2c_write_byte(IMU_BUS, SMPLRT_DIV, div)){
+	if(imu_write_byte(SMPLRT_DIV, div)){
 		fprintf(stderr,"ERROR: in mpu_set_sample_rate, failed to write SMPLRT_DIV register\n");
 		return -1;
 	}
@@ -1365,9 +2391,9 @@ int mpu_set_dmp_state(unsigned char enable){
 		// Disable data ready interrupt.
 		set_int_enable(0);
 		// Disable bypass mode.
-		mpu_set_bypass(0);
+		mpu_set_bypass(imu0, 0);
 		// Remove FIFO elements.
-		rc_i2c_write_byte(IMU_BUS, FIFO_EN , 0);
+		imu_write_byte(FIFO_EN , 0);
 		// Enable DMP interrupt.
 		set_int_enable(1);
 		mpu_reset_fifo();
@@ -1376,386 +2402,1150 @@ int mpu_set_dmp_state(unsigned char enable){
 		// Disable DMP interrupt.
 		set_int_enable(0);
 		// Restore FIFO settings.
-		rc_i2c_write_byte(IMU_BUS, FIFO_EN , 0);
+		imu_write_byte(FIFO_EN , 0);
+		mpu_reset_fifo();
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* void* imu_interrupt_handler(void* ptr)
+*
+* Here is where the magic happens. This function runs as its own thread and
+* waits on the interrupt source set up by rc_initialize_imu_dmp, normally the
+* config's interrupt_pin. When an interrupt arrives the timestamp is
+* recorded, the FIFO is read, and the user-defined interrupt function is called
+* for each new sample if set.
+*******************************************************************************/
+void* imu_interrupt_handler( __unused void* ptr){
+	int ret;
+	int first_run = 1;
+	uint64_t timestamp;
+	if(!imu_event_src.initialized){
+		fprintf(stderr,"ERROR: IMU interrupt source not initialized\n");
+		fprintf(stderr,"aborting imu_interrupt_handler\n");
+		return NULL;
+	}
+	// keep running until the program closes
+	mpu_reset_fifo();
+	while(rc_get_state()!=EXITING && shutdown_interrupt_thread!=1) {
+		// system hangs here until IMU FIFO interrupt
+		ret = rc_event_source_wait(&imu_event_src, IMU_POLL_TIMEOUT, &timestamp);
+		if(rc_get_state()==EXITING || shutdown_interrupt_thread==1){
+			break;
+		}
+		else if(ret>0){
+			// interrupt received, mark the timestamp
+			last_interrupt_timestamp_nanos = timestamp;
+			// try to load fifo no matter the claim bus state
+			if(imu_bus_in_use(imu0)){
+				fprintf(stderr,"WARNING: Something has claimed the I2C bus when an\n");
+				fprintf(stderr,"IMU interrupt was received. Reading IMU anyway.\n");
+			}
+			pthread_mutex_lock(&imu_config_mutex);
+			imu_claim_bus(imu0);
+			ret = read_dmp_fifo();
+			record_read_latency();
+			update_temp_comp(timestamp);
+			if(gyro_bias_push) push_gyro_bias();
+			imu_release_bus(imu0);
+			// hand every packet to the user in order, except on the first run
+			// since the FIFO may contain stale data from before startup
+			ret = deliver_dmp_fifo(!first_run);
+			// record if it was successful or not
+			if(ret>0) first_run = 0;
+			else last_read_successful = 0;
+			// changes asked for from inside the callbacks
+			if(reconfig_pending){
+				reconfig_pending = 0;
+				apply_imu_config(reconfig_conf);
+			}
+			pthread_mutex_unlock(&imu_config_mutex);
+		}
+	}
+	rc_event_source_close(&imu_event_src);
+	thread_running_flag = 0;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_set_imu_interrupt_func(void (*func)(void))
+*
+* sets a user function to be called when new data is read
+*******************************************************************************/
+int rc_set_imu_interrupt_func(void (*func)(void)){
+	if(func==NULL){
+		fprintf(stderr,"ERROR: trying to assign NULL pointer to imu_interrupt_func\n");
+		return -1;
+	}
+	imu_interrupt_func = func;
+	interrupt_func_set = 1;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_stop_imu_interrupt_func()
+*
+* stops the user function from being called when new data is available
+*******************************************************************************/
+int rc_stop_imu_interrupt_func(){
+	interrupt_func_set = 0;
+	return 0;
+}
+
+/*******************************************************************************
+* int read_fifo_count_combined(uint16_t* fifo_count, int* got)
+*
+* Reads FIFO_COUNT and speculatively the first fifo_spec_len bytes of the FIFO
+* onto the end of fifo_buf in one combined i2c transaction. Only as many of
+* those bytes as the count says were there are kept. DMP mode only, where the
+* read is one packet long, packets come every 5ms or more and any bytes lost
+* past the count are found by the resync. fifo_count is set to what's left in
+* the FIFO and got to the bytes kept. Returns 0 on success, -1 if the separate reads
+* have to be used instead.
+*******************************************************************************/
+static int read_fifo_count_combined(uint16_t* fifo_count, int* got){
+	uint8_t regs[2] = {FIFO_COUNTH, FIFO_R_W};
+	uint8_t lens[2];
+	uint8_t count_buf[2];
+	uint8_t* bufs[2];
+	int n, ret;
+
+	if(!config.fifo_combined_read || !combined_read_ok) return -1;
+	if(imu0->transport!=IMU_TRANSPORT_I2C) return -1;
+	if(fifo_spec_len<=0 || fifo_spec_len>MAX_FIFO_BUFFER) return -1;
+	if(FIFO_BUF_LEN-fifo_fill<fifo_spec_len) return -1;
+	lens[0] = 2;
+	lens[1] = fifo_spec_len;
+	bufs[0] = count_buf;
+	bufs[1] = &fifo_buf[fifo_fill];
+	fifo_stats.i2c_syscalls++;
+	pthread_mutex_lock(&i2c_bus_mutex[imu0->bus]);
+	rc_i2c_set_device_address(imu0->bus, imu0->address);
+	ret = rc_i2c_read_blocks(imu0->bus, 2, regs, lens, bufs);
+	pthread_mutex_unlock(&i2c_bus_mutex[imu0->bus]);
+	if(ret<0){
+		if(errno==EOPNOTSUPP || errno==ENOTTY || errno==EINVAL){
+			if(config.show_warnings){
+				printf("i2c driver can't combine transactions, using separate reads\n");
+			}
+			combined_read_ok = 0;
+		}
+		else{
+			// try again with separate reads
+			fifo_stats.i2c_retries++;
+			if(config.show_warnings){
+				printf("combined fifo read i2c error: %s\n",strerror(errno));
+			}
+		}
+		return -1;
+	}
+	*fifo_count = ((uint16_t)count_buf[0]<<8) | count_buf[1];
+	if(*fifo_count>=fifo_spec_len){
+		n = fifo_spec_len;
+		fifo_stats.spec_hits++;
+	}
+	else{
+		// anything past the count was read from an empty FIFO
+		n = *fifo_count;
+		fifo_stats.spec_misses++;
+	}
+	fifo_fill += n;
+	*fifo_count -= n;
+	*got = n;
+	return 0;
+}
+
+/*******************************************************************************
+* int drain_fifo(int* overflow)
+*
+* Reads everything currently in the FIFO onto the end of fifo_buf in chunks no
+* longer than one i2c transfer, leaving whatever was already there in place.
+* Shared by the DMP and raw FIFO modes. The count and the expected amount of
+* data are read together when possible so the usual case is a single i2c
+* system call. If overflow isn't NULL it is set when the FIFO was found full,
+* meaning the MPU has started overwriting old bytes. While recording, what was
+* read is logged, and while replaying it comes from the recording instead.
+* Returns the number of bytes read or -1 on an i2c error.
+*******************************************************************************/
+int drain_fifo(int* overflow){
+	uint16_t fifo_count;
+	int ret, chunk, seen, total = 0;
+	int fill_start = fifo_fill;
+	uint64_t start, t;
+
+	if(overflow!=NULL) *overflow = 0;
+	if(replay_active) return replay_fifo_read(overflow);
+	start = rc_nanos_since_boot();
+	fifo_stats.fifo_reads++;
+
+	// check fifo count register to see how much new data is there, picking
+	// up the first packet along with it if we can
+	if(read_fifo_count_combined(&fifo_count, &total)<0){
+		fifo_stats.i2c_syscalls += READ_SYSCALLS;
+		if(imu_read_word(FIFO_COUNTH, &fifo_count)<0){
+			if(config.show_warnings){
+				printf("fifo_count i2c error: %s\n",strerror(errno));
+			}
+			fifo_stats.i2c_errors++;
+			if(recording) record_fifo_read(fill_start, 0, 0);
+			return -1;
+		}
+	}
+	#ifdef DEBUG
+	printf("fifo_count: %d\n", fifo_count+total);
+	#endif
+
+	seen = fifo_count+total;
+	record_fifo_count(seen);
+	if(seen>=MPU_FIFO_SIZE){
+		if(config.show_warnings) printf("warning: imu fifo overflow\n");
+		fifo_stats.overflows++;
+		if(overflow!=NULL) *overflow = 1;
+	}
+	// anything that doesn't fit in the buffer is picked up next time
+	if(fifo_count>FIFO_BUF_LEN-fifo_fill){
+		fifo_count = FIFO_BUF_LEN-fifo_fill;
+	}
+
+	while(fifo_count>0){
+		chunk = min(fifo_count, MAX_FIFO_BUFFER);
+		fifo_stats.i2c_syscalls += READ_SYSCALLS;
+		ret = imu_read_bytes(FIFO_R_W, chunk, &fifo_buf[fifo_fill]);
+		if(ret<0){
+			// if i2c_read returned -1 there was an error, try again
+			fifo_stats.i2c_retries++;
+			fifo_stats.i2c_syscalls += READ_SYSCALLS;
+			ret = imu_read_bytes(FIFO_R_W, chunk, &fifo_buf[fifo_fill]);
+		}
+		if(ret!=chunk){
+			fifo_stats.i2c_errors++;
+			if(config.show_warnings){
+				fprintf(stderr,"ERROR: failed to read fifo buffer register\n");
+				printf("read %d bytes, expected %d\n", ret, chunk);
+			}
+			// some bytes may have left the FIFO without reaching us, let the
+			// caller parse what we have and deal with the gap
+			break;
+		}
+		fifo_fill += chunk;
+		fifo_count -= chunk;
+		total += chunk;
+	}
+	t = rc_nanos_since_boot()-start;
+	fifo_stats.i2c_time_last_ns = t;
+	fifo_stats.i2c_time_total_ns += t;
+	if(t>fifo_stats.i2c_time_max_ns) fifo_stats.i2c_time_max_ns = t;
+	if(recording) record_fifo_read(fill_start, seen, 1);
+	return total;
+}
+
+/*******************************************************************************
+* void consume_fifo(int bytes)
+*
+* Drops the first bytes of fifo_buf once they have been parsed, moving any
+* partial packet to the front for the next drain_fifo.
+*******************************************************************************/
+void consume_fifo(int bytes){
+	if(bytes<=0) return;
+	if(bytes>fifo_fill) bytes = fifo_fill;
+	fifo_fill -= bytes;
+	if(fifo_fill>0) memmove(fifo_buf, &fifo_buf[bytes], fifo_fill);
+	return;
+}
+
+/*******************************************************************************
+* int read_dmp_fifo()
+*
+* Drains everything currently in the FIFO into fifo_buf behind whatever partial
+* packet was left over from the previous call, then walks the buffer recording
+* the position of every complete DMP packet and magnetometer block in the order
+* they arrived. Magnetometer blocks are the 7 bytes the I2C master copies in
+* from the AK8963 and are recognized by a valid quaternion directly after them.
+* Bytes that fit neither pattern are discarded one at a time until alignment
+* is found again, so an I2C glitch or FIFO overflow only costs the packets that
+* were actually corrupted instead of resetting the FIFO. Incomplete data at the
+* end is kept for the next call. Nothing is written to the data struct here,
+* that is left to deliver_dmp_fifo() which must be called after every read,
+* once the I2C bus has been released. Returns the number of DMP packets found
+* or -1 if none.
+*******************************************************************************/
+int read_dmp_fifo(){
+	int p, rem, packets, discarded, aligned;
+
+	if(!dmp_en){
+		printf("only use mpu_read_fifo in dmp mode\n");
+		return -1;
+	}
+
+	// if the fifo packet_len variable not set up yet, this function must
+	// have been called prematurely
+	if(packet_len!=FIFO_LEN_NO_MAG && packet_len!=FIFO_LEN_MAG){
+		fprintf(stderr,"ERROR: packet_len is set incorrectly for read_dmp_fifo\n");
+		return -1;
+	}
+
+	if(drain_fifo(NULL)<0) return -1;
+
+	// walk the buffer, a quaternion is 16 bytes so nothing can be decided
+	// with less than that
+	p = 0;
+	packets = 0;
+	discarded = 0;
+	aligned = 1;
+	fifo_num_packets = 0;
+	while((rem = fifo_fill-p) >= 16){
+		if(check_quaternion_validity(fifo_buf,p)){
+			// wait for the rest of this packet
+			if(rem<FIFO_LEN_NO_MAG) break;
+			fifo_tokens[fifo_num_tokens++] = p;
+			p += FIFO_LEN_NO_MAG;
+			packets++;
+			aligned = 1;
+			continue;
+		}
+		if(config.enable_magnetometer){
+			// need the quaternion after a mag block to recognize it
+			if(rem<FIFO_LEN_MAG-FIFO_LEN_NO_MAG+16) break;
+			if(check_quaternion_validity(fifo_buf,p+FIFO_LEN_MAG-FIFO_LEN_NO_MAG)){
+				// negative offsets mark magnetometer blocks
+				fifo_tokens[fifo_num_tokens++] = -(p+1);
+				p += FIFO_LEN_MAG-FIFO_LEN_NO_MAG;
+				aligned = 1;
+				continue;
+			}
+		}
+		// neither a DMP packet nor magnetometer data, slide forward a byte.
+		// Only the first failure where a packet should have started counts,
+		// not every byte of the slide
+		if(aligned) fifo_stats.quat_failures++;
+		aligned = 0;
+		p++;
+		discarded++;
+	}
+	fifo_parsed = p;
+	fifo_num_packets = packets;
+
+	// bookkeeping
+	if(discarded){
+		if(config.show_warnings){
+			printf("warning: discarded %d bytes to resync imu fifo\n",discarded);
+		}
+		fifo_stats.resyncs++;
+		fifo_stats.dropped_bytes += discarded;
+		fifo_stats.dropped_packets += (discarded+packet_len-1)/packet_len;
+	}
+	if(packets>1) fifo_stats.multi_reads++;
+	if((uint64_t)packets>fifo_stats.max_backlog) fifo_stats.max_backlog=packets;
+	fifo_stats.packets += packets;
+
+	// if a whole FIFO's worth of garbage came through without a single good
+	// packet the stream is hopeless, start over
+	if(packets==0 && discarded>=MPU_FIFO_SIZE){
+		if(config.show_warnings) printf("warning: resetting imu fifo\n");
+		fifo_stats.resets++;
 		mpu_reset_fifo();
+		return -1;
+	}
+	if(packets==0) return -1;
+	return packets;
+}
+
+/*******************************************************************************
+* int deliver_dmp_fifo(int publish)
+*
+* Goes through the packets found by the last read_dmp_fifo() in order. Each
+* magnetometer block updates the mag readings and each DMP packet fills in the
+* data struct and runs data_fusion if the magnetometer is enabled. If publish
+* is set, the sample is then pushed to the sample queue and the user's
+* interrupt function is called so every sample is seen even when several piled
+* up in the FIFO. Only the newest packet arrived with the interrupt, earlier
+* ones are timestamped backwards from it at the DMP sample period. Afterwards
+* any partial packet is moved to the front of fifo_buf.
+* Returns the number of DMP packets delivered.
+*******************************************************************************/
+int deliver_dmp_fifo(int publish){
+	int i, n, packets = 0;
+	uint64_t period = 1000000000/config.dmp_sample_rate;
+	for(i=0;i<fifo_num_tokens;i++){
+		n = fifo_tokens[i];
+		if(n<0){
+			parse_mag_block(imu0, &fifo_buf[-n-1], data_ptr);
+			continue;
+		}
+		parse_dmp_packet(&fifo_buf[n]);
+		if(config.temp_compensation && temp_valid){
+			apply_temp_comp(data_ptr, 1, 1);
+		}
+		if(config.gyro_bias_estimation){
+			update_gyro_bias(1.0f/config.dmp_sample_rate, 1);
+		}
+		if(config.dynamic_notch) apply_dynamic_notch(data_ptr->gyro);
+		if(config.enable_magnetometer){
+			#ifdef DEBUG
+			printf("running data_fusion\n");
+			#endif
+			data_fusion();
+		}
+		last_read_successful = 1;
+		packets++;
+		if(!publish) continue;
+		push_imu_sample(last_interrupt_timestamp_nanos -\
+								(fifo_num_packets-packets)*period);
+		// the newest packet is the one that raised the interrupt
+		// replayed interrupt times are from the recording, not now
+		if(packets==fifo_num_packets && !replay_active) record_latency();
+		if(interrupt_func_set) imu_interrupt_func();
+		n = (queue_head-1)&(RC_IMU_QUEUE_LEN-1);
+		dispatch_imu_subscribers(IMU_DISPATCH_INLINE, &imu_queue[n].s);
+		notify_imu_worker(imu_queue[n].s.seq);
+	}
+	fifo_num_tokens = 0;
+	fifo_num_packets = 0;
+	// keep incomplete data for next time
+	consume_fifo(fifo_parsed);
+	fifo_parsed = 0;
+	return packets;
+}
+
+/*******************************************************************************
+* void parse_dmp_packet(unsigned char* raw)
+*
+* Fills in the quaternion, Tait-Bryan angles, accel and gyro readings in the
+* data struct from one 28-byte DMP packet.
+*******************************************************************************/
+void parse_dmp_packet(unsigned char* raw){
+	long quat[4];
+	double q_tmp[4];
+	double sum,qlen;
+	int i;
+	// parse the quaternion data from the buffer
+	quat[0] = ((long)raw[0] << 24) | ((long)raw[1] << 16) |
+		((long)raw[2] << 8) | raw[3];
+	quat[1] = ((long)raw[4] << 24) | ((long)raw[5] << 16) |
+		((long)raw[6] << 8) | raw[7];
+	quat[2] = ((long)raw[8] << 24) | ((long)raw[9] << 16) |
+		((long)raw[10] << 8) | raw[11];
+	quat[3] = ((long)raw[12] << 24) | ((long)raw[13] << 16) |
+		((long)raw[14] << 8) | raw[15];
+
+	// do double-precision quaternion normalization since the numbers
+	// in raw format are huge
+	for(i=0;i<4;i++) q_tmp[i]=(double)quat[i];
+	sum = 0.0;
+	for(i=0;i<4;i++) sum+=q_tmp[i]*q_tmp[i];
+	qlen=sqrt(sum);
+	for(i=0;i<4;i++) q_tmp[i]/=qlen;
+	// make floating point and put in output
+	for(i=0;i<4;i++) data_ptr->dmp_quat[i]=(float)q_tmp[i];
+
+	// fill in tait-bryan angles to the data struct
+	rc_quaternion_to_tb_array(data_ptr->dmp_quat, data_ptr->dmp_TaitBryan);
+	raw+=16; // increase offset by 16 which was the quaternion size
+
+	// Read Accel values and load into imu_data struct
+	// Turn the MSB and LSB into a signed 16-bit value
+	data_ptr->raw_accel[0] = (int16_t)(((uint16_t)raw[0]<<8)|raw[1]);
+	data_ptr->raw_accel[1] = (int16_t)(((uint16_t)raw[2]<<8)|raw[3]);
+	data_ptr->raw_accel[2] = (int16_t)(((uint16_t)raw[4]<<8)|raw[5]);
+
+	// Fill in real unit values
+	data_ptr->accel[0] = data_ptr->raw_accel[0] * data_ptr->accel_to_ms2;
+	data_ptr->accel[1] = data_ptr->raw_accel[1] * data_ptr->accel_to_ms2;
+	data_ptr->accel[2] = data_ptr->raw_accel[2] * data_ptr->accel_to_ms2;
+	raw+=6;
+
+	// Read gyro values and load into imu_data struct
+	// Turn the MSB and LSB into a signed 16-bit value
+	data_ptr->raw_gyro[0] = (int16_t)(((int16_t)raw[0]<<8)|raw[1]);
+	data_ptr->raw_gyro[1] = (int16_t)(((int16_t)raw[2]<<8)|raw[3]);
+	data_ptr->raw_gyro[2] = (int16_t)(((int16_t)raw[4]<<8)|raw[5]);
+	// Fill in real unit values
+	data_ptr->gyro[0] = data_ptr->raw_gyro[0] * data_ptr->gyro_to_degs;
+	data_ptr->gyro[1] = data_ptr->raw_gyro[1] * data_ptr->gyro_to_degs;
+	data_ptr->gyro[2] = data_ptr->raw_gyro[2] * data_ptr->gyro_to_degs;
+	return;
+}
+
+/*******************************************************************************
+* void parse_mag_block(imu_dev_t* dev, unsigned char* raw, rc_imu_data_t* data)
+*
+* Updates the magnetometer readings in data from the 7 bytes the I2C master
+* copies from dev's AK8963, into the FIFO in DMP mode or into the EXT_SENS_DATA
+* registers in one-shot mode.
+*******************************************************************************/
+void parse_mag_block(imu_dev_t* dev, unsigned char* raw, rc_imu_data_t* data){
+	int16_t mag_adc[3];
+	float factory_cal_data[3]; // just temp holder for mag data
+	// Turn the MSB and LSB into a signed 16-bit value
+	// Data stored as little Endian
+	mag_adc[0] = (int16_t)(((int16_t)raw[1]<<8) | raw[0]);
+	mag_adc[1] = (int16_t)(((int16_t)raw[3]<<8) | raw[2]);
+	mag_adc[2] = (int16_t)(((int16_t)raw[5]<<8) | raw[4]);
+
+	// if the data is zero the magnetometer wasn't ready, keep the old values
+	if(mag_adc[0]==0 && mag_adc[1]==0 && mag_adc[2]==0) return;
+
+	// multiply by the sensitivity adjustment and convert to units of uT
+	// Also correct the coordinate system as someone in invensense
+	// thought it would be a bright idea to have the magnetometer coordiate
+	// system aligned differently than the accelerometer and gyro.... -__-
+	factory_cal_data[0] = mag_adc[1]*dev->mag_factory_adjust[1] * MAG_RAW_TO_uT;
+	factory_cal_data[1] = mag_adc[0]*dev->mag_factory_adjust[0] * MAG_RAW_TO_uT;
+	factory_cal_data[2] = -mag_adc[2]*dev->mag_factory_adjust[2] * MAG_RAW_TO_uT;
+	if(dev==imu0 && config.mag_cal_online) update_mag_cal(factory_cal_data);
+
+	// now apply out own calibration, but first make sure we don't
+	// accidentally multiply by zero in case of uninitialized scale factors
+	if(dev->mag_scales[0]==0.0) dev->mag_scales[0]=1.0;
+	if(dev->mag_scales[1]==0.0) dev->mag_scales[1]=1.0;
+	if(dev->mag_scales[2]==0.0) dev->mag_scales[2]=1.0;
+	data->mag[0] = (factory_cal_data[0]-dev->mag_offsets[0])*dev->mag_scales[0];
+	data->mag[1] = (factory_cal_data[1]-dev->mag_offsets[1])*dev->mag_scales[1];
+	data->mag[2] = (factory_cal_data[2]-dev->mag_offsets[2])*dev->mag_scales[2];
+	return;
+}
+
+/*******************************************************************************
+* int latency_bin(uint64_t ns)
+*
+* Histogram bin for a latency, floor(log2) of the time in microseconds.
+*******************************************************************************/
+static inline int latency_bin(uint64_t ns){
+	uint64_t us = ns/1000;
+	int bin;
+	if(us<2) return 0;
+	bin = 63-__builtin_clzll(us);
+	if(bin>=RC_IMU_HIST_BINS) bin = RC_IMU_HIST_BINS-1;
+	return bin;
+}
+
+/*******************************************************************************
+* void record_latency()
+*
+* Updates the interrupt to callback latency counters, called right before the
+* user's interrupt function runs for the packet that raised the interrupt.
+*******************************************************************************/
+void record_latency(){
+	uint64_t lat = rc_nanos_since_epoch() - last_interrupt_timestamp_nanos;
+	fifo_stats.interrupts++;
+	fifo_stats.latency_last_ns = lat;
+	fifo_stats.latency_total_ns += lat;
+	if(lat>fifo_stats.latency_max_ns) fifo_stats.latency_max_ns = lat;
+	fifo_stats.latency_hist[latency_bin(lat)]++;
+	return;
+}
+
+/*******************************************************************************
+* void record_read_latency()
+*
+* Same for the time from the interrupt until the FIFO has been read, which
+* leaves out data fusion and the user's code.
+*******************************************************************************/
+void record_read_latency(){
+	uint64_t lat = rc_nanos_since_epoch() - last_interrupt_timestamp_nanos;
+	fifo_stats.read_latency_last_ns = lat;
+	fifo_stats.read_latency_total_ns += lat;
+	if(lat>fifo_stats.read_latency_max_ns) fifo_stats.read_latency_max_ns = lat;
+	fifo_stats.read_latency_hist[latency_bin(lat)]++;
+	return;
+}
+
+/*******************************************************************************
+* void record_fifo_count(int bytes)
+*
+* Adds one FIFO read to the histogram of how many whole packets were waiting.
+*******************************************************************************/
+void record_fifo_count(int bytes){
+	int n = (packet_len>0) ? bytes/packet_len : 0;
+	if(n>=RC_IMU_HIST_BINS) n = RC_IMU_HIST_BINS-1;
+	fifo_stats.fifo_count_hist[n]++;
+	return;
+}
+
+/*******************************************************************************
+* int rc_get_imu_fifo_stats(rc_imu_fifo_stats_t* stats)
+*
+* Copies the DMP FIFO counters into the user's struct. The counters are only
+* written by the interrupt thread so a torn read is possible but harmless.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_get_imu_fifo_stats(rc_imu_fifo_stats_t* stats){
+	if(stats==NULL){
+		fprintf(stderr,"ERROR: in rc_get_imu_fifo_stats, received NULL pointer\n");
+		return -1;
+	}
+	*stats = fifo_stats;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_reset_imu_fifo_stats()
+*
+* Zeros all DMP FIFO counters.
+*******************************************************************************/
+int rc_reset_imu_fifo_stats(){
+	int source = fifo_stats.interrupt_source;
+	memset(&fifo_stats,0,sizeof(fifo_stats));
+	fifo_stats.interrupt_source = source;
+	return 0;
+}
+
+/*******************************************************************************
+* uint64_t hist_percentile(const uint64_t* hist, uint64_t n, double pct)
+*
+* Upper edge in microseconds of the latency bin holding the pct percentile of
+* n values, 0 if there are none. Latencies are binned, so this is a bound.
+*******************************************************************************/
+static uint64_t hist_percentile(const uint64_t* hist, uint64_t n, double pct){
+	uint64_t want, sum = 0;
+	int i;
+	if(n==0) return 0;
+	want = (uint64_t)(pct*n/100.0);
+	if(want>=n) want = n-1;
+	for(i=0;i<RC_IMU_HIST_BINS-1;i++){
+		sum += hist[i];
+		if(sum>want) break;
+	}
+	return (uint64_t)2<<i;
+}
+
+/*******************************************************************************
+* void print_stats_interval(const rc_imu_fifo_stats_t* a,
+*										const rc_imu_fifo_stats_t* b)
+*
+* Writes one line to stats_dump_file describing what changed between two
+* snapshots of the FIFO stats, a taken before b.
+*******************************************************************************/
+static void print_stats_interval(const rc_imu_fifo_stats_t* a,\
+										const rc_imu_fifo_stats_t* b){
+	uint64_t rh[RC_IMU_HIST_BINS], lh[RC_IMU_HIST_BINS];
+	uint64_t rn = 0, ln = 0, reads = 0, pkts = 0;
+	int i;
+	for(i=0;i<RC_IMU_HIST_BINS;i++){
+		rh[i] = b->read_latency_hist[i]-a->read_latency_hist[i];
+		lh[i] = b->latency_hist[i]-a->latency_hist[i];
+		rn += rh[i];
+		ln += lh[i];
+		reads += b->fifo_count_hist[i]-a->fifo_count_hist[i];
+		pkts += i*(b->fifo_count_hist[i]-a->fifo_count_hist[i]);
+	}
+	fprintf(stats_dump_file, "imu: %llu packets %llu interrupts, read p50 %lluus"\
+		" p99 %lluus, callback p50 %lluus p99 %lluus max %lluus, fifo %.2f"\
+		" packets/read, overflows %llu resyncs %llu resets %llu, i2c errors %llu"\
+		" retries %llu, bad quaternions %llu\n",
+		(unsigned long long)(b->packets-a->packets),
+		(unsigned long long)(b->interrupts-a->interrupts),
+		(unsigned long long)hist_percentile(rh, rn, 50.0),
+		(unsigned long long)hist_percentile(rh, rn, 99.0),
+		(unsigned long long)hist_percentile(lh, ln, 50.0),
+		(unsigned long long)hist_percentile(lh, ln, 99.0),
+		(unsigned long long)hist_percentile(lh, ln, 100.0),
+		reads ? (double)pkts/reads : 0.0,
+		(unsigned long long)(b->overflows-a->overflows),
+		(unsigned long long)(b->resyncs-a->resyncs),
+		(unsigned long long)(b->resets-a->resets),
+		(unsigned long long)(b->i2c_errors-a->i2c_errors),
+		(unsigned long long)(b->i2c_retries-a->i2c_retries),
+		(unsigned long long)(b->quat_failures-a->quat_failures));
+	fflush(stats_dump_file);
+	return;
+}
+
+/*******************************************************************************
+* void* imu_stats_dump_handler(void* ptr)
+*
+* Normal priority thread that snapshots the FIFO stats every
+* stats_dump_period_ms and prints the difference from the last snapshot.
+*******************************************************************************/
+void* imu_stats_dump_handler(__unused void* ptr){
+	rc_imu_fifo_stats_t last, now;
+	int waited;
+	last = fifo_stats;
+	while(!shutdown_stats_dump){
+		for(waited=0; waited<stats_dump_period_ms && !shutdown_stats_dump;\
+												waited+=STATS_DUMP_POLL_MS){
+			rc_usleep(1000*min(STATS_DUMP_POLL_MS, stats_dump_period_ms-waited));
+		}
+		if(shutdown_stats_dump) break;
+		now = fifo_stats;
+		// start over if rc_reset_imu_fifo_stats was called
+		if(now.fifo_reads<last.fifo_reads) memset(&last, 0, sizeof(last));
+		print_stats_interval(&last, &now);
+		last = now;
+	}
+	return NULL;
+}
+
+/*******************************************************************************
+* int rc_start_imu_stats_dump(const char* path, int period_ms)
+*
+* Starts a thread that appends a one line summary of the FIFO stats for the
+* last period_ms to the file at path, or prints it to stdout if path is NULL.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_start_imu_stats_dump(const char* path, int period_ms){
+	if(stats_dump_running){
+		fprintf(stderr,"ERROR: in rc_start_imu_stats_dump, already running\n");
+		return -1;
+	}
+	if(period_ms<=0){
+		fprintf(stderr,"ERROR: in rc_start_imu_stats_dump, period_ms must be positive\n");
+		return -1;
+	}
+	if(path==NULL) stats_dump_file = stdout;
+	else{
+		stats_dump_file = fopen(path, "a");
+		if(stats_dump_file==NULL){
+			fprintf(stderr,"ERROR: in rc_start_imu_stats_dump, can't open %s: %s\n",\
+												path, strerror(errno));
+			return -1;
+		}
+	}
+	stats_dump_period_ms = period_ms;
+	shutdown_stats_dump = 0;
+	if(pthread_create(&stats_dump_thread, NULL, imu_stats_dump_handler, NULL)){
+		fprintf(stderr,"ERROR: in rc_start_imu_stats_dump, failed to start thread\n");
+		if(stats_dump_file!=stdout) fclose(stats_dump_file);
+		return -1;
 	}
+	stats_dump_running = 1;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_stop_imu_stats_dump()
+*
+* Stops the thread started by rc_start_imu_stats_dump and closes its file.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_stop_imu_stats_dump(){
+	if(!stats_dump_running) return 0;
+	shutdown_stats_dump = 1;
+	pthread_join(stats_dump_thread, NULL);
+	if(stats_dump_file!=stdout) fclose(stats_dump_file);
+	stats_dump_file = NULL;
+	stats_dump_running = 0;
 	return 0;
 }
 
 /*******************************************************************************
-* void* imu_interrupt_handler(void* ptr)
+* void publish_imu_sample(int index, const rc_imu_sample_t* s, int has_mag,
+*							const int* mag_perm, const float* mag_sign)
 *
-* Here is where the magic happens. This function runs as its own thread and 
-* monitors the gpio pin IMU_INTERRUPT_PIN with the blocking function call 
-* poll(). If a valid interrupt is received from the IMU then mark the timestamp,
-* read in the IMU data, and call the user-defined interrupt function if set.
+* Copies the newest sample of IMU index into its vote slot, same seqlock as
+* the sample queue. IMU 0 passes its orientation so the magnetometer lands in
+* the same frame as the DMP's accel and gyro, instances rotate everything
+* themselves and pass NULL.
 *******************************************************************************/
-void* imu_interrupt_handler( __unused void* ptr){ 
-	struct pollfd fdset[1];
-	int ret;
-	char buf[64];
-	int first_run = 1;
-	int imu_gpio_fd = rc_gpio_fd_open(IMU_INTERRUPT_PIN);
-	if(imu_gpio_fd == -1){
-		fprintf(stderr,"ERROR: can't open IMU_INTERRUPT_PIN gpio fd\n");
-		fprintf(stderr,"aborting imu_interrupt_handler\n");
-		return NULL;
-	}
-	fdset[0].fd = imu_gpio_fd;
-	fdset[0].events = POLLPRI;
-	// keep running until the program closes
-	mpu_reset_fifo();
-	while(rc_get_state()!=EXITING && shutdown_interrupt_thread!=1) {
-		// system hangs here until IMU FIFO interrupt
-		poll(fdset, 1, IMU_POLL_TIMEOUT); 
-		if(rc_get_state()==EXITING || shutdown_interrupt_thread==1){
-			break;
-		}
-		else if (fdset[0].revents & POLLPRI) {
-			lseek(fdset[0].fd, 0, SEEK_SET);  
-			read(fdset[0].fd, buf, 64);
-			// interrupt received, mark the timestamp
-			last_interrupt_timestamp_nanos = rc_nanos_since_epoch();
-			// try to load fifo no matter the claim bus state
-			if(rc_i2c_get_in_use_state(IMU_BUS)){
-				fprintf(stderr,"WARNING: Something has claimed the I2C bus when an\n");
-				fprintf(stderr,"IMU interrupt was received. Reading IMU anyway.\n");
-			}
-			rc_i2c_claim_bus(IMU_BUS);
-			ret = read_dmp_fifo();
-			rc_i2c_release_bus(IMU_BUS);
-			// record if it was successful or not
-			if (ret==0) last_read_successful=1;
-			else last_read_successful=0;
-			// call the user function if not the first run
-			if(first_run == 1){
-				first_run = 0;
-			}
-			else if(interrupt_func_set && last_read_successful){
-				imu_interrupt_func(); 
-			}
-		}
-	}
-	rc_gpio_fd_close(imu_gpio_fd);
-	thread_running_flag = 0;
-	return 0;
+void publish_imu_sample(int index, const rc_imu_sample_t* s, int has_mag,\
+							const int* mag_perm, const float* mag_sign){
+	imu_vote_slot_t* slot = &vote_slots[index];
+	uint32_t ver = slot->ver;
+	int i;
+	__atomic_store_n(&slot->ver, ver+1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot->s = *s;
+	slot->has_mag = has_mag;
+	if(mag_perm!=NULL){
+		for(i=0;i<3;i++) slot->s.data.mag[i] = mag_sign[i]*s->data.mag[mag_perm[i]];
+	}
+	__atomic_store_n(&slot->ver, ver+2, __ATOMIC_RELEASE);
+	return;
 }
 
 /*******************************************************************************
-* int rc_set_imu_interrupt_func(void (*func)(void))
+* int copy_vote_slot(int index, rc_imu_sample_t* s, int* has_mag)
 *
-* sets a user function to be called when new data is read
+* Copies the newest sample of IMU index out of its vote slot, retrying a few
+* times if it raced with the writer. Returns 0 on success, -1 if the writer
+* kept getting in the way or no sample has been published yet.
 *******************************************************************************/
-int rc_set_imu_interrupt_func(void (*func)(void)){
-	if(func==NULL){
-		fprintf(stderr,"ERROR: trying to assign NULL pointer to imu_interrupt_func\n");
-		return -1;
+int copy_vote_slot(int index, rc_imu_sample_t* s, int* has_mag){
+	imu_vote_slot_t* slot = &vote_slots[index];
+	uint32_t ver;
+	int tries;
+	for(tries=0;tries<4;tries++){
+		ver = __atomic_load_n(&slot->ver, __ATOMIC_ACQUIRE);
+		if(ver&1) continue;
+		*s = slot->s;
+		*has_mag = slot->has_mag;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&slot->ver, __ATOMIC_RELAXED)!=ver) continue;
+		return (s->timestamp_ns==0) ? -1 : 0;
 	}
-	imu_interrupt_func = func;
-	interrupt_func_set = 1;
-	return 0;
+	return -1;
 }
 
 /*******************************************************************************
-* int rc_stop_imu_interrupt_func()
+* void start_vote_slot(int index)
+* void stop_vote_slot(int index)
 *
-* stops the user function from being called when new data is available
+* Marks IMU index as publishing or not. Starting clears out whatever sample a
+* previous run left behind.
 *******************************************************************************/
-int rc_stop_imu_interrupt_func(){
-	interrupt_func_set = 0;
-	return 0;
+void start_vote_slot(int index){
+	rc_imu_sample_t empty;
+	memset(&empty, 0, sizeof(empty));
+	publish_imu_sample(index, &empty, 0, NULL, NULL);
+	__atomic_or_fetch(&vote_running, 1u<<index, __ATOMIC_RELEASE);
+	return;
+}
+
+void stop_vote_slot(int index){
+	__atomic_and_fetch(&vote_running, ~(1u<<index), __ATOMIC_RELEASE);
+	return;
 }
 
 /*******************************************************************************
-* int read_dmp_fifo()
+* void rotate_vec(imu_dev_t* dev, const float in[3], float out[3])
 *
-* Reads the FIFO buffer and populates the data struct. Here is where we see 
-* bad/empty/double packets due to i2c bus errors and the IMU failing to have
-* data ready in time. enabling warnings in the config struct will let this
-* function print out warnings when these conditions are detected. If write
-* errors are detected then this function tries some i2c transfers a second time.
+* Applies an instance's orientation the same way data_fusion does for IMU 0's
+* magnetometer.
 *******************************************************************************/
-int read_dmp_fifo(){
-	unsigned char raw[MAX_FIFO_BUFFER];
-	long quat[4];
-	int16_t mag_adc[3];
-	uint16_t fifo_count;
-	int ret, mag_data_available, dmp_data_available;
-	int i = 0; // position of beginning of mag data
-	int j = 0; // position of beginning of dmp data
-	static int first_run = 1; // set to 0 after first call
-	float factory_cal_data[3]; // just temp holder for mag data
-	double q_tmp[4];
-	double sum,qlen;
-	
-	if(!dmp_en){
-		printf("only use mpu_read_fifo in dmp mode\n");
-		return -1;
+static void rotate_vec(imu_dev_t* dev, const float in[3], float out[3]){
+	int i;
+	for(i=0;i<3;i++) out[i] = dev->orient_sign[i]*in[dev->orient_perm[i]];
+	return;
+}
+
+/*******************************************************************************
+* void* imu_instance_handler(void* ptr)
+*
+* Thread for one additional IMU. Waits for its data ready interrupt, or sleeps
+* until the next sample is due when it has no interrupt, then reads all the
+* sensors in one burst, rotates them, publishes the sample for the vote and
+* calls the instance's function.
+*******************************************************************************/
+void* imu_instance_handler(void* ptr){
+	imu_dev_t* dev = (imu_dev_t*)ptr;
+	rc_imu_subscriber_func_t func;
+	rc_imu_sample_t s;
+	struct timespec next;
+	uint64_t timestamp, period;
+	int ret;
+	period = 1000000000ULL/dev->config.dmp_sample_rate;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while(rc_get_state()!=EXITING && !dev->shutdown){
+		if(dev->event_src.initialized){
+			ret = rc_event_source_wait(&dev->event_src, IMU_POLL_TIMEOUT,\
+																&timestamp);
+			if(ret<=0) continue;
+		}
+		else{
+			next.tv_nsec += period;
+			while(next.tv_nsec>=1000000000){
+				next.tv_nsec -= 1000000000;
+				next.tv_sec++;
+			}
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+			timestamp = rc_nanos_since_epoch();
+		}
+		if(rc_get_state()==EXITING || dev->shutdown) break;
+		imu_claim_bus(dev);
+		ret = read_imu_burst(dev, &dev->config, &dev->data);
+		imu_release_bus(dev);
+		if(ret<0) continue;
+		// raw values stay in the sensor frame, the rest is rotated
+		s.timestamp_ns = timestamp;
+		s.seq = dev->seq++;
+		s.data = dev->data;
+		rotate_vec(dev, dev->data.accel, s.data.accel);
+		rotate_vec(dev, dev->data.gyro, s.data.gyro);
+		if(dev->config.enable_magnetometer){
+			rotate_vec(dev, dev->data.mag, s.data.mag);
+		}
+		publish_imu_sample(dev->index, &s, dev->config.enable_magnetometer,\
+																NULL, NULL);
+		func = dev->func;
+		if(func!=NULL) func(&s, dev->ctx);
 	}
+	return NULL;
+}
 
-	// if the fifo packet_len variable not set up yet, this function must
-	// have been called prematurely
-	if(packet_len!=FIFO_LEN_NO_MAG && packet_len!=FIFO_LEN_MAG){
-		fprintf(stderr,"ERROR: packet_len is set incorrectly for read_dmp_fifo\n");
+/*******************************************************************************
+* int rc_initialize_imu_instance(int imu, rc_imu_config_t conf)
+*
+* Sets up additional IMU number imu in raw register mode at dmp_sample_rate
+* and starts its thread. The bus, address or SPI slave and interrupt pin all
+* come from conf. Features whose state exists once, for IMU 0, are refused
+* rather than silently sharing it. Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_initialize_imu_instance(int imu, rc_imu_config_t conf){
+	imu_dev_t* dev;
+	struct sched_param params;
+	uint8_t c;
+	int ret;
+	if(imu<1 || imu>=RC_MAX_IMUS){
+		fprintf(stderr,"ERROR: in rc_initialize_imu_instance, imu must be between 1 & %d\n",\
+															RC_MAX_IMUS-1);
 		return -1;
 	}
-	
-	// make sure the i2c address is set correctly. 
-	// this shouldn't take any time at all if already set
-	rc_i2c_set_device_address(IMU_BUS, IMU_ADDR);
-	int is_new_dmp_data = 0;
-
-	// check fifo count register to make sure new data is there
-	if(rc_i2c_read_word(IMU_BUS, FIFO_COUNTH, &fifo_count)<0){
-		if(config.show_warnings){
-			printf("fifo_count i2c error: %s\n",strerror(errno));
-		}
+	dev = &imu_devs[imu];
+	if(dev->initialized){
+		fprintf(stderr,"ERROR: in rc_initialize_imu_instance, IMU %d already running\n", imu);
 		return -1;
 	}
-	#ifdef DEBUG
-	printf("fifo_count: %d\n", fifo_count);
-	#endif
-
-	/***************************************************************************
-	* now that we see how many values are in the buffer, we have a long list of
-	* checks to determine what should be done
-	***************************************************************************/
-	mag_data_available=0;
-	dmp_data_available=0;
-
-	// empty FIFO, just return, nothing else to do
-	if(fifo_count==0){
-		// if(config.show_warnings&& first_run!=1){
-		// 	printf("WARNING: empty fifo\n");
-		// }
+	// raw mode samples at 1khz/(1+SMPLRT_DIV) so the rate must divide 1000
+	if(conf.dmp_sample_rate<DMP_MIN_RATE || conf.dmp_sample_rate>1000 ||\
+								1000%conf.dmp_sample_rate!=0){
+		fprintf(stderr,"ERROR: in rc_initialize_imu_instance, dmp_sample_rate must divide 1000 and be at least %d\n",\
+															DMP_MIN_RATE);
 		return -1;
 	}
-
-	// one packet, perfect!
-	if(fifo_count==FIFO_LEN_NO_MAG){
-		i = 0; // set offset to 0
-		mag_data_available=0;
-		dmp_data_available=1;
-		goto READ_FIFO;
+	// the estimators and filters keep a single set of state, IMU 0's
+	if(conf.gyro_bias_estimation || conf.temp_compensation ||\
+		conf.temp_model_online || conf.mag_cal_online || conf.dynamic_notch){
+		fprintf(stderr,"ERROR: in rc_initialize_imu_instance, gyro bias, temperature, online mag cal and notch features are for IMU 0 only\n");
+		return -1;
 	}
-	if(fifo_count==FIFO_LEN_MAG){
-		i = 0; // set offset to 0
-		mag_data_available=1;
-		dmp_data_available=1;
-		goto READ_FIFO;
+	dev->index = imu;
+	dev->config = conf;
+	dev->seq = 0;
+	if(orientation_transform(conf.orientation, dev->orient_perm,\
+												dev->orient_sign)<0){
+		fprintf(stderr,"ERROR: in rc_initialize_imu_instance, invalid orientation\n");
+		return -1;
 	}
-
-	// these numbers pop up under high stress and represent uneven 
-	// combinations of magnetometer and DMP data
-	if(fifo_count==42){
-		if(config.show_warnings&& first_run!=1){
-			printf("warning: packet count 42\n");
-		}
-		i = 7; // set offset to 7
-		mag_data_available=0;
-		dmp_data_available=1;
-		goto READ_FIFO;
+	if(imu_bus_init(dev, conf.transport, conf.i2c_bus, conf.i2c_address,\
+													conf.spi_slave)<0){
+		fprintf(stderr,"ERROR: in rc_initialize_imu_instance, failed to initialize bus\n");
+		return -1;
 	}
-	if(fifo_count==63){
-		if(config.show_warnings&& first_run!=1){
-			printf("warning: packet count 63\n");
-		}
-		i = 28; // set offset to 7
-		mag_data_available=0;
-		dmp_data_available=1;
-		goto READ_FIFO;
+	imu_claim_bus(dev);
+	if(reset_mpu9250(dev, conf.fast_startup)<0){
+		fprintf(stderr,"ERROR: in rc_initialize_imu_instance, failed to reset IMU %d\n", imu);
+		goto FAIL;
+	}
+	if(mpu_read_byte(dev, WHO_AM_I_MPU9250, &c)<0 || c!=0x71){
+		fprintf(stderr,"ERROR: in rc_initialize_imu_instance, no MPU9250 found for IMU %d\n", imu);
+		goto FAIL;
+	}
+	if(load_gyro_offets(dev)<0){
+		fprintf(stderr,"ERROR: in rc_initialize_imu_instance, failed to load gyro offsets\n");
+		goto FAIL;
+	}
+	if(mpu_write_byte(dev, SMPLRT_DIV, 1000/conf.dmp_sample_rate-1) ||\
+		set_gyro_fsr(dev, conf.gyro_fsr, &dev->data) ||\
+		set_accel_fsr(dev, conf.accel_fsr, &dev->data) ||\
+		set_gyro_dlpf(dev, conf.gyro_dlpf) ||\
+		set_accel_dlpf(dev, conf.accel_dlpf)){
+		fprintf(stderr,"ERROR: in rc_initialize_imu_instance, failed to configure sensors\n");
+		goto FAIL;
+	}
+	// the magnetometer goes behind the I2C master, which also sets the
+	// interrupt pin active low either way
+	if(conf.enable_magnetometer){
+		ret = initialize_magnetometer(dev) || set_mag_slave_read(dev);
 	}
-	if(fifo_count==77){
-		if(config.show_warnings&& first_run!=1){
-			printf("warning: packet count 77\n");
-		}
-		i = 42; // set offset to 7
-		mag_data_available=0;
-		dmp_data_available=1;
-		goto READ_FIFO;
+	else ret = power_down_magnetometer(dev);
+	if(ret || mpu_set_bypass(dev, 0)){
+		fprintf(stderr,"ERROR: in rc_initialize_imu_instance, failed to set up magnetometer\n");
+		goto FAIL;
 	}
-
-	// if exactly 2 packets are there we just missed one (whoops)
-	// read both in and set the offset i to one packet length
-	// the last packet data will be read normally
-	if(fifo_count==2*FIFO_LEN_NO_MAG){
-		if(config.show_warnings&& first_run!=1){
-			printf("warning: imu fifo contains two packets\n");
-		}
-		i = FIFO_LEN_NO_MAG; // set offset to beginning of second packet
-		mag_data_available=0;
-		dmp_data_available=1;
-		goto READ_FIFO;
+	// data ready interrupt if there is somewhere for it to go, else a timer
+	rc_event_source_close(&dev->event_src);
+	if(conf.interrupt_source==EVENT_SOURCE_EVENTFD ||\
+					conf.interrupt_source==EVENT_SOURCE_PIPE){
+		ret = rc_event_source_open_fd(&dev->event_src, conf.interrupt_fd,\
+													conf.interrupt_source);
 	}
-	if(fifo_count==2*FIFO_LEN_MAG){
-		if(config.show_warnings&& first_run!=1){
-			printf("warning: imu fifo contains two packets\n");
-		}
-		i = FIFO_LEN_MAG; // set offset to beginning of second packet
-		mag_data_available=1;
-		dmp_data_available=1;
-		goto READ_FIFO;
+	else if(conf.interrupt_pin>=0){
+		ret = rc_event_source_open_gpio(&dev->event_src, conf.interrupt_pin,\
+									EDGE_FALLING, conf.interrupt_source);
 	}
-
-	// if there are exactly 7 14, or 21 bytes available, there must be magnetometer
-	// data but nothing else. read it in anyway
-	if(fifo_count==7 || fifo_count==14 || fifo_count==21){
-		i = fifo_count - 7;
-		mag_data_available = 1;
-		dmp_data_available = 0;
-		goto READ_FIFO;
+	else ret = 0;
+	if(ret<0){
+		fprintf(stderr,"ERROR: in rc_initialize_imu_instance, failed to configure interrupt source\n");
+		goto FAIL;
+	}
+	if(dev->event_src.initialized && mpu_write_byte(dev, INT_ENABLE, RAW_RDY_EN)){
+		fprintf(stderr,"ERROR: in rc_initialize_imu_instance, failed to enable interrupt\n");
+		rc_event_source_close(&dev->event_src);
+		goto FAIL;
+	}
+	imu_release_bus(dev);
+	start_vote_slot(imu);
+	dev->shutdown = 0;
+	if(pthread_create(&dev->thread, NULL, imu_instance_handler, dev)){
+		fprintf(stderr,"ERROR: in rc_initialize_imu_instance, failed to start thread\n");
+		stop_vote_slot(imu);
+		rc_event_source_close(&dev->event_src);
+		return -1;
 	}
+	params.sched_priority = conf.dmp_interrupt_priority;
+	pthread_setschedparam(dev->thread, SCHED_FIFO, &params);
+	dev->initialized = 1;
+	return 0;
 
-	// finally, if we got a weird packet length, reset the fifo
-	if(config.show_warnings&& first_run!=1){
-		printf("warning: %d bytes in FIFO, expected %d\n", fifo_count,packet_len);
-	}
-	mpu_reset_fifo();
+FAIL:
+	imu_release_bus(dev);
 	return -1;
+}
 
-	/***************************************************************************
-	* now we get to the reading section. Here we also have logic to determine
-	* the order of the data in the packet as magnetometer data may come before
-	* or after the DMP data
-	***************************************************************************/
-READ_FIFO:
-	memset(raw,0,MAX_FIFO_BUFFER);
-	// read it in!
-	ret = rc_i2c_read_bytes(IMU_BUS, FIFO_R_W, fifo_count, &raw[0]);
-	if(ret<0){
-		// if i2c_read returned -1 there was an error, try again
-		ret = rc_i2c_read_bytes(IMU_BUS, FIFO_R_W, fifo_count, &raw[0]);
+/*******************************************************************************
+* int rc_set_imu_instance_func(int imu, rc_imu_subscriber_func_t func,
+*																void* ctx)
+*
+* Sets the function called from IMU imu's thread with every sample, or NULL to
+* stop calling it.
+*******************************************************************************/
+int rc_set_imu_instance_func(int imu, rc_imu_subscriber_func_t func, void* ctx){
+	if(imu<1 || imu>=RC_MAX_IMUS){
+		fprintf(stderr,"ERROR: in rc_set_imu_instance_func, imu must be between 1 & %d\n",\
+															RC_MAX_IMUS-1);
+		return -1;
 	}
-	if(ret!=fifo_count){
-		if(config.show_warnings){
-			fprintf(stderr,"ERROR: failed to read fifo buffer register\n");
-			printf("read %d bytes, expected %d\n", ret, packet_len);
-		}
+	imu_devs[imu].func = NULL;
+	imu_devs[imu].ctx = ctx;
+	imu_devs[imu].func = func;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_read_imu_instance(int imu, rc_imu_sample_t* s)
+*
+* Copies the newest sample of any running IMU, 0 included. Returns 0 on
+* success or -1 if it is not running or has no sample yet.
+*******************************************************************************/
+int rc_read_imu_instance(int imu, rc_imu_sample_t* s){
+	int has_mag;
+	if(imu<0 || imu>=RC_MAX_IMUS || s==NULL){
+		fprintf(stderr,"ERROR: in rc_read_imu_instance, invalid argument\n");
+		return -1;
+	}
+	if(!(__atomic_load_n(&vote_running, __ATOMIC_ACQUIRE)&(1u<<imu))){
+		fprintf(stderr,"ERROR: in rc_read_imu_instance, IMU %d not running\n", imu);
 		return -1;
 	}
+	return copy_vote_slot(imu, s, &has_mag);
+}
 
-	// if dmp data is available we must figure out if it's before or 
-	// after the magnetometer data. Usually before.
-	if(dmp_data_available){
-		if(config.enable_magnetometer && check_quaternion_validity(raw,i+7)){
-			j=i+7; // 7 mag bytes before dmp data
-		}
-		else if(check_quaternion_validity(raw,i)){
-			// printf("after\n");
-			j=i; // 7 mag bytes after dmp data
-			i=i+FIFO_LEN_NO_MAG; // update mag data offset
-		}
-		else{
-			if(config.show_warnings){
-				printf("warning: Quaternion out of bounds\n");
-				printf("fifo_count: %d\n", fifo_count);
-			}
-			mpu_reset_fifo();
-			return -1;
-		}
-		// now we can read the quaternion
-		// parse the quaternion data from the buffer
-		quat[0] = ((long)raw[j+0] << 24) | ((long)raw[j+1] << 16) |
-			((long)raw[j+2] << 8) | raw[j+3];
-		quat[1] = ((long)raw[j+4] << 24) | ((long)raw[j+5] << 16) |
-			((long)raw[j+6] << 8) | raw[j+7];
-		quat[2] = ((long)raw[j+8] << 24) | ((long)raw[j+9] << 16) |
-			((long)raw[j+10] << 8) | raw[j+11];
-		quat[3] = ((long)raw[j+12] << 24) | ((long)raw[j+13] << 16) |
-			((long)raw[j+14] << 8) | raw[j+15];
-		
-		// do double-precision quaternion normalization since the numbers
-		// in raw format are huge
-		for(i=0;i<4;i++) q_tmp[i]=(double)quat[i];
-		sum = 0.0;
-		for(i=0;i<4;i++) sum+=q_tmp[i]*q_tmp[i];
-		qlen=sqrt(sum);
-		for(i=0;i<4;i++) q_tmp[i]/=qlen;
-		// make floating point and put in output
-		for(i=0;i<4;i++) data_ptr->dmp_quat[i]=(float)q_tmp[i];
-
-		// fill in tait-bryan angles to the data struct
-		rc_quaternion_to_tb_array(data_ptr->dmp_quat, data_ptr->dmp_TaitBryan);
-		
-		j+=16; // increase offset by 16 which was the quaternion size
-		
-		// Read Accel values and load into imu_data struct
-		// Turn the MSB and LSB into a signed 16-bit value
-		data_ptr->raw_accel[0] = (int16_t)(((uint16_t)raw[j+0]<<8)|raw[j+1]);
-		data_ptr->raw_accel[1] = (int16_t)(((uint16_t)raw[j+2]<<8)|raw[j+3]);
-		data_ptr->raw_accel[2] = (int16_t)(((uint16_t)raw[j+4]<<8)|raw[j+5]);
-		
-		// Fill in real unit values
-		data_ptr->accel[0] = data_ptr->raw_accel[0] * data_ptr->accel_to_ms2;
-		data_ptr->accel[1] = data_ptr->raw_accel[1] * data_ptr->accel_to_ms2;
-		data_ptr->accel[2] = data_ptr->raw_accel[2] * data_ptr->accel_to_ms2;
-		j+=6;
-		
-		// Read gyro values and load into imu_data struct
-		// Turn the MSB and LSB into a signed 16-bit value
-		data_ptr->raw_gyro[0] = (int16_t)(((int16_t)raw[0+j]<<8)|raw[1+j]);
-		data_ptr->raw_gyro[1] = (int16_t)(((int16_t)raw[2+j]<<8)|raw[3+j]);
-		data_ptr->raw_gyro[2] = (int16_t)(((int16_t)raw[4+j]<<8)|raw[5+j]);
-		// Fill in real unit values
-		data_ptr->gyro[0] = data_ptr->raw_gyro[0] * data_ptr->gyro_to_degs;
-		data_ptr->gyro[1] = data_ptr->raw_gyro[1] * data_ptr->gyro_to_degs;
-		data_ptr->gyro[2] = data_ptr->raw_gyro[2] * data_ptr->gyro_to_degs;
-
-		is_new_dmp_data = 1;
-	}
-
-	// if there was magnetometer data try to read it
-	if(mag_data_available){
-		// Turn the MSB and LSB into a signed 16-bit value
-		// Data stored as little Endian
-		mag_adc[0] = (int16_t)(((int16_t)raw[i+1]<<8) | raw[i+0]);  
-		mag_adc[1] = (int16_t)(((int16_t)raw[i+3]<<8) | raw[i+2]);  
-		mag_adc[2] = (int16_t)(((int16_t)raw[i+5]<<8) | raw[i+4]); 
-		
-		// if the data is non-zero, save it
-		// multiply by the sensitivity adjustment and convert to units of 
-		// uT micro Teslas. Also correct the coordinate system as someone 
-		// in invensense thought it would be bright idea to have the 
-		// magnetometer coordiate system aligned differently than the 
-		// accelerometer and gyro.... -__-
-		if(mag_adc[0]!=0 || mag_adc[1]!=0 || mag_adc[2]!=0){
-			// multiply by the sensitivity adjustment and convert to units of uT
-			// Also correct the coordinate system as someone in invensense 
-			// thought it would be a bright idea to have the magnetometer coordiate
-			// system aligned differently than the accelerometer and gyro.... -__-
-			factory_cal_data[0] = mag_adc[1]*mag_factory_adjust[1] * MAG_RAW_TO_uT;
-			factory_cal_data[1] = mag_adc[0]*mag_factory_adjust[0] * MAG_RAW_TO_uT;
-			factory_cal_data[2] = -mag_adc[2]*mag_factory_adjust[2] * MAG_RAW_TO_uT;
-		
-			// now apply out own calibration, but first make sure we don't 
-			// accidentally multiply by zero in case of uninitialized scale factors
-			if(mag_scales[0]==0.0) mag_scales[0]=1.0;
-			if(mag_scales[1]==0.0) mag_scales[1]=1.0;
-			if(mag_scales[2]==0.0) mag_scales[2]=1.0;
-			data_ptr->mag[0] = (factory_cal_data[0]-mag_offsets[0])*mag_scales[0];
-			data_ptr->mag[1] = (factory_cal_data[1]-mag_offsets[1])*mag_scales[1];
-			data_ptr->mag[2] = (factory_cal_data[2]-mag_offsets[2])*mag_scales[2];
-		}
+/*******************************************************************************
+* int rc_power_off_imu_instance(int imu)
+*
+* Stops IMU imu's thread and puts the chip to sleep.
+*******************************************************************************/
+int rc_power_off_imu_instance(int imu){
+	imu_dev_t* dev;
+	int ret = 0;
+	if(imu<1 || imu>=RC_MAX_IMUS){
+		fprintf(stderr,"ERROR: in rc_power_off_imu_instance, imu must be between 1 & %d\n",\
+															RC_MAX_IMUS-1);
+		return -1;
 	}
+	dev = &imu_devs[imu];
+	if(!dev->initialized) return 0;
+	stop_vote_slot(imu);
+	dev->shutdown = 1;
+	pthread_join(dev->thread, NULL);
+	rc_event_source_close(&dev->event_src);
+	imu_claim_bus(dev);
+	if(mpu_write_byte(dev, PWR_MGMT_1, H_RESET) ||\
+					mpu_write_byte(dev, PWR_MGMT_1, MPU_SLEEP)){
+		fprintf(stderr,"ERROR: in rc_power_off_imu_instance, failed to put IMU %d to sleep\n", imu);
+		ret = -1;
+	}
+	imu_release_bus(dev);
+	dev->initialized = 0;
+	return ret;
+}
 
-	
-	
-	// run data_fusion to filter yaw with compass if new mag data came in
-	if(is_new_dmp_data && config.enable_magnetometer){
-		#ifdef DEBUG
-		printf("running data_fusion\n");
-		#endif
-		data_fusion();
+/*******************************************************************************
+* int rc_calibrate_imu_instance_gyro(int imu, rc_imu_config_t conf)
+*
+* Runs the gyro calibration on the IMU conf points at and saves the offsets
+* for instance imu.
+*******************************************************************************/
+int rc_calibrate_imu_instance_gyro(int imu, rc_imu_config_t conf){
+	imu_dev_t* dev;
+	if(imu<1 || imu>=RC_MAX_IMUS){
+		fprintf(stderr,"ERROR: in rc_calibrate_imu_instance_gyro, imu must be between 1 & %d\n",\
+															RC_MAX_IMUS-1);
+		return -1;
 	}
+	dev = &imu_devs[imu];
+	if(dev->initialized){
+		fprintf(stderr,"ERROR: in rc_calibrate_imu_instance_gyro, power off IMU %d first\n", imu);
+		return -1;
+	}
+	dev->index = imu;
+	dev->config = conf;
+	if(imu_bus_init(dev, conf.transport, conf.i2c_bus, conf.i2c_address,\
+													conf.spi_slave)<0){
+		fprintf(stderr,"ERROR: in rc_calibrate_imu_instance_gyro, failed to initialize bus\n");
+		return -1;
+	}
+	return calibrate_gyro(dev);
+}
 
-	// if we finally got dmp data, turn off the first run flag
-	if(is_new_dmp_data) first_run=0;
+/*******************************************************************************
+* float trimmed_mean(float* v, int n)
+*
+* Mean of the n values in v without the highest and lowest when n is 3 or
+* more. Sorts v in place, n is never more than RC_MAX_IMUS.
+*******************************************************************************/
+static float trimmed_mean(float* v, int n){
+	float t, sum = 0.0f;
+	int i, j;
+	for(i=1;i<n;i++){
+		t = v[i];
+		for(j=i;j>0 && v[j-1]>t;j--) v[j] = v[j-1];
+		v[j] = t;
+	}
+	if(n>=3){
+		v++;
+		n -= 2;
+	}
+	for(i=0;i<n;i++) sum += v[i];
+	return sum/n;
+}
 
-	// finally, our return value is based on the presence of DMP data only
-	// even if new magnetometer data was read, the expected timing must come
-	// from the DMP samples only
-	if(is_new_dmp_data) return 0;
-	else return -1;
+/*******************************************************************************
+* int rc_vote_imu_data(rc_imu_vote_t* vote, uint64_t max_age_ns)
+*
+* Combines the newest sample of every running IMU into vote. Only accel, gyro,
+* mag and temp of vote->data are filled in.
+*******************************************************************************/
+int rc_vote_imu_data(rc_imu_vote_t* vote, uint64_t max_age_ns){
+	rc_imu_sample_t s[RC_MAX_IMUS];
+	int has_mag[RC_MAX_IMUS];
+	float v[RC_MAX_IMUS];
+	uint64_t now;
+	uint32_t running;
+	int i, j, k, n = 0;
+	if(vote==NULL){
+		fprintf(stderr,"ERROR: in rc_vote_imu_data, received NULL pointer\n");
+		return -1;
+	}
+	memset(vote, 0, sizeof(rc_imu_vote_t));
+	running = __atomic_load_n(&vote_running, __ATOMIC_ACQUIRE);
+	now = rc_nanos_since_epoch();
+	for(i=0;i<RC_MAX_IMUS;i++){
+		if(!(running&(1u<<i))) continue;
+		if(copy_vote_slot(i, &s[n], &has_mag[n])<0) continue;
+		if(max_age_ns>0 && now>s[n].timestamp_ns &&\
+					now-s[n].timestamp_ns>max_age_ns) continue;
+		if(s[n].timestamp_ns>vote->timestamp_ns){
+			vote->timestamp_ns = s[n].timestamp_ns;
+		}
+		vote->used |= 1u<<i;
+		n++;
+	}
+	vote->n = n;
+	if(n==0) return 0;
+	for(j=0;j<3;j++){
+		for(i=0;i<n;i++) v[i] = s[i].data.accel[j];
+		vote->data.accel[j] = trimmed_mean(v, n);
+		for(i=0;i<n;i++) v[i] = s[i].data.gyro[j];
+		vote->data.gyro[j] = trimmed_mean(v, n);
+		for(i=0, k=0;i<n;i++) if(has_mag[i]) v[k++] = s[i].data.mag[j];
+		if(k>0) vote->data.mag[j] = trimmed_mean(v, k);
+		vote->n_mag = k;
+	}
+	for(i=0;i<n;i++) v[i] = s[i].data.temp;
+	vote->data.temp = trimmed_mean(v, n);
+	return n;
 }
 
 /*******************************************************************************
@@ -1796,92 +3586,104 @@ int check_quaternion_validity(unsigned char* raw, int i){
 }
 
 /*******************************************************************************
-* int data_fusion()
+* int orientation_transform(rc_imu_orientation_t orient, int perm[3],
+*															float sign[3])
 *
-* This fuses the magnetometer data with the quaternion straight from the DMP
-* to correct the yaw heading to a compass heading. Much thanks to Pansenti for
-* open sourcing this routine. In addition to the Pansenti implementation I also
-* correct the magnetometer data for DMP orientation, initialize yaw with the
-* magnetometer to prevent initial rise time, and correct the yaw_mixing_factor
-* with the sample rate so the filter rise time remains constant with different
-* sample rates.
+* The DMP remaps accel and gyro internally to match the requested orientation
+* but the magnetometer bypasses it, so data_fusion has to do the same swap. Each
+* orientation is a signed permutation of the axes which is worked out here once,
+* normally into orient_perm and orient_sign, so data_fusion can apply it
+* without branching. Returns -1 if the orientation is not one of
+* rc_imu_orientation_t.
 *******************************************************************************/
-int data_fusion(){
-	float tilt_tb[3], tilt_q[4], mag_vec[3];
-	static float newMagYaw = 0;
-	static float newDMPYaw = 0;
-	float lastDMPYaw, lastMagYaw, newYaw; 
-	static int dmp_spin_counter = 0;
-	static int mag_spin_counter = 0;
-	static int first_run = 1; // set to 0 after first call to this function
-	
-	
-	// start by filling in the roll/pitch components of the fused euler
-	// angles from the DMP generated angles. Ignore yaw for now, we have to
-	// filter that later. 
-	tilt_tb[0] = data_ptr->dmp_TaitBryan[TB_PITCH_X];
-	tilt_tb[1] = data_ptr->dmp_TaitBryan[TB_ROLL_Y];
-	tilt_tb[2] = 0.0f;
-
-	// generate a quaternion rotation of just roll/pitch
-	rc_tb_to_quaternion_array(tilt_tb,tilt_q);
-
-	// create a quaternion vector from the current magnetic field vector
-	// in IMU body coordinate frame. Since the DMP quaternion is aligned with
-	// a particular orientation, we must be careful to orient the magnetometer
-	// data to match.
-	switch(config.orientation){
+int orientation_transform(rc_imu_orientation_t orient, int perm[3], float sign[3]){
+	int i;
+	for(i=0;i<3;i++) sign[i] = 1.0f;
+	switch(orient){
 	case ORIENTATION_Z_UP:
-		mag_vec[0] = data_ptr->mag[TB_PITCH_X];
-		mag_vec[1] = data_ptr->mag[TB_ROLL_Y];
-		mag_vec[2] = data_ptr->mag[TB_YAW_Z];
+		perm[0]=TB_PITCH_X;	perm[1]=TB_ROLL_Y;	perm[2]=TB_YAW_Z;
 		break;
 	case ORIENTATION_Z_DOWN:
-		mag_vec[0] = -data_ptr->mag[TB_PITCH_X];
-		mag_vec[1] = data_ptr->mag[TB_ROLL_Y];
-		mag_vec[2] = -data_ptr->mag[TB_YAW_Z];
+		perm[0]=TB_PITCH_X;	perm[1]=TB_ROLL_Y;	perm[2]=TB_YAW_Z;
+		sign[0]=-1.0f;		sign[2]=-1.0f;
 		break;
 	case ORIENTATION_X_UP:
-		mag_vec[0] = data_ptr->mag[TB_YAW_Z];
-		mag_vec[1] = data_ptr->mag[TB_ROLL_Y];
-		mag_vec[2] = data_ptr->mag[TB_PITCH_X];
+		perm[0]=TB_YAW_Z;	perm[1]=TB_ROLL_Y;	perm[2]=TB_PITCH_X;
 		break;
 	case ORIENTATION_X_DOWN:
-		mag_vec[0] = -data_ptr->mag[TB_YAW_Z];
-		mag_vec[1] = data_ptr->mag[TB_ROLL_Y];
-		mag_vec[2] = -data_ptr->mag[TB_PITCH_X];
+		perm[0]=TB_YAW_Z;	perm[1]=TB_ROLL_Y;	perm[2]=TB_PITCH_X;
+		sign[0]=-1.0f;		sign[2]=-1.0f;
 		break;
 	case ORIENTATION_Y_UP:
-		mag_vec[0] = data_ptr->mag[TB_PITCH_X];
-		mag_vec[1] = -data_ptr->mag[TB_YAW_Z];
-		mag_vec[2] = data_ptr->mag[TB_ROLL_Y];
+		perm[0]=TB_PITCH_X;	perm[1]=TB_YAW_Z;	perm[2]=TB_ROLL_Y;
+		sign[1]=-1.0f;
 		break;
 	case ORIENTATION_Y_DOWN:
-		mag_vec[0] = data_ptr->mag[TB_PITCH_X];
-		mag_vec[1] = data_ptr->mag[TB_YAW_Z];
-		mag_vec[2] = -data_ptr->mag[TB_ROLL_Y];
+		perm[0]=TB_PITCH_X;	perm[1]=TB_YAW_Z;	perm[2]=TB_ROLL_Y;
+		sign[2]=-1.0f;
 		break;
 	case ORIENTATION_X_FORWARD:
-		mag_vec[0] = data_ptr->mag[TB_ROLL_Y];
-		mag_vec[1] = -data_ptr->mag[TB_PITCH_X];
-		mag_vec[2] = data_ptr->mag[TB_YAW_Z];
+		perm[0]=TB_ROLL_Y;	perm[1]=TB_PITCH_X;	perm[2]=TB_YAW_Z;
+		sign[1]=-1.0f;
 		break;
 	case ORIENTATION_X_BACK:
-		mag_vec[0] = -data_ptr->mag[TB_ROLL_Y];
-		mag_vec[1] = data_ptr->mag[TB_PITCH_X];
-		mag_vec[2] = data_ptr->mag[TB_YAW_Z];
+		perm[0]=TB_ROLL_Y;	perm[1]=TB_PITCH_X;	perm[2]=TB_YAW_Z;
+		sign[0]=-1.0f;
 		break;
 	default:
 		fprintf(stderr,"ERROR: invalid orientation\n");
 		return -1;
 	}
-	// tilt that vector by the roll/pitch of the IMU to align magnetic field
-	// vector such that Z points vertically
-	rc_quaternion_rotate_vector_array(mag_vec,tilt_q);
+	return 0;
+}
+
+/*******************************************************************************
+* int data_fusion()
+*
+* This fuses the magnetometer data with the quaternion straight from the DMP
+* to correct the yaw heading to a compass heading. Much thanks to Pansenti for
+* open sourcing this routine. In addition to the Pansenti implementation I also
+* correct the magnetometer data for DMP orientation, initialize yaw with the
+* magnetometer to prevent initial rise time, and correct the yaw_mixing_factor
+* with the sample rate so the filter rise time remains constant with different
+* sample rates.
+*
+* The magnetometer vector is tilted level by the roll/pitch part of the DMP
+* quaternion. Rather than converting the roll/pitch angles back to a
+* quaternion, their sines and cosines are read straight off the quaternion's
+* rotation matrix. Only the two horizontal components matter for the heading
+* and atan2 ignores a common positive scale, so the usual division by
+* cos(roll) is skipped too.
+*******************************************************************************/
+int data_fusion(){
+	float mag_vec[3], a, b, s, hx, hy;
+	float* q = data_ptr->dmp_quat;
+	static float newMagYaw = 0;
+	static float newDMPYaw = 0;
+	float lastDMPYaw, lastMagYaw, newYaw; 
+	static int dmp_spin_counter = 0;
+	static int mag_spin_counter = 0;
+	
+	// create a vector from the current magnetic field in IMU body coordinate
+	// frame. Since the DMP quaternion is aligned with a particular
+	// orientation, we must be careful to orient the magnetometer data to match.
+	mag_vec[0] = orient_sign[0]*data_ptr->mag[orient_perm[0]];
+	mag_vec[1] = orient_sign[1]*data_ptr->mag[orient_perm[1]];
+	mag_vec[2] = orient_sign[2]*data_ptr->mag[orient_perm[2]];
+
+	// pitch is atan2(a,b) and roll is asin(s) as in rc_quaternion_to_tb_array,
+	// so sin(pitch)=a/c, cos(pitch)=b/c, sin(roll)=s, cos(roll)=c where
+	// c=sqrt(a*a+b*b). Tilting the vector by roll/pitch to align Z vertically
+	// then leaves these horizontal components, each scaled by c.
+	a = 2.0f*(q[2]*q[3] + q[0]*q[1]);
+	b = 1.0f - 2.0f*(q[1]*q[1] + q[2]*q[2]);
+	s = 2.0f*(q[0]*q[2] - q[1]*q[3]);
+	hx = (a*a + b*b)*mag_vec[0] + s*(a*mag_vec[1] + b*mag_vec[2]);
+	hy = b*mag_vec[1] - a*mag_vec[2];
 	// from the aligned magnetic field vector, find a yaw heading
 	// check for validity and make sure the heading is positive
 	lastMagYaw = newMagYaw; // save from last loop
-	newMagYaw = -atan2(mag_vec[1], mag_vec[0]);
+	newMagYaw = -atan2(hy, hx);
 	if (newMagYaw != newMagYaw) {
 		#ifdef WARNINGS
 		printf("newMagYaw NAN\n");
@@ -1902,8 +3704,8 @@ int data_fusion(){
 	if(newDMPYaw-lastDMPYaw < -PI) dmp_spin_counter++;
 	else if (newDMPYaw-lastDMPYaw > PI) dmp_spin_counter--;
 	
-	// if this is the first run, set up filters
-	if(first_run){
+	// if this is the first run or the settings changed, set up filters
+	if(fusion_reset){
 		lastMagYaw = newMagYaw;
 		lastDMPYaw = newDMPYaw;
 		mag_spin_counter = 0;
@@ -1916,7 +3718,7 @@ int data_fusion(){
 		rc_prefill_filter_outputs(&low_pass,newMagYaw);
 		rc_prefill_filter_inputs(&high_pass,newDMPYaw);
 		rc_prefill_filter_outputs(&high_pass,0);
-		first_run = 0;
+		fusion_reset = 0;
 	}
 	
 	// new Yaw is the sum of low and high pass complementary filters.
@@ -1940,75 +3742,88 @@ int data_fusion(){
 }
 
 /*******************************************************************************
-* int write_gyro_offsets_to_disk(int16_t offsets[3])
+* int16_t* cal_gyro_offsets(rc_calibration_t* cal, int index)
+* float* cal_mag_offsets(rc_calibration_t* cal, int index)
+* float* cal_mag_scales(rc_calibration_t* cal, int index)
+* uint32_t cal_gyro_bit(int index)
+* uint32_t cal_mag_bit(int index)
 *
-* Reads steady state gyro offsets from the disk and puts them in the IMU's 
-* gyro offset register. If no calibration file exists then make a new one.
+* Where IMU index's sections are in the calibration store, IMU 0 has the
+* original ones and the instances theirs.
 *******************************************************************************/
-int write_gyro_offets_to_disk(int16_t offsets[3]){
-	FILE *cal;
-	char file_path[100];
+static int16_t* cal_gyro_offsets(rc_calibration_t* cal, int index){
+	return index==0 ? cal->gyro_offsets : cal->imu_gyro_offsets[index-1];
+}
 
-	// construct a new file path string and open for writing
-	strcpy(file_path, CONFIG_DIRECTORY);
-	strcat(file_path, GYRO_CAL_FILE);
-	cal = fopen(file_path, "w+");
-	// if opening for writing failed, the directory may not exist yet
-	if (cal == 0) {
-		mkdir(CONFIG_DIRECTORY, 0777);
-		cal = fopen(file_path, "w+");
-		if (cal == 0){
-			fprintf(stderr,"could not open config directory\n");
-			fprintf(stderr,CONFIG_DIRECTORY);
-			fprintf(stderr,"\n");
-			return -1;
-		}
-	}
-	// write to the file, close, and exit
-	if(fprintf(cal,"%d\n%d\n%d\n", offsets[0],offsets[1],offsets[2])<0){
-		printf("Failed to write gyro offsets to file\n");
-		fclose(cal);
+static float* cal_mag_offsets(rc_calibration_t* cal, int index){
+	return index==0 ? cal->mag_offsets : cal->imu_mag_offsets[index-1];
+}
+
+static float* cal_mag_scales(rc_calibration_t* cal, int index){
+	return index==0 ? cal->mag_scales : cal->imu_mag_scales[index-1];
+}
+
+static uint32_t cal_gyro_bit(int index){
+	return index==0 ? RC_CAL_GYRO : RC_CAL_IMU_GYRO(index);
+}
+
+static uint32_t cal_mag_bit(int index){
+	return index==0 ? RC_CAL_MAG : RC_CAL_IMU_MAG(index);
+}
+
+/*******************************************************************************
+* int write_gyro_offsets_to_disk(int index, int16_t offsets[3])
+*
+* Saves steady state gyro offsets of IMU index to the calibration store.
+*******************************************************************************/
+int write_gyro_offets_to_disk(int index, int16_t offsets[3]){
+	rc_calibration_t cal;
+	int i;
+	if(rc_get_calibration(&cal)) return -1;
+	for(i=0;i<3;i++) cal_gyro_offsets(&cal, index)[i] = offsets[i];
+	cal.valid |= cal_gyro_bit(index);
+	if(rc_save_calibration(&cal)){
+		fprintf(stderr,"Failed to write gyro offsets to calibration store\n");
 		return -1;
 	}
-	fclose(cal);
 	return 0;
 }
 
 /*******************************************************************************
-* int load_gyro_offsets()
+* int load_gyro_offsets(imu_dev_t* dev)
 *
-* Loads steady state gyro offsets from the disk and puts them in the IMU's 
-* gyro offset register. If no calibration file exists then make a new one.
+* Loads steady state gyro offsets from dev's slot in the calibration store
+* and puts them in the IMU's gyro offset register. Zero offsets are used if
+* there are none.
 *******************************************************************************/
-int load_gyro_offets(){
-	FILE *cal;
-	char file_path[100];
+int load_gyro_offets(imu_dev_t* dev){
+	rc_calibration_t cal;
 	uint8_t data[6];
 	int x,y,z;
 	
-	// construct a new file path string and open for reading
-	strcpy (file_path, CONFIG_DIRECTORY);
-	strcat (file_path, GYRO_CAL_FILE);
-	cal = fopen(file_path, "r");
-	
-	if (cal == 0) {
-		// calibration file doesn't exist yet
-		fprintf(stderr,"WARNING: no gyro calibration data found\n");
+	rc_get_calibration(&cal);
+	if(!(cal.valid & cal_gyro_bit(dev->index))){
+		// not calibrated yet
+		fprintf(stderr,"WARNING: no gyro calibration data found for IMU %d\n", dev->index);
 		fprintf(stderr,"Please run rc_calibrate_gyro\n\n");
-		// use zero offsets
-		x = 0;
-		y = 0;
-		z = 0;
-	}
-	else {
-		// read in data
-		fscanf(cal,"%d\n%d\n%d\n", &x,&y,&z);
-		fclose(cal);
 	}
+	// offsets are zero until calibrated
+	x = cal_gyro_offsets(&cal, dev->index)[0];
+	y = cal_gyro_offsets(&cal, dev->index)[1];
+	z = cal_gyro_offsets(&cal, dev->index)[2];
 
 	#ifdef DEBUG
 	printf("offsets: %d %d %d\n", x, y, z);
 	#endif
+	dev->gyro_offsets[0] = x;
+	dev->gyro_offsets[1] = y;
+	dev->gyro_offsets[2] = z;
+	if(dev==imu0){
+		reset_gyro_bias();
+		// the temperature model goes with the offsets it's relative to
+		temp_model = cal.imu_temp_model;
+		reset_temp_comp();
+	}
 
 	// Divide by 4 to get 32.9 LSB per deg/s to conform to expected bias input 
 	// format. also make negative since we wish to subtract out the steady 
@@ -2021,7 +3836,7 @@ int load_gyro_offets(){
 	data[5] = (-z/4)       & 0xFF;
 
 	// Push gyro biases to hardware registers
-	if(rc_i2c_write_bytes(IMU_BUS, XG_OFFSET_H, 6, &data[0])){
+	if(mpu_write_bytes(dev, XG_OFFSET_H, 6, &data[0])){
 		fprintf(stderr,"ERROR: failed to load gyro offsets into IMU register\n");
 		return -1;
 	}
@@ -2035,84 +3850,95 @@ int load_gyro_offets(){
 * state gyro offsets. These offsets are then saved to disk for later use.
 *******************************************************************************/
 int rc_calibrate_gyro_routine(){
-	uint8_t c, data[6];
-	int32_t gyro_sum[3] = {0, 0, 0};
-	int16_t offsets[3];
-	int was_last_steady = 1;
-	
 	// make sure the bus is not currently in use by another thread
 	// do not proceed to prevent interfering with that process
-	if(rc_i2c_get_in_use_state(IMU_BUS)){
+	if(imu_bus_in_use(imu0)){
 		fprintf(stderr,"i2c bus claimed by another process\n");
 		fprintf(stderr,"aborting gyro calibration()\n");
 		return -1;
 	}
 	
 	// if it is not claimed, start the i2c bus
-	if(rc_i2c_init(IMU_BUS, IMU_ADDR)){
+	if(imu_bus_init(imu0, imu0->transport, imu0->bus, imu0->address,\
+												imu0->spi_slave)){
 		fprintf(stderr,"rc_initialize_imu_dmp failed at rc_i2c_init\n");
 		return -1;
 	}
+	return calibrate_gyro(imu0);
+}
+
+/*******************************************************************************
+* int calibrate_gyro(imu_dev_t* dev)
+*
+* The calibration itself for any IMU whose bus is already set up, saving the
+* offsets in dev's calibration slot.
+*******************************************************************************/
+int calibrate_gyro(imu_dev_t* dev){
+	uint8_t c, data[6];
+	int32_t gyro_sum[3] = {0, 0, 0};
+	int16_t offsets[3];
+	int was_last_steady = 1;
+	int fast = (dev==imu0) ? fast_startup : dev->config.fast_startup;
 	
 	// claiming the bus does no guarantee other code will not interfere 
 	// with this process, but best to claim it so other code can check
 	// like we did above
-	rc_i2c_claim_bus(IMU_BUS);
+	imu_claim_bus(dev);
 	
 	// reset device, reset all registers
-	if(reset_mpu9250()<0){
+	if(reset_mpu9250(dev, fast)<0){
 		fprintf(stderr,"ERROR: failed to reset MPU9250\n");
 		return -1;
 	}
 
 	// set up the IMU specifically for calibration. 
-	rc_i2c_write_byte(IMU_BUS, PWR_MGMT_1, 0x01);  
-	rc_i2c_write_byte(IMU_BUS, PWR_MGMT_2, 0x00); 
+	mpu_write_byte(dev, PWR_MGMT_1, 0x01);  
+	mpu_write_byte(dev, PWR_MGMT_2, 0x00); 
 	rc_usleep(200000);
 	
 	// // set bias registers to 0
 	// // Push gyro biases to hardware registers
 	// uint8_t zeros[] = {0,0,0,0,0,0};
-	// if(rc_i2c_write_bytes(IMU_BUS, XG_OFFSET_H, 6, zeros)){
+	// if(mpu_write_bytes(dev, XG_OFFSET_H, 6, zeros)){
 		// fprintf(stderr,"ERROR: failed to load gyro offsets into IMU register\n");
 		// return -1;
 	// }
 
-	rc_i2c_write_byte(IMU_BUS, INT_ENABLE, 0x00);  // Disable all interrupts
-	rc_i2c_write_byte(IMU_BUS, FIFO_EN, 0x00);     // Disable FIFO
-	rc_i2c_write_byte(IMU_BUS, PWR_MGMT_1, 0x00);  // Turn on internal clock source
-	rc_i2c_write_byte(IMU_BUS, I2C_MST_CTRL, 0x00);// Disable I2C master
-	rc_i2c_write_byte(IMU_BUS, USER_CTRL, 0x00);   // Disable FIFO and I2C master
-	rc_i2c_write_byte(IMU_BUS, USER_CTRL, 0x0C);   // Reset FIFO and DMP
+	mpu_write_byte(dev, INT_ENABLE, 0x00);  // Disable all interrupts
+	mpu_write_byte(dev, FIFO_EN, 0x00);     // Disable FIFO
+	mpu_write_byte(dev, PWR_MGMT_1, 0x00);  // Turn on internal clock source
+	mpu_write_byte(dev, I2C_MST_CTRL, 0x00);// Disable I2C master
+	mpu_write_byte(dev, USER_CTRL, 0x00);   // Disable FIFO and I2C master
+	mpu_write_byte(dev, USER_CTRL, 0x0C);   // Reset FIFO and DMP
 	rc_usleep(15000);
 
 	// Configure MPU9250 gyro and accelerometer for bias calculation
-	rc_i2c_write_byte(IMU_BUS, CONFIG, 0x01);      // Set low-pass filter to 188 Hz
-	rc_i2c_write_byte(IMU_BUS, SMPLRT_DIV, 0x04);  // Set sample rate to 200hz
+	mpu_write_byte(dev, CONFIG, 0x01);      // Set low-pass filter to 188 Hz
+	mpu_write_byte(dev, SMPLRT_DIV, 0x04);  // Set sample rate to 200hz
 	// Set gyro full-scale to 250 degrees per second, maximum sensitivity
-	rc_i2c_write_byte(IMU_BUS, GYRO_CONFIG, 0x00); 
+	mpu_write_byte(dev, GYRO_CONFIG, 0x00); 
 	// Set accelerometer full-scale to 2 g, maximum sensitivity	
-	rc_i2c_write_byte(IMU_BUS, ACCEL_CONFIG, 0x00); 
+	mpu_write_byte(dev, ACCEL_CONFIG, 0x00); 
 
 COLLECT_DATA:
 
 	if(rc_get_state()==EXITING){
-		rc_i2c_release_bus(IMU_BUS);
+		imu_release_bus(dev);
 		return -1;
 	}
 
 	// Configure FIFO to capture gyro data for bias calculation
-	rc_i2c_write_byte(IMU_BUS, USER_CTRL, 0x40);   // Enable FIFO  
+	mpu_write_byte(dev, USER_CTRL, 0x40);   // Enable FIFO  
 	// Enable gyro sensors for FIFO (max size 512 bytes in MPU-9250)
 	c = FIFO_GYRO_X_EN|FIFO_GYRO_Y_EN|FIFO_GYRO_Z_EN;
-	rc_i2c_write_byte(IMU_BUS, FIFO_EN, c); 
+	mpu_write_byte(dev, FIFO_EN, c); 
 	// 6 bytes per sample. 200hz. wait 0.4 seconds
 	rc_usleep(400000);
 
 	// At end of sample accumulation, turn off FIFO sensor read
-	rc_i2c_write_byte(IMU_BUS, FIFO_EN, 0x00);   
+	mpu_write_byte(dev, FIFO_EN, 0x00);   
 	// read FIFO sample count and log number of samples
-	rc_i2c_read_bytes(IMU_BUS, FIFO_COUNTH, 2, &data[0]); 
+	mpu_read_bytes(dev, FIFO_COUNTH, 2, &data[0]); 
 	int16_t fifo_count = ((uint16_t)data[0] << 8) | data[1];
 	int samples = fifo_count/6;
 
@@ -2134,7 +3960,7 @@ COLLECT_DATA:
 	gyro_sum[2] = 0;
 	for (i=0; i<samples; i++) {
 		// read data for averaging
-		if(rc_i2c_read_bytes(IMU_BUS, FIFO_R_W, 6, data)<0){
+		if(mpu_read_bytes(dev, FIFO_R_W, 6, data)<0){
 			fprintf(stderr,"ERROR: failed to read FIFO\n");
 			return -1;
 		}
@@ -2186,13 +4012,13 @@ COLLECT_DATA:
 		goto COLLECT_DATA;
 	}
 	// done with I2C for now
-	rc_i2c_release_bus(IMU_BUS);
+	imu_release_bus(dev);
 	#ifdef DEBUG
 	printf("offsets: %d %d %d\n", offsets[0], offsets[1], offsets[2]);
 	#endif
 	// write to disk
-	if(write_gyro_offets_to_disk(offsets)<0){
-		fprintf(stderr,"ERROR in rc_calibrate_gyro_routine, failed to write to disk\n");
+	if(write_gyro_offets_to_disk(dev->index, offsets)<0){
+		fprintf(stderr,"ERROR in calibrate_gyro, failed to write to disk\n");
 		return -1;
 	}
 	return 0;
@@ -2324,90 +4150,55 @@ uint64_t rc_nanos_since_last_imu_interrupt(){
 /*******************************************************************************
 * int write_mag_cal_to_disk(float offsets[3], float scale[3])
 *
-* Reads steady state gyro offsets from the disk and puts them in the IMU's 
-* gyro offset register. If no calibration file exists then make a new one.
+* Saves magnetometer offsets and scales to the calibration store.
 *******************************************************************************/
 int write_mag_cal_to_disk(float offsets[3], float scale[3]){
-	FILE *cal;
-	char file_path[100];
-	int ret;
-	
-	// construct a new file path string and open for writing
-	strcpy(file_path, CONFIG_DIRECTORY);
-	strcat(file_path, MAG_CAL_FILE);
-	cal = fopen(file_path, "w+");
-	// if opening for writing failed, the directory may not exist yet
-	if (cal == 0) {
-		mkdir(CONFIG_DIRECTORY, 0777);
-		cal = fopen(file_path, "w+");
-		if (cal == 0){
-			fprintf(stderr,"could not open config directory\n");
-			fprintf(stderr, CONFIG_DIRECTORY);
-			fprintf(stderr,"\n");
-			return -1;
-		}
-	}
-	
-	// write to the file, close, and exit
-	ret = fprintf(cal,"%f\n%f\n%f\n%f\n%f\n%f\n", 	offsets[0],\
-													offsets[1],\
-													offsets[2],\
-													scale[0],\
-													scale[1],\
-													scale[2]);
-	if(ret<0){
-		fprintf(stderr,"Failed to write mag calibration to file\n");
-		fclose(cal);
+	rc_calibration_t cal;
+	int i;
+	if(rc_get_calibration(&cal)) return -1;
+	for(i=0;i<3;i++){
+		cal.mag_offsets[i] = offsets[i];
+		cal.mag_scales[i] = scale[i];
+	}
+	cal.valid |= RC_CAL_MAG;
+	if(rc_save_calibration(&cal)){
+		fprintf(stderr,"Failed to write mag calibration to calibration store\n");
 		return -1;
 	}
-	fclose(cal);
 	return 0;
 }
 
 /*******************************************************************************
-* int load_mag_calibration()
+* int load_mag_calibration(imu_dev_t* dev)
 *
-* Loads steady state magnetometer offsets and scale from the disk into global
-* variables for correction later by read_magnetometer and FIFO read functions
+* Loads steady state magnetometer offsets and scale from dev's slot in the
+* calibration store into dev for correction later by read_magnetometer and
+* FIFO read functions
 *******************************************************************************/
-int load_mag_calibration(){
-	FILE *cal;
-	char file_path[100];
-	float x,y,z,sx,sy,sz;
-	
-	// construct a new file path string and open for reading
-	strcpy (file_path, CONFIG_DIRECTORY);
-	strcat (file_path, MAG_CAL_FILE);
-	cal = fopen(file_path, "r");
+int load_mag_calibration(imu_dev_t* dev){
+	rc_calibration_t cal;
+	int i;
 	
-	if (cal == 0) {
-		// calibration file doesn't exist yet
-		fprintf(stderr,"WARNING: no magnetometer calibration data found\n");
+	// the online fit starts over whenever the magnetometer is set up
+	if(dev==imu0) reset_mag_cal();
+	rc_get_calibration(&cal);
+	// write to dev fo use by rc_read_mag_data, offsets are zero and scales one
+	// until calibrated
+	for(i=0;i<3;i++){
+		dev->mag_offsets[i] = cal_mag_offsets(&cal, dev->index)[i];
+		dev->mag_scales[i] = cal_mag_scales(&cal, dev->index)[i];
+	}
+	if(!(cal.valid & cal_mag_bit(dev->index))){
+		// not calibrated yet
+		fprintf(stderr,"WARNING: no magnetometer calibration data found for IMU %d\n", dev->index);
 		fprintf(stderr,"Please run rc_calibrate_mag\n\n");
-		mag_offsets[0]=0.0;
-		mag_offsets[1]=0.0;
-		mag_offsets[2]=0.0;
-		mag_scales[0]=1.0;
-		mag_scales[1]=1.0;
-		mag_scales[2]=1.0;
 		return -1;
 	}
-	// read in data
-	fscanf(cal,"%f\n%f\n%f\n%f\n%f\n%f\n", &x,&y,&z,&sx,&sy,&sz);
 
 	#ifdef DEBUG
-	printf("magcal: %f %f %f %f %f %f\n", x,y,z,sx,sy,sz);
+	printf("magcal: %f %f %f %f %f %f\n", dev->mag_offsets[0], dev->mag_offsets[1],\
+			dev->mag_offsets[2], dev->mag_scales[0], dev->mag_scales[1], dev->mag_scales[2]);
 	#endif
-
-	// write to global variables fo use by rc_read_mag_data
-	mag_offsets[0]=x;
-	mag_offsets[1]=y;
-	mag_offsets[2]=z;
-	mag_scales[0]=sx;
-	mag_scales[1]=sy;
-	mag_scales[2]=sz;
-
-	fclose(cal);
 	return 0;
 }
 
@@ -2425,24 +4216,26 @@ int rc_calibrate_mag_routine(){
 	const int sample_rate_hz = 15;
 	int i;
 	uint8_t c;
-	float new_scale[3];
-	rc_matrix_t A = rc_empty_matrix();
-	rc_vector_t center = rc_empty_vector();
-	rc_vector_t lengths = rc_empty_vector();
+	float new_scale[3], new_offset[3];
+	// the ellipsoid fit squares field values of ~50uT so work in double
+	rc_matrix_d_t A = rc_empty_matrix_d();
+	rc_vector_d_t center = rc_empty_vector_d();
+	rc_vector_d_t lengths = rc_empty_vector_d();
 	rc_imu_data_t imu_data; // to collect magnetometer data
 	config = rc_default_imu_config();
 	config.enable_magnetometer = 1;
 	
 	// make sure the bus is not currently in use by another thread
 	// do not proceed to prevent interfering with that process
-	if(rc_i2c_get_in_use_state(IMU_BUS)){
+	if(imu_bus_in_use(imu0)){
 		fprintf(stderr,"i2c bus claimed by another process\n");
 		fprintf(stderr,"aborting gyro calibration()\n");
 		return -1;
 	}
 	
 	// if it is not claimed, start the i2c bus
-	if(rc_i2c_init(IMU_BUS, IMU_ADDR)){
+	if(imu_bus_init(imu0, imu0->transport, imu0->bus, imu0->address,\
+												imu0->spi_slave)){
 		fprintf(stderr,"rc_initialize_imu_dmp failed at rc_i2c_init\n");
 		return -1;
 	}
@@ -2450,39 +4243,48 @@ int rc_calibrate_mag_routine(){
 	// claiming the bus does no guarantee other code will not interfere 
 	// with this process, but best to claim it so other code can check
 	// like we did above
-	rc_i2c_claim_bus(IMU_BUS);
+	imu_claim_bus(imu0);
 	
 	// reset device, reset all registers
-	if(reset_mpu9250()<0){
+	if(reset_mpu9250(imu0, fast_startup)<0){
 		fprintf(stderr,"ERROR: failed to reset MPU9250\n");
 		return -1;
 	}
 	//check the who am i register to make sure the chip is alive
-	if(rc_i2c_read_byte(IMU_BUS, WHO_AM_I_MPU9250, &c)<0){
+	if(imu_read_byte(WHO_AM_I_MPU9250, &c)<0){
 		fprintf(stderr,"Reading WHO_AM_I_MPU9250 register failed\n");
-		rc_i2c_release_bus(IMU_BUS);
+		imu_release_bus(imu0);
 		return -1;
 	}
 	if(c!=0x71){
 		fprintf(stderr,"mpu9250 WHO AM I register should return 0x71\n");
 		fprintf(stderr,"WHO AM I returned: 0x%x\n", c);
-		rc_i2c_release_bus(IMU_BUS);
+		imu_release_bus(imu0);
+		return -1;
+	}
+	// rc_read_mag_data reads what the MPU's I2C master fetched, so the master
+	// needs a sample clock and the slave 0 read set up as rc_initialize_imu
+	// does, the filter enables the sample rate divider
+	if(set_gyro_dlpf(imu0, config.gyro_dlpf) || mpu_set_sample_rate(200)){
+		fprintf(stderr,"ERROR: failed to set IMU sample rate\n");
+		imu_release_bus(imu0);
 		return -1;
 	}
-	if(initialize_magnetometer()){
+	if(initialize_magnetometer(imu0) || set_mag_slave_read(imu0) ||\
+												mpu_set_bypass(imu0, 0)){
 		fprintf(stderr,"ERROR: failed to initialize_magnetometer\n");
-		rc_i2c_release_bus(IMU_BUS);
+		imu_release_bus(imu0);
 		return -1;
 	}
 	
 	// set local calibration to initial values and prepare variables
-	mag_offsets[0] = 0.0;
-	mag_offsets[1] = 0.0;
-	mag_offsets[2] = 0.0;
-	mag_scales[0]  = 1.0;
-	mag_scales[1]  = 1.0;
-	mag_scales[2]  = 1.0;
-	rc_alloc_matrix(&A,samples,3);
+	imu0->mag_offsets[0] = 0.0;
+	imu0->mag_offsets[1] = 0.0;
+	imu0->mag_offsets[2] = 0.0;
+	imu0->mag_scales[0]  = 1.0;
+	imu0->mag_scales[1]  = 1.0;
+	imu0->mag_scales[2]  = 1.0;
+	rc_alloc_matrix_d(&A,samples,3);
 	i = 0;
 		
 	// sample data
@@ -2515,7 +4317,7 @@ int rc_calibrate_mag_routine(){
 	}
 	// done with I2C for now
 	rc_power_off_imu();
-	rc_i2c_release_bus(IMU_BUS);
+	imu_release_bus(imu0);
 	
 	printf("\n\nOkay Stop!\n");
 	printf("Calculating calibration constants.....\n");
@@ -2528,27 +4330,27 @@ int rc_calibrate_mag_routine(){
 		return -1;
 	}
 	// make empty vectors for ellipsoid fitting to populate
-	if(rc_fit_ellipsoid(A,&center,&lengths)<0){
+	if(rc_fit_ellipsoid_d(A,&center,&lengths)<0){
 		fprintf(stderr,"failed to fit ellipsoid to magnetometer data\n");
-		rc_free_matrix(&A);
+		rc_free_matrix_d(&A);
 		return -1;
 	}
 	// empty memory, we are done with A
-	rc_free_matrix(&A); 
+	rc_free_matrix_d(&A); 
 	// do some sanity checks to make sure data is reasonable
 	if(fabs(center.d[0])>200 || fabs(center.d[1])>200 || \
 											fabs(center.d[2])>200){
 		fprintf(stderr,"ERROR: center of fitted ellipsoid out of bounds\n");
-		rc_free_vector(&center);
-		rc_free_vector(&lengths);
+		rc_free_vector_d(&center);
+		rc_free_vector_d(&lengths);
 		return -1;
 	}
 	if( lengths.d[0]>200 || lengths.d[0]<5 || \
 		lengths.d[1]>200 || lengths.d[1]<5 || \
 		lengths.d[2]>200 || lengths.d[2]<5){
 		fprintf(stderr,"ERROR: length of fitted ellipsoid out of bounds\n");
-		//rc_free_vector(&center);
-		//rc_free_vector(&lengths);
+		//rc_free_vector_d(&center);
+		//rc_free_vector_d(&lengths);
 		//return -1;
 	}
 	// all seems well, calculate scaling factors to map ellipse lengths to
@@ -2557,6 +4359,9 @@ int rc_calibrate_mag_routine(){
 	new_scale[0] = 70.0f/lengths.d[0];
 	new_scale[1] = 70.0f/lengths.d[1];
 	new_scale[2] = 70.0f/lengths.d[2];
+	new_offset[0] = center.d[0];
+	new_offset[1] = center.d[1];
+	new_offset[2] = center.d[2];
 	// print results
 	printf("\n");
 	printf("Offsets X: %7.3f Y: %7.3f Z: %7.3f\n", 	center.d[0],\
@@ -2566,43 +4371,38 @@ int rc_calibrate_mag_routine(){
 													new_scale[1],\
 													new_scale[2]);
 	// write to disk
-	if(write_mag_cal_to_disk(center.d,new_scale)<0){
-		rc_free_vector(&center);
-		rc_free_vector(&lengths);
+	if(write_mag_cal_to_disk(new_offset,new_scale)<0){
+		rc_free_vector_d(&center);
+		rc_free_vector_d(&lengths);
 		return -1;
 	}
-	rc_free_vector(&center);
-	rc_free_vector(&lengths);
+	rc_free_vector_d(&center);
+	rc_free_vector_d(&lengths);
 	return 0;
 }
 
 /*******************************************************************************
 * int rc_is_gyro_calibrated()
 *
-* return 1 is a gyro calibration file exists, otherwise 0
+* return 1 if the calibration store has gyro offsets, otherwise 0
 *******************************************************************************/
 int rc_is_gyro_calibrated(){
-	char file_path[100];
-	strcpy (file_path, CONFIG_DIRECTORY);
-	strcat (file_path, GYRO_CAL_FILE);
-	if(!access(file_path, F_OK)) return 1;
-	else return 0;
+	rc_calibration_t cal;
+	if(rc_get_calibration(&cal)) return 0;
+	return (cal.valid & RC_CAL_GYRO) ? 1 : 0;
 }
 
 /*******************************************************************************
 * int rc_is_mag_calibrated()
 *
-* return 1 is a magnetometer calibration file exists, otherwise 0
+* return 1 if the calibration store has a magnetometer calibration, otherwise 0
 *******************************************************************************/
 int rc_is_mag_calibrated(){
-	char file_path[100];
-	strcpy (file_path, CONFIG_DIRECTORY);
-	strcat (file_path, MAG_CAL_FILE);
-	if(!access(file_path, F_OK)) return 1;
-	else return 0;
+	rc_calibration_t cal;
+	if(rc_get_calibration(&cal)) return 0;
+	return (cal.valid & RC_CAL_MAG) ? 1 : 0;
 }
 
 
 
-
 // Phew, that was a lot of code....
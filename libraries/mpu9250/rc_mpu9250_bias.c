@@ -0,0 +1,920 @@
+/*******************************************************************************
+* rc_mpu9250_bias.c
+*
+* Background estimation of IMU 0's sensor errors while it runs: the gyro bias
+* while the board is still, the temperature model of gyro and accel bias and
+* scale, and the magnetometer's hard and soft iron calibration from normal
+* motion.
+*******************************************************************************/
+
+#include "rc_mpu9250_common.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/*******************************************************************************
+*	Local variables
+*******************************************************************************/
+// background gyro bias estimation, see update_gyro_bias
+static float still_mean[6];		// running mean of gyro then accel
+static float still_var[6];			// running variance of gyro then accel
+static uint64_t still_count;		// samples in a row that looked still
+static float gyro_bias[3];			// residual bias removed in software, deg/s
+int gyro_bias_push;			// offset register steps waiting to be written
+static int16_t gyro_offset_steps[3];
+static rc_imu_gyro_bias_t bias_stats;
+// temperature compensation, see update_temp_comp
+#define TEMP_READ_NS		1000000000	// how often the IMU thread reads it
+#define TEMP_FIT_SMOOTH		1e-3f	// ties empty nodes to their neighbours
+rc_imu_temp_model_t temp_model;		// model in use, as set or learned
+static rc_imu_temp_model_t temp_filled;	// same with empty nodes interpolated
+int temp_dirty;				// temp_filled needs rebuilding
+int temp_valid;				// a temperature has been read since startup
+static float temp_now;				// temperature the values below are for
+static int temp_k;					// node below temp_now
+static float temp_u;					// fraction of the way to the next node
+static float temp_gyro_bias[3], temp_gyro_scale[3];
+static float temp_accel_bias[3], temp_accel_scale[3];
+static uint64_t temp_read_ns;
+// sums behind the least squares fit of the model, see add_temp_reading.
+// Readings between node k and k+1 go in interval k, nodes have a prior.
+typedef struct temp_fit_t{
+	double lo[RC_IMU_TEMP_NODES-1];		// sum of (1-u)^2
+	double hi[RC_IMU_TEMP_NODES-1];		// sum of u^2
+	double cross[RC_IMU_TEMP_NODES-1];	// sum of u(1-u)
+	double w_lo[RC_IMU_TEMP_NODES-1];	// sum of 1-u
+	double w_hi[RC_IMU_TEMP_NODES-1];	// sum of u
+	double y_lo[RC_IMU_TEMP_NODES-1][3];	// sum of (1-u)y
+	double y_hi[RC_IMU_TEMP_NODES-1][3];	// sum of uy
+	double prior[RC_IMU_TEMP_NODES];
+	double y_prior[RC_IMU_TEMP_NODES][3];
+} temp_fit_t;
+static temp_fit_t temp_fit;
+static int temp_fit_seeded;
+static int16_t temp_steps[3];	// modelled bias in whole offset register steps
+static int16_t temp_steps_hw[3];		// steps in the offset registers now
+static float temp_hw_bias[3];		// the same in deg/s
+// online magnetometer calibration, see update_mag_cal
+#define MAG_CAL_UNIT			50.0	// uT, keeps the fit parameters near 1
+#define MAG_CAL_P0				1000.0	// initial covariance, nothing known yet
+#define MAG_CAL_MEMORY			1000	// readings, sets the forgetting factor
+#define MAG_CAL_LAMBDA			(1.0-1.0/MAG_CAL_MEMORY)
+#define MAG_CAL_MAX_TRACE		(6*MAG_CAL_P0)	// forgetting stops here
+#define MAG_CAL_MIN_STEP		2.0f	// uT between readings that are used
+#define MAG_CAL_BINS			24		// directions for coverage
+#define MAG_CAL_MIN_SAMPLES		200		// readings before trusting the fit
+#define MAG_CAL_ERR_ALPHA		0.02f	// filter constant for fit_error
+#define MAG_CAL_MAX_ERR			0.05f	// fit_error needed to converge
+#define MAG_CAL_MAX_CENTER		200.0f	// sanity limits as in the routine
+#define MAG_CAL_MIN_LEN			5.0f
+#define MAG_CAL_MAX_LEN			200.0f
+#define MAG_CAL_RADIUS			70.0f	// uT, scale readings to this sphere
+#define MAG_CAL_SWAP_INTERVAL	100		// readings between swaps
+#define MAG_CAL_SWAP_OFFSET		0.5f	// uT change worth swapping for
+#define MAG_CAL_SWAP_SCALE		0.005f	// relative scale change worth it
+static double mag_rls_theta[6];
+static double mag_rls_P[6][6];
+static uint64_t mag_bin_hit[MAG_CAL_BINS];	// reading count when last visited
+static float mag_last[3];
+static float mag_err_sq;
+static uint64_t mag_last_swap;
+static rc_imu_mag_cal_t mag_cal_stats;
+
+/*******************************************************************************
+* void reset_gyro_bias()
+*
+* Forgets the background gyro bias estimate, called whenever the hardware
+* offsets are loaded from disk.
+*******************************************************************************/
+void reset_gyro_bias(){
+	int i;
+	for(i=0;i<6;i++){
+		still_mean[i] = 0.0f;
+		still_var[i] = 0.0f;
+	}
+	for(i=0;i<3;i++) gyro_bias[i] = 0.0f;
+	still_count = 0;
+	gyro_bias_push = 0;
+	memset(&bias_stats, 0, sizeof(bias_stats));
+	return;
+}
+
+/*******************************************************************************
+* void update_gyro_bias(float dt, int use_accel)
+*
+* Called from the IMU thread for every sample when gyro_bias_estimation is
+* enabled. The running mean and variance of each gyro and accel axis are
+* updated in constant time with a time constant of a quarter of still_time, so
+* once the IMU has looked still for still_time nothing from before it stopped
+* moving is left in them. While still, the residual gyro reading is averaged
+* into the bias estimate, plainly at first and then with
+* gyro_bias_time_constant so it follows slow drift with temperature. The
+* estimate is subtracted from the gyro readings and, if gyro_bias_to_hardware
+* is set, whole steps of the offset registers are queued to be written the
+* next time the IMU thread has the i2c bus.
+*******************************************************************************/
+void update_gyro_bias(float dt, int use_accel){
+	float a, b, d, x, thresh;
+	int i, n, still = 1, push = 0;
+
+	a = 4.0f*dt/config.still_time;
+	if(a>1.0f) a = 1.0f;
+	n = use_accel ? 6 : 3;
+	for(i=0;i<n;i++){
+		x = (i<3) ? data_ptr->gyro[i] : data_ptr->accel[i-3];
+		d = x - still_mean[i];
+		still_mean[i] += a*d;
+		still_var[i] = (1.0f-a)*(still_var[i] + a*d*d);
+		thresh = (i<3) ? config.still_gyro_thresh : config.still_accel_thresh;
+		if(still_var[i] > thresh*thresh) still = 0;
+	}
+	if(!still) still_count = 0;
+	else still_count++;
+	bias_stats.still = (still_count*dt >= config.still_time);
+
+	if(bias_stats.still && config.temp_model_online && temp_valid){
+		// the temperature model takes the residual instead
+		bias_stats.still_samples++;
+		learn_temp_model(dt);
+	}
+	else if(bias_stats.still){
+		bias_stats.still_samples++;
+		b = 1.0f/bias_stats.still_samples;
+		if(b < dt/config.gyro_bias_time_constant){
+			b = dt/config.gyro_bias_time_constant;
+		}
+		for(i=0;i<3;i++){
+			gyro_bias[i] += b*(data_ptr->gyro[i]-gyro_bias[i]);
+			// whole steps only so noise doesn't flip the register back and forth
+			gyro_offset_steps[i] = (int16_t)(gyro_bias[i]*GYRO_OFFSET_LSB_PER_DEGS);
+			if(gyro_offset_steps[i]!=0) push = 1;
+		}
+		if(push && config.gyro_bias_to_hardware && !replay_active){
+			gyro_bias_push = 1;
+		}
+	}
+	for(i=0;i<3;i++) data_ptr->gyro[i] -= gyro_bias[i];
+	return;
+}
+
+/*******************************************************************************
+* int push_gyro_bias()
+*
+* Moves the queued whole steps of the bias estimate into the gyro offset
+* registers. Must be called from the IMU thread with the bus claimed.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int push_gyro_bias(){
+	uint8_t data[6];
+	int i, x[3];
+	float d;
+	gyro_bias_push = 0;
+	// same format as load_gyro_offets, plus the temperature model's steps
+	for(i=0;i<3;i++){
+		x[i] = imu0->gyro_offsets[i] + 4*gyro_offset_steps[i];
+		data[2*i]   = ((-x[i]/4 - temp_steps[i]) >> 8) & 0xFF;
+		data[2*i+1] = (-x[i]/4 - temp_steps[i])      & 0xFF;
+	}
+	if(imu_write_bytes(XG_OFFSET_H, 6, data)){
+		if(config.show_warnings){
+			printf("failed to write gyro offset registers\n");
+		}
+		return -1;
+	}
+	// the hardware removes this much from now on
+	for(i=0;i<3;i++){
+		imu0->gyro_offsets[i] = x[i];
+		d = gyro_offset_steps[i]/GYRO_OFFSET_LSB_PER_DEGS;
+		gyro_bias[i] -= d;
+		still_mean[i] -= d;
+		gyro_offset_steps[i] = 0;
+		temp_steps_hw[i] = temp_steps[i];
+		temp_hw_bias[i] = temp_steps[i]/GYRO_OFFSET_LSB_PER_DEGS;
+	}
+	bias_stats.hw_updates++;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_get_imu_gyro_bias(rc_imu_gyro_bias_t* bias)
+*
+* Reports the state of the background gyro bias estimator.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_get_imu_gyro_bias(rc_imu_gyro_bias_t* bias){
+	int i;
+	if(bias==NULL){
+		fprintf(stderr,"ERROR: in rc_get_imu_gyro_bias, received NULL pointer\n");
+		return -1;
+	}
+	*bias = bias_stats;
+	for(i=0;i<3;i++){
+		bias->bias[i] = gyro_bias[i];
+		bias->offsets[i] = imu0->gyro_offsets[i];
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_save_imu_gyro_bias()
+*
+* Writes the hardware offsets plus the current software estimate to the
+* calibration store so the next start begins from the drifted bias.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_save_imu_gyro_bias(){
+	int16_t offsets[3];
+	int i;
+	if(bias_stats.still_samples==0){
+		fprintf(stderr,"ERROR: in rc_save_imu_gyro_bias, no estimate yet\n");
+		return -1;
+	}
+	// the file is in units of 250DPS full scale
+	for(i=0;i<3;i++){
+		offsets[i] = imu0->gyro_offsets[i] + lrintf(gyro_bias[i]*32768.0f/250.0f);
+	}
+	return write_gyro_offets_to_disk(0, offsets);
+}
+
+/*******************************************************************************
+* rc_imu_temp_model_t rc_default_imu_temp_model()
+*
+* A model that changes nothing, nodes every 10 degrees from -20C to 90C which
+* covers the die temperatures the MPU9250 sees in practice.
+*******************************************************************************/
+rc_imu_temp_model_t rc_default_imu_temp_model(){
+	rc_imu_temp_model_t m;
+	int i, j;
+	memset(&m, 0, sizeof(m));
+	m.temp_min = -20.0f;
+	m.temp_step = 10.0f;
+	for(i=0;i<RC_IMU_TEMP_NODES;i++){
+		for(j=0;j<3;j++){
+			m.gyro_scale[i][j] = 1.0f;
+			m.accel_scale[i][j] = 1.0f;
+		}
+	}
+	return m;
+}
+
+/*******************************************************************************
+* void reset_temp_comp()
+*
+* Forgets the temperature and the steps in the offset registers, called
+* whenever the offsets are loaded from disk or the chip isn't there at all.
+*******************************************************************************/
+void reset_temp_comp(){
+	int i;
+	temp_valid = 0;
+	temp_dirty = 1;
+	temp_fit_seeded = 0;
+	for(i=0;i<3;i++){
+		temp_steps[i] = 0;
+		temp_steps_hw[i] = 0;
+		temp_hw_bias[i] = 0.0f;
+	}
+	return;
+}
+
+/*******************************************************************************
+* void copy_temp_node(rc_imu_temp_model_t* m, int k, int a, int b, float u)
+*
+* Sets node k of m to the point u of the way from node a to node b of the
+* model in use.
+*******************************************************************************/
+static void copy_temp_node(rc_imu_temp_model_t* m, int k, int a, int b, float u){
+	const rc_imu_temp_model_t* t = &temp_model;
+	int i;
+	for(i=0;i<3;i++){
+		m->gyro_bias[k][i] = t->gyro_bias[a][i] + u*(t->gyro_bias[b][i]-t->gyro_bias[a][i]);
+		m->gyro_scale[k][i] = t->gyro_scale[a][i] + u*(t->gyro_scale[b][i]-t->gyro_scale[a][i]);
+		m->accel_bias[k][i] = t->accel_bias[a][i] + u*(t->accel_bias[b][i]-t->accel_bias[a][i]);
+		m->accel_scale[k][i] = t->accel_scale[a][i] + u*(t->accel_scale[b][i]-t->accel_scale[a][i]);
+	}
+	return;
+}
+
+/*******************************************************************************
+* void fill_temp_model()
+*
+* Rebuilds temp_filled from the model in use. Nodes without data are
+* interpolated between the nearest nodes that have some, or copied from the
+* nearest one past the ends of the data. If no node has data the model is
+* used as it is.
+*******************************************************************************/
+void fill_temp_model(){
+	int k, lo, hi;
+	temp_filled = temp_model;
+	temp_dirty = 0;
+	for(k=0;k<RC_IMU_TEMP_NODES;k++){
+		if(temp_model.weight[k]>0.0f) continue;
+		for(lo=k-1;lo>=0 && temp_model.weight[lo]<=0.0f;lo--);
+		for(hi=k+1;hi<RC_IMU_TEMP_NODES && temp_model.weight[hi]<=0.0f;hi++);
+		if(lo<0 && hi>=RC_IMU_TEMP_NODES) return;
+		if(lo<0) copy_temp_node(&temp_filled, k, hi, hi, 0.0f);
+		else if(hi>=RC_IMU_TEMP_NODES) copy_temp_node(&temp_filled, k, lo, lo, 0.0f);
+		else copy_temp_node(&temp_filled, k, lo, hi, (float)(k-lo)/(hi-lo));
+	}
+	return;
+}
+
+/*******************************************************************************
+* int temp_node(const rc_imu_temp_model_t* m, float temp, float* u)
+*
+* Returns the node below temp in m and sets u to how far it is to the next
+* one. Temperatures past the ends of the table use the end nodes.
+*******************************************************************************/
+static int temp_node(const rc_imu_temp_model_t* m, float temp, float* u){
+	float f = (temp-m->temp_min)/m->temp_step;
+	if(!(f>0.0f)){
+		*u = 0.0f;
+		return 0;
+	}
+	if(f>=RC_IMU_TEMP_NODES-1){
+		*u = 1.0f;
+		return RC_IMU_TEMP_NODES-2;
+	}
+	*u = f-(int)f;
+	return (int)f;
+}
+
+/*******************************************************************************
+* void eval_temp_model(float temp)
+*
+* Interpolates the filled model at temp into the values applied to every
+* sample.
+*******************************************************************************/
+void eval_temp_model(float temp){
+	const rc_imu_temp_model_t* m = &temp_filled;
+	float u;
+	int i, k;
+	k = temp_node(m, temp, &u);
+	for(i=0;i<3;i++){
+		temp_gyro_bias[i] = m->gyro_bias[k][i] + u*(m->gyro_bias[k+1][i]-m->gyro_bias[k][i]);
+		temp_gyro_scale[i] = m->gyro_scale[k][i] + u*(m->gyro_scale[k+1][i]-m->gyro_scale[k][i]);
+		temp_accel_bias[i] = m->accel_bias[k][i] + u*(m->accel_bias[k+1][i]-m->accel_bias[k][i]);
+		temp_accel_scale[i] = m->accel_scale[k][i] + u*(m->accel_scale[k+1][i]-m->accel_scale[k][i]);
+	}
+	temp_now = temp;
+	temp_k = k;
+	temp_u = u;
+	temp_valid = 1;
+	return;
+}
+
+/*******************************************************************************
+* void apply_temp_comp(rc_imu_data_t* data, int accel, int gyro)
+*
+* Corrects the accel and/or gyro readings in data for the current
+* temperature. Whatever part of the gyro bias is already in the offset
+* registers isn't subtracted again.
+*******************************************************************************/
+void apply_temp_comp(rc_imu_data_t* data, int accel, int gyro){
+	int i;
+	for(i=0;i<3 && gyro;i++){
+		data->gyro[i] = (data->gyro[i]-temp_gyro_bias[i]+temp_hw_bias[i])*\
+														temp_gyro_scale[i];
+	}
+	for(i=0;i<3 && accel;i++){
+		data->accel[i] = (data->accel[i]-temp_accel_bias[i])*temp_accel_scale[i];
+	}
+	return;
+}
+
+/*******************************************************************************
+* void update_temp_comp(uint64_t now)
+*
+* Called from the IMU thread with the bus claimed after every FIFO read. Reads
+* the temperature once every TEMP_READ_NS, evaluates the model there and, if
+* gyro_bias_to_hardware is set, queues the whole offset register steps of the
+* modelled gyro bias to be written with push_gyro_bias. With compensation off
+* any steps still in the registers are queued to be taken back out.
+*******************************************************************************/
+void update_temp_comp(uint64_t now){
+	uint16_t adc;
+	int i;
+	if(!config.temp_compensation){
+		temp_valid = 0;
+		for(i=0;i<3;i++){
+			temp_steps[i] = 0;
+			if(temp_steps_hw[i]!=0) gyro_bias_push = 1;
+		}
+		return;
+	}
+	if(!temp_valid || now-temp_read_ns>=TEMP_READ_NS){
+		if(imu_read_word(TEMP_OUT_H, &adc)<0){
+			if(config.show_warnings){
+				printf("failed to read IMU temperature registers\n");
+			}
+		}
+		else{
+			data_ptr->temp = 21.0 + (int16_t)adc/TEMP_SENSITIVITY;
+			temp_read_ns = now;
+			if(temp_dirty) fill_temp_model();
+			eval_temp_model(data_ptr->temp);
+		}
+	}
+	else if(temp_dirty){
+		fill_temp_model();
+		eval_temp_model(temp_now);
+	}
+	if(!temp_valid) return;
+	for(i=0;i<3;i++){
+		if(config.gyro_bias_to_hardware){
+			temp_steps[i] = (int16_t)(temp_gyro_bias[i]*GYRO_OFFSET_LSB_PER_DEGS);
+		}
+		else temp_steps[i] = 0;
+		if(temp_steps[i]!=temp_steps_hw[i]) gyro_bias_push = 1;
+	}
+	return;
+}
+
+/*******************************************************************************
+* void add_temp_reading(temp_fit_t* fit, int k, float u, const double y[3])
+*
+* Adds a gyro reading y taken u of the way from node k to node k+1 to the
+* least squares fit. It pulls on both nodes in proportion to how close each
+* is, so the normal equations are tridiagonal.
+*******************************************************************************/
+static void add_temp_reading(temp_fit_t* fit, int k, float u, const double y[3]){
+	int j;
+	fit->lo[k] += (1.0-u)*(1.0-u);
+	fit->hi[k] += u*u;
+	fit->cross[k] += u*(1.0-u);
+	fit->w_lo[k] += 1.0-u;
+	fit->w_hi[k] += u;
+	for(j=0;j<3;j++){
+		fit->y_lo[k][j] += (1.0-u)*y[j];
+		fit->y_hi[k][j] += u*y[j];
+	}
+	return;
+}
+
+/*******************************************************************************
+* void forget_temp_readings(temp_fit_t* fit, int k, float u, double a)
+*
+* Scales down the readings in interval k, and the priors of its nodes by how
+* close they are, by the fraction a. Whole readings are forgotten at a time
+* so the fit stays a proper weighted least squares fit.
+*******************************************************************************/
+static void forget_temp_readings(temp_fit_t* fit, int k, float u, double a){
+	double f = 1.0-a, f_lo = 1.0-a*(1.0-u), f_hi = 1.0-a*u;
+	int j;
+	fit->lo[k] *= f;
+	fit->hi[k] *= f;
+	fit->cross[k] *= f;
+	fit->w_lo[k] *= f;
+	fit->w_hi[k] *= f;
+	fit->prior[k] *= f_lo;
+	fit->prior[k+1] *= f_hi;
+	for(j=0;j<3;j++){
+		fit->y_lo[k][j] *= f;
+		fit->y_hi[k][j] *= f;
+		fit->y_prior[k][j] *= f_lo;
+		fit->y_prior[k+1][j] *= f_hi;
+	}
+	return;
+}
+
+/*******************************************************************************
+* int solve_temp_fit(const temp_fit_t* fit, rc_imu_temp_model_t* m)
+*
+* Solves the normal equations into the gyro bias nodes of m and sets their
+* weights. A small smoothing term between neighbouring nodes keeps them
+* solvable when some nodes have no readings. They're tridiagonal so each axis
+* goes through rc_tridiag_solve_d, on views of arrays on the stack so nothing
+* is allocated when the IMU thread calls this every sample. The system is
+* scaled to the average weight per node first so the pivots stay clear of the
+* solver's zero tolerance however few readings there are. Returns 0 on success
+* or -1 leaving m untouched.
+*******************************************************************************/
+static int solve_temp_fit(const temp_fit_t* fit, rc_imu_temp_model_t* m){
+	double sub[RC_IMU_TEMP_NODES], d[RC_IMU_TEMP_NODES], e[RC_IMU_TEMP_NODES];
+	double b[3][RC_IMU_TEMP_NODES], x[3][RC_IMU_TEMP_NODES];
+	double w[RC_IMU_TEMP_NODES];
+	double lambda = 0.0, scale;
+	rc_vector_d_t va = rc_empty_vector_d();
+	rc_vector_d_t vb = rc_empty_vector_d();
+	rc_vector_d_t vc = rc_empty_vector_d();
+	rc_vector_d_t vd = rc_empty_vector_d();
+	rc_vector_d_t vx = rc_empty_vector_d();
+	int j, k;
+	// gather the sums for each node from the intervals on either side
+	for(k=0;k<RC_IMU_TEMP_NODES;k++){
+		d[k] = fit->prior[k];
+		e[k] = 0.0;
+		w[k] = fit->prior[k];
+		for(j=0;j<3;j++) b[j][k] = fit->y_prior[k][j];
+		if(k>0){
+			d[k] += fit->hi[k-1];
+			w[k] += fit->w_hi[k-1];
+			for(j=0;j<3;j++) b[j][k] += fit->y_hi[k-1][j];
+		}
+		if(k<RC_IMU_TEMP_NODES-1){
+			d[k] += fit->lo[k];
+			w[k] += fit->w_lo[k];
+			for(j=0;j<3;j++) b[j][k] += fit->y_lo[k][j];
+			e[k] = fit->cross[k];
+		}
+		lambda += d[k];
+	}
+	// smoothing scaled to the average weight per node
+	scale = lambda/RC_IMU_TEMP_NODES;
+	if(!(scale>0.0)) scale = 1.0;
+	lambda = TEMP_FIT_SMOOTH*lambda/RC_IMU_TEMP_NODES + 1e-9;
+	for(k=0;k<RC_IMU_TEMP_NODES-1;k++){
+		d[k] += lambda;
+		d[k+1] += lambda;
+		e[k] -= lambda;
+	}
+	// symmetric, so the sub-diagonal is the super-diagonal shifted down one
+	for(k=0;k<RC_IMU_TEMP_NODES;k++){
+		d[k] /= scale;
+		e[k] /= scale;
+		for(j=0;j<3;j++) b[j][k] /= scale;
+	}
+	sub[0] = 0.0;
+	for(k=1;k<RC_IMU_TEMP_NODES;k++) sub[k] = e[k-1];
+	rc_vector_view_array_d(&va, sub, RC_IMU_TEMP_NODES);
+	rc_vector_view_array_d(&vb, d, RC_IMU_TEMP_NODES);
+	rc_vector_view_array_d(&vc, e, RC_IMU_TEMP_NODES);
+	for(j=0;j<3;j++){
+		rc_vector_view_array_d(&vd, b[j], RC_IMU_TEMP_NODES);
+		rc_vector_view_array_d(&vx, x[j], RC_IMU_TEMP_NODES);
+		if(rc_tridiag_solve_d(va, vb, vc, vd, &vx)){
+			fprintf(stderr,"ERROR: in solve_temp_fit, failed to solve\n");
+			return -1;
+		}
+	}
+	for(k=0;k<RC_IMU_TEMP_NODES;k++){
+		m->weight[k] = w[k];
+		for(j=0;j<3;j++) m->gyro_bias[k][j] = x[j][k];
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* void seed_temp_fit()
+*
+* Starts the online fit from the model in use, each node counting as weight
+* readings of its own value.
+*******************************************************************************/
+void seed_temp_fit(){
+	int j, k;
+	memset(&temp_fit, 0, sizeof(temp_fit));
+	for(k=0;k<RC_IMU_TEMP_NODES;k++){
+		temp_fit.prior[k] = temp_model.weight[k];
+		for(j=0;j<3;j++){
+			temp_fit.y_prior[k][j] = temp_model.weight[k]*temp_model.gyro_bias[k][j];
+		}
+	}
+	temp_fit_seeded = 1;
+	return;
+}
+
+/*******************************************************************************
+* void learn_temp_model(float dt)
+*
+* Called by update_gyro_bias for every still sample when temp_model_online is
+* set, with the gyro already compensated. Undoing the compensation gives what
+* the gyro reads at temp_now relative to the calibrated offsets, which goes
+* into the same least squares fit rc_fit_imu_temp_model does, so the model
+* comes out as a recorded sweep would give. Readings near temp_now are
+* forgotten with gyro_bias_time_constant so the model follows slow changes
+* while what was learned at other temperatures is kept. Costs the same small
+* solve every sample.
+*******************************************************************************/
+void learn_temp_model(float dt){
+	double y[3];
+	int i;
+	if(!temp_fit_seeded) seed_temp_fit();
+	for(i=0;i<3;i++){
+		y[i] = data_ptr->gyro[i]/temp_gyro_scale[i] + temp_gyro_bias[i];
+	}
+	forget_temp_readings(&temp_fit, temp_k, temp_u, dt/config.gyro_bias_time_constant);
+	add_temp_reading(&temp_fit, temp_k, temp_u, y);
+	if(solve_temp_fit(&temp_fit, &temp_model)) return;
+	fill_temp_model();
+	eval_temp_model(temp_now);
+	return;
+}
+
+/*******************************************************************************
+* int rc_fit_imu_temp_model(rc_imu_temp_model_t* model, const float* temp,
+*										const float (*gyro)[3], int n)
+*
+* Least squares fit of the gyro bias nodes of model to n still readings,
+* setting each node's weight to how many readings are behind it.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_fit_imu_temp_model(rc_imu_temp_model_t* model, const float* temp,\
+										const float (*gyro)[3], int n){
+	temp_fit_t fit;
+	double y[3];
+	float u;
+	int i, j, k;
+	if(model==NULL || temp==NULL || gyro==NULL || n<1){
+		fprintf(stderr,"ERROR: in rc_fit_imu_temp_model, invalid argument\n");
+		return -1;
+	}
+	if(!(model->temp_step>0.0f)){
+		fprintf(stderr,"ERROR: in rc_fit_imu_temp_model, temp_step must be positive\n");
+		return -1;
+	}
+	memset(&fit, 0, sizeof(fit));
+	for(i=0;i<n;i++){
+		k = temp_node(model, temp[i], &u);
+		for(j=0;j<3;j++) y[j] = gyro[i][j];
+		add_temp_reading(&fit, k, u, y);
+	}
+	if(solve_temp_fit(&fit, model)){
+		fprintf(stderr,"ERROR: in rc_fit_imu_temp_model, failed to solve fit\n");
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_get_imu_temp_model(rc_imu_temp_model_t* model)
+*
+* Copies out the temperature model in use, including what has been learned
+* online. Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_get_imu_temp_model(rc_imu_temp_model_t* model){
+	int locked = 0;
+	if(model==NULL){
+		fprintf(stderr,"ERROR: in rc_get_imu_temp_model, received NULL pointer\n");
+		return -1;
+	}
+	// the IMU thread learns into the model, but may also be the caller
+	if(!(thread_running_flag && pthread_equal(pthread_self(), imu_interrupt_thread))){
+		pthread_mutex_lock(&imu_config_mutex);
+		locked = 1;
+	}
+	// nothing has been loaded or set before the IMU first starts
+	if(temp_model.temp_step>0.0f) *model = temp_model;
+	else *model = rc_default_imu_temp_model();
+	if(locked) pthread_mutex_unlock(&imu_config_mutex);
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_set_imu_temp_model(const rc_imu_temp_model_t* model)
+*
+* Puts model in use from the next sample on. Returns 0 on success or -1 on
+* failure.
+*******************************************************************************/
+int rc_set_imu_temp_model(const rc_imu_temp_model_t* model){
+	int i, locked = 0;
+	if(model==NULL){
+		fprintf(stderr,"ERROR: in rc_set_imu_temp_model, received NULL pointer\n");
+		return -1;
+	}
+	if(!(model->temp_step>0.0f)){
+		fprintf(stderr,"ERROR: in rc_set_imu_temp_model, temp_step must be positive\n");
+		return -1;
+	}
+	for(i=0;i<RC_IMU_TEMP_NODES;i++){
+		if(!(model->weight[i]>=0.0f)){
+			fprintf(stderr,"ERROR: in rc_set_imu_temp_model, weights can't be negative\n");
+			return -1;
+		}
+	}
+	if(!(thread_running_flag && pthread_equal(pthread_self(), imu_interrupt_thread))){
+		pthread_mutex_lock(&imu_config_mutex);
+		locked = 1;
+	}
+	temp_model = *model;
+	temp_fit_seeded = 0;
+	fill_temp_model();
+	if(temp_valid) eval_temp_model(temp_now);
+	if(locked) pthread_mutex_unlock(&imu_config_mutex);
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_save_imu_temp_model()
+*
+* Writes the temperature model in use to the calibration store so the next
+* start begins with it. Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_save_imu_temp_model(){
+	rc_calibration_t cal;
+	if(rc_get_calibration(&cal)) return -1;
+	if(rc_get_imu_temp_model(&cal.imu_temp_model)) return -1;
+	cal.valid |= RC_CAL_IMU_TEMP;
+	if(rc_save_calibration(&cal)){
+		fprintf(stderr,"ERROR: in rc_save_imu_temp_model, failed to write calibration store\n");
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* static void reset_mag_fit()
+*
+* Puts the ellipsoid fit back to a sphere at the origin with nothing known.
+*******************************************************************************/
+static void reset_mag_fit(){
+	int i, j;
+	for(i=0;i<6;i++){
+		for(j=0;j<6;j++) mag_rls_P[i][j] = (i==j) ? MAG_CAL_P0 : 0.0;
+		mag_rls_theta[i] = (i%2==0) ? 1.0 : 0.0;
+	}
+}
+
+/*******************************************************************************
+* void reset_mag_cal()
+*
+* Starts the online magnetometer calibration over, fit, coverage and stats.
+*******************************************************************************/
+void reset_mag_cal(){
+	int i;
+	reset_mag_fit();
+	for(i=0;i<MAG_CAL_BINS;i++) mag_bin_hit[i] = 0;
+	for(i=0;i<3;i++) mag_last[i] = 0.0f;
+	mag_err_sq = 1.0f;
+	mag_last_swap = 0;
+	memset(&mag_cal_stats, 0, sizeof(mag_cal_stats));
+	return;
+}
+
+/*******************************************************************************
+* int mag_fit_to_cal(float center[3], float lengths[3])
+*
+* Turns the current parameters a,b,c,d,e,f of the axis-aligned ellipsoid
+* a*x^2 + b*x + c*y^2 + d*y + e*z^2 + f*z = 1, in units of MAG_CAL_UNIT, into
+* its center and semi-axis lengths in uT, the same model as rc_fit_ellipsoid.
+* Returns 0 if it's a sensible ellipsoid or -1 if not.
+*******************************************************************************/
+int mag_fit_to_cal(float center[3], float lengths[3]){
+	double g = 1.0, q;
+	int i;
+	for(i=0;i<3;i++){
+		q = mag_rls_theta[2*i];
+		if(q<=0.0) return -1;
+		center[i] = -mag_rls_theta[2*i+1]/(2.0*q);
+		g += q*center[i]*center[i];
+	}
+	for(i=0;i<3;i++){
+		lengths[i] = sqrt(g/mag_rls_theta[2*i])*MAG_CAL_UNIT;
+		center[i] *= MAG_CAL_UNIT;
+		if(!isfinite(center[i]) || !isfinite(lengths[i])) return -1;
+		if(fabs(center[i])>MAG_CAL_MAX_CENTER) return -1;
+		if(lengths[i]<MAG_CAL_MIN_LEN || lengths[i]>MAG_CAL_MAX_LEN) return -1;
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* void update_mag_cal(float m[3])
+*
+* Called with every factory-corrected magnetometer reading when mag_cal_online
+* is enabled. Readings closer than MAG_CAL_MIN_STEP to the last one used are
+* skipped so sitting still doesn't wind up the covariance or swamp the fit
+* with one direction. Each reading used is one recursive least squares update
+* of the ellipsoid parameters with a forgetting factor, O(1) with a 6x6
+* covariance. Directions the motion doesn't excite, like pitch and roll on a
+* ground vehicle, would grow without bound under forgetting, so forgetting
+* stops once the covariance trace is back up to where it started, and the fit
+* starts over if it ever becomes non-finite anyway. Coverage is tracked in MAG_CAL_BINS directions from the center
+* and a direction stops counting once MAG_CAL_MEMORY readings have passed
+* without visiting it, the same memory as the fit. Once the fit is good and
+* covers enough directions, imu0->mag_offsets and imu0->mag_scales are replaced with it.
+*******************************************************************************/
+void update_mag_cal(float m[3]){
+	double phi[6], Pphi[6], k[6], den, err, trace, lambda;
+	float v[3], center[3], lengths[3], dist, e;
+	int i, j, ax, bin, valid, covered, swap;
+
+	dist = 0.0f;
+	for(i=0;i<3;i++) dist += (m[i]-mag_last[i])*(m[i]-mag_last[i]);
+	if(dist<MAG_CAL_MIN_STEP*MAG_CAL_MIN_STEP) return;
+	for(i=0;i<3;i++) mag_last[i] = m[i];
+	mag_cal_stats.samples++;
+
+	// how well does the current fit explain this reading
+	valid = (mag_fit_to_cal(center,lengths)==0);
+	if(valid){
+		e = 0.0f;
+		for(i=0;i<3;i++){
+			v[i] = (m[i]-center[i])/lengths[i];
+			e += v[i]*v[i];
+		}
+		e = sqrtf(e)-1.0f;
+		mag_err_sq += MAG_CAL_ERR_ALPHA*(e*e-mag_err_sq);
+	}
+	else for(i=0;i<3;i++) center[i] = imu0->mag_offsets[i];
+
+	// cube map of directions from the center, 4 bins per face
+	for(i=0;i<3;i++) v[i] = m[i]-center[i];
+	ax = 0;
+	if(fabsf(v[1])>fabsf(v[ax])) ax = 1;
+	if(fabsf(v[2])>fabsf(v[ax])) ax = 2;
+	bin = 4*(2*ax+(v[ax]<0.0f)) + 2*(v[(ax+1)%3]>=0.0f) + (v[(ax+2)%3]>=0.0f);
+	mag_bin_hit[bin] = mag_cal_stats.samples;
+
+	// recursive least squares step, phi*theta should come out to 1
+	for(i=0;i<3;i++){
+		phi[2*i+1] = m[i]/MAG_CAL_UNIT;
+		phi[2*i] = phi[2*i+1]*phi[2*i+1];
+	}
+	den = MAG_CAL_LAMBDA;
+	err = 1.0;
+	for(i=0;i<6;i++){
+		Pphi[i] = 0.0;
+		for(j=0;j<6;j++) Pphi[i] += mag_rls_P[i][j]*phi[j];
+		den += phi[i]*Pphi[i];
+		err -= phi[i]*mag_rls_theta[i];
+	}
+	for(i=0;i<6;i++){
+		k[i] = Pphi[i]/den;
+		mag_rls_theta[i] += k[i]*err;
+	}
+	// P is symmetric so P*phi is also phi'*P, update one triangle and mirror
+	trace = 0.0;
+	for(i=0;i<6;i++){
+		for(j=i;j<6;j++){
+			mag_rls_P[i][j] -= k[i]*Pphi[j];
+			mag_rls_P[j][i] = mag_rls_P[i][j];
+		}
+		trace += mag_rls_P[i][i];
+	}
+	lambda = (trace/MAG_CAL_LAMBDA>MAG_CAL_MAX_TRACE) ? 1.0 : MAG_CAL_LAMBDA;
+	for(i=0;i<6;i++){
+		for(j=0;j<6;j++) mag_rls_P[i][j] /= lambda;
+	}
+	if(!isfinite(trace) || !isfinite(mag_rls_theta[0]+mag_rls_theta[1]+\
+			mag_rls_theta[2]+mag_rls_theta[3]+mag_rls_theta[4]+mag_rls_theta[5])){
+		reset_mag_fit();
+		return;
+	}
+
+	// coverage over the forgetting window
+	covered = 0;
+	for(i=0;i<MAG_CAL_BINS;i++){
+		if(mag_bin_hit[i] && mag_cal_stats.samples-mag_bin_hit[i]<MAG_CAL_MEMORY){
+			covered++;
+		}
+	}
+	mag_cal_stats.coverage = (float)covered/MAG_CAL_BINS;
+	mag_cal_stats.fit_error = sqrtf(mag_err_sq);
+
+	// swap in the new calibration once it's trustworthy and different enough
+	// to matter, but not more often than every MAG_CAL_SWAP_INTERVAL readings
+	if(mag_fit_to_cal(center,lengths)<0) return;
+	mag_cal_stats.converged = mag_cal_stats.samples>=MAG_CAL_MIN_SAMPLES &&\
+				mag_cal_stats.coverage>=config.mag_cal_coverage &&\
+				mag_cal_stats.fit_error<MAG_CAL_MAX_ERR;
+	if(!mag_cal_stats.converged) return;
+	if(mag_cal_stats.samples-mag_last_swap<MAG_CAL_SWAP_INTERVAL) return;
+	swap = 0;
+	for(i=0;i<3;i++){
+		if(fabsf(center[i]-imu0->mag_offsets[i])>MAG_CAL_SWAP_OFFSET) swap = 1;
+		if(fabsf(MAG_CAL_RADIUS/lengths[i]-imu0->mag_scales[i]) >\
+								MAG_CAL_SWAP_SCALE*imu0->mag_scales[i]) swap = 1;
+	}
+	if(!swap) return;
+	for(i=0;i<3;i++){
+		imu0->mag_offsets[i] = center[i];
+		imu0->mag_scales[i] = MAG_CAL_RADIUS/lengths[i];
+	}
+	mag_last_swap = mag_cal_stats.samples;
+	mag_cal_stats.swaps++;
+	return;
+}
+
+/*******************************************************************************
+* int rc_get_imu_mag_calibration(rc_imu_mag_cal_t* cal)
+*
+* Reports the state of the online magnetometer calibration along with the
+* offsets and scales currently in use. Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_get_imu_mag_calibration(rc_imu_mag_cal_t* cal){
+	int i;
+	if(cal==NULL){
+		fprintf(stderr,"ERROR: in rc_get_imu_mag_calibration, received NULL pointer\n");
+		return -1;
+	}
+	*cal = mag_cal_stats;
+	for(i=0;i<3;i++){
+		cal->offsets[i] = imu0->mag_offsets[i];
+		cal->scales[i] = imu0->mag_scales[i];
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_save_imu_mag_calibration()
+*
+* Writes the offsets and scales currently in use to the calibration store
+* so the next start begins with them.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_save_imu_mag_calibration(){
+	if(mag_cal_stats.swaps==0){
+		fprintf(stderr,"ERROR: in rc_save_imu_mag_calibration, online calibration hasn't converged\n");
+		return -1;
+	}
+	return write_mag_cal_to_disk(imu0->mag_offsets, imu0->mag_scales);
+}
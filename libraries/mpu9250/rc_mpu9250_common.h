@@ -0,0 +1,232 @@
+/*******************************************************************************
+* rc_mpu9250_common.h
+*
+* all things shared between rc_mpu9250.c and the modules split out of it:
+* rc_mpu9250_queue.c, rc_mpu9250_recorder.c, rc_mpu9250_bias.c and
+* rc_mpu9250_notch.c
+*
+* State lives in the file that owns it, static unless another file needs it,
+* in which case it is declared extern here next to its owner's name.
+*******************************************************************************/
+
+#ifndef RC_MPU9250_COMMON_H
+#define RC_MPU9250_COMMON_H
+
+#include "../rc_defs.h"
+#include "../redperipherallib.h"
+#include "../preprocessor_macros.h"
+#include "rc_mpu9250_defs.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// macros
+#define ARRAY_SIZE(array) sizeof(array)/sizeof(array[0])
+#define min(a, b)	((a < b) ? a : b)
+#define DEG_TO_RAD		0.0174532925199
+#define RAD_TO_DEG		57.295779513
+#define PI				M_PI
+#define TWO_PI			(2.0 * M_PI)
+
+// there should be 28 or 35 bytes in the FIFO if the magnetometer is disabled
+// or enabled.
+#define FIFO_LEN_NO_MAG 28
+#define FIFO_LEN_MAG	35
+#define FIFO_BUF_LEN (MPU_FIFO_SIZE+FIFO_LEN_MAG)
+// accel, temp and gyro registers read together by rc_read_imu_all
+#define IMU_BURST_LEN	14
+
+// error threshold checks
+#define QUAT_ERROR_THRESH		(1L<<16) // very precise threshold
+#define QUAT_MAG_SQ_NORMALIZED	(1L<<28)
+#define QUAT_MAG_SQ_MIN			(QUAT_MAG_SQ_NORMALIZED - QUAT_ERROR_THRESH)
+#define QUAT_MAG_SQ_MAX			(QUAT_MAG_SQ_NORMALIZED + QUAT_ERROR_THRESH)
+#define GYRO_CAL_THRESH			50
+#define GYRO_OFFSET_THRESH		500
+// the gyro offset registers are in units of 1000DPS full scale
+#define GYRO_OFFSET_LSB_PER_DEGS	(32768.0f/1000.0f)
+// dynamic notch spectrum size, rc_default_imu_config bases notch_budget on it
+#define NOTCH_WINDOW		64		// samples per spectrum
+#define NOTCH_BINS			16		// frequencies looked at per axis
+#define NOTCH_STEPS			(3*NOTCH_BINS*NOTCH_WINDOW)	// work in one spectrum
+
+// Everything that belongs to one physical MPU9250: how to reach it and its
+// calibration, plus for IMU instances the thread that samples it. imu_devs[0]
+// is the IMU driven by the DMP code, the rest are rc_initialize_imu_instance's.
+typedef struct imu_dev_t{
+	int index;					// also its calibration slot
+	rc_imu_transport_t transport;
+	int bus;
+	uint8_t address;
+	int spi_slave;
+	int16_t gyro_offsets[3];	// offsets in the hardware, same units as the file
+	float mag_factory_adjust[3];
+	float mag_offsets[3];
+	float mag_scales[3];
+	// IMU instances only
+	int initialized;
+	rc_imu_config_t config;
+	rc_imu_data_t data;
+	int orient_perm[3];
+	float orient_sign[3];
+	rc_imu_subscriber_func_t func;
+	void* ctx;
+	pthread_t thread;
+	int shutdown;
+	rc_event_source_t event_src;
+	uint64_t seq;
+} imu_dev_t;
+// one sample queue slot, a seqlock, see rc_mpu9250_queue.c
+typedef struct imu_queue_slot_t{
+	uint32_t ver;	// odd while the writer is updating the slot
+	rc_imu_sample_t s;
+} imu_queue_slot_t;
+// indices into the subscriber table in calling order, see rebuild_sub_list
+typedef struct imu_sub_list_t{
+	int n;
+	int idx[RC_IMU_MAX_SUBSCRIBERS];
+} imu_sub_list_t;
+
+/*******************************************************************************
+*	shared state, see the file named above each group for what it means
+*******************************************************************************/
+// rc_mpu9250.c
+extern rc_imu_config_t config;
+extern int dmp_en;
+extern int packet_len;
+extern pthread_t imu_interrupt_thread;
+extern int thread_running_flag;
+extern int interrupt_func_set;
+extern int last_read_successful;
+extern uint64_t last_interrupt_timestamp_nanos;
+extern rc_imu_data_t* data_ptr;
+extern int shutdown_interrupt_thread;
+extern unsigned char fifo_buf[FIFO_BUF_LEN];
+extern int fifo_fill;
+extern int fifo_spec_len;
+extern rc_imu_fifo_stats_t fifo_stats;
+extern int orient_perm[3];
+extern float orient_sign[3];
+extern int fusion_reset;
+extern pthread_mutex_t imu_config_mutex;
+extern imu_dev_t imu_devs[RC_MAX_IMUS];
+extern imu_dev_t* const imu0;
+// rc_mpu9250_queue.c
+extern imu_queue_slot_t imu_queue[RC_IMU_QUEUE_LEN];
+extern uint64_t queue_head;
+extern imu_sub_list_t* sub_list[2];
+// rc_mpu9250_recorder.c
+extern int recording;
+extern int replay_active;
+extern unsigned char* replay_map;
+extern size_t replay_map_len;
+// rc_mpu9250_bias.c
+extern int gyro_bias_push;
+extern rc_imu_temp_model_t temp_model;
+extern int temp_dirty;
+extern int temp_valid;
+
+/*******************************************************************************
+*	functions for internal use only
+*******************************************************************************/
+int imu_bus_init(imu_dev_t* dev, rc_imu_transport_t transport, int bus,\
+										int address, int spi_slave);
+int imu_bus_in_use(imu_dev_t* dev);
+void imu_claim_bus(imu_dev_t* dev);
+void imu_release_bus(imu_dev_t* dev);
+int imu_spi_transfer(imu_dev_t* dev, uint8_t reg, uint8_t length, uint8_t* tx,\
+																uint8_t* rx);
+int mpu_read_bytes(imu_dev_t* dev, uint8_t reg, uint8_t length, uint8_t* data);
+int mpu_read_byte(imu_dev_t* dev, uint8_t reg, uint8_t* data);
+int mpu_read_word(imu_dev_t* dev, uint8_t reg, uint16_t* data);
+int mpu_write_bytes(imu_dev_t* dev, uint8_t reg, uint8_t length, uint8_t* data);
+int mpu_write_byte(imu_dev_t* dev, uint8_t reg, uint8_t data);
+int imu_read_bytes(uint8_t reg, uint8_t length, uint8_t* data);
+int imu_read_byte(uint8_t reg, uint8_t* data);
+int imu_read_word(uint8_t reg, uint16_t* data);
+int imu_write_bytes(uint8_t reg, uint8_t length, uint8_t* data);
+int imu_write_byte(uint8_t reg, uint8_t data);
+int mag_read_bytes(imu_dev_t* dev, uint8_t reg, uint8_t length, uint8_t* data);
+int mag_write_byte(imu_dev_t* dev, uint8_t reg, uint8_t data);
+int reset_mpu9250(imu_dev_t* dev, int fast);
+int set_gyro_fsr(imu_dev_t* dev, rc_gyro_fsr_t fsr, rc_imu_data_t* data);
+int set_accel_fsr(imu_dev_t* dev, rc_accel_fsr_t, rc_imu_data_t* data);
+int set_gyro_dlpf(imu_dev_t* dev, rc_gyro_dlpf_t);
+int set_accel_dlpf(imu_dev_t* dev, rc_accel_dlpf_t);
+int initialize_magnetometer(imu_dev_t* dev);
+int power_down_magnetometer(imu_dev_t* dev);
+int set_mag_slave_read(imu_dev_t* dev);
+int mpu_set_bypass(imu_dev_t* dev, unsigned char bypass_on);
+int mpu_write_mem(unsigned short mem_addr, unsigned short length,\
+												unsigned char *data);
+int mpu_read_mem(unsigned short mem_addr, unsigned short length,\
+												unsigned char *data);
+int dmp_load_motion_driver_firmware();
+int dmp_fast_load_firmware();
+int dmp_set_orientation(unsigned short orient);
+int dmp_enable_gyro_cal(unsigned char enable);
+int dmp_enable_lp_quat(unsigned char enable);
+int dmp_enable_6x_lp_quat(unsigned char enable);
+int mpu_reset_fifo(void);
+int mpu_set_sample_rate(int rate);
+int dmp_set_fifo_rate(unsigned short rate);
+int dmp_enable_feature(unsigned short mask);
+int mpu_set_dmp_state(unsigned char enable);
+int set_int_enable(unsigned char enable);
+int dmp_set_interrupt_mode(unsigned char mode);
+int drain_fifo(int* overflow);
+void consume_fifo(int bytes);
+int read_imu_burst(imu_dev_t* dev, rc_imu_config_t* conf, rc_imu_data_t* data);
+void publish_imu_sample(int index, const rc_imu_sample_t* s, int has_mag,\
+							const int* mag_perm, const float* mag_sign);
+int copy_vote_slot(int index, rc_imu_sample_t* s, int* has_mag);
+void start_vote_slot(int index);
+void stop_vote_slot(int index);
+void* imu_instance_handler(void* ptr);
+int read_dmp_fifo();
+int deliver_dmp_fifo(int publish);
+void parse_dmp_packet(unsigned char* raw);
+void parse_mag_block(imu_dev_t* dev, unsigned char* raw, rc_imu_data_t* data);
+void push_imu_sample(uint64_t timestamp);
+void record_latency();
+void record_read_latency();
+void record_fifo_count(int bytes);
+int copy_imu_sample(uint64_t n, rc_imu_sample_t* s);
+void dispatch_imu_subscribers(int type, const rc_imu_sample_t* s);
+void notify_imu_worker(uint64_t seq);
+int start_imu_worker();
+void stop_imu_worker();
+void* imu_worker_handler(void* ptr);
+void record_fifo_read(int fill_start, int fifo_count, int ok);
+int replay_fifo_read(int* overflow);
+void* imu_rec_handler(void* ptr);
+void* imu_replay_handler(void* ptr);
+void update_gyro_bias(float dt, int use_accel);
+int push_gyro_bias();
+void reset_gyro_bias();
+void reset_temp_comp();
+void fill_temp_model();
+void eval_temp_model(float temp);
+void apply_temp_comp(rc_imu_data_t* data, int accel, int gyro);
+void update_temp_comp(uint64_t now);
+void seed_temp_fit();
+void learn_temp_model(float dt);
+void reset_dynamic_notch(rc_imu_config_t* conf, int rate);
+void apply_dynamic_notch(float gyro[3]);
+void update_mag_cal(float m[3]);
+void reset_mag_cal();
+int mag_fit_to_cal(float center[3], float lengths[3]);
+int orientation_transform(rc_imu_orientation_t orient, int perm[3], float sign[3]);
+int apply_imu_config(rc_imu_config_t conf);
+int data_fusion();
+int load_gyro_offets(imu_dev_t* dev);
+int write_gyro_offets_to_disk(int index, int16_t offsets[3]);
+int calibrate_gyro(imu_dev_t* dev);
+int load_mag_calibration(imu_dev_t* dev);
+int write_mag_cal_to_disk(float offsets[3], float scale[3]);
+void* imu_interrupt_handler(void* ptr);
+void* imu_fifo_handler(void* ptr);
+int parse_fifo_record(unsigned char* raw, rc_imu_fifo_sample_t* s);
+int check_quaternion_validity(unsigned char* raw, int i);
+
+#endif // RC_MPU9250_COMMON_H
@@ -16,6 +16,7 @@ identical but the latter has a different register map
 #define DMP_MIN_RATE 4
 #define IMU_POLL_TIMEOUT 300 // milliseconds
 #define MAX_FIFO_BUFFER	128
+#define MPU_FIFO_SIZE	1024 // FIFO bytes with BIT_FIFO_SIZE_1024 in ACCEL_CONFIG_2
 
 
 /******************************************************************
@@ -245,6 +246,14 @@ identical but the latter has a different register map
 #define SIG_COND_RST			0x01
 
 
+/*******************************************************************
+* I2C master slave bits
+*******************************************************************/
+#define I2C_SLV_READ			0x01<<7	// I2C_SLVx_ADDR, read from the slave
+#define I2C_SLV_EN				0x01<<7	// I2C_SLVx_CTRL, enable the transfer
+#define I2C_SLV4_DONE			0x01<<6	// I2C_MST_STATUS, slave 4 finished
+
+
 
 
 
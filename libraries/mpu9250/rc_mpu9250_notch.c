@@ -0,0 +1,323 @@
+/*******************************************************************************
+* rc_mpu9250_notch.c
+*
+* Notch filters that follow vibration peaks in IMU 0's gyro. A spectrum of
+* each axis is worked out a few Goertzel steps per sample and the notches are
+* retuned whenever one completes.
+*******************************************************************************/
+
+#include "rc_mpu9250_common.h"
+#include <string.h>
+#include <math.h>
+
+/*******************************************************************************
+*	Local variables
+*******************************************************************************/
+// dynamic notch filtering, see apply_dynamic_notch
+#define NOTCH_MAX_FRAC		0.45f	// of the sample rate, keeps clear of Nyquist
+#define NOTCH_PEAK_RATIO	20.0f	// power over the bank's median that is a peak
+#define NOTCH_PEAK_MIN		0.01f	// and its fraction of the strongest peak
+#define NOTCH_CAPTURE		2.0f	// bins a peak may move and keep its notch
+#define NOTCH_TRACK			0.5f	// how far a notch moves toward its peak
+#define NOTCH_HOLD			4		// spectra without a peak before dropping out
+typedef struct notch_biquad_t{
+	float b0, b1, b2, a1, a2;	// passes everything while freq is 0
+	float x1, x2, y1, y2;
+	float freq;
+	float amplitude;
+	int misses;				// spectra in a row its peak wasn't found
+} notch_biquad_t;
+static int notch_rate;		// sample rate the stage is set up for, 0 if off
+static int notch_count;
+static float notch_q;
+static int notch_budget;
+static float notch_bin_hz[NOTCH_BINS];
+static float notch_spacing;		// Hz between bins
+static float notch_coef[NOTCH_BINS];	// 2cos(w) of each bin
+static float notch_window[NOTCH_WINDOW];	// Hann
+static float notch_buf[2][3][NOTCH_WINDOW];	// one filling, one being analysed
+static float notch_sum[3], notch_sum_i[3];	// sums of x and i*x, window filling
+static float notch_trend[3][2];	// line removed from the window being analysed
+static int notch_fill;				// buffer being filled
+static int notch_fill_len;
+static int notch_busy;				// the other buffer is being analysed
+static int notch_axis, notch_bin, notch_i;	// how far the analysis has got
+static float notch_s1, notch_s2;	// Goertzel state between samples
+static float notch_power[3][NOTCH_BINS];
+static notch_biquad_t notch_filter[3][RC_IMU_MAX_NOTCHES];
+static rc_imu_notch_stats_t notch_stats;
+
+/*******************************************************************************
+* void reset_dynamic_notch(rc_imu_config_t* conf, int rate)
+*
+* Sets the dynamic notch stage up for samples arriving at rate with the
+* settings in conf, or turns it off if rate is 0 or dynamic_notch isn't set.
+* All notches start out passing everything until a peak is found.
+*******************************************************************************/
+void reset_dynamic_notch(rc_imu_config_t* conf, int rate){
+	int i, j;
+	float fmax;
+	notch_rate = 0;
+	memset(notch_filter, 0, sizeof(notch_filter));
+	for(i=0;i<3;i++){
+		for(j=0;j<RC_IMU_MAX_NOTCHES;j++) notch_filter[i][j].b0 = 1.0f;
+	}
+	memset(&notch_stats, 0, sizeof(notch_stats));
+	notch_fill = 0;
+	notch_fill_len = 0;
+	notch_busy = 0;
+	for(i=0;i<3;i++) notch_sum[i] = notch_sum_i[i] = 0.0f;
+	if(!conf->dynamic_notch || rate<=0) return;
+	fmax = conf->notch_max_hz;
+	if(fmax>NOTCH_MAX_FRAC*rate) fmax = NOTCH_MAX_FRAC*rate;
+	if(conf->notch_min_hz<=0.0f || fmax<=conf->notch_min_hz){
+		fprintf(stderr,"ERROR: in dynamic notch, no frequencies between notch_min_hz and\n");
+		fprintf(stderr,"notch_max_hz below %dhz, dynamic notch disabled\n",\
+									(int)(NOTCH_MAX_FRAC*rate));
+		return;
+	}
+	if(conf->notch_count<1 || conf->notch_count>RC_IMU_MAX_NOTCHES ||\
+					conf->notch_q<=0.0f || conf->notch_budget<1){
+		fprintf(stderr,"ERROR: in dynamic notch, notch_count must be 1 to %d and notch_q\n",\
+													RC_IMU_MAX_NOTCHES);
+		fprintf(stderr,"and notch_budget positive, dynamic notch disabled\n");
+		return;
+	}
+	notch_count = conf->notch_count;
+	notch_q = conf->notch_q;
+	notch_budget = conf->notch_budget;
+	notch_spacing = (fmax-conf->notch_min_hz)/(NOTCH_BINS-1);
+	for(i=0;i<NOTCH_BINS;i++){
+		notch_bin_hz[i] = conf->notch_min_hz + i*notch_spacing;
+		notch_coef[i] = 2.0f*cosf(TWO_PI*notch_bin_hz[i]/rate);
+	}
+	for(i=0;i<NOTCH_WINDOW;i++){
+		notch_window[i] = 0.5f - 0.5f*cosf(TWO_PI*i/NOTCH_WINDOW);
+	}
+	// a spectrum starts as a window fills and takes this many samples, the
+	// next can't start until the window after it's done fills
+	i = (NOTCH_STEPS+notch_budget-1)/notch_budget;
+	i = (i+NOTCH_WINDOW-1)/NOTCH_WINDOW*NOTCH_WINDOW;
+	notch_stats.spectrum_period = (float)i/rate;
+	notch_stats.budget = notch_budget;
+	notch_rate = rate;
+	return;
+}
+
+/*******************************************************************************
+* static void tune_notch(notch_biquad_t* f, float freq)
+*
+* Moves a notch filter to freq keeping its state so the output doesn't jump.
+*******************************************************************************/
+static void tune_notch(notch_biquad_t* f, float freq){
+	float w = TWO_PI*freq/notch_rate;
+	float alpha = sinf(w)/(2.0f*notch_q);
+	float a0 = 1.0f+alpha;
+	f->b0 = 1.0f/a0;
+	f->b1 = -2.0f*cosf(w)/a0;
+	f->b2 = f->b0;
+	f->a1 = f->b1;
+	f->a2 = (1.0f-alpha)/a0;
+	f->freq = freq;
+}
+
+/*******************************************************************************
+* static void retune_notches(int axis)
+*
+* Called when an axis' spectrum is complete. Picks the strongest peaks that
+* stand out from the bank's median, which is the noise floor as long as fewer
+* than half the bins are taken by peaks, refines their frequency between bins
+* with a parabola through the log of the power and gives each one a notch:
+* the notch already following a peak nearby if there is one, otherwise a free
+* notch or the one whose peak has been missing longest. Notches without a peak
+* for NOTCH_HOLD spectra go back to passing everything.
+*******************************************************************************/
+static void retune_notches(int axis){
+	notch_biquad_t* f = notch_filter[axis];
+	float* p = notch_power[axis];
+	float sorted[NOTCH_BINS], floor, v, d, den, lo, mid, hi;
+	float freq[RC_IMU_MAX_NOTCHES], amp[RC_IMU_MAX_NOTCHES];
+	int i, j, k, n, used[NOTCH_BINS], taken[RC_IMU_MAX_NOTCHES];
+	for(k=0;k<NOTCH_BINS;k++){
+		v = p[k];
+		for(i=k;i>0 && sorted[i-1]>v;i--) sorted[i] = sorted[i-1];
+		sorted[i] = v;
+		used[k] = 0;
+	}
+	floor = NOTCH_PEAK_RATIO*0.5f*(sorted[NOTCH_BINS/2-1]+sorted[NOTCH_BINS/2]);
+	v = NOTCH_PEAK_MIN*sorted[NOTCH_BINS-1];
+	if(floor<v) floor = v;
+	for(n=0;n<notch_count;n++){
+		j = -1;
+		for(k=0;k<NOTCH_BINS;k++){
+			if(used[k] || p[k]<=floor) continue;
+			if(k>0 && p[k-1]>p[k]) continue;
+			if(k<NOTCH_BINS-1 && p[k+1]>p[k]) continue;
+			if(j<0 || p[k]>p[j]) j = k;
+		}
+		if(j<0) break;
+		used[j] = 1;
+		d = 0.0f;
+		if(j>0 && j<NOTCH_BINS-1 && p[j-1]>0.0f && p[j+1]>0.0f){
+			lo = logf(p[j-1]);
+			mid = logf(p[j]);
+			hi = logf(p[j+1]);
+			den = lo-2.0f*mid+hi;
+			if(den<0.0f) d = 0.5f*(lo-hi)/den;
+		}
+		freq[n] = notch_bin_hz[j] + d*notch_spacing;
+		// a Hann windowed sine of amplitude A gives A*N/4
+		amp[n] = 4.0f*sqrtf(p[j])/NOTCH_WINDOW;
+	}
+	for(i=0;i<notch_count;i++) taken[i] = 0;
+	for(i=0;i<n;i++){
+		j = -1;
+		for(k=0;k<notch_count;k++){
+			if(taken[k] || f[k].freq==0.0f) continue;
+			if(fabsf(f[k].freq-freq[i])>NOTCH_CAPTURE*notch_spacing) continue;
+			if(j<0 || fabsf(f[k].freq-freq[i])<fabsf(f[j].freq-freq[i])) j = k;
+		}
+		if(j>=0){
+			tune_notch(&f[j], f[j].freq + NOTCH_TRACK*(freq[i]-f[j].freq));
+		}
+		else{
+			for(k=0;k<notch_count;k++){
+				if(taken[k]) continue;
+				if(j<0 || f[k].freq==0.0f || (f[j].freq!=0.0f && f[k].misses>f[j].misses)){
+					j = k;
+					if(f[k].freq==0.0f) break;
+				}
+			}
+			tune_notch(&f[j], freq[i]);
+		}
+		taken[j] = 1;
+		f[j].misses = 0;
+		f[j].amplitude = amp[i];
+	}
+	for(k=0;k<notch_count;k++){
+		if(!taken[k] && f[k].freq!=0.0f && ++f[k].misses>=NOTCH_HOLD){
+			f[k].b0 = 1.0f;
+			f[k].b1 = f[k].b2 = f[k].a1 = f[k].a2 = 0.0f;
+			f[k].freq = 0.0f;
+			f[k].amplitude = 0.0f;
+		}
+		notch_stats.freq[axis][k] = f[k].freq;
+		notch_stats.amplitude[axis][k] = f[k].amplitude;
+	}
+}
+
+/*******************************************************************************
+* static void run_notch_analysis(int steps)
+*
+* Carries the Goertzel bank over the window waiting for analysis forward by
+* at most steps multiply-adds, one bin of one axis at a time, picking up where
+* the last sample left off. The window's straight line fit is taken out first
+* so slow motion doesn't leak into the bins as vibration.
+*******************************************************************************/
+static void run_notch_analysis(int steps){
+	const float* x;
+	float a, b, c, s0, s1 = notch_s1, s2 = notch_s2;
+	int i = notch_i, n;
+	while(steps>0){
+		x = notch_buf[notch_fill^1][notch_axis];
+		a = notch_trend[notch_axis][0];
+		b = notch_trend[notch_axis][1];
+		c = notch_coef[notch_bin];
+		n = min(NOTCH_WINDOW-i, steps);
+		steps -= n;
+		for(;n>0;n--,i++){
+			s0 = (x[i]-a-b*i)*notch_window[i] + c*s1 - s2;
+			s2 = s1;
+			s1 = s0;
+		}
+		if(i<NOTCH_WINDOW) break;
+		notch_power[notch_axis][notch_bin] = s1*s1 + s2*s2 - c*s1*s2;
+		s1 = s2 = 0.0f;
+		i = 0;
+		if(++notch_bin<NOTCH_BINS) continue;
+		notch_bin = 0;
+		retune_notches(notch_axis);
+		if(++notch_axis<3) continue;
+		notch_axis = 0;
+		notch_busy = 0;
+		notch_stats.spectra++;
+		break;
+	}
+	notch_s1 = s1;
+	notch_s2 = s2;
+	notch_i = i;
+}
+
+/*******************************************************************************
+* void apply_dynamic_notch(float gyro[3])
+*
+* Runs one gyro sample through the notch filters in place and gives the
+* spectrum analysis its share of time. The unfiltered sample goes into the
+* window being filled; when that's full it's handed to the analysis if the
+* previous one is done, otherwise it's dropped and filling starts over.
+*******************************************************************************/
+void apply_dynamic_notch(float gyro[3]){
+	notch_biquad_t* f;
+	uint64_t t, cost;
+	float x, y;
+	int i, j;
+	if(notch_rate==0) return;
+	t = rc_nanos_since_boot();
+	for(i=0;i<3;i++){
+		x = gyro[i];
+		notch_buf[notch_fill][i][notch_fill_len] = x;
+		notch_sum[i] += x;
+		notch_sum_i[i] += notch_fill_len*x;
+		for(j=0;j<notch_count;j++){
+			f = &notch_filter[i][j];
+			y = f->b0*x + f->b1*f->x1 + f->b2*f->x2 - f->a1*f->y1 - f->a2*f->y2;
+			f->x2 = f->x1;
+			f->x1 = x;
+			f->y2 = f->y1;
+			f->y1 = y;
+			x = y;
+		}
+		gyro[i] = x;
+	}
+	if(++notch_fill_len==NOTCH_WINDOW){
+		if(notch_busy) notch_stats.skipped_windows++;
+		else{
+			// least squares line through the window, i from 0 to N-1
+			for(i=0;i<3;i++){
+				x = notch_sum[i]/NOTCH_WINDOW;
+				y = 12.0f*(notch_sum_i[i]-0.5f*(NOTCH_WINDOW-1)*notch_sum[i])/\
+						(NOTCH_WINDOW*((float)NOTCH_WINDOW*NOTCH_WINDOW-1.0f));
+				notch_trend[i][0] = x - 0.5f*(NOTCH_WINDOW-1)*y;
+				notch_trend[i][1] = y;
+			}
+			notch_fill ^= 1;
+			notch_busy = 1;
+			notch_axis = notch_bin = notch_i = 0;
+			notch_s1 = notch_s2 = 0.0f;
+		}
+		notch_fill_len = 0;
+		for(i=0;i<3;i++) notch_sum[i] = notch_sum_i[i] = 0.0f;
+	}
+	if(notch_busy) run_notch_analysis(notch_budget);
+	cost = rc_nanos_since_boot()-t;
+	notch_stats.samples++;
+	notch_stats.cost_last_ns = cost;
+	notch_stats.cost_total_ns += cost;
+	if(cost>notch_stats.cost_max_ns) notch_stats.cost_max_ns = cost;
+	return;
+}
+
+/*******************************************************************************
+* int rc_get_imu_notch_stats(rc_imu_notch_stats_t* stats)
+*
+* Reports where the dynamic notches are and what they cost.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_get_imu_notch_stats(rc_imu_notch_stats_t* stats){
+	if(stats==NULL){
+		fprintf(stderr,"ERROR: in rc_get_imu_notch_stats, received NULL pointer\n");
+		return -1;
+	}
+	*stats = notch_stats;
+	return 0;
+}
@@ -0,0 +1,478 @@
+/*******************************************************************************
+* rc_mpu9250_queue.c
+*
+* The timestamped sample queue that IMU 0's interrupt thread publishes into,
+* the readers that copy samples back out of it and the subscribers called with
+* every sample, either inline from the interrupt thread or from the worker
+* thread.
+*******************************************************************************/
+
+#include "rc_mpu9250_common.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+
+/*******************************************************************************
+*	Local variables
+*******************************************************************************/
+// timestamped sample queue, each slot is its own seqlock so readers can detect
+// a sample being overwritten while they copy it. Only the interrupt thread
+// writes, queue_head counts samples published since the program started.
+imu_queue_slot_t imu_queue[RC_IMU_QUEUE_LEN];
+uint64_t queue_head;
+// subscribers, see rc_add_imu_subscriber. Each dispatch type has two order
+// lists, one live and one spare, so a list is never rebuilt while a thread
+// walks it. sub_busy is odd while a thread is dispatching from that type.
+// sub_waiters counts threads blocked on sub_cond for a pass to finish so the
+// dispatching thread only takes sub_mutex to wake them when there are any.
+typedef struct imu_subscriber_t{
+	rc_imu_subscriber_func_t func;
+	void* ctx;
+	int decimation;
+	int priority;
+	rc_imu_dispatch_t dispatch;
+	int active;
+	uint64_t order;			// tie breaker, earlier subscribers first
+	int retiring;			// being removed, slot not free yet
+	uint32_t retired_at;	// odd sub_busy of the pass still using the slot
+	rc_imu_subscriber_stats_t stats;
+} imu_subscriber_t;
+static imu_subscriber_t imu_subs[RC_IMU_MAX_SUBSCRIBERS];
+static imu_sub_list_t sub_lists[2][2];
+imu_sub_list_t* sub_list[2] = {&sub_lists[0][0], &sub_lists[1][0]};
+static uint32_t sub_busy[2];
+static uint32_t sub_waiters[2];
+static uint64_t sub_order;
+static pthread_mutex_t sub_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sub_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t imu_worker_thread;
+static int worker_running;
+static int shutdown_worker_thread;
+static int worker_efd = -1;
+static rc_event_source_t worker_src;
+
+/*******************************************************************************
+* void push_imu_sample(uint64_t timestamp)
+*
+* Copies the data struct into the next queue slot and publishes it. Only ever
+* called from the interrupt thread. The slot version goes odd before the copy
+* and even again after so readers can tell if they raced with this.
+*******************************************************************************/
+void push_imu_sample(uint64_t timestamp){
+	uint64_t n = queue_head;
+	imu_queue_slot_t* slot = &imu_queue[n&(RC_IMU_QUEUE_LEN-1)];
+	uint32_t ver = slot->ver;
+	__atomic_store_n(&slot->ver, ver+1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot->s.timestamp_ns = timestamp;
+	slot->s.seq = n;
+	slot->s.data = *data_ptr;
+	__atomic_store_n(&slot->ver, ver+2, __ATOMIC_RELEASE);
+	__atomic_store_n(&queue_head, n+1, __ATOMIC_RELEASE);
+	publish_imu_sample(0, &slot->s, config.enable_magnetometer,\
+											orient_perm, orient_sign);
+	return;
+}
+
+/*******************************************************************************
+* int copy_imu_sample(uint64_t n, rc_imu_sample_t* s)
+*
+* Copies sample number n out of the queue. Returns 0 on success or -1 if the
+* slot was being written or already holds a newer sample.
+*******************************************************************************/
+int copy_imu_sample(uint64_t n, rc_imu_sample_t* s){
+	imu_queue_slot_t* slot = &imu_queue[n&(RC_IMU_QUEUE_LEN-1)];
+	uint32_t ver = __atomic_load_n(&slot->ver, __ATOMIC_ACQUIRE);
+	if(ver&1) return -1;
+	*s = slot->s;
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if(__atomic_load_n(&slot->ver, __ATOMIC_RELAXED)!=ver) return -1;
+	if(s->seq!=n) return -1;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_initialize_imu_reader(rc_imu_reader_t* r)
+*
+* Points a reader at the end of the sample queue so the first call to
+* rc_read_imu_sample returns the next sample to arrive. Each consumer thread
+* should have its own reader. Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_initialize_imu_reader(rc_imu_reader_t* r){
+	if(r==NULL){
+		fprintf(stderr,"ERROR: in rc_initialize_imu_reader, received NULL pointer\n");
+		return -1;
+	}
+	r->next = __atomic_load_n(&queue_head, __ATOMIC_ACQUIRE);
+	r->missed = 0;
+	r->initialized = 1;
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_read_imu_sample(rc_imu_reader_t* r, rc_imu_sample_t* s)
+*
+* Copies the oldest sample this reader hasn't seen yet into s. If the reader
+* fell more than RC_IMU_QUEUE_LEN samples behind, the overwritten samples are
+* skipped and added to r->missed. Never blocks.
+* Returns 1 if a sample was copied, 0 if there was nothing new, -1 on error.
+*******************************************************************************/
+int rc_read_imu_sample(rc_imu_reader_t* r, rc_imu_sample_t* s){
+	uint64_t head;
+	if(r==NULL || s==NULL){
+		fprintf(stderr,"ERROR: in rc_read_imu_sample, received NULL pointer\n");
+		return -1;
+	}
+	if(!r->initialized){
+		fprintf(stderr,"ERROR: in rc_read_imu_sample, reader not initialized\n");
+		return -1;
+	}
+	while(1){
+		head = __atomic_load_n(&queue_head, __ATOMIC_ACQUIRE);
+		if(r->next>=head) return 0;
+		// skip over anything that has already been overwritten
+		if(head-r->next > RC_IMU_QUEUE_LEN){
+			r->missed += head - RC_IMU_QUEUE_LEN - r->next;
+			r->next = head - RC_IMU_QUEUE_LEN;
+		}
+		if(copy_imu_sample(r->next,s)==0){
+			r->next++;
+			return 1;
+		}
+		// the writer lapped us during the copy, that sample is gone
+		r->missed++;
+		r->next++;
+	}
+}
+
+/*******************************************************************************
+* int rc_read_latest_imu_sample(rc_imu_sample_t* s)
+*
+* Copies the newest sample in the queue into s without disturbing any reader.
+* Retries if the copy raced with the interrupt thread so the result is never
+* torn. Returns 0 on success or -1 if no samples have arrived yet.
+*******************************************************************************/
+int rc_read_latest_imu_sample(rc_imu_sample_t* s){
+	uint64_t head;
+	if(s==NULL){
+		fprintf(stderr,"ERROR: in rc_read_latest_imu_sample, received NULL pointer\n");
+		return -1;
+	}
+	while(1){
+		head = __atomic_load_n(&queue_head, __ATOMIC_ACQUIRE);
+		if(head==0) return -1;
+		if(copy_imu_sample(head-1,s)==0) return 0;
+	}
+}
+
+/*******************************************************************************
+* void rebuild_sub_list(int type)
+*
+* Sorts the active subscribers of one dispatch type by priority into the spare
+* list and swaps it in. Called with sub_mutex held.
+*******************************************************************************/
+static void rebuild_sub_list(int type){
+	imu_sub_list_t* l;
+	imu_subscriber_t *a, *b;
+	int i, j, tmp;
+	l = (sub_list[type]==&sub_lists[type][0]) ? &sub_lists[type][1] : &sub_lists[type][0];
+	l->n = 0;
+	for(i=0;i<RC_IMU_MAX_SUBSCRIBERS;i++){
+		if(imu_subs[i].active && (int)imu_subs[i].dispatch==type) l->idx[l->n++] = i;
+	}
+	// insertion sort, highest priority first then oldest first
+	for(i=1;i<l->n;i++){
+		for(j=i;j>0;j--){
+			a = &imu_subs[l->idx[j-1]];
+			b = &imu_subs[l->idx[j]];
+			if(a->priority>b->priority) break;
+			if(a->priority==b->priority && a->order<b->order) break;
+			tmp = l->idx[j];
+			l->idx[j] = l->idx[j-1];
+			l->idx[j-1] = tmp;
+		}
+	}
+	__atomic_store_n(&sub_list[type], l, __ATOMIC_RELEASE);
+	return;
+}
+
+/*******************************************************************************
+* uint32_t wait_for_dispatch(int type)
+*
+* Waits for any dispatch pass of this type already in progress in another
+* thread to finish, so that pass can't be using the spare order list or a
+* subscriber that was just removed. This blocks on sub_cond rather than
+* spinning since the dispatching thread may have a lower priority than the
+* caller, and sub_mutex is released while waiting so a subscriber adding or
+* removing subscribers can't deadlock against us. The dispatching thread
+* itself doesn't wait since subscribers may change subscriptions, in that
+* case the current odd sub_busy value is returned so the caller knows the
+* pass is still running. Otherwise returns 0.
+* Called with sub_mutex held.
+*******************************************************************************/
+static uint32_t wait_for_dispatch(int type){
+	pthread_t t = (type==IMU_DISPATCH_INLINE) ? imu_interrupt_thread : imu_worker_thread;
+	uint32_t b = __atomic_load_n(&sub_busy[type], __ATOMIC_ACQUIRE);
+	if(!(b&1)) return 0;
+	if(pthread_equal(pthread_self(), t)) return b;
+	__atomic_add_fetch(&sub_waiters[type], 1, __ATOMIC_SEQ_CST);
+	while(__atomic_load_n(&sub_busy[type], __ATOMIC_SEQ_CST)==b){
+		pthread_cond_wait(&sub_cond, &sub_mutex);
+	}
+	__atomic_sub_fetch(&sub_waiters[type], 1, __ATOMIC_SEQ_CST);
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_add_imu_subscriber(rc_imu_subscriber_func_t func, void* ctx,
+*					int decimation, int priority, rc_imu_dispatch_t dispatch)
+*
+* Subscribes func to every decimation'th DMP sample. Subscribers of the same
+* dispatch type are called highest priority first. IMU_DISPATCH_WORKER starts
+* the worker thread if it isn't running yet. ctx is passed back untouched.
+* Returns a subscriber id or -1 on failure.
+*******************************************************************************/
+int rc_add_imu_subscriber(rc_imu_subscriber_func_t func, void* ctx,\
+				int decimation, int priority, rc_imu_dispatch_t dispatch){
+	int i, id = -1;
+	imu_subscriber_t* sub;
+	if(func==NULL){
+		fprintf(stderr,"ERROR: in rc_add_imu_subscriber, received NULL pointer\n");
+		return -1;
+	}
+	if(decimation<1){
+		fprintf(stderr,"ERROR: in rc_add_imu_subscriber, decimation must be >=1\n");
+		return -1;
+	}
+	if(dispatch!=IMU_DISPATCH_INLINE && dispatch!=IMU_DISPATCH_WORKER){
+		fprintf(stderr,"ERROR: in rc_add_imu_subscriber, invalid dispatch type\n");
+		return -1;
+	}
+	pthread_mutex_lock(&sub_mutex);
+	wait_for_dispatch(dispatch);
+	// a removed slot can be reused once the dispatch pass that might still
+	// be calling it has finished
+	for(i=0;i<RC_IMU_MAX_SUBSCRIBERS;i++){
+		sub = &imu_subs[i];
+		if(sub->active || sub->retiring) continue;
+		if(sub->retired_at && sub->retired_at==\
+				__atomic_load_n(&sub_busy[sub->dispatch], __ATOMIC_ACQUIRE)) continue;
+		id = i;
+		break;
+	}
+	if(id<0){
+		pthread_mutex_unlock(&sub_mutex);
+		fprintf(stderr,"ERROR: in rc_add_imu_subscriber, already %d subscribers\n",\
+													RC_IMU_MAX_SUBSCRIBERS);
+		return -1;
+	}
+	sub = &imu_subs[id];
+	sub->func = func;
+	sub->ctx = ctx;
+	sub->decimation = decimation;
+	sub->priority = priority;
+	sub->dispatch = dispatch;
+	sub->order = sub_order++;
+	sub->retired_at = 0;
+	memset(&sub->stats, 0, sizeof(sub->stats));
+	sub->active = 1;
+	rebuild_sub_list(dispatch);
+	pthread_mutex_unlock(&sub_mutex);
+	if(dispatch==IMU_DISPATCH_WORKER && start_imu_worker()){
+		rc_remove_imu_subscriber(id);
+		return -1;
+	}
+	return id;
+}
+
+/*******************************************************************************
+* int rc_remove_imu_subscriber(int id)
+*
+* Stops calling a subscriber. Once this returns the subscriber won't be called
+* again, unless this was called from inside a subscriber of the same dispatch
+* type in which case the current pass finishes first.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_remove_imu_subscriber(int id){
+	imu_subscriber_t* sub;
+	if(id<0 || id>=RC_IMU_MAX_SUBSCRIBERS){
+		fprintf(stderr,"ERROR: in rc_remove_imu_subscriber, invalid id\n");
+		return -1;
+	}
+	pthread_mutex_lock(&sub_mutex);
+	sub = &imu_subs[id];
+	if(!sub->active){
+		pthread_mutex_unlock(&sub_mutex);
+		fprintf(stderr,"ERROR: in rc_remove_imu_subscriber, subscriber %d not active\n", id);
+		return -1;
+	}
+	sub->active = 0;
+	sub->retiring = 1;
+	wait_for_dispatch(sub->dispatch);
+	rebuild_sub_list(sub->dispatch);
+	sub->retired_at = wait_for_dispatch(sub->dispatch);
+	sub->retiring = 0;
+	pthread_mutex_unlock(&sub_mutex);
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_get_imu_subscriber_stats(int id, rc_imu_subscriber_stats_t* stats)
+*
+* Copies the call counters and timing of one subscriber. They are only written
+* by the dispatching thread so a torn read is possible but harmless.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_get_imu_subscriber_stats(int id, rc_imu_subscriber_stats_t* stats){
+	if(id<0 || id>=RC_IMU_MAX_SUBSCRIBERS || stats==NULL){
+		fprintf(stderr,"ERROR: in rc_get_imu_subscriber_stats, invalid arguments\n");
+		return -1;
+	}
+	*stats = imu_subs[id].stats;
+	return 0;
+}
+
+/*******************************************************************************
+* void dispatch_imu_subscribers(int type, const rc_imu_sample_t* s)
+*
+* Calls every subscriber of one dispatch type that is due for this sample, in
+* priority order, timing each call. Wakes anyone in wait_for_dispatch once the
+* pass is over.
+*******************************************************************************/
+void dispatch_imu_subscribers(int type, const rc_imu_sample_t* s){
+	imu_sub_list_t* l;
+	imu_subscriber_t* sub;
+	uint64_t t1, t2;
+	int i;
+	__atomic_add_fetch(&sub_busy[type], 1, __ATOMIC_ACQ_REL);
+	l = __atomic_load_n(&sub_list[type], __ATOMIC_ACQUIRE);
+	for(i=0;i<l->n;i++){
+		sub = &imu_subs[l->idx[i]];
+		if(s->seq % sub->decimation) continue;
+		t1 = rc_nanos_since_boot();
+		sub->func(s, sub->ctx);
+		t2 = rc_nanos_since_boot()-t1;
+		sub->stats.calls++;
+		sub->stats.last_ns = t2;
+		if(t2>sub->stats.max_ns) sub->stats.max_ns = t2;
+	}
+	__atomic_add_fetch(&sub_busy[type], 1, __ATOMIC_SEQ_CST);
+	// a waiter counts itself before checking sub_busy with sub_mutex held, so
+	// either it sees the pass is over or we see it and signal under the lock
+	if(__atomic_load_n(&sub_waiters[type], __ATOMIC_SEQ_CST)){
+		pthread_mutex_lock(&sub_mutex);
+		pthread_cond_broadcast(&sub_cond);
+		pthread_mutex_unlock(&sub_mutex);
+	}
+	return;
+}
+
+/*******************************************************************************
+* void notify_imu_worker(uint64_t seq)
+*
+* Called from the interrupt thread after each sample. Wakes the worker only if
+* one of its subscribers is due so idle samples cost no system call.
+*******************************************************************************/
+void notify_imu_worker(uint64_t seq){
+	imu_sub_list_t* l;
+	int i;
+	if(!worker_running) return;
+	l = __atomic_load_n(&sub_list[IMU_DISPATCH_WORKER], __ATOMIC_ACQUIRE);
+	for(i=0;i<l->n;i++){
+		if(seq % imu_subs[l->idx[i]].decimation==0){
+			eventfd_write(worker_efd, 1);
+			return;
+		}
+	}
+	return;
+}
+
+/*******************************************************************************
+* int start_imu_worker()
+*
+* Starts the worker thread for IMU_DISPATCH_WORKER subscribers at normal
+* priority if it isn't already running. Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int start_imu_worker(){
+	pthread_mutex_lock(&sub_mutex);
+	if(worker_running){
+		pthread_mutex_unlock(&sub_mutex);
+		return 0;
+	}
+	worker_efd = eventfd(0, 0);
+	if(worker_efd<0 || rc_event_source_open_fd(&worker_src, worker_efd,\
+													EVENT_SOURCE_EVENTFD)){
+		fprintf(stderr,"ERROR: failed to create imu worker eventfd\n");
+		if(worker_efd>=0) close(worker_efd);
+		worker_efd = -1;
+		pthread_mutex_unlock(&sub_mutex);
+		return -1;
+	}
+	shutdown_worker_thread = 0;
+	if(pthread_create(&imu_worker_thread, NULL, imu_worker_handler, NULL)){
+		fprintf(stderr,"ERROR: failed to start imu worker thread\n");
+		rc_event_source_close(&worker_src);
+		close(worker_efd);
+		worker_efd = -1;
+		pthread_mutex_unlock(&sub_mutex);
+		return -1;
+	}
+	worker_running = 1;
+	pthread_mutex_unlock(&sub_mutex);
+	return 0;
+}
+
+/*******************************************************************************
+* void stop_imu_worker()
+*
+* Stops the worker thread if it's running. Subscribers stay registered and
+* the worker starts again with the next rc_initialize_imu_dmp.
+*******************************************************************************/
+void stop_imu_worker(){
+	if(!worker_running) return;
+	shutdown_worker_thread = 1;
+	eventfd_write(worker_efd, 1);
+	pthread_join(imu_worker_thread, NULL);
+	worker_running = 0;
+	rc_event_source_close(&worker_src);
+	close(worker_efd);
+	worker_efd = -1;
+	return;
+}
+
+/*******************************************************************************
+* void* imu_worker_handler(void* ptr)
+*
+* Worker thread for IMU_DISPATCH_WORKER subscribers. Reads the sample queue
+* with its own reader so it can fall behind without holding anything up, and
+* charges samples lost to queue overwrites to the subscribers that were due.
+*******************************************************************************/
+void* imu_worker_handler(__unused void* ptr){
+	rc_imu_reader_t reader;
+	rc_imu_sample_t s;
+	imu_sub_list_t* l;
+	imu_subscriber_t* sub;
+	uint64_t ts, expected, d;
+	int i;
+	rc_initialize_imu_reader(&reader);
+	expected = reader.next;
+	while(rc_get_state()!=EXITING && !shutdown_worker_thread){
+		if(rc_event_source_wait(&worker_src, IMU_POLL_TIMEOUT, &ts)<=0) continue;
+		while(!shutdown_worker_thread && rc_read_imu_sample(&reader, &s)==1){
+			if(s.seq!=expected){
+				// multiples of each decimation in [expected, s.seq)
+				l = __atomic_load_n(&sub_list[IMU_DISPATCH_WORKER], __ATOMIC_ACQUIRE);
+				for(i=0;i<l->n;i++){
+					sub = &imu_subs[l->idx[i]];
+					d = sub->decimation;
+					sub->stats.missed += (s.seq+d-1)/d - (expected+d-1)/d;
+				}
+			}
+			expected = s.seq+1;
+			dispatch_imu_subscribers(IMU_DISPATCH_WORKER, &s);
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,455 @@
+/*******************************************************************************
+* rc_mpu9250_recorder.c
+*
+* Recording of IMU 0's raw FIFO stream to a file and replaying such a file
+* through the normal DMP parsing, data fusion, sample queue and subscribers
+* without a cape.
+*******************************************************************************/
+
+#include "rc_mpu9250_common.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+/*******************************************************************************
+*	Local variables
+*******************************************************************************/
+// FIFO stream recording, see rc_start_imu_recording. The interrupt thread
+// appends each read to rec_ring and a normal priority thread writes it out.
+#define REC_MAGIC		"RCIMUREC"
+#define REC_VERSION		1
+#define REC_RING_LEN	(1<<18)	// must be a power of 2
+#define REC_READ_ERROR	0xFFFF	// record len for a FIFO read that failed
+typedef struct imu_rec_file_header_t{
+	char magic[8];
+	uint32_t version;
+	uint32_t header_len;
+	int32_t packet_len;
+	int32_t dmp_sample_rate;
+	int32_t enable_magnetometer;
+	int32_t orientation;
+	float compass_time_constant;
+	float accel_to_ms2;
+	float gyro_to_degs;
+	float mag_factory_adjust[3];
+	float mag_offsets[3];
+	float mag_scales[3];
+	uint64_t start_ns;
+} imu_rec_file_header_t;
+typedef struct imu_rec_header_t{
+	uint64_t timestamp_ns;	// interrupt time of the read
+	uint16_t fifo_count;	// FIFO count register when it was read
+	uint16_t len;			// bytes that follow, or REC_READ_ERROR
+} __attribute__((packed)) imu_rec_header_t;
+int recording;
+static FILE* rec_file;
+static unsigned char rec_ring[REC_RING_LEN];
+static uint64_t rec_head, rec_tail;	// bytes written to and taken from rec_ring
+static uint64_t rec_records, rec_dropped;
+static int shutdown_rec_thread;
+static pthread_t imu_rec_thread;
+// replay, see rc_initialize_imu_replay
+int replay_active;
+unsigned char* replay_map;
+size_t replay_map_len;
+static const unsigned char* replay_cur;	// record drain_fifo should return next
+static rc_imu_replay_speed_t replay_speed;
+static uint64_t replay_records;
+static int replay_error;	// replay stopped at a corrupt or truncated record
+
+/*******************************************************************************
+* void record_fifo_read(int fill_start, int fifo_count, int ok)
+*
+* Called from drain_fifo while recording. Appends one record holding the
+* interrupt timestamp, the FIFO count and the bytes that were just added to
+* fifo_buf to the recording ring. This is the interrupt thread so nothing here
+* blocks, if the writer thread has fallen too far behind the record is dropped
+* and counted instead.
+*******************************************************************************/
+void record_fifo_read(int fill_start, int fifo_count, int ok){
+	imu_rec_header_t h;
+	uint64_t head, tail, pos;
+	int len, first;
+
+	len = ok ? fifo_fill-fill_start : 0;
+	head = rec_head;
+	tail = __atomic_load_n(&rec_tail, __ATOMIC_ACQUIRE);
+	if(REC_RING_LEN-(head-tail) < sizeof(h)+len){
+		rec_dropped++;
+		return;
+	}
+	h.timestamp_ns = last_interrupt_timestamp_nanos;
+	h.fifo_count = fifo_count;
+	h.len = ok ? len : REC_READ_ERROR;
+	// copy the header then the data, either may wrap around the ring
+	pos = head&(REC_RING_LEN-1);
+	first = min(sizeof(h), REC_RING_LEN-pos);
+	memcpy(&rec_ring[pos], &h, first);
+	memcpy(rec_ring, (unsigned char*)&h+first, sizeof(h)-first);
+	pos = (head+sizeof(h))&(REC_RING_LEN-1);
+	first = min(len, REC_RING_LEN-(int)pos);
+	memcpy(&rec_ring[pos], &fifo_buf[fill_start], first);
+	memcpy(rec_ring, &fifo_buf[fill_start+first], len-first);
+	rec_records++;
+	__atomic_store_n(&rec_head, head+sizeof(h)+len, __ATOMIC_RELEASE);
+	return;
+}
+
+/*******************************************************************************
+* void* imu_rec_handler(void* ptr)
+*
+* Normal priority thread that moves recorded FIFO reads from the ring to the
+* file every few milliseconds, keeping disk writes out of the interrupt thread.
+*******************************************************************************/
+void* imu_rec_handler(__unused void* ptr){
+	uint64_t head, tail;
+	int pos, n, done = 0;
+	while(!done){
+		done = shutdown_rec_thread;
+		head = __atomic_load_n(&rec_head, __ATOMIC_ACQUIRE);
+		tail = rec_tail;
+		while(tail!=head){
+			pos = tail&(REC_RING_LEN-1);
+			n = min(head-tail, (uint64_t)(REC_RING_LEN-pos));
+			if(fwrite(&rec_ring[pos], 1, n, rec_file)!=(size_t)n){
+				fprintf(stderr,"ERROR: in imu_rec_handler, failed to write recording\n");
+				done = 1;
+				break;
+			}
+			tail += n;
+			__atomic_store_n(&rec_tail, tail, __ATOMIC_RELEASE);
+		}
+		if(!done) rc_usleep(20000);
+	}
+	return NULL;
+}
+
+/*******************************************************************************
+* int rc_start_imu_recording(const char* path)
+*
+* Starts logging every DMP FIFO read to a binary file along with everything
+* replay needs to reproduce the same output. Must be called after
+* rc_initialize_imu_dmp. Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_start_imu_recording(const char* path){
+	imu_rec_file_header_t h;
+	if(path==NULL){
+		fprintf(stderr,"ERROR: in rc_start_imu_recording, received NULL pointer\n");
+		return -1;
+	}
+	if(!dmp_en || !thread_running_flag || replay_active){
+		fprintf(stderr,"ERROR: in rc_start_imu_recording, IMU must be running in DMP mode\n");
+		return -1;
+	}
+	if(recording){
+		fprintf(stderr,"ERROR: in rc_start_imu_recording, already recording\n");
+		return -1;
+	}
+	rec_file = fopen(path, "wb");
+	if(rec_file==NULL){
+		fprintf(stderr,"ERROR: in rc_start_imu_recording, can't open %s: %s\n",\
+													path, strerror(errno));
+		return -1;
+	}
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, REC_MAGIC, sizeof(h.magic));
+	h.version = REC_VERSION;
+	h.header_len = sizeof(h);
+	h.packet_len = packet_len;
+	h.dmp_sample_rate = config.dmp_sample_rate;
+	h.enable_magnetometer = config.enable_magnetometer;
+	h.orientation = config.orientation;
+	h.compass_time_constant = config.compass_time_constant;
+	h.accel_to_ms2 = data_ptr->accel_to_ms2;
+	h.gyro_to_degs = data_ptr->gyro_to_degs;
+	memcpy(h.mag_factory_adjust, imu0->mag_factory_adjust, sizeof(h.mag_factory_adjust));
+	memcpy(h.mag_offsets, imu0->mag_offsets, sizeof(h.mag_offsets));
+	memcpy(h.mag_scales, imu0->mag_scales, sizeof(h.mag_scales));
+	h.start_ns = rc_nanos_since_epoch();
+	if(fwrite(&h, sizeof(h), 1, rec_file)!=1){
+		fprintf(stderr,"ERROR: in rc_start_imu_recording, failed to write header\n");
+		fclose(rec_file);
+		return -1;
+	}
+	rec_head = 0;
+	rec_tail = 0;
+	rec_records = 0;
+	rec_dropped = 0;
+	shutdown_rec_thread = 0;
+	if(pthread_create(&imu_rec_thread, NULL, imu_rec_handler, NULL)){
+		fprintf(stderr,"ERROR: in rc_start_imu_recording, failed to start thread\n");
+		fclose(rec_file);
+		return -1;
+	}
+	__atomic_store_n(&recording, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_stop_imu_recording()
+*
+* Stops recording, writes out anything still buffered and closes the file.
+* FIFO reads happen with imu_config_mutex held, so taking it waits for one
+* in progress to add its record. From the IMU thread itself no read is in
+* progress. Returns the number of FIFO reads recorded or -1 on failure.
+*******************************************************************************/
+int rc_stop_imu_recording(){
+	int ret = 0;
+	if(!recording) return 0;
+	if(thread_running_flag && pthread_equal(pthread_self(), imu_interrupt_thread)){
+		__atomic_store_n(&recording, 0, __ATOMIC_RELEASE);
+	}
+	else{
+		pthread_mutex_lock(&imu_config_mutex);
+		__atomic_store_n(&recording, 0, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&imu_config_mutex);
+	}
+	shutdown_rec_thread = 1;
+	pthread_join(imu_rec_thread, NULL);
+	if(rec_tail!=rec_head) ret = -1;
+	if(fclose(rec_file)) ret = -1;
+	rec_file = NULL;
+	if(ret<0){
+		fprintf(stderr,"ERROR: in rc_stop_imu_recording, recording incomplete\n");
+		return -1;
+	}
+	if(rec_dropped){
+		fprintf(stderr,"WARNING: %llu FIFO reads were dropped from the recording,\n",\
+										(unsigned long long)rec_dropped);
+		fprintf(stderr,"replay won't match the original run\n");
+	}
+	return rec_records;
+}
+
+/*******************************************************************************
+* int replay_fifo_read(int* overflow)
+*
+* drain_fifo while replaying. Copies the bytes of the current record onto the
+* end of fifo_buf exactly as the original read did and keeps the same stats.
+* imu_replay_handler has already checked the record's length against the file
+* and FIFO_BUF_LEN. Returns the number of bytes or -1 if the original read
+* failed.
+*******************************************************************************/
+int replay_fifo_read(int* overflow){
+	imu_rec_header_t h;
+	const unsigned char* rec = replay_cur;
+	int len;
+	if(rec==NULL) return -1;
+	memcpy(&h, rec, sizeof(h));
+	replay_cur = NULL;
+	fifo_stats.fifo_reads++;
+	if(h.len==REC_READ_ERROR || h.len>FIFO_BUF_LEN){
+		fifo_stats.i2c_errors++;
+		return -1;
+	}
+	record_fifo_count(h.fifo_count);
+	if(h.fifo_count>=MPU_FIFO_SIZE){
+		if(config.show_warnings) printf("warning: imu fifo overflow\n");
+		fifo_stats.overflows++;
+		if(overflow!=NULL) *overflow = 1;
+	}
+	len = min(h.len, FIFO_BUF_LEN-fifo_fill);
+	memcpy(&fifo_buf[fifo_fill], rec+sizeof(h), len);
+	fifo_fill += len;
+	return len;
+}
+
+/*******************************************************************************
+* void* imu_replay_handler(void* ptr)
+*
+* Stands in for imu_interrupt_handler when replaying. Each record becomes one
+* interrupt with its original timestamp, followed by the same FIFO parsing and
+* delivery as on hardware. In real-time mode the records are spaced out like
+* the original interrupts, otherwise they are replayed as fast as possible.
+* A record longer than any FIFO read or running past the end of the file
+* stops the replay and sets replay_error.
+*******************************************************************************/
+void* imu_replay_handler(__unused void* ptr){
+	const imu_rec_file_header_t* fh = (const imu_rec_file_header_t*)replay_map;
+	const unsigned char* p = replay_map + fh->header_len;
+	const unsigned char* end = replay_map + replay_map_len;
+	imu_rec_header_t h;
+	uint64_t start = 0, first_ts = 0, t;
+	struct timespec ts;
+	int ret, len, first_run = 1;
+
+	mpu_reset_fifo();
+	while(rc_get_state()!=EXITING && shutdown_interrupt_thread!=1){
+		if(p==end) break;
+		if(end-p<(long)sizeof(h)){
+			fprintf(stderr,"ERROR: in imu_replay_handler, truncated record header\n");
+			replay_error = 1;
+			break;
+		}
+		memcpy(&h, p, sizeof(h));
+		len = (h.len==REC_READ_ERROR) ? 0 : h.len;
+		if(len>FIFO_BUF_LEN){
+			fprintf(stderr,"ERROR: in imu_replay_handler, corrupt record of %d bytes\n", len);
+			replay_error = 1;
+			break;
+		}
+		if(end-p<(long)sizeof(h)+len){
+			fprintf(stderr,"ERROR: in imu_replay_handler, truncated record\n");
+			replay_error = 1;
+			break;
+		}
+		if(replay_speed==IMU_REPLAY_REALTIME){
+			if(start==0){
+				start = rc_nanos_since_boot();
+				first_ts = h.timestamp_ns;
+			}
+			t = start + (h.timestamp_ns-first_ts);
+			ts.tv_sec = t/1000000000;
+			ts.tv_nsec = t%1000000000;
+			while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)==EINTR){
+				if(shutdown_interrupt_thread) break;
+			}
+		}
+		last_interrupt_timestamp_nanos = h.timestamp_ns;
+		replay_cur = p;
+		p += sizeof(h)+len;
+		ret = read_dmp_fifo();
+		ret = deliver_dmp_fifo(!first_run);
+		if(ret>0) first_run = 0;
+		else last_read_successful = 0;
+		replay_records++;
+	}
+	thread_running_flag = 0;
+	return NULL;
+}
+
+/*******************************************************************************
+* int rc_initialize_imu_replay(rc_imu_data_t* data, rc_imu_config_t conf,
+*						const char* path, rc_imu_replay_speed_t speed)
+*
+* Replays a file made with rc_start_imu_recording through the DMP mode code
+* path without touching the hardware. The sample rate, orientation,
+* magnetometer settings and calibration come from the recording, the rest of
+* conf is used as given. Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_initialize_imu_replay(rc_imu_data_t* data, rc_imu_config_t conf,\
+						const char* path, rc_imu_replay_speed_t speed){
+	const imu_rec_file_header_t* h;
+	struct sched_param params;
+	struct stat st;
+	int fd;
+
+	if(data==NULL || path==NULL){
+		fprintf(stderr,"ERROR: in rc_initialize_imu_replay, received NULL pointer\n");
+		return -1;
+	}
+	if(speed!=IMU_REPLAY_REALTIME && speed!=IMU_REPLAY_MAX_SPEED){
+		fprintf(stderr,"ERROR: in rc_initialize_imu_replay, invalid speed\n");
+		return -1;
+	}
+	if(thread_running_flag){
+		fprintf(stderr,"ERROR: in rc_initialize_imu_replay, IMU already running\n");
+		return -1;
+	}
+	fd = open(path, O_RDONLY);
+	if(fd<0){
+		fprintf(stderr,"ERROR: in rc_initialize_imu_replay, can't open %s: %s\n",\
+													path, strerror(errno));
+		return -1;
+	}
+	if(fstat(fd, &st)<0 || st.st_size<(off_t)sizeof(imu_rec_file_header_t)){
+		fprintf(stderr,"ERROR: in rc_initialize_imu_replay, %s is not an IMU recording\n", path);
+		close(fd);
+		return -1;
+	}
+	replay_map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(replay_map==MAP_FAILED){
+		fprintf(stderr,"ERROR: in rc_initialize_imu_replay, mmap failed\n");
+		replay_map = NULL;
+		return -1;
+	}
+	replay_map_len = st.st_size;
+	madvise(replay_map, replay_map_len, MADV_SEQUENTIAL);
+	h = (const imu_rec_file_header_t*)replay_map;
+	if(memcmp(h->magic, REC_MAGIC, sizeof(h->magic)) || h->version!=REC_VERSION ||\
+		h->header_len!=sizeof(*h) || (h->packet_len!=FIFO_LEN_NO_MAG &&\
+		h->packet_len!=FIFO_LEN_MAG) || h->dmp_sample_rate<DMP_MIN_RATE ||\
+		h->dmp_sample_rate>DMP_MAX_RATE){
+		fprintf(stderr,"ERROR: in rc_initialize_imu_replay, %s is not a valid IMU recording\n", path);
+		munmap(replay_map, replay_map_len);
+		replay_map = NULL;
+		return -1;
+	}
+	// set up the same state rc_initialize_imu_dmp would have
+	conf.dmp_sample_rate = h->dmp_sample_rate;
+	conf.enable_magnetometer = h->enable_magnetometer;
+	conf.orientation = h->orientation;
+	conf.compass_time_constant = h->compass_time_constant;
+	if(orientation_transform(conf.orientation, orient_perm, orient_sign)<0){
+		munmap(replay_map, replay_map_len);
+		replay_map = NULL;
+		return -1;
+	}
+	config = conf;
+	data_ptr = data;
+	fusion_reset = 1;
+	data->accel_to_ms2 = h->accel_to_ms2;
+	data->gyro_to_degs = h->gyro_to_degs;
+	memcpy(imu0->mag_factory_adjust, h->mag_factory_adjust, sizeof(imu0->mag_factory_adjust));
+	memcpy(imu0->mag_offsets, h->mag_offsets, sizeof(imu0->mag_offsets));
+	memcpy(imu0->mag_scales, h->mag_scales, sizeof(imu0->mag_scales));
+	reset_mag_cal();
+	reset_temp_comp();
+	reset_dynamic_notch(&conf, conf.dmp_sample_rate);
+	dmp_en = 1;
+	packet_len = h->packet_len;
+	fifo_spec_len = packet_len;
+	replay_speed = speed;
+	replay_records = 0;
+	replay_error = 0;
+	replay_cur = NULL;
+	replay_active = 1;
+	// start the thread playing the part of the interrupt handler
+	interrupt_func_set = 1;
+	shutdown_interrupt_thread = 0;
+	rc_set_imu_interrupt_func(&rc_null_func);
+	thread_running_flag = 1;
+	start_vote_slot(0);
+	if(pthread_create(&imu_interrupt_thread, NULL, imu_replay_handler, NULL)){
+		fprintf(stderr,"ERROR: in rc_initialize_imu_replay, failed to start thread\n");
+		stop_vote_slot(0);
+		thread_running_flag = 0;
+		replay_active = 0;
+		munmap(replay_map, replay_map_len);
+		replay_map = NULL;
+		return -1;
+	}
+	params.sched_priority = config.dmp_interrupt_priority;
+	pthread_setschedparam(imu_interrupt_thread, SCHED_FIFO, &params);
+	if(sub_list[IMU_DISPATCH_WORKER]->n>0) start_imu_worker();
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_wait_for_imu_replay()
+*
+* Blocks until the replay started by rc_initialize_imu_replay reaches the end
+* of the recording or the program is exiting. Returns the number of FIFO reads
+* replayed, or -1 if no replay was started or it stopped at a corrupt or
+* truncated record.
+*******************************************************************************/
+int rc_wait_for_imu_replay(){
+	if(!replay_active){
+		fprintf(stderr,"ERROR: in rc_wait_for_imu_replay, no replay running\n");
+		return -1;
+	}
+	while(thread_running_flag && rc_get_state()!=EXITING) rc_usleep(1000);
+	if(replay_error){
+		fprintf(stderr,"ERROR: in rc_wait_for_imu_replay, recording is corrupt after %llu reads\n",\
+										(unsigned long long)replay_records);
+		return -1;
+	}
+	return replay_records;
+}
@@ -0,0 +1,459 @@
+/*******************************************************************************
+* rc_calibration.c
+*
+* One binary file holding the calibration of every sensor on the cape. It is
+* a small header with a version and CRC-32 followed by fixed size fields, so
+* loading it is a single mmap and copy instead of parsing several text files.
+* Updates go to a temporary file which is synced and renamed over the old one,
+* so a power cut mid-write leaves either the old or the new calibration and
+* never half of each. The old text files are still read when there is no
+* binary store, and migrated into one. A store that can't be read is moved
+* aside to calibration.bin.bad before anything new is saved over it.
+*******************************************************************************/
+
+#include "../redperipherallib.h"
+#include "../rc_defs.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define CAL_MAGIC		0x4C414352	// "RCAL" in a little endian file
+#define CAL_VERSION		3
+#define PATH_LEN		100
+
+// on-disk layout, native byte order since the file never leaves the board.
+// New versions may only append fields so older ones can still be migrated.
+typedef struct cal_header_t{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t header_len;	// sizeof(cal_header_t)
+	uint32_t payload_len;
+	uint32_t crc;			// CRC-32 of the payload
+} cal_header_t;
+
+typedef struct cal_payload_v1_t{
+	uint32_t valid;
+	int16_t gyro_offsets[3];
+	int16_t reserved;
+	float mag_offsets[3];
+	float mag_scales[3];
+	int32_t dsm_mins[RC_CAL_DSM_CHANNELS];
+	int32_t dsm_maxes[RC_CAL_DSM_CHANNELS];
+	float adc_gains[RC_CAL_ADC_CHANNELS];
+	float adc_offsets[RC_CAL_ADC_CHANNELS];
+} cal_payload_v1_t;
+
+// version 2 adds gyro and magnetometer sections for the extra IMUs
+typedef struct cal_payload_v2_t{
+	cal_payload_v1_t v1;
+	int16_t imu_gyro_offsets[RC_MAX_IMUS-1][3];
+	int16_t reserved;
+	float imu_mag_offsets[RC_MAX_IMUS-1][3];
+	float imu_mag_scales[RC_MAX_IMUS-1][3];
+} cal_payload_v2_t;
+
+// version 3 adds the temperature model of IMU 0
+typedef struct cal_payload_v3_t{
+	cal_payload_v2_t v2;
+	float temp_min;
+	float temp_step;
+	float temp_gyro_bias[RC_IMU_TEMP_NODES][3];
+	float temp_gyro_scale[RC_IMU_TEMP_NODES][3];
+	float temp_accel_bias[RC_IMU_TEMP_NODES][3];
+	float temp_accel_scale[RC_IMU_TEMP_NODES][3];
+	float temp_weight[RC_IMU_TEMP_NODES];
+} cal_payload_v3_t;
+
+// payload length of each version, index 0 unused
+static const size_t cal_payload_len[CAL_VERSION+1] = {0,\
+	sizeof(cal_payload_v1_t), sizeof(cal_payload_v2_t), sizeof(cal_payload_v3_t)};
+
+// the copy in memory, only reached through rc_get/rc_save_calibration
+static pthread_mutex_t cal_mutex = PTHREAD_MUTEX_INITIALIZER;
+static rc_calibration_t cal_cache;
+static int cal_loaded;
+static int cal_unusable;	// the store exists but couldn't be loaded
+
+/*******************************************************************************
+* uint32_t cal_crc32(const void* data, size_t len)
+*
+* Plain bitwise CRC-32, the store is only a couple hundred bytes.
+*******************************************************************************/
+static uint32_t cal_crc32(const void* data, size_t len){
+	const uint8_t* p = data;
+	uint32_t c = 0xFFFFFFFF;
+	size_t i;
+	int j;
+	for(i=0;i<len;i++){
+		c ^= p[i];
+		for(j=0;j<8;j++) c = (c>>1) ^ (0xEDB88320 & -(c&1));
+	}
+	return ~c;
+}
+
+/*******************************************************************************
+* void cal_defaults(rc_calibration_t* cal)
+*
+* Neutral values for every section: zero offsets, unity scales and gains.
+*******************************************************************************/
+static void cal_defaults(rc_calibration_t* cal){
+	int i, j;
+	memset(cal, 0, sizeof(*cal));
+	for(i=0;i<3;i++) cal->mag_scales[i] = 1.0f;
+	for(i=0;i<RC_MAX_IMUS-1;i++){
+		for(j=0;j<3;j++) cal->imu_mag_scales[i][j] = 1.0f;
+	}
+	for(i=0;i<RC_CAL_ADC_CHANNELS;i++) cal->adc_gains[i] = 1.0f;
+	cal->imu_temp_model = rc_default_imu_temp_model();
+}
+
+/*******************************************************************************
+* void cal_path(char* buf, const char* file)
+*
+* Builds the full path of a file in the config directory.
+*******************************************************************************/
+static void cal_path(char* buf, const char* file){
+	strcpy(buf, CONFIG_DIRECTORY);
+	strcat(buf, file);
+}
+
+/*******************************************************************************
+* int cal_load_store(rc_calibration_t* cal)
+*
+* Maps the binary store and copies it into cal after checking the magic,
+* version, length and CRC. Older versions load with neutral values for the
+* sections added since. Returns 0 on success, -1 if the file doesn't exist
+* and -2 if it exists but can't be used.
+*******************************************************************************/
+static int cal_load_store(rc_calibration_t* cal){
+	char file_path[PATH_LEN];
+	const cal_header_t* h;
+	const cal_payload_v1_t* p;
+	const cal_payload_v2_t* p2;
+	const cal_payload_v3_t* p3;
+	struct stat st;
+	size_t len;
+	void* map;
+	int fd, i, j, ret = -2;
+
+	cal_path(file_path, CAL_STORE_FILE);
+	fd = open(file_path, O_RDONLY);
+	if(fd<0) return (errno==ENOENT) ? -1 : -2;
+	if(fstat(fd, &st)<0 || st.st_size<(off_t)sizeof(cal_header_t)){
+		close(fd);
+		fprintf(stderr,"WARNING: calibration store %s is truncated\n", file_path);
+		return -2;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map==MAP_FAILED) return -2;
+	h = map;
+	p = (const cal_payload_v1_t*)((const char*)map + sizeof(cal_header_t));
+	p2 = (const cal_payload_v2_t*)p;
+	p3 = (const cal_payload_v3_t*)p;
+	len = (h->version>=1 && h->version<=CAL_VERSION) ? cal_payload_len[h->version] : 0;
+	if(h->magic!=CAL_MAGIC || h->header_len!=sizeof(cal_header_t)){
+		fprintf(stderr,"WARNING: %s is not a calibration store\n", file_path);
+	}
+	else if(h->version<1 || h->version>CAL_VERSION){
+		fprintf(stderr,"WARNING: calibration store version %d not supported\n",\
+																	h->version);
+	}
+	else if(h->payload_len!=len || (size_t)st.st_size!=sizeof(cal_header_t)+len){
+		fprintf(stderr,"WARNING: calibration store %s is truncated\n", file_path);
+	}
+	else if(cal_crc32(p, h->payload_len)!=h->crc){
+		fprintf(stderr,"WARNING: calibration store %s is corrupted\n", file_path);
+	}
+	else{
+		cal_defaults(cal);
+		cal->valid = p->valid;
+		for(i=0;i<3;i++){
+			cal->gyro_offsets[i] = p->gyro_offsets[i];
+			cal->mag_offsets[i] = p->mag_offsets[i];
+			cal->mag_scales[i] = p->mag_scales[i];
+		}
+		for(i=0;i<RC_CAL_DSM_CHANNELS;i++){
+			cal->dsm_mins[i] = p->dsm_mins[i];
+			cal->dsm_maxes[i] = p->dsm_maxes[i];
+		}
+		for(i=0;i<RC_CAL_ADC_CHANNELS;i++){
+			cal->adc_gains[i] = p->adc_gains[i];
+			cal->adc_offsets[i] = p->adc_offsets[i];
+		}
+		for(i=0;i<RC_MAX_IMUS-1 && h->version>=2;i++){
+			for(j=0;j<3;j++){
+				cal->imu_gyro_offsets[i][j] = p2->imu_gyro_offsets[i][j];
+				cal->imu_mag_offsets[i][j] = p2->imu_mag_offsets[i][j];
+				cal->imu_mag_scales[i][j] = p2->imu_mag_scales[i][j];
+			}
+		}
+		if(h->version>=3){
+			cal->imu_temp_model.temp_min = p3->temp_min;
+			cal->imu_temp_model.temp_step = p3->temp_step;
+			for(i=0;i<RC_IMU_TEMP_NODES;i++){
+				for(j=0;j<3;j++){
+					cal->imu_temp_model.gyro_bias[i][j] = p3->temp_gyro_bias[i][j];
+					cal->imu_temp_model.gyro_scale[i][j] = p3->temp_gyro_scale[i][j];
+					cal->imu_temp_model.accel_bias[i][j] = p3->temp_accel_bias[i][j];
+					cal->imu_temp_model.accel_scale[i][j] = p3->temp_accel_scale[i][j];
+				}
+				cal->imu_temp_model.weight[i] = p3->temp_weight[i];
+			}
+		}
+		ret = 0;
+	}
+	munmap(map, st.st_size);
+	return ret;
+}
+
+/*******************************************************************************
+* int cal_write_store(const rc_calibration_t* cal)
+*
+* Writes cal to a temporary file next to the store, syncs it, renames it over
+* the store and syncs the directory so the rename itself survives a power cut.
+* Returns 0 on success or -1 on failure, in which case the old store is left
+* untouched.
+*******************************************************************************/
+static int cal_write_store(const rc_calibration_t* cal){
+	char file_path[PATH_LEN], tmp_path[PATH_LEN];
+	struct{
+		cal_header_t h;
+		cal_payload_v3_t p;
+	} buf;
+	cal_payload_v2_t* p2 = &buf.p.v2;
+	cal_payload_v1_t* p1 = &buf.p.v2.v1;
+	int fd, i, j;
+
+	memset(&buf, 0, sizeof(buf));
+	p1->valid = cal->valid;
+	for(i=0;i<3;i++){
+		p1->gyro_offsets[i] = cal->gyro_offsets[i];
+		p1->mag_offsets[i] = cal->mag_offsets[i];
+		p1->mag_scales[i] = cal->mag_scales[i];
+	}
+	for(i=0;i<RC_CAL_DSM_CHANNELS;i++){
+		p1->dsm_mins[i] = cal->dsm_mins[i];
+		p1->dsm_maxes[i] = cal->dsm_maxes[i];
+	}
+	for(i=0;i<RC_CAL_ADC_CHANNELS;i++){
+		p1->adc_gains[i] = cal->adc_gains[i];
+		p1->adc_offsets[i] = cal->adc_offsets[i];
+	}
+	for(i=0;i<RC_MAX_IMUS-1;i++){
+		for(j=0;j<3;j++){
+			p2->imu_gyro_offsets[i][j] = cal->imu_gyro_offsets[i][j];
+			p2->imu_mag_offsets[i][j] = cal->imu_mag_offsets[i][j];
+			p2->imu_mag_scales[i][j] = cal->imu_mag_scales[i][j];
+		}
+	}
+	buf.p.temp_min = cal->imu_temp_model.temp_min;
+	buf.p.temp_step = cal->imu_temp_model.temp_step;
+	for(i=0;i<RC_IMU_TEMP_NODES;i++){
+		for(j=0;j<3;j++){
+			buf.p.temp_gyro_bias[i][j] = cal->imu_temp_model.gyro_bias[i][j];
+			buf.p.temp_gyro_scale[i][j] = cal->imu_temp_model.gyro_scale[i][j];
+			buf.p.temp_accel_bias[i][j] = cal->imu_temp_model.accel_bias[i][j];
+			buf.p.temp_accel_scale[i][j] = cal->imu_temp_model.accel_scale[i][j];
+		}
+		buf.p.temp_weight[i] = cal->imu_temp_model.weight[i];
+	}
+	buf.h.magic = CAL_MAGIC;
+	buf.h.version = CAL_VERSION;
+	buf.h.header_len = sizeof(cal_header_t);
+	buf.h.payload_len = sizeof(cal_payload_v3_t);
+	buf.h.crc = cal_crc32(&buf.p, sizeof(buf.p));
+
+	cal_path(file_path, CAL_STORE_FILE);
+	cal_path(tmp_path, CAL_STORE_FILE ".tmp");
+	fd = open(tmp_path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	// if opening for writing failed, the directory may not exist yet
+	if(fd<0){
+		mkdir(CONFIG_DIRECTORY, 0777);
+		fd = open(tmp_path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+		if(fd<0){
+			fprintf(stderr,"ERROR: in rc_save_calibration, could not open %s\n", tmp_path);
+			return -1;
+		}
+	}
+	if(write(fd, &buf, sizeof(buf))!=(ssize_t)sizeof(buf) || fsync(fd)<0){
+		fprintf(stderr,"ERROR: in rc_save_calibration, failed to write %s\n", tmp_path);
+		close(fd);
+		unlink(tmp_path);
+		return -1;
+	}
+	close(fd);
+	if(rename(tmp_path, file_path)<0){
+		fprintf(stderr,"ERROR: in rc_save_calibration, failed to replace %s\n", file_path);
+		unlink(tmp_path);
+		return -1;
+	}
+	fd = open(CONFIG_DIRECTORY, O_RDONLY|O_DIRECTORY);
+	if(fd>=0){
+		fsync(fd);
+		close(fd);
+	}
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_import_text_calibration(rc_calibration_t* cal)
+*
+* Reads whichever of the old gyro, magnetometer and DSM text calibration files
+* exist into cal and marks those sections valid. Sections without a file are
+* left alone. Returns the number of files imported.
+*******************************************************************************/
+int rc_import_text_calibration(rc_calibration_t* cal){
+	char file_path[PATH_LEN];
+	FILE* f;
+	int i, n = 0, x, y, z;
+	int mins[RC_CAL_DSM_CHANNELS], maxes[RC_CAL_DSM_CHANNELS];
+	float m[6];
+
+	if(cal==NULL){
+		fprintf(stderr,"ERROR: in rc_import_text_calibration, received NULL pointer\n");
+		return -1;
+	}
+	cal_path(file_path, GYRO_CAL_FILE);
+	f = fopen(file_path, "r");
+	if(f!=NULL){
+		if(fscanf(f,"%d\n%d\n%d\n", &x,&y,&z)==3){
+			cal->gyro_offsets[0] = x;
+			cal->gyro_offsets[1] = y;
+			cal->gyro_offsets[2] = z;
+			cal->valid |= RC_CAL_GYRO;
+			n++;
+		}
+		fclose(f);
+	}
+	cal_path(file_path, MAG_CAL_FILE);
+	f = fopen(file_path, "r");
+	if(f!=NULL){
+		if(fscanf(f,"%f\n%f\n%f\n%f\n%f\n%f\n", &m[0],&m[1],&m[2],\
+											&m[3],&m[4],&m[5])==6){
+			for(i=0;i<3;i++){
+				cal->mag_offsets[i] = m[i];
+				cal->mag_scales[i] = m[3+i];
+			}
+			cal->valid |= RC_CAL_MAG;
+			n++;
+		}
+		fclose(f);
+	}
+	cal_path(file_path, DSM_CAL_FILE);
+	f = fopen(file_path, "r");
+	if(f!=NULL){
+		for(i=0;i<RC_CAL_DSM_CHANNELS;i++){
+			if(fscanf(f,"%d %d", &mins[i], &maxes[i])!=2) break;
+		}
+		if(i==RC_CAL_DSM_CHANNELS){
+			memcpy(cal->dsm_mins, mins, sizeof(mins));
+			memcpy(cal->dsm_maxes, maxes, sizeof(maxes));
+			cal->valid |= RC_CAL_DSM;
+			n++;
+		}
+		fclose(f);
+	}
+	return n;
+}
+
+/*******************************************************************************
+* void cal_load_cache()
+*
+* Fills cal_cache the first time it's needed. If there is no store yet, the
+* old text files are imported and saved as a new store. A store that exists
+* but can't be used is left alone and cal_unusable set, it may be from a
+* newer version and the text files are no longer kept up to date, so neutral
+* values are used. Called with cal_mutex held.
+*******************************************************************************/
+static void cal_load_cache(){
+	int ret;
+	if(cal_loaded) return;
+	ret = cal_load_store(&cal_cache);
+	if(ret==-2){
+		fprintf(stderr,"ERROR: in rc_get_calibration, can't use calibration store %s%s\n",\
+										CONFIG_DIRECTORY, CAL_STORE_FILE);
+		fprintf(stderr,"using uncalibrated values, the file was left as it is\n");
+		cal_defaults(&cal_cache);
+		cal_unusable = 1;
+	}
+	else if(ret<0){
+		cal_defaults(&cal_cache);
+		if(rc_import_text_calibration(&cal_cache)>0){
+			#ifdef DEBUG
+			printf("migrating text calibration files to %s\n", CAL_STORE_FILE);
+			#endif
+			cal_write_store(&cal_cache);
+		}
+	}
+	cal_loaded = 1;
+	return;
+}
+
+/*******************************************************************************
+* int rc_get_calibration(rc_calibration_t* cal)
+*
+* Copies the calibration into cal. The store is only read from disk the first
+* time, see cal_load_cache, after that the copy kept in memory is returned.
+* Sections without data have neutral values and their valid bit clear.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+int rc_get_calibration(rc_calibration_t* cal){
+	if(cal==NULL){
+		fprintf(stderr,"ERROR: in rc_get_calibration, received NULL pointer\n");
+		return -1;
+	}
+	pthread_mutex_lock(&cal_mutex);
+	cal_load_cache();
+	*cal = cal_cache;
+	pthread_mutex_unlock(&cal_mutex);
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_save_calibration(rc_calibration_t* cal)
+*
+* Atomically replaces the store with cal and updates the copy in memory.
+* To change one sensor, get the calibration, modify it and save it back.
+* cal only holds neutral values for the sections of a store that couldn't be
+* loaded, so that store is renamed to calibration.bin.bad first rather than
+* lost, and nothing is saved if it can't be. Returns 0 on success or -1 on
+* failure.
+*******************************************************************************/
+int rc_save_calibration(rc_calibration_t* cal){
+	char file_path[PATH_LEN], bad_path[PATH_LEN];
+	int ret;
+	if(cal==NULL){
+		fprintf(stderr,"ERROR: in rc_save_calibration, received NULL pointer\n");
+		return -1;
+	}
+	pthread_mutex_lock(&cal_mutex);
+	cal_load_cache();
+	if(cal_unusable){
+		cal_path(file_path, CAL_STORE_FILE);
+		cal_path(bad_path, CAL_STORE_FILE ".bad");
+		if(rename(file_path, bad_path)<0 && errno!=ENOENT){
+			fprintf(stderr,"ERROR: in rc_save_calibration, can't move unusable store %s aside: %s\n",\
+												file_path, strerror(errno));
+			pthread_mutex_unlock(&cal_mutex);
+			return -1;
+		}
+		fprintf(stderr,"WARNING: unusable calibration store moved to %s\n", bad_path);
+		cal_unusable = 0;
+	}
+	ret = cal_write_store(cal);
+	if(ret==0){
+		cal_cache = *cal;
+		cal_loaded = 1;
+	}
+	pthread_mutex_unlock(&cal_mutex);
+	return ret;
+}
@@ -56,31 +56,24 @@ void* calibration_listen_func(void *ptr);
 *******************************************************************************/ 
 int rc_initialize_dsm(){
 	int i;
-	//if calibration file exists, load it and start spektrum thread
-	FILE *cal;
-	char file_path[100];
+	//if a calibration is stored, load it and start spektrum thread
+	rc_calibration_t cal;
 
-	// construct a new file path string
-	strcpy(file_path, CONFIG_DIRECTORY);
-	strcat(file_path, DSM_CAL_FILE);
-	
-	// open for reading
-	cal = fopen(file_path, "r");
-
-	if (cal == NULL) {
-		printf("\ndsm Calibration File Doesn't Exist Yet\n");
+	rc_get_calibration(&cal);
+	if (!(cal.valid & RC_CAL_DSM)) {
+		printf("\ndsm Calibration Doesn't Exist Yet\n");
 		printf("Run calibrate_dsm example to create one\n");
 		printf("Using default values for now\n");
 		load_default_calibration();
 	}
 	else{
 		for(i=0;i<MAX_DSM_CHANNELS;i++){
-			fscanf(cal,"%d %d", &rc_mins[i],&rc_maxes[i]);
+			rc_mins[i] = cal.dsm_mins[i];
+			rc_maxes[i] = cal.dsm_maxes[i];
 		}
 		#ifdef DEBUG
 		printf("DSM Calibration Loaded\n");
 		#endif
-		fclose(cal);
 	}
 
 	rc_set_pinmux_mode(DSM_PIN, PINMUX_UART);
@@ -813,38 +806,27 @@ int rc_calibrate_dsm_routine(){
 		return -1;
 	}
 	
-	// construct a new file path string
-	char file_path[100];
-	strcpy (file_path, CONFIG_DIRECTORY);
-	strcat (file_path, DSM_CAL_FILE);
-	
-	// open for writing
-	FILE* cal;
-	cal = fopen(file_path, "w");
-	if (cal == NULL) {
-		mkdir(CONFIG_DIRECTORY, 0777);
-		cal = fopen(file_path, "w");
-		if (cal == 0){
-			printf("could not open config directory\n");
-			printf(CONFIG_DIRECTORY);
-			printf("\n");
-			return -1;
-		}
-	}
-
-	// if new data was captures for a channel, write data to cal file
+	// if new data was captures for a channel, store it
 	// otherwise fill in defaults for unused channels in case
-	// a higher channel radio is used in the future with this cal file
+	// a higher channel radio is used in the future with this calibration
+	rc_calibration_t cal;
+	rc_get_calibration(&cal);
 	for(i=0;i<MAX_DSM_CHANNELS;i++){
 		if((rc_mins[i]==0) || (rc_mins[i]==rc_maxes[i])){
-			fprintf(cal, "%d %d\n",DEFAULT_MIN, DEFAULT_MAX);
+			cal.dsm_mins[i] = DEFAULT_MIN;
+			cal.dsm_maxes[i] = DEFAULT_MAX;
 		}
 		else{
-			fprintf(cal, "%d %d\n", rc_mins[i], rc_maxes[i]);
+			cal.dsm_mins[i] = rc_mins[i];
+			cal.dsm_maxes[i] = rc_maxes[i];
 		}
 	}
-	fclose(cal);
-	printf("New calibration file written\n");
+	cal.valid |= RC_CAL_DSM;
+	if(rc_save_calibration(&cal)){
+		printf("could not save dsm calibration\n");
+		return -1;
+	}
+	printf("New calibration saved\n");
 	printf("use rc_test_dsm to confirm\n");
 	return 0;
 }
@@ -18,6 +18,7 @@
 #define DSM_CAL_FILE	"dsm.cal"
 #define GYRO_CAL_FILE 	"gyro.cal"
 #define MAG_CAL_FILE	"mag.cal"
+#define CAL_STORE_FILE	"calibration.bin"
 
 // PID file location
 // file created to indicate running process
@@ -25,6 +25,10 @@
 *******************************************************************************/
 // global roboticscape state
 enum rc_state_t rc_state = UNINITIALIZED;
+// ADC calibration from the calibration store, loaded by rc_initialize, see
+// rc_get_adc_calibration and rc_set_adc_calibration
+static float adc_gains[RC_CAL_ADC_CHANNELS] = {1,1,1,1,1,1,1};
+static float adc_offsets[RC_CAL_ADC_CHANNELS];
 
 
 
@@ -43,6 +47,8 @@ void shutdown_signal_handler(int signo);
 int rc_initialize(){
 	FILE *fd; 
 	rc_bb_model_t model;
+	rc_calibration_t cal;
+	int i;
 
 	// ensure root privaleges until we sort out udev rules
 	if(geteuid()!=0){
@@ -110,6 +116,16 @@ int rc_initialize(){
 		return -1;
 	}
 
+	// read the calibration store once for every sensor that needs it
+	#ifdef DEBUG
+	printf("Loading calibration\n");
+	#endif
+	if(rc_get_calibration(&cal)==0 && (cal.valid & RC_CAL_ADC)){
+		for(i=0;i<RC_CAL_ADC_CHANNELS;i++){
+			rc_set_adc_calibration(i, cal.adc_gains[i], cal.adc_offsets[i]);
+		}
+	}
+
 	// eQep encoder counters
 	#ifdef DEBUG
 	printf("Initializing: eQEP\n");
@@ -421,7 +437,8 @@ int rc_adc_raw(int ch){
 /*******************************************************************************
 * float rc_adc_volt(int ch)
 * 
-* returns an actual voltage for an adc channel
+* returns an actual voltage for an adc channel, corrected with the gain and
+* offset in the calibration store if there are any
 *******************************************************************************/
 float rc_adc_volt(int ch){
 	if(ch<0 || ch>6){
@@ -429,7 +446,42 @@ float rc_adc_volt(int ch){
 		return -1;
 	}
 	int raw_adc = mmap_adc_read_raw((uint8_t)ch);
-	return raw_adc * 1.8 / 4095.0;
+	return (raw_adc * 1.8 / 4095.0)*adc_gains[ch] + adc_offsets[ch];
+}
+
+/*******************************************************************************
+* int rc_get_adc_calibration(int ch, float* gain, float* offset)
+* 
+* returns the gain and offset rc_adc_volt applies to a channel
+*******************************************************************************/
+int rc_get_adc_calibration(int ch, float* gain, float* offset){
+	if(ch<0 || ch>6){
+		fprintf(stderr,"ERROR: analog pin must be in 0-6\n");
+		return -1;
+	}
+	if(gain==NULL || offset==NULL){
+		fprintf(stderr,"ERROR: in rc_get_adc_calibration, received NULL pointer\n");
+		return -1;
+	}
+	*gain = adc_gains[ch];
+	*offset = adc_offsets[ch];
+	return 0;
+}
+
+/*******************************************************************************
+* int rc_set_adc_calibration(int ch, float gain, float offset)
+* 
+* sets the gain and offset rc_adc_volt applies to a channel from now on, this
+* isn't saved to the calibration store
+*******************************************************************************/
+int rc_set_adc_calibration(int ch, float gain, float offset){
+	if(ch<0 || ch>6){
+		fprintf(stderr,"ERROR: analog pin must be in 0-6\n");
+		return -1;
+	}
+	adc_gains[ch] = gain;
+	adc_offsets[ch] = offset;
+	return 0;
 }
 
 /*******************************************************************************
@@ -355,7 +355,16 @@ int rc_set_encoder_pos(int ch, int value);
 * All 7 ADC channels on the Sitara including the 4 listed above can be read
 * with rc_adc_raw(int ch) which returns the raw integer output of the 
 * 12-bit ADC. rc_adc_volt(int ch) additionally converts this raw value to 
-* a voltage. ch must be from 0 to 6.
+* a voltage, applying the channel's gain and offset from the calibration
+* store if it has one. ch must be from 0 to 6.
+*
+* @ int rc_get_adc_calibration(int ch, float* gain, float* offset)
+* @ int rc_set_adc_calibration(int ch, float gain, float offset)
+*
+* Read or change the gain and offset rc_adc_volt applies to a channel, so
+* volts = raw volts*gain + offset. rc_initialize loads them from the
+* calibration store. Setting them only lasts until the program exits, save
+* them with rc_save_calibration to keep them.
 *
 * See the test_adc example for sample use case.
 ******************************************************************************/
@@ -363,6 +372,8 @@ float rc_battery_voltage();
 float rc_dc_jack_voltage();
 int   rc_adc_raw(int ch);
 float rc_adc_volt(int ch);
+int   rc_get_adc_calibration(int ch, float* gain, float* offset);
+int   rc_set_adc_calibration(int ch, float gain, float offset);
 
 
 /******************************************************************************
@@ -559,6 +570,19 @@ int   rc_calibrate_dsm_routine();
 * best to get the default config with rc_default_imu_config() function and
 * modify from there.
 *
+* The MPU9250 is reached over I2C bus 0 by default. On boards that wire its
+* SPI pins to SPI1, set transport to IMU_TRANSPORT_SPI and spi_slave to the
+* slave it's on. Slave 2 is selected manually around each transfer since the
+* cape can only select slave 1 automatically. Configuration registers are
+* then written at 1MHz and sensor and FIFO data read at 20MHz, the limits in
+* the datasheet, and the chip's I2C interface is disabled. The magnetometer is reached through the MPU's
+* own I2C master in that case since bypass mode needs the I2C pins, which
+* makes its setup a little slower. The combined FIFO count and data read is
+* an I2C feature and is skipped over SPI, where two reads cost less than one
+* i2c transaction anyway. Everything else works the same on both.
+* i2c_bus, i2c_address and interrupt_pin default to where the cape's MPU9250
+* is wired and only need changing for additional IMUs, see below.
+*
 * @ struct rc_imu_data_t 
 *
 * This is the container for holding the sensor data from the IMU.
@@ -587,6 +611,264 @@ int   rc_calibrate_dsm_routine();
 * configuration struct. Since the magnetometer requires additional setup and
 * is slower to read, it is disabled by default.
 *
+* @ int rc_read_imu_all(rc_imu_data_t* data)
+*
+* Reads the accelerometer, thermometer and gyroscope, plus the magnetometer if
+* it is enabled, in a single i2c transaction. The MPU9250 keeps these
+* registers next to each other and its I2C master copies the magnetometer data
+* in right behind the gyroscope, so this is much cheaper than calling the
+* individual read functions when a loop needs everything.
+*
+* @ int rc_get_imu_fifo_stats(rc_imu_fifo_stats_t* stats)
+* @ int rc_reset_imu_fifo_stats()
+*
+* In DMP mode every packet in the FIFO is delivered in order, so if the
+* interrupt thread falls behind the user's interrupt function will be called
+* several times in a row. These counters show how often that happens and how
+* much data was lost to FIFO overflows or corrupted reads. They also report
+* the latency from the interrupt to the user's interrupt function. With the
+* gpio character device the interrupt time comes from the kernel, with sysfs
+* it is taken when the interrupt thread wakes so wakeup latency isn't counted.
+* The i2c counters show the system calls and bus time spent reading the FIFO.
+* With fifo_combined_read set, which is the default, the FIFO count and the
+* expected packet are read in one combined i2c transaction and a second read
+* is only made when more data is waiting. If the i2c driver doesn't support
+* combined transactions the library quietly falls back to separate reads.
+* Failed and retried FIFO reads are counted too, as are quaternion check
+* failures where a packet was expected to start. Histograms of the latency to
+* the end of the FIFO read and to the user's function, binned in powers of two
+* microseconds, and of the number of packets waiting at each read show the
+* spread that the worst case and mean hide.
+*
+* @ int rc_start_imu_stats_dump(const char* path, int period_ms)
+* @ int rc_stop_imu_stats_dump()
+*
+* Starts a normal priority thread that appends one line every period_ms to the
+* file at path, or stdout if path is NULL, summarizing the FIFO stats for that
+* period: packets, latency percentiles, packets per read and error counts.
+* Handy for catching scheduling problems on a vehicle in the field.
+* rc_power_off_imu stops it too.
+*
+* @ int rc_initialize_imu_fifo(rc_imu_data_t* data, rc_imu_config_t conf,
+*							rc_imu_fifo_sample_t* batch, int batch_len)
+*
+* RAW FIFO: For vibration analysis and fast rate loops the accelerometer and
+* gyroscope can be sampled into the FIFO without the DMP at up to 1khz, or the
+* gyroscope alone at 8khz, set with fifo_sample_rate in the config struct.
+* A background thread drains the FIFO in bursts of about batch_len samples,
+* writes them scaled and timestamped into the batch array you provide, then
+* calls the function set with rc_set_imu_batch_func() with the number of new
+* samples. Note that 8khz gyro data is more than a 400khz I2C bus can carry.
+*
+* @ int rc_initialize_imu_reader(rc_imu_reader_t* r)
+* @ int rc_read_imu_sample(rc_imu_reader_t* r, rc_imu_sample_t* s)
+* @ int rc_read_latest_imu_sample(rc_imu_sample_t* s)
+*
+* In DMP mode every sample is also copied into a queue of the last
+* RC_IMU_QUEUE_LEN samples along with its sample number and a timestamp in
+* nanoseconds since epoch. When several packets are read from one interrupt,
+* the older ones are timestamped backwards from the interrupt at the DMP sample
+* period. Any number of threads can consume the queue without locks, each with
+* its own rc_imu_reader_t. rc_read_imu_sample returns samples in order and
+* counts any that were overwritten before the reader got to them in r->missed.
+* rc_read_latest_imu_sample just returns the newest sample. Neither ever
+* returns a partially updated sample and both are safe to call from the IMU
+* interrupt function.
+*
+* @ int rc_add_imu_subscriber(rc_imu_subscriber_func_t func, void* ctx,
+*					int decimation, int priority, rc_imu_dispatch_t dispatch)
+* @ int rc_remove_imu_subscriber(int id)
+* @ int rc_get_imu_subscriber_stats(int id, rc_imu_subscriber_stats_t* stats)
+*
+* Instead of chaining everything inside one interrupt function, any number of
+* consumers up to RC_IMU_MAX_SUBSCRIBERS can subscribe to DMP samples. Each
+* is called with the sample and its own ctx pointer on every decimation'th
+* sample, where sample numbers divisible by decimation are the ones delivered
+* so subscribers at related rates stay in phase. IMU_DISPATCH_INLINE
+* subscribers run in the SCHED_FIFO interrupt thread right after the function
+* set with rc_set_imu_interrupt_func, highest priority first, so keep them
+* short. IMU_DISPATCH_WORKER subscribers run in a separate normal priority
+* thread fed from the sample queue, again in priority order, so a slow logger
+* can never delay the interrupt thread. If the worker falls more than
+* RC_IMU_QUEUE_LEN samples behind, the lost samples are counted in the
+* subscriber's stats. rc_add_imu_subscriber returns an id for the other two
+* functions. Subscribers may be added and removed at any time, even from
+* inside a subscriber.
+*
+* @ int rc_get_imu_startup_stats(rc_imu_startup_stats_t* stats)
+*
+* Most of the time in rc_initialize_imu_dmp goes to resetting the chip and
+* loading the DMP firmware over I2C. With fast_startup set, which is the
+* default, the reset is followed by polling until the chip answers instead of
+* a fixed 100ms sleep, the firmware goes out in large bursts with a single
+* read-back pass at the end, and if the same firmware is found still loaded
+* from a previous run only its data banks, which the DMP changes as it runs,
+* are written again. rc_get_imu_startup_stats breaks down where the time went
+* in the last call.
+*
+* @ int rc_reconfigure_imu(rc_imu_config_t conf)
+*
+* Applies a new config to whichever mode is running without resetting the
+* chip, reloading the DMP firmware or restarting the IMU thread. Only the
+* registers for settings that actually changed are written and the FIFO is
+* reset if the samples waiting in it no longer match, so switching DMP sample
+* rate, orientation, filters or the magnetometer costs a few milliseconds
+* instead of a full restart. Full scale ranges are fixed while the DMP runs.
+* The transport, the interrupt source, the raw FIFO mode sample rate and
+* sensors, and while recording the DMP rate, orientation and magnetometer
+* can't be changed. It may be called from the interrupt function or a
+* subscriber, in which case the change takes effect after the current samples
+* are delivered.
+*
+* @ int rc_get_imu_gyro_bias(rc_imu_gyro_bias_t* bias)
+* @ int rc_save_imu_gyro_bias()
+*
+* Gyro bias drifts with temperature. With gyro_bias_estimation set in the
+* config struct, the IMU thread keeps a running variance of the gyro and
+* accelerometer and whenever both have been quiet for still_time seconds the
+* residual gyro reading is averaged into a bias estimate that is subtracted
+* from the gyro readings. If gyro_bias_to_hardware is also set, the estimate
+* is moved into the gyro offset registers as it grows so the DMP benefits too.
+* rc_get_imu_gyro_bias reports the estimate and rc_save_imu_gyro_bias writes
+* it to the calibration store used by rc_calibrate_gyro_routine.
+*
+* @ int rc_get_imu_mag_calibration(rc_imu_mag_cal_t* cal)
+* @ int rc_save_imu_mag_calibration()
+*
+* With mag_cal_online set in the config struct, every magnetometer reading
+* also updates a recursive least squares fit of the same ellipsoid that
+* rc_calibrate_mag_routine fits, at a small fixed cost per reading and with no
+* need to stop and spin the vehicle. Coverage of 24 directions around the
+* ellipsoid is tracked and once the fit is good and at least mag_cal_coverage
+* of them have been seen recently, the offsets and scales in use are swapped
+* for the fitted ones. The fit slowly forgets old readings so it follows
+* changes such as new hardware near the compass. rc_save_imu_mag_calibration
+* writes the calibration in use to the calibration store like
+* rc_calibrate_mag_routine does.
+*
+* @ rc_imu_temp_model_t rc_default_imu_temp_model()
+* @ int rc_fit_imu_temp_model(rc_imu_temp_model_t* model, const float* temp,
+*										const float (*gyro)[3], int n)
+* @ int rc_get_imu_temp_model(rc_imu_temp_model_t* model)
+* @ int rc_set_imu_temp_model(const rc_imu_temp_model_t* model)
+* @ int rc_save_imu_temp_model()
+*
+* With temp_compensation set in the config struct, gyro and accel readings
+* are corrected with a bias and scale that depend on the die temperature, so
+* drift over a thermal cycle doesn't need a stop to recalibrate. The model is
+* a table of RC_IMU_TEMP_NODES evenly spaced temperatures per axis, linearly
+* interpolated, so applying it costs the same few operations per sample at
+* any temperature. Gyro bias is relative to the rc_calibrate_gyro_routine
+* offsets, refit after recalibrating. Nodes with zero weight have no data of
+* their own and are interpolated from their neighbours. The model is loaded
+* from the calibration store when the IMU starts and the temperature is read
+* once a second in DMP and raw FIFO modes, filling in the data struct's temp
+* too, and with every rc_read_imu_all otherwise. If gyro_bias_to_hardware is
+* set, whole steps of the modelled gyro bias go into the offset registers so
+* the DMP's quaternion benefits, the rest is applied in software only.
+* Replays have no temperature so nothing is applied to them.
+*
+* The gyro bias can be fitted two ways. With temp_model_online and
+* gyro_bias_estimation both set, whatever gyro_bias_estimation would have
+* averaged into its single bias goes into the table nodes around the current
+* temperature instead, filling in the model as the vehicle sees temperatures.
+* From a recorded sweep, rc_fit_imu_temp_model does a least squares fit of
+* the nodes to n still readings of temperature and gyro taken without
+* compensation, replacing model's gyro bias and weights and leaving its
+* scales and accel terms, which need a reference to fit, as they are. Use
+* rc_set_imu_temp_model to put a model in use and rc_save_imu_temp_model to
+* keep the one in use for next time.
+*
+* @ int rc_get_imu_notch_stats(rc_imu_notch_stats_t* stats)
+*
+* Motor and propeller vibration shows up in the gyro readings, aliased down
+* to whatever the sample rate is. Rather than lowering gyro_dlpf until it's
+* gone, which delays everything, set dynamic_notch in the config struct and
+* the gyro readings in DMP and raw FIFO modes go through notch_count notch
+* filters per axis that follow the strongest vibration peaks between
+* notch_min_hz and notch_max_hz, capped a little below half the sample rate.
+* The peaks are found with a bank of Goertzel filters run over windows of the
+* unfiltered readings and each notch moves smoothly toward its peak as the
+* vibration changes, dropping out a few spectra after its peak goes away. The
+* DMP's own quaternion is computed on the chip and isn't affected.
+*
+* The cost per sample is fixed: the notch filters plus notch_budget steps of
+* spectrum analysis, one multiply-add of one Goertzel filter each. The default
+* budget analyses every window, a smaller one spreads each spectrum over more
+* samples and skips the windows in between, so notches follow more slowly.
+* rc_get_imu_notch_stats reports where the notches are, how often the
+* spectrum is updated and the time actually spent per sample.
+*
+* @ int rc_start_imu_recording(const char* path)
+* @ int rc_stop_imu_recording()
+*
+* Once rc_initialize_imu_dmp is running, every FIFO read can be logged to a
+* compact binary file: the raw bytes, the FIFO count and the interrupt
+* timestamp, plus a header with the settings and calibration needed to decode
+* them. A separate thread does the disk writes so the interrupt thread never
+* waits on the file. rc_stop_imu_recording returns the number of reads logged.
+*
+* @ int rc_initialize_imu_replay(rc_imu_data_t* data, rc_imu_config_t conf,
+*						const char* path, rc_imu_replay_speed_t speed)
+* @ int rc_wait_for_imu_replay()
+*
+* Feeds a recording through the same FIFO parsing, data fusion, sample queue,
+* interrupt function and subscribers as DMP mode, no cape required, so
+* flight code and filters can be tested and benchmarked against real data with
+* deterministic results. IMU_REPLAY_REALTIME spaces the reads out like the
+* original interrupts, IMU_REPLAY_MAX_SPEED goes as fast as the CPU allows.
+* Samples carry their original timestamps. rc_wait_for_imu_replay blocks
+* until the end of the file and returns the number of reads replayed, or -1
+* if the replay stopped at a corrupt or truncated record, then call
+* rc_power_off_imu as usual. Worker subscribers may miss samples at max speed
+* since nothing waits for them.
+*
+* @ int rc_initialize_imu_instance(int imu, rc_imu_config_t conf)
+* @ int rc_set_imu_instance_func(int imu, rc_imu_subscriber_func_t func,
+*																void* ctx)
+* @ int rc_read_imu_instance(int imu, rc_imu_sample_t* s)
+* @ int rc_power_off_imu_instance(int imu)
+*
+* Up to RC_MAX_IMUS-1 extra MPU9250s, numbered from 1, can run alongside the
+* cape's IMU, which is number 0. Each has its own bus, address or SPI slave
+* and interrupt pin from conf, its own calibration slot in the calibration
+* store and its own SCHED_FIFO thread, so a slow bus on one never holds up
+* another. Instances read the sensor registers in one burst each time their
+* data ready interrupt fires at dmp_sample_rate, or on a timer when
+* interrupt_pin is -1, and rotate accel, gyro and magnetometer into the
+* orientation from conf so every IMU reports in the same frame. The function
+* set with rc_set_imu_instance_func is called from that thread with each
+* sample and its ctx pointer. rc_read_imu_instance copies the newest sample
+* of any IMU, including number 0 while it runs in DMP mode, without locking.
+* IMUs sharing an i2c bus take turns on it, but start them one at a time since
+* their magnetometers all answer at the same address during setup.
+*
+* Instances only keep what is listed above. Everything else exists once and
+* belongs to IMU 0: the DMP and raw FIFO modes and their buffers, the sample
+* queue and readers, subscribers and the worker thread, recording and replay,
+* FIFO statistics, and the gyro bias, temperature model, online magnetometer
+* calibration and dynamic notch state. Functions for those take no IMU number
+* and always act on IMU 0. rc_initialize_imu_instance fails if conf turns on
+* gyro_bias_estimation, temp_compensation, temp_model_online, mag_cal_online
+* or dynamic_notch.
+*
+* @ int rc_calibrate_imu_instance_gyro(int imu, rc_imu_config_t conf)
+*
+* Same as rc_calibrate_gyro_routine for the IMU conf points at, saving the
+* offsets in calibration slot imu. The instance must not be running.
+*
+* @ int rc_vote_imu_data(rc_imu_vote_t* vote, uint64_t max_age_ns)
+*
+* Combines the newest sample from every running IMU no older than max_age_ns,
+* 0 for any age, into one. Each axis of the accelerometer, gyroscope and
+* magnetometer and the temperature is averaged over the IMUs after dropping
+* the highest and lowest value when there are three or more, so one faulty
+* IMU can't pull the result while the rest still average out noise. Each IMU
+* thread only publishes its own sample so adding IMUs costs them nothing; the
+* vote itself is a few sorts of at most RC_MAX_IMUS values. IMU 0 takes part
+* while it runs in DMP mode. Returns the number of IMUs used, 0 if none had
+* a fresh sample, or -1 on error.
+*
 ******************************************************************************/
 // defines for index location within TaitBryan and quaternion vectors
 #define TB_PITCH_X	0
@@ -642,6 +924,13 @@ typedef enum rc_imu_orientation_t{
 	ORIENTATION_X_BACK		= 161
 } rc_imu_orientation_t;
 
+typedef enum rc_imu_transport_t{
+	IMU_TRANSPORT_I2C,
+	IMU_TRANSPORT_SPI
+} rc_imu_transport_t;
+
+#define RC_IMU_MAX_NOTCHES 4
+
 typedef struct rc_imu_config_t{
 	// full scale ranges for sensors
 	rc_accel_fsr_t accel_fsr; // AFS_2G, AFS_4G, AFS_8G, AFS_16G
@@ -662,6 +951,59 @@ typedef struct rc_imu_config_t{
 	int dmp_interrupt_priority; // scheduler priority for handler
 	int show_warnings;	// set to 1 to enable showing of rc_i2c_bus warnings
 
+	// where DMP interrupts come from, an rc_event_source_type_t. The default
+	// EVENT_SOURCE_AUTO uses the gpio character device if available and sysfs
+	// otherwise. EVENT_SOURCE_EVENTFD and EVENT_SOURCE_PIPE read events from
+	// interrupt_fd instead of the IMU interrupt pin.
+	int interrupt_source;
+	int interrupt_fd;
+	// read the FIFO count and one packet in a single i2c transaction, 0 or 1
+	int fifo_combined_read;
+	// poll for readiness instead of fixed sleeps and load the DMP firmware
+	// in bursts, skipping it if still loaded from a previous run, 0 or 1
+	int fast_startup;
+	// how registers are reached. IMU_TRANSPORT_SPI talks to the MPU over
+	// spi_slave and leaves the I2C bus free for other devices
+	rc_imu_transport_t transport;
+	int spi_slave;	// slave the MPU is on, see rc_spi_init
+	// where the MPU is when it's on I2C and the gpio its interrupt pin goes
+	// to, only worth changing for additional IMUs
+	int i2c_bus;
+	int i2c_address;
+	int interrupt_pin;	// -1 to poll instead, IMU instances only
+
+	// background gyro bias estimation whenever the IMU is still, DMP and raw
+	// FIFO modes only
+	int gyro_bias_estimation;	// 0 or 1
+	int gyro_bias_to_hardware;	// also update the gyro offset registers, 0 or 1
+	float still_gyro_thresh;	// deg/s standard deviation that counts as still
+	float still_accel_thresh;	// m/s^2 standard deviation that counts as still
+	float still_time;			// seconds of stillness before estimating
+	float gyro_bias_time_constant;	// seconds, how fast the estimate follows drift
+
+	// temperature compensation of gyro and accel bias and scale, 0 or 1
+	int temp_compensation;
+	// fit the temperature model's gyro bias while still, needs
+	// gyro_bias_estimation too, 0 or 1
+	int temp_model_online;
+
+	// continuous magnetometer calibration from normal motion, 0 or 1
+	int mag_cal_online;
+	float mag_cal_coverage;	// fraction of directions seen before it's used
+
+	// notch filters that follow gyro vibration, DMP and raw FIFO modes
+	int dynamic_notch;		// 0 or 1
+	int notch_count;		// notches per axis, 1 to RC_IMU_MAX_NOTCHES
+	float notch_min_hz;		// range searched for vibration peaks
+	float notch_max_hz;
+	float notch_q;			// quality factor, higher is narrower
+	int notch_budget;		// spectrum analysis steps allowed per sample
+
+	// raw FIFO settings, only used with rc_initialize_imu_fifo
+	int fifo_sample_rate;	// 4-1000hz dividing 1000, or 8000 gyro only
+	int fifo_enable_accel;	// 0 or 1
+	int fifo_enable_gyro;	// 0 or 1
+
 } rc_imu_config_t;
 
 typedef struct rc_imu_data_t{
@@ -692,6 +1034,149 @@ typedef struct rc_imu_data_t{
 	float compass_heading_raw;	// heading in radians from magnetometer
 } rc_imu_data_t;
 
+#define RC_IMU_HIST_BINS 16
+
+typedef struct rc_imu_fifo_stats_t{
+	uint64_t packets;			// DMP packets delivered
+	uint64_t multi_reads;		// reads that found more than one packet
+	uint64_t max_backlog;		// most packets found in a single read
+	uint64_t overflows;			// times the FIFO was found full
+	uint64_t resyncs;			// reads that had to discard bytes to realign
+	uint64_t dropped_bytes;		// bytes discarded while realigning
+	uint64_t dropped_packets;	// estimate of packets lost to the above
+	uint64_t resets;			// FIFO resets after unrecoverable corruption
+	uint64_t interrupts;		// interrupts that delivered at least one packet
+	uint64_t latency_last_ns;	// interrupt to user callback, last interrupt
+	uint64_t latency_max_ns;	// interrupt to user callback, worst case
+	uint64_t latency_total_ns;	// sum over all interrupts for the mean
+	int interrupt_source;		// rc_event_source_type_t in use
+	uint64_t fifo_reads;		// times the FIFO was read
+	uint64_t i2c_syscalls;		// bus system calls made reading the FIFO
+	uint64_t i2c_time_last_ns;	// time spent reading the FIFO, last read
+	uint64_t i2c_time_max_ns;	// time spent reading the FIFO, worst case
+	uint64_t i2c_time_total_ns;	// sum over all reads for the mean
+	uint64_t spec_hits;			// combined reads that got all the data at once
+	uint64_t spec_misses;		// combined reads that found less than expected
+	uint64_t i2c_errors;		// FIFO reads that failed even after a retry
+	uint64_t i2c_retries;		// FIFO reads that had to be tried again
+	uint64_t quat_failures;		// invalid quaternions where a packet should start
+	uint64_t read_latency_last_ns;	// interrupt to FIFO read done, last interrupt
+	uint64_t read_latency_max_ns;	// interrupt to FIFO read done, worst case
+	uint64_t read_latency_total_ns;	// sum over all interrupts for the mean
+	// bin i counts latencies of 2^i to 2^(i+1) microseconds, bin 0 also
+	// counts shorter ones and the last bin longer ones
+	uint64_t read_latency_hist[RC_IMU_HIST_BINS];
+	uint64_t latency_hist[RC_IMU_HIST_BINS];
+	// FIFO reads by the number of whole packets waiting, the last bin counts
+	// that many or more
+	uint64_t fifo_count_hist[RC_IMU_HIST_BINS];
+} rc_imu_fifo_stats_t;
+
+typedef struct rc_imu_fifo_sample_t{
+	uint64_t timestamp_ns;	// estimated sample time, nanoseconds since epoch
+	float accel[3];			// units of m/s^2, 0 if accel disabled
+	float gyro[3];			// units of degrees/s, 0 if gyro disabled
+} rc_imu_fifo_sample_t;
+
+#define RC_IMU_QUEUE_LEN 64 // must be a power of 2
+
+typedef struct rc_imu_sample_t{
+	uint64_t timestamp_ns;	// estimated sample time, nanoseconds since epoch
+	uint64_t seq;			// sample number since the program started
+	rc_imu_data_t data;
+} rc_imu_sample_t;
+
+typedef struct rc_imu_reader_t{
+	uint64_t next;			// seq of the next sample to read
+	uint64_t missed;		// samples overwritten before they could be read
+	int initialized;
+} rc_imu_reader_t;
+
+#define RC_IMU_MAX_SUBSCRIBERS 16
+
+typedef enum rc_imu_dispatch_t{
+	IMU_DISPATCH_INLINE,	// in the IMU interrupt thread, time-critical only
+	IMU_DISPATCH_WORKER		// in a normal priority worker thread
+} rc_imu_dispatch_t;
+
+typedef void (*rc_imu_subscriber_func_t)(const rc_imu_sample_t* s, void* ctx);
+
+typedef struct rc_imu_subscriber_stats_t{
+	uint64_t calls;			// times the subscriber was called
+	uint64_t missed;		// samples due but lost because the worker fell behind
+	uint64_t last_ns;		// time spent in the most recent call
+	uint64_t max_ns;		// longest time spent in one call
+} rc_imu_subscriber_stats_t;
+
+typedef struct rc_imu_startup_stats_t{
+	uint64_t reset_ns;			// resetting the chip and checking WHO_AM_I
+	uint64_t gyro_cal_ns;		// loading gyro offsets from disk
+	uint64_t sensor_config_ns;	// sample rate, magnetometer, ranges, filters
+	uint64_t firmware_ns;		// loading and verifying the DMP firmware
+	uint64_t dmp_config_ns;		// DMP features, orientation and FIFO setup
+	uint64_t total_ns;			// all of rc_initialize_imu_dmp
+	int firmware_resident;		// 1 if the firmware code was already loaded
+	int firmware_bytes;			// bytes of firmware written
+} rc_imu_startup_stats_t;
+
+typedef struct rc_imu_gyro_bias_t{
+	int still;				// 1 if the IMU currently counts as still
+	float bias[3];			// bias being subtracted in software, deg/s
+	int16_t offsets[3];		// hardware offsets, units of the calibration store
+	uint64_t still_samples;	// samples averaged into the estimate
+	uint64_t hw_updates;	// times the offset registers were rewritten
+} rc_imu_gyro_bias_t;
+
+typedef struct rc_imu_mag_cal_t{
+	int converged;			// 1 once the fit is good and covers enough
+	float coverage;			// fraction of directions seen recently
+	float fit_error;		// RMS radius error of recent readings, relative
+	float offsets[3];		// offsets in use, uT
+	float scales[3];		// scales in use
+	uint64_t samples;		// readings used by the fit
+	uint64_t swaps;			// times the calibration in use was replaced
+} rc_imu_mag_cal_t;
+
+#define RC_IMU_TEMP_NODES 12
+
+typedef struct rc_imu_temp_model_t{
+	float temp_min;			// degrees C of the first node
+	float temp_step;		// degrees C between nodes
+	float gyro_bias[RC_IMU_TEMP_NODES][3];	// deg/s, subtracted first
+	float gyro_scale[RC_IMU_TEMP_NODES][3];	// then multiplied by, 1 for none
+	float accel_bias[RC_IMU_TEMP_NODES][3];	// m/s^2
+	float accel_scale[RC_IMU_TEMP_NODES][3];
+	float weight[RC_IMU_TEMP_NODES];	// samples behind each node, 0 if none
+} rc_imu_temp_model_t;
+
+typedef struct rc_imu_notch_stats_t{
+	float freq[3][RC_IMU_MAX_NOTCHES];		// Hz per axis, 0 if not in use
+	float amplitude[3][RC_IMU_MAX_NOTCHES];	// deg/s of the vibration at freq
+	float spectrum_period;		// seconds between spectrum updates
+	int budget;					// analysis steps allowed per sample
+	uint64_t samples;			// samples filtered
+	uint64_t spectra;			// spectra analysed, all three axes
+	uint64_t skipped_windows;	// windows not analysed for lack of budget
+	uint64_t cost_last_ns;		// time spent on the last sample
+	uint64_t cost_max_ns;		// time spent on a sample, worst case
+	uint64_t cost_total_ns;		// sum over all samples for the mean
+} rc_imu_notch_stats_t;
+
+#define RC_MAX_IMUS 4	// IMU 0 on the cape plus up to 3 instances
+
+typedef struct rc_imu_vote_t{
+	rc_imu_data_t data;		// voted accel, gyro, mag and temp
+	uint64_t timestamp_ns;	// newest sample that took part
+	int n;					// IMUs that took part
+	int n_mag;				// of those, how many had a magnetometer
+	uint32_t used;			// bit i set if IMU i took part
+} rc_imu_vote_t;
+
+typedef enum rc_imu_replay_speed_t{
+	IMU_REPLAY_REALTIME,	// same timing as the recording
+	IMU_REPLAY_MAX_SPEED	// as fast as possible
+} rc_imu_replay_speed_t;
+
 // General functions
 rc_imu_config_t rc_default_imu_config();
 int rc_set_imu_config_to_defaults(rc_imu_config_t* conf);
@@ -703,6 +1188,7 @@ int rc_read_accel_data(rc_imu_data_t* data);
 int rc_read_gyro_data(rc_imu_data_t* data);
 int rc_read_mag_data(rc_imu_data_t* data);
 int rc_read_imu_temp(rc_imu_data_t* data);
+int rc_read_imu_all(rc_imu_data_t* data);
 
 // interrupt-driven sampling mode functions
 int rc_initialize_imu_dmp(rc_imu_data_t* data, rc_imu_config_t conf);
@@ -711,12 +1197,120 @@ int rc_stop_imu_interrupt_func();
 int rc_was_last_imu_read_successful();
 uint64_t rc_nanos_since_last_imu_interrupt();
 
+// raw FIFO mode functions
+int rc_initialize_imu_fifo(rc_imu_data_t* data, rc_imu_config_t conf,\
+							rc_imu_fifo_sample_t* batch, int batch_len);
+int rc_set_imu_batch_func(void (*func)(int n));
+int rc_get_imu_fifo_stats(rc_imu_fifo_stats_t* stats);
+int rc_reset_imu_fifo_stats();
+int rc_start_imu_stats_dump(const char* path, int period_ms);
+int rc_stop_imu_stats_dump();
+int rc_initialize_imu_reader(rc_imu_reader_t* r);
+int rc_read_imu_sample(rc_imu_reader_t* r, rc_imu_sample_t* s);
+int rc_read_latest_imu_sample(rc_imu_sample_t* s);
+int rc_add_imu_subscriber(rc_imu_subscriber_func_t func, void* ctx,\
+				int decimation, int priority, rc_imu_dispatch_t dispatch);
+int rc_remove_imu_subscriber(int id);
+int rc_get_imu_subscriber_stats(int id, rc_imu_subscriber_stats_t* stats);
+int rc_get_imu_startup_stats(rc_imu_startup_stats_t* stats);
+int rc_reconfigure_imu(rc_imu_config_t conf);
+int rc_get_imu_gyro_bias(rc_imu_gyro_bias_t* bias);
+int rc_save_imu_gyro_bias();
+int rc_get_imu_mag_calibration(rc_imu_mag_cal_t* cal);
+int rc_save_imu_mag_calibration();
+rc_imu_temp_model_t rc_default_imu_temp_model();
+int rc_fit_imu_temp_model(rc_imu_temp_model_t* model, const float* temp,\
+										const float (*gyro)[3], int n);
+int rc_get_imu_temp_model(rc_imu_temp_model_t* model);
+int rc_set_imu_temp_model(const rc_imu_temp_model_t* model);
+int rc_save_imu_temp_model();
+int rc_get_imu_notch_stats(rc_imu_notch_stats_t* stats);
+int rc_start_imu_recording(const char* path);
+int rc_stop_imu_recording();
+int rc_initialize_imu_replay(rc_imu_data_t* data, rc_imu_config_t conf,\
+						const char* path, rc_imu_replay_speed_t speed);
+int rc_wait_for_imu_replay();
+
+// additional IMUs
+int rc_initialize_imu_instance(int imu, rc_imu_config_t conf);
+int rc_set_imu_instance_func(int imu, rc_imu_subscriber_func_t func, void* ctx);
+int rc_read_imu_instance(int imu, rc_imu_sample_t* s);
+int rc_power_off_imu_instance(int imu);
+int rc_calibrate_imu_instance_gyro(int imu, rc_imu_config_t conf);
+int rc_vote_imu_data(rc_imu_vote_t* vote, uint64_t max_age_ns);
+
 // other
 int rc_calibrate_gyro_routine();
 int rc_calibrate_mag_routine();
 int rc_is_gyro_calibrated();
 int rc_is_mag_calibrated();
 
+/*******************************************************************************
+* CALIBRATION STORE
+*
+* Calibration for the IMU, DSM radio and ADC channels is kept together in one
+* binary file in /var/lib/roboticscape/ with a version number and checksum.
+* It is read once, normally by rc_initialize, and kept in memory after that.
+* Every update replaces the whole file atomically so a power cut while saving
+* can't leave a corrupted calibration behind. The old gyro.cal, mag.cal and
+* dsm.cal text files are imported automatically if there is no store yet.
+* A store that exists but can't be read, because it is corrupted or from a
+* newer version of the library, is never overwritten: an error is printed and
+* neutral values are used, and the next save first renames it to
+* calibration.bin.bad. Nothing is saved if that rename fails.
+*
+* @ int rc_get_calibration(rc_calibration_t* cal)
+*
+* Copies the current calibration into cal. The valid field has a bit set for
+* each section that has been calibrated, other sections hold neutral values.
+* Returns 0 on success or -1 on failure.
+*
+* @ int rc_save_calibration(rc_calibration_t* cal)
+*
+* Replaces the stored calibration with cal. To change one section, get the
+* calibration first, modify it and save it back. The calibration routines and
+* rc_save_imu_gyro_bias/rc_save_imu_mag_calibration/rc_save_imu_temp_model
+* do this for you. IMU instances other than number 0 have their own gyro and
+* magnetometer sections. ADC gains take effect the next time rc_initialize
+* runs. Returns 0 on success or -1 on failure.
+*
+* @ int rc_import_text_calibration(rc_calibration_t* cal)
+*
+* Reads any of the old text calibration files that exist into cal and marks
+* those sections valid, then save cal to keep them. Returns the number of
+* files imported or -1 on error.
+*******************************************************************************/
+#define RC_CAL_GYRO		(1<<0)
+#define RC_CAL_MAG		(1<<1)
+#define RC_CAL_DSM		(1<<2)
+#define RC_CAL_ADC		(1<<3)
+#define RC_CAL_IMU_TEMP	(1<<4)	// temperature model of IMU 0
+#define RC_CAL_DSM_CHANNELS	9
+#define RC_CAL_ADC_CHANNELS	7
+// sections for IMU instance n, 1 to RC_MAX_IMUS-1
+#define RC_CAL_IMU_GYRO(n)	(1<<(6+2*(n)))
+#define RC_CAL_IMU_MAG(n)	(1<<(7+2*(n)))
+
+typedef struct rc_calibration_t{
+	uint32_t valid;			// RC_CAL_* bits for the sections that are set
+	int16_t gyro_offsets[3];	// raw gyro steady state offsets
+	float mag_offsets[3];	// uT, subtracted before scaling
+	float mag_scales[3];
+	int dsm_mins[RC_CAL_DSM_CHANNELS];	// raw pulse width range per channel
+	int dsm_maxes[RC_CAL_DSM_CHANNELS];
+	float adc_gains[RC_CAL_ADC_CHANNELS];	// volts = raw volts*gain + offset
+	float adc_offsets[RC_CAL_ADC_CHANNELS];
+	// the same IMU sections for instances 1 and up, index 0 is instance 1
+	int16_t imu_gyro_offsets[RC_MAX_IMUS-1][3];
+	float imu_mag_offsets[RC_MAX_IMUS-1][3];
+	float imu_mag_scales[RC_MAX_IMUS-1][3];
+	rc_imu_temp_model_t imu_temp_model;
+} rc_calibration_t;
+
+int rc_get_calibration(rc_calibration_t* cal);
+int rc_save_calibration(rc_calibration_t* cal);
+int rc_import_text_calibration(rc_calibration_t* cal);
+
 /*******************************************************************************
 * BMP280 Barometer
 *
@@ -832,6 +1426,15 @@ int rc_set_sea_level_pressure_pa(float pa);
 * This sends the device address and register address to be read from before
 * reading the response. 
 *
+* @ int rc_i2c_read_blocks(int bus, int n, uint8_t* regAddrs, uint8_t* lengths,
+*												uint8_t** data)
+* Reads n blocks of lengths[i] bytes starting at register regAddrs[i] into
+* data[i], all in one combined transaction with repeated starts. This takes one
+* system call where the same reads with rc_i2c_read_bytes take two each, and
+* nothing else can use the bus in between. Up to 8 blocks per call. Returns the
+* total number of bytes read or -1 on error, in which case errno is left as
+* set by the i2c driver.
+*
 * @ int rc_i2c_write_byte(int bus, uint8_t regAddr, uint8_t data);
 * @ int rc_i2c_write_bytes(int bus, uint8_t regAddr, uint8_t length, uint8_t* data)
 * @ int rc_i2c_write_word(int bus, uint8_t regAddr, uint16_t data);
@@ -860,6 +1463,8 @@ int rc_i2c_read_bytes(int bus, uint8_t regAddr, uint8_t length,  uint8_t *data);
 int rc_i2c_read_word(int bus, uint8_t regAddr, uint16_t *data);
 int rc_i2c_read_words(int bus, uint8_t regAddr, uint8_t length, uint16_t *data);
 int rc_i2c_read_bit(int bus, uint8_t regAddr, uint8_t bitNum, uint8_t *data);
+int rc_i2c_read_blocks(int bus, int n, uint8_t* regAddrs, uint8_t* lengths,\
+												uint8_t** data);
 
 int rc_i2c_write_byte(int bus, uint8_t regAddr, uint8_t data);
 int rc_i2c_write_bytes(int bus, uint8_t regAddr, uint8_t length, uint8_t* data);
@@ -881,6 +1486,10 @@ int rc_i2c_send_byte(int bus, uint8_t data);
 * with select/deselect_spi_slave() functions. On the Robotics Cape, slave 1
 * can be used in either mode, but slave 2 must be selected manually. On the
 * BB Blue either slave can be used in manual or automatic modes. 
+*
+* rc_spi_set_speed changes the clock for the transfers that follow without
+* reopening the device, for chips that allow faster reads of some registers
+* than others.
 *******************************************************************************/
 typedef enum ss_mode_t{
 	SS_MODE_AUTO,
@@ -900,6 +1509,7 @@ int rc_manual_deselect_spi_slave(int slave);
 int rc_spi_send_bytes(char* data, int bytes, int slave);
 int rc_spi_read_bytes(char* data, int bytes, int slave);
 int rc_spi_transfer(char* tx_data, int tx_bytes, char* rx_data, int slave);
+int rc_spi_set_speed(int speed_hz, int slave);
 int rc_spi_write_reg_byte(char reg_addr, char data, int slave);
 char rc_spi_read_reg_byte(char reg_addr, int slave);
 int rc_spi_read_reg_bytes(char reg_addr, char* data, int bytes, int slave);
@@ -1057,6 +1667,47 @@ int rc_gpio_fd_close(int fd);
 int rc_gpio_set_value_mmap(int pin, int state);
 int rc_gpio_get_value_mmap(int pin);
 
+/*******************************************************************************
+* Event Sources
+*
+* A uniform way for a thread to wait on an interrupt. A gpio edge can come
+* through the GPIO character device, where the kernel timestamps the edge in
+* its interrupt handler, or through the sysfs value file where the timestamp is
+* taken after the waiting thread wakes up. EVENT_SOURCE_AUTO tries the
+* character device first and falls back to sysfs. An eventfd or the read end of
+* a pipe can stand in for a gpio to drive interrupt handlers from software for
+* testing and benchmarking. Writes to a pipe source are one uint64_t each
+* containing the event time in nanoseconds since epoch, or 0.
+*
+* @ int rc_event_source_wait(rc_event_source_t* src, int timeout_ms,
+*														uint64_t* timestamp)
+*
+* Blocks for up to timeout_ms (-1 for forever) and returns the number of events
+* consumed, 0 on timeout, or -1 on error. timestamp gets the time of the newest
+* event in nanoseconds since epoch.
+*******************************************************************************/
+typedef enum rc_event_source_type_t{
+	EVENT_SOURCE_AUTO,
+	EVENT_SOURCE_GPIO_CHARDEV,
+	EVENT_SOURCE_GPIO_SYSFS,
+	EVENT_SOURCE_EVENTFD,
+	EVENT_SOURCE_PIPE
+}rc_event_source_type_t;
+
+typedef struct rc_event_source_t{
+	rc_event_source_type_t type;	// source actually in use
+	int fd;
+	int gpio;						// -1 for eventfd and pipe sources
+	int initialized;
+}rc_event_source_t;
+
+int rc_event_source_open_gpio(rc_event_source_t* src, unsigned int gpio,\
+							rc_pin_edge_t edge, rc_event_source_type_t type);
+int rc_event_source_open_fd(rc_event_source_t* src, int fd,\
+											rc_event_source_type_t type);
+int rc_event_source_wait(rc_event_source_t* src, int timeout_ms, uint64_t* timestamp);
+int rc_event_source_close(rc_event_source_t* src);
+
 
 /*******************************************************************************
 * PWM
@@ -1368,6 +2019,14 @@ typedef struct rc_matrix_t{
 * ensures v is sized correctly. Existing data in v (if any) is freed and lost.
 * Returns 0 on success or -1 on failure.
 *
+* @ int rc_vector_view_array(rc_vector_t* v, float* ptr, int length)
+*
+* Zero-copy alternative to rc_vector_from_array. v is pointed directly at the
+* user's array which must outlive v. rc_free_vector resets a view without
+* freeing the array. Functions writing to a view, in place ones included,
+* put their result in the array and fail rather than resize it. Returns 0 on
+* success or -1 on failure.
+*
 * @ int rc_duplicate_vector(rc_vector_t a, rc_vector_t* b)
 *
 * Allocates memory for a duplicate of vector a and copies the contents into
@@ -1500,6 +2159,7 @@ int   rc_vector_ones(rc_vector_t* v, int length);
 int   rc_random_vector(rc_vector_t* v, int length);
 int   rc_vector_fibonnaci(rc_vector_t* v, int length);
 int   rc_vector_from_array(rc_vector_t* v, float* ptr, int length);
+int   rc_vector_view_array(rc_vector_t* v, float* ptr, int length);
 int   rc_duplicate_vector(rc_vector_t a, rc_vector_t* b);
 int   rc_set_vector_entry(rc_vector_t* v, int pos, float val);
 float rc_get_vector_entry(rc_vector_t v, int pos);
@@ -1588,6 +2248,15 @@ int   rc_vector_sum_inplace(rc_vector_t* v1, rc_vector_t v2);
 * is allocated to hold the duplicate of A.
 * Returns 0 on success or -1 on error.
 *
+* @ int rc_matrix_view_array(rc_matrix_t* A, float* ptr, int rows, int cols)
+*
+* Wraps a user's row-major array of rows*cols values as matrix A without
+* copying the data, only the row pointers are allocated. The array must outlive
+* A and is never freed by rc_free_matrix. Like vector views, results written
+* to A land in the array, and operations that would change its shape, such as
+* transposing a non-square view in place, fail instead. Returns 0 on success
+* or -1 on failure.
+*
 * @ int rc_set_matrix_entry(rc_matrix_t* A, int row, int col, float val)
 *
 * Sets the specified single entry of matrix A to 'val' where the position is
@@ -1686,6 +2355,7 @@ int   rc_identity_matrix(rc_matrix_t* A, int dim);
 int   rc_random_matrix(rc_matrix_t* A, int rows, int cols);
 int   rc_diag_matrix(rc_matrix_t* A, rc_vector_t v);
 int   rc_duplicate_matrix(rc_matrix_t A, rc_matrix_t* B);
+int   rc_matrix_view_array(rc_matrix_t* A, float* ptr, int rows, int cols);
 int   rc_set_matrix_entry(rc_matrix_t* A, int row, int col, float val);
 float rc_get_matrix_entry(rc_matrix_t A, int row, int col);
 int   rc_print_matrix(rc_matrix_t A);
@@ -1778,6 +2448,33 @@ int   rc_matrix_transpose_inplace(rc_matrix_t* A);
 * be placed in the vector 'lens'
 *
 * Returns 0 on success or -1 on failure. 
+*
+* @ int rc_tridiag_solve(rc_vector_t a, rc_vector_t b, rc_vector_t c,
+*										rc_vector_t d, rc_vector_t* x)
+*
+* Solves the tridiagonal system Ax=d in O(n) time with the Thomas algorithm.
+* b is the main diagonal, a the sub-diagonal and c the super-diagonal, all of
+* length n so that row i reads a[i]x[i-1] + b[i]x[i] + c[i]x[i+1] = d[i]. a[0]
+* and c[n-1] are ignored. No pivoting is done so A should be diagonally
+* dominant or positive definite. Returns 0 on success or -1 on failure.
+*
+* @ int rc_banded_solve(rc_matrix_t Ab, int kl, int ku, rc_vector_t b,
+*										rc_vector_t* x)
+*
+* Solves Ax=b where A is a band matrix with kl sub-diagonals and ku
+* super-diagonals in compact row storage. Ab has n rows and kl+ku+1 columns
+* with A[i][j] stored at Ab.d[i][j-i+kl], so column kl holds the main diagonal.
+* Like rc_tridiag_solve no pivoting is done. Returns 0 on success or -1 on
+* failure.
+*
+* @ int rc_banded_solve_ws(rc_matrix_t Ab, int kl, int ku, rc_vector_t b,
+*										rc_matrix_t* U, rc_vector_t* x)
+*
+* Same as rc_banded_solve but eliminates in the workspace U instead of a
+* temporary copy of Ab. U is only allocated when its size doesn't match Ab, so
+* keeping U and x between calls makes repeated solves allocation free. Pass &Ab
+* as U to factor the band in place when Ab isn't needed afterwards. x may be
+* the same vector as b. Returns 0 on success or -1 on failure.
 *******************************************************************************/
 int   rc_matrix_times_col_vec(rc_matrix_t A, rc_vector_t v, rc_vector_t* c);
 int   rc_row_vec_times_matrix(rc_vector_t v, rc_matrix_t A, rc_vector_t* c);
@@ -1789,6 +2486,67 @@ int   rc_invert_matrix_inplace(rc_matrix_t* A);
 int   rc_lin_system_solve(rc_matrix_t A, rc_vector_t b, rc_vector_t* x);
 int   rc_lin_system_solve_qr(rc_matrix_t A, rc_vector_t b, rc_vector_t* x);
 int   rc_fit_ellipsoid(rc_matrix_t pts, rc_vector_t* ctr, rc_vector_t* lens);
+int   rc_tridiag_solve(rc_vector_t a, rc_vector_t b, rc_vector_t c, rc_vector_t d, rc_vector_t* x);
+int   rc_banded_solve(rc_matrix_t Ab, int kl, int ku, rc_vector_t b, rc_vector_t* x);
+int   rc_banded_solve_ws(rc_matrix_t Ab, int kl, int ku, rc_vector_t b, rc_matrix_t* U, rc_vector_t* x);
+
+/*******************************************************************************
+* Riccati Equations and LQR
+*
+* Solves the discrete algebraic Riccati equation (DARE) with the structure-
+* preserving doubling algorithm which converges quadratically, typically in
+* 5-15 iterations. All intermediate matrices live in an rc_dare_workspace_t
+* which is allocated on first use and reused afterwards so gains can be
+* recomputed on-board when model parameters such as mass change.
+*
+* @ rc_dare_workspace_t rc_empty_dare_workspace()
+*
+* Returns a workspace with no allocated memory. Initialize workspaces with this
+* before their first use.
+*
+* @ int rc_alloc_dare_workspace(rc_dare_workspace_t* ws, int n, int m)
+*
+* Preallocates a workspace for n states and m inputs. This is optional since
+* the solvers allocate the workspace themselves if it is the wrong size.
+* Returns 0 on success or -1 on failure.
+*
+* @ int rc_free_dare_workspace(rc_dare_workspace_t* ws)
+*
+* Frees all memory in the workspace. Returns 0 on success or -1 on failure.
+*
+* @ int rc_dare_solve(rc_matrix_t A, rc_matrix_t B, rc_matrix_t Q, rc_matrix_t R,
+*								rc_dare_workspace_t* ws, rc_matrix_t* P)
+*
+* Finds the stabilizing solution P to P = A'PA - A'PB(R+B'PB)^-1 B'PA + Q for
+* the n-state, m-input system x[k+1]=Ax[k]+Bu[k]. Q must be symmetric positive
+* semi-definite and R symmetric positive definite. The number of doubling steps
+* taken is left in ws->iterations. Returns 0 on success or -1 on failure.
+*
+* @ int rc_lqr_gain(rc_matrix_t A, rc_matrix_t B, rc_matrix_t Q, rc_matrix_t R,
+*								rc_dare_workspace_t* ws, rc_matrix_t* K)
+*
+* Computes the m x n discrete LQR gain K=(R+B'PB)^-1 B'PA so that the control
+* law u=-Kx minimizes the infinite sum of x'Qx + u'Ru. The Riccati solution P
+* is left in ws->Hk. Returns 0 on success or -1 on failure.
+*******************************************************************************/
+typedef struct rc_dare_workspace_t{
+	int n;				// number of states
+	int m;				// number of inputs
+	int iterations;		// doubling steps taken by the last solve
+	rc_matrix_t Ak, Gk, Hk;	// doubling iterates, Hk converges to P
+	rc_matrix_t W, XA, XG, T;	// n x n scratch
+	rc_matrix_t S, Y, NB;	// scratch involving the inputs
+	int* piv;			// LU pivot indices
+	int initialized;
+} rc_dare_workspace_t;
+
+rc_dare_workspace_t rc_empty_dare_workspace();
+int   rc_alloc_dare_workspace(rc_dare_workspace_t* ws, int n, int m);
+int   rc_free_dare_workspace(rc_dare_workspace_t* ws);
+int   rc_dare_solve(rc_matrix_t A, rc_matrix_t B, rc_matrix_t Q, rc_matrix_t R,\
+								rc_dare_workspace_t* ws, rc_matrix_t* P);
+int   rc_lqr_gain(rc_matrix_t A, rc_matrix_t B, rc_matrix_t Q, rc_matrix_t R,\
+								rc_dare_workspace_t* ws, rc_matrix_t* K);
 
 
 /*******************************************************************************
@@ -1869,6 +2627,116 @@ int rc_poly_differentiate(rc_vector_t a, int d, rc_vector_t* b);
 int rc_poly_divide(rc_vector_t n, rc_vector_t d, rc_vector_t* div, rc_vector_t* rem);
 int rc_poly_butter(int N, float wc, rc_vector_t* b);
 
+/*******************************************************************************
+* Double Precision Algebra
+*
+* Every vector, matrix, linear algebra and polynomial function above has a
+* double precision twin with a _d suffix that works on rc_vector_d_t and
+* rc_matrix_d_t and behaves identically. They are built from the same source
+* as the float versions. Use these for calibration and estimation over long
+* baselines where float loses accuracy, and keep hot control loops in float.
+*
+* @ int rc_vector_to_double(rc_vector_t v, rc_vector_d_t* out)
+* @ int rc_vector_to_float(rc_vector_d_t v, rc_vector_t* out)
+* @ int rc_matrix_to_double(rc_matrix_t A, rc_matrix_d_t* out)
+* @ int rc_matrix_to_float(rc_matrix_d_t A, rc_matrix_t* out)
+*
+* Converts between precisions, allocating out if necessary. This always copies
+* since the element sizes differ. To work on existing double arrays without
+* copying use rc_vector_view_array_d and rc_matrix_view_array_d.
+* Return 0 on success or -1 on failure.
+*******************************************************************************/
+// double precision vector type
+typedef struct rc_vector_d_t{
+	int len;
+	double* d;
+	int initialized;
+} rc_vector_d_t;
+
+// double precision matrix type
+typedef struct rc_matrix_d_t{
+	int rows;
+	int cols;
+	double** d;
+	int initialized;
+} rc_matrix_d_t;
+
+int   rc_vector_to_double(rc_vector_t v, rc_vector_d_t* out);
+int   rc_vector_to_float(rc_vector_d_t v, rc_vector_t* out);
+int   rc_matrix_to_double(rc_matrix_t A, rc_matrix_d_t* out);
+int   rc_matrix_to_float(rc_matrix_d_t A, rc_matrix_t* out);
+
+int   rc_alloc_vector_d(rc_vector_d_t* v, int length);
+int   rc_free_vector_d(rc_vector_d_t* v);
+rc_vector_d_t rc_empty_vector_d();
+int   rc_vector_zeros_d(rc_vector_d_t* v, int length);
+int   rc_vector_ones_d(rc_vector_d_t* v, int length);
+int   rc_random_vector_d(rc_vector_d_t* v, int length);
+int   rc_vector_fibonnaci_d(rc_vector_d_t* v, int length);
+int   rc_vector_from_array_d(rc_vector_d_t* v, double* ptr, int length);
+int   rc_vector_view_array_d(rc_vector_d_t* v, double* ptr, int length);
+int   rc_duplicate_vector_d(rc_vector_d_t a, rc_vector_d_t* b);
+int   rc_set_vector_entry_d(rc_vector_d_t* v, int pos, double val);
+double rc_get_vector_entry_d(rc_vector_d_t v, int pos);
+int   rc_print_vector_d(rc_vector_d_t v);
+int   rc_print_vector_sci_d(rc_vector_d_t v);
+int   rc_vector_times_scalar_d(rc_vector_d_t* v, double s);
+double rc_vector_norm_d(rc_vector_d_t v, double p);
+int   rc_vector_max_d(rc_vector_d_t v);
+int   rc_vector_min_d(rc_vector_d_t v);
+double rc_std_dev_d(rc_vector_d_t v);
+double rc_vector_mean_d(rc_vector_d_t v);
+int   rc_vector_projection_d(rc_vector_d_t v, rc_vector_d_t e, rc_vector_d_t* p);
+double rc_vector_dot_product_d(rc_vector_d_t v1, rc_vector_d_t v2);
+int   rc_vector_outer_product_d(rc_vector_d_t v1, rc_vector_d_t v2, rc_matrix_d_t* A);
+int   rc_vector_cross_product_d(rc_vector_d_t v1, rc_vector_d_t v2, rc_vector_d_t* p);
+int   rc_vector_sum_d(rc_vector_d_t v1, rc_vector_d_t v2, rc_vector_d_t* s);
+int   rc_vector_sum_inplace_d(rc_vector_d_t* v1, rc_vector_d_t v2);
+int   rc_alloc_matrix_d(rc_matrix_d_t* A, int rows, int cols);
+int   rc_free_matrix_d(rc_matrix_d_t* A);
+rc_matrix_d_t rc_empty_matrix_d();
+int   rc_matrix_zeros_d(rc_matrix_d_t* A, int rows, int cols);
+int   rc_identity_matrix_d(rc_matrix_d_t* A, int dim);
+int   rc_random_matrix_d(rc_matrix_d_t* A, int rows, int cols);
+int   rc_diag_matrix_d(rc_matrix_d_t* A, rc_vector_d_t v);
+int   rc_duplicate_matrix_d(rc_matrix_d_t A, rc_matrix_d_t* B);
+int   rc_matrix_view_array_d(rc_matrix_d_t* A, double* ptr, int rows, int cols);
+int   rc_set_matrix_entry_d(rc_matrix_d_t* A, int row, int col, double val);
+double rc_get_matrix_entry_d(rc_matrix_d_t A, int row, int col);
+int   rc_print_matrix_d(rc_matrix_d_t A);
+void  rc_print_matrix_sci_d(rc_matrix_d_t A);
+int   rc_matrix_times_scalar_d(rc_matrix_d_t* A, double s);
+int   rc_multiply_matrices_d(rc_matrix_d_t A, rc_matrix_d_t B, rc_matrix_d_t* C);
+int   rc_left_multiply_matrix_inplace_d(rc_matrix_d_t A, rc_matrix_d_t* B);
+int   rc_right_multiply_matrix_inplace_d(rc_matrix_d_t* A, rc_matrix_d_t B);
+int   rc_add_matrices_d(rc_matrix_d_t A, rc_matrix_d_t B, rc_matrix_d_t* C);
+int   rc_add_matrices_inplace_d(rc_matrix_d_t* A, rc_matrix_d_t B);
+int   rc_matrix_transpose_d(rc_matrix_d_t A, rc_matrix_d_t* T);
+int   rc_matrix_transpose_inplace_d(rc_matrix_d_t* A);
+int   rc_matrix_times_col_vec_d(rc_matrix_d_t A, rc_vector_d_t v, rc_vector_d_t* c);
+int   rc_row_vec_times_matrix_d(rc_vector_d_t v, rc_matrix_d_t A, rc_vector_d_t* c);
+double rc_matrix_determinant_d(rc_matrix_d_t A);
+int   rc_lup_decomp_d(rc_matrix_d_t A, rc_matrix_d_t* L, rc_matrix_d_t* U, rc_matrix_d_t* P);
+int   rc_qr_decomp_d(rc_matrix_d_t A, rc_matrix_d_t* Q, rc_matrix_d_t* R);
+int   rc_invert_matrix_d(rc_matrix_d_t A, rc_matrix_d_t* Ainv);
+int   rc_invert_matrix_inplace_d(rc_matrix_d_t* A);
+int   rc_lin_system_solve_d(rc_matrix_d_t A, rc_vector_d_t b, rc_vector_d_t* x);
+int   rc_lin_system_solve_qr_d(rc_matrix_d_t A, rc_vector_d_t b, rc_vector_d_t* x);
+int   rc_fit_ellipsoid_d(rc_matrix_d_t pts, rc_vector_d_t* ctr, rc_vector_d_t* lens);
+int   rc_tridiag_solve_d(rc_vector_d_t a, rc_vector_d_t b, rc_vector_d_t c, rc_vector_d_t d, rc_vector_d_t* x);
+int   rc_banded_solve_d(rc_matrix_d_t Ab, int kl, int ku, rc_vector_d_t b, rc_vector_d_t* x);
+int   rc_banded_solve_ws_d(rc_matrix_d_t Ab, int kl, int ku, rc_vector_d_t b, rc_matrix_d_t* U, rc_vector_d_t* x);
+int   rc_print_poly_d(rc_vector_d_t v);
+int   rc_poly_conv_d(rc_vector_d_t a, rc_vector_d_t b, rc_vector_d_t* c);
+int   rc_poly_power_d(rc_vector_d_t a, int n, rc_vector_d_t* b);
+int   rc_poly_add_d(rc_vector_d_t a, rc_vector_d_t b, rc_vector_d_t* c);
+int   rc_poly_add_inplace_d(rc_vector_d_t* a, rc_vector_d_t b);
+int   rc_poly_subtract_d(rc_vector_d_t a, rc_vector_d_t b, rc_vector_d_t* c);
+int   rc_poly_subtract_inplace_d(rc_vector_d_t* a, rc_vector_d_t b);
+int   rc_poly_differentiate_d(rc_vector_d_t a, int d, rc_vector_d_t* b);
+int   rc_poly_divide_d(rc_vector_d_t n, rc_vector_d_t d, rc_vector_d_t* div, rc_vector_d_t* rem);
+int   rc_poly_butter_d(int N, double wc, rc_vector_d_t* b);
+
 /*******************************************************************************
 * Quaternion Math
 *
@@ -2008,6 +2876,66 @@ int   rc_quaternion_rotate_vector(rc_vector_t* v, rc_vector_t q);
 void  rc_quaternion_rotate_vector_array(float v[3], float q[4]);
 int   rc_quaternion_to_rotation_matrix(rc_vector_t q, rc_matrix_t* m);
 
+/*******************************************************************************
+* Attitude and Heading Reference System
+*
+* Software sensor fusion on raw gyro, accel and magnetometer samples as an
+* alternative to the DMP, usable at any sample rate. Choose between Mahony's
+* complementary filter, Madgwick's gradient descent filter, or an extended
+* Kalman filter which also estimates gyro bias. All state is held in the
+* rc_ahrs_t struct with no dynamic memory.
+*
+* @ int rc_init_ahrs(rc_ahrs_t* a, rc_ahrs_algorithm_t algorithm, float dt)
+*
+* Sets up an AHRS to be updated every dt seconds with default tuning. The
+* tuning fields in the struct may be changed at any time afterwards, as may dt
+* if the sample period varies.
+*
+* @ int rc_reset_ahrs(rc_ahrs_t* a)
+*
+* Forgets the current estimate but keeps the tuning. The next update with a
+* usable accel sample sets the initial attitude directly.
+*
+* @ int rc_march_ahrs(rc_ahrs_t* a, float gyro[3], float accel[3], float mag[3])
+*
+* Advances the estimate one step using the same units as rc_imu_data_t: gyro in
+* degrees/s, accel in m/s^2 and mag in uT. mag may be NULL to estimate only
+* roll and pitch. Accel samples whose magnitude differs from 1g by more than
+* the accel_gate fraction are ignored so hard maneuvers don't tilt the estimate.
+* The quaternion q rotates body to world coordinates, world Z up.
+*******************************************************************************/
+typedef enum rc_ahrs_algorithm_t{
+	RC_AHRS_MAHONY,
+	RC_AHRS_MADGWICK,
+	RC_AHRS_EKF
+} rc_ahrs_algorithm_t;
+
+typedef struct rc_ahrs_t{
+	rc_ahrs_algorithm_t algorithm;
+	float dt;				// seconds between updates
+	// tuning
+	float kp, ki;			// Mahony proportional and integral gains
+	float beta;				// Madgwick gradient step gain
+	float gyro_noise;		// EKF gyro noise, rad/s
+	float gyro_bias_noise;	// EKF gyro bias random walk, rad/s/sqrt(s)
+	float accel_noise;		// EKF gravity direction noise, normalized
+	float mag_noise;		// EKF magnetic field direction noise, normalized
+	float accel_gate;		// ignore accel off from 1g by this fraction, 0 off
+	// state
+	float q[4];				// orientation quaternion
+	float tb[3];			// tait-bryan angles from q, radians
+	float bias[3];			// gyro bias estimate, rad/s (Mahony ki and EKF)
+	float P[7][7];			// EKF covariance of q and bias
+	uint64_t updates;
+	int aligned;			// set once the initial attitude is known
+	int initialized;
+} rc_ahrs_t;
+
+rc_ahrs_t rc_empty_ahrs();
+int rc_init_ahrs(rc_ahrs_t* a, rc_ahrs_algorithm_t algorithm, float dt);
+int rc_reset_ahrs(rc_ahrs_t* a);
+int rc_march_ahrs(rc_ahrs_t* a, float gyro[3], float accel[3], float mag[3]);
+
 /*******************************************************************************
 * Ring Buffer
 *
@@ -2353,6 +3281,144 @@ int   rc_integrator(rc_filter_t *f, float dt);
 int   rc_double_integrator(rc_filter_t* f, float dt);
 int   rc_pid_filter(rc_filter_t* f,float kp,float ki,float kd,float Tf,float dt);
 
+/*******************************************************************************
+* Gain-Scheduling Lookup Tables
+*
+* An rc_lut_t is an N-dimensional grid of matrices (or vectors when cols=1)
+* indexed by up to RC_LUT_MAX_DIMS scheduling variables such as airspeed or
+* battery voltage. rc_lut_eval performs multilinear interpolation between the
+* surrounding grid points straight into a preallocated matrix. The bracketing
+* cell found on the previous call is remembered per dimension and checked first
+* so slowly-varying scheduling variables rarely need a search. Inputs outside
+* the breakpoint range are clamped to the edge of the table.
+*
+* @ rc_lut_t rc_empty_lut()
+*
+* Returns an rc_lut_t struct which is completely zero'd out with no memory
+* allocated for it. New tables should be initialized with this before calling
+* rc_alloc_lut.
+*
+* @ int rc_alloc_lut(rc_lut_t* t, int dims, int* len, int rows, int cols)
+*
+* Allocates memory for a table with 'dims' scheduling variables where dimension
+* i has len[i]>=2 breakpoints. Each grid point holds a rows x cols matrix, use
+* cols=1 for tables of vectors. Breakpoints default to 0,1,2... and all table
+* entries are zero'd. Returns 0 on success or -1 on failure.
+*
+* @ int rc_free_lut(rc_lut_t* t)
+*
+* Frees the memory allocated for table t. Returns 0 on success or -1 on failure.
+*
+* @ int rc_set_lut_breakpoints(rc_lut_t* t, int dim, rc_vector_t bp)
+*
+* Sets the strictly ascending breakpoints of dimension 'dim'.
+* Returns 0 on success or -1 on failure.
+*
+* @ int rc_set_lut_entry(rc_lut_t* t, int* index, rc_matrix_t M)
+* @ int rc_set_lut_entry_vector(rc_lut_t* t, int* index, rc_vector_t v)
+*
+* Copies matrix M or vector v into the table at the grid point given by array
+* 'index' which contains one breakpoint index per dimension.
+* Returns 0 on success or -1 on failure.
+*
+* @ int rc_lut_eval(rc_lut_t* t, float* x, rc_matrix_t* out)
+* @ int rc_lut_eval_vector(rc_lut_t* t, float* x, rc_vector_t* out)
+*
+* Interpolates the table at the point given by array x, one value per
+* dimension, and writes the result to out. No memory is allocated when out is
+* already the right size so allocate it once outside of your control loop.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+#define RC_LUT_MAX_DIMS 4
+
+typedef struct rc_lut_t{
+	int dims;						// number of scheduling variables
+	int rows;						// rows of each table entry
+	int cols;						// columns of each table entry
+	int entries;					// rows*cols
+	int len[RC_LUT_MAX_DIMS];		// number of breakpoints per dimension
+	int stride[RC_LUT_MAX_DIMS];	// floats between neighbouring grid points
+	float* bp[RC_LUT_MAX_DIMS];		// ascending breakpoints per dimension
+	int last[RC_LUT_MAX_DIMS];		// cached bracket from the last lookup
+	float* d;						// contiguous table data
+	int initialized;
+} rc_lut_t;
+
+rc_lut_t rc_empty_lut();
+int   rc_alloc_lut(rc_lut_t* t, int dims, int* len, int rows, int cols);
+int   rc_free_lut(rc_lut_t* t);
+int   rc_set_lut_breakpoints(rc_lut_t* t, int dim, rc_vector_t bp);
+int   rc_set_lut_entry(rc_lut_t* t, int* index, rc_matrix_t M);
+int   rc_set_lut_entry_vector(rc_lut_t* t, int* index, rc_vector_t v);
+int   rc_lut_eval(rc_lut_t* t, float* x, rc_matrix_t* out);
+int   rc_lut_eval_vector(rc_lut_t* t, float* x, rc_vector_t* out);
+
+/*******************************************************************************
+* Cubic Spline Trajectories
+*
+* Smooth setpoint trajectories through waypoints. rc_spline_fit solves for the
+* spline in O(n) using rc_tridiag_solve and keeps its working memory in the
+* rc_spline_t struct so a trajectory with the same number of waypoints can be
+* re-planned every control cycle without allocating. Evaluation caches the last
+* segment so stepping forward in time costs O(1) and random access O(log n).
+* Use one spline per axis for multi-dimensional trajectories.
+*
+* @ rc_spline_t rc_empty_spline()
+*
+* Returns a spline with no allocated memory. Initialize splines with this
+* before their first use.
+*
+* @ int rc_free_spline(rc_spline_t* s)
+*
+* Frees all memory used by the spline. Returns 0 on success or -1 on failure.
+*
+* @ int rc_spline_fit(rc_spline_t* s, rc_vector_t t, rc_vector_t y,
+*								rc_spline_bc_t bc, float v0, float vn)
+*
+* Fits a cubic spline through the waypoints (t[i],y[i]) where t is strictly
+* increasing with at least 2 entries. RC_SPLINE_NATURAL leaves zero curvature
+* at the ends and ignores v0 and vn. RC_SPLINE_CLAMPED sets the start and end
+* velocities to v0 and vn, use 0 for rest-to-rest motion. If the fit fails
+* after s was modified, s is freed and left empty.
+* Returns 0 on success or -1 on failure.
+*
+* @ int rc_spline_eval(rc_spline_t* s, float t, float* pos, float* vel,
+*								float* acc)
+*
+* Evaluates position, velocity and acceleration at time t. Any output pointer
+* may be NULL. Before the first and after the last waypoint the position is
+* held at the end point with zero velocity and acceleration.
+* Returns 0 on success or -1 on failure.
+*
+* @ int rc_spline_eval_batch(rc_spline_t* s, rc_vector_t t, rc_vector_t* pos,
+*								rc_vector_t* vel, rc_vector_t* acc)
+*
+* Evaluates the spline at every time in vector t. The outputs are resized to
+* match t if necessary, vel and acc may be NULL. Sorted times are fastest.
+* Returns 0 on success or -1 on failure.
+*******************************************************************************/
+typedef enum rc_spline_bc_t{
+	RC_SPLINE_NATURAL,
+	RC_SPLINE_CLAMPED
+} rc_spline_bc_t;
+
+typedef struct rc_spline_t{
+	int n;				// number of waypoints
+	int last;			// segment found by the last evaluation
+	rc_vector_t t;		// waypoint times
+	rc_matrix_t c;		// (n-1) x 4 polynomial coefficients per segment
+	rc_vector_t sub, diag, sup, rhs, m; // fitting workspace
+	int initialized;
+} rc_spline_t;
+
+rc_spline_t rc_empty_spline();
+int   rc_free_spline(rc_spline_t* s);
+int   rc_spline_fit(rc_spline_t* s, rc_vector_t t, rc_vector_t y,\
+								rc_spline_bc_t bc, float v0, float vn);
+int   rc_spline_eval(rc_spline_t* s, float t, float* pos, float* vel, float* acc);
+int   rc_spline_eval_batch(rc_spline_t* s, rc_vector_t t, rc_vector_t* pos,\
+								rc_vector_t* vel, rc_vector_t* acc);
+
 
 
 #endif //ROBOTICS_CAPE
@@ -11,6 +11,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <linux/i2c.h> // for struct i2c_msg
 #include <linux/i2c-dev.h> //for IOCTL defs
 
 // debian wheezy enumerates the busses backwards on the BBB
@@ -22,6 +23,7 @@
 #define I2C1_FILE "/dev/i2c-1"
 #define I2C2_FILE "/dev/i2c-2"
 #define MAX_I2C_LENGTH   128
+#define MAX_I2C_BLOCKS   8	// register blocks per rc_i2c_read_blocks call
 
 /******************************************************************
 * struct rc_i2c_t 
@@ -207,6 +209,60 @@ int rc_i2c_read_bytes(int bus, uint8_t regAddr, uint8_t length,\
 	return ret;
 }
 
+/******************************************************************
+* rc_i2c_read_blocks
+* reads n register blocks from the current device in a single
+* I2C_RDWR transaction, each register address write followed by a
+* repeated start and the read. One system call instead of two per
+* block, and no other master can get on the bus in between.
+******************************************************************/
+int rc_i2c_read_blocks(int bus, int n, uint8_t* regAddrs, uint8_t* lengths,\
+												uint8_t** data){
+	struct i2c_msg msgs[2*MAX_I2C_BLOCKS];
+	struct i2c_rdwr_ioctl_data xfer;
+	int i, ret, total = 0;
+
+	// Boundary checks
+	if(bus != 0 && bus!=1 && bus!=2){
+		printf("i2c bus must be 0, 1 or 2\n");
+		return -1;
+	}
+	if(n<1 || n>MAX_I2C_BLOCKS){
+		printf("rc_i2c_read_blocks can read 1 to %d blocks\n", MAX_I2C_BLOCKS);
+		return -1;
+	}
+	for(i=0;i<n;i++){
+		if(lengths[i] > MAX_I2C_LENGTH){
+			printf("rc_i2c_read_blocks data length is enforced as MAX_I2C_LENGTH!\n");
+			return -1;
+		}
+		msgs[2*i].addr = i2c[bus].devAddr;
+		msgs[2*i].flags = 0;
+		msgs[2*i].len = 1;
+		msgs[2*i].buf = &regAddrs[i];
+		msgs[2*i+1].addr = i2c[bus].devAddr;
+		msgs[2*i+1].flags = I2C_M_RD;
+		msgs[2*i+1].len = lengths[i];
+		msgs[2*i+1].buf = data[i];
+		total += lengths[i];
+	}
+	xfer.msgs = msgs;
+	xfer.nmsgs = 2*n;
+
+	// claim the bus during this operation
+	int old_in_use = i2c[bus].in_use;
+	i2c[bus].in_use = 1;
+	#ifdef DEBUG
+	printf("i2c devAddr:0x%x  ", i2c[bus].devAddr);
+	printf("reading %d blocks starting at 0x%x\n", n, regAddrs[0]);
+	#endif
+	ret = ioctl(i2c[bus].file, I2C_RDWR, &xfer);
+	// return the in_use state to previous state.
+	i2c[bus].in_use = old_in_use;
+	if(ret<0) return -1;
+	return total;
+}
+
 /******************************************************************
 * rc_i2c_read_byte
 ******************************************************************/
@@ -371,6 +371,34 @@ int rc_spi_transfer(char* tx_data, int tx_bytes, char* rx_data, int slave){
 	return ret;
 }
 
+/*******************************************************************************
+* @ int rc_spi_set_speed(int speed_hz, int slave)
+*
+* Sets the clock speed used by the transfers that follow. The speed is kept in
+* the shared transfer structs so it applies to whichever slave is used next,
+* callers talking to more than one slave at different speeds should set it
+* before each transfer. Returns 0 on success or -1 on error.
+*******************************************************************************/
+int rc_spi_set_speed(int speed_hz, int slave){
+	// sanity checks
+	if(slave!=1 && slave!=2 && slave != 3 && slave != 4){
+		printf("ERROR: SPI slave must be 1, 2, 3 or 4\n");
+		return -1;
+	}
+	if(initialized[slave-1]==0){
+		printf("ERROR: SPI slave %d not yet initialized\n", slave);
+		return -1;
+	}
+	if(speed_hz>SPI_MAX_SPEED || speed_hz<SPI_MIN_SPEED){
+		printf("ERROR: SPI speed_hz must be between %d & %d\n", SPI_MIN_SPEED,\
+																SPI_MAX_SPEED);
+		return -1;
+	}
+	xfer[0].speed_hz = speed_hz;
+	xfer[1].speed_hz = speed_hz;
+	return 0;
+}
+
 /*******************************************************************************
 * int rc_spi_write_reg_byte(char reg_addr, char data, int slave)
 *